@@ -1,14 +1,17 @@
 #include "whisper.h"
 
+#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <string>
 #include <thread>
+#include <vector>
 
 // command-line parameters
 struct whisper_params {
     int32_t n_threads = std::min(4, (int32_t) std::thread::hardware_concurrency());
     int32_t what = 0; // what to benchmark: 0 - whisper encoder, 1 - memcpy, 2 - ggml_mul_mat
+    int32_t n_batch = 1; // number of windows per encoder evaluation
 
     std::string model = "models/ggml-base.en.bin";
 
@@ -29,6 +32,7 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-t"  || arg == "--threads")    { params.n_threads  = std::stoi(argv[++i]); }
         else if (arg == "-m"  || arg == "--model")      { params.model      = argv[++i]; }
         else if (arg == "-w"  || arg == "--what")       { params.what       = atoi(argv[++i]); }
+        else if (arg == "-b"  || arg == "--batch")      { params.n_batch    = atoi(argv[++i]); }
         else if (arg == "-ng" || arg == "--no-gpu")     { params.use_gpu    = false; }
         else if (arg == "-fa" || arg == "--flash-attn") { params.flash_attn = true; }
         else {
@@ -55,6 +59,8 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "                           %-7s  0 - whisper\n",                                 "");
     fprintf(stderr, "                           %-7s  1 - memcpy\n",                                  "");
     fprintf(stderr, "                           %-7s  2 - ggml_mul_mat\n",                            "");
+    fprintf(stderr, "                           %-7s  3 - ggml_flash_attn_ext\n",                     "");
+    fprintf(stderr, "  -b N,     --batch N     [%-7d] also time the encoder on N windows at once\n",     params.n_batch);
     fprintf(stderr, "\n");
 }
 
@@ -138,6 +144,43 @@ static int whisper_bench_full(const whisper_params & params) {
     }
 
     whisper_print_timings(ctx);
+
+    // batched encoder
+    if (params.n_batch > 1) {
+        std::vector<whisper_state *> states(params.n_batch);
+        std::vector<int> offsets(params.n_batch, 0);
+
+        for (auto & state : states) {
+            state = whisper_init_state(ctx);
+            if (state == nullptr || whisper_set_mel_with_state(ctx, state, nullptr, 0, n_mels) != 0) {
+                fprintf(stderr, "error: failed to init state\n");
+                return 5;
+            }
+        }
+
+        // heat
+        if (int ret = whisper_encode_batch(ctx, states.data(), offsets.data(), params.n_batch, params.n_threads) != 0) {
+            fprintf(stderr, "error: failed to encode: %d\n", ret);
+            return 4;
+        }
+
+        const auto t_start = std::chrono::steady_clock::now();
+
+        if (int ret = whisper_encode_batch(ctx, states.data(), offsets.data(), params.n_batch, params.n_threads) != 0) {
+            fprintf(stderr, "error: failed to encode: %d\n", ret);
+            return 4;
+        }
+
+        const double t_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+
+        fprintf(stderr, "\n");
+        fprintf(stderr, "%s: batched encode time = %8.2f ms / %d windows (%8.2f ms per window)\n", __func__, t_ms, params.n_batch, t_ms/params.n_batch);
+
+        for (auto * state : states) {
+            whisper_free_state(state);
+        }
+    }
+
     whisper_free(ctx);
 
     fprintf(stderr, "\n");
@@ -168,6 +211,7 @@ int main(int argc, char ** argv) {
         case 0: ret = whisper_bench_full(params);                break;
         case 1: ret = whisper_bench_memcpy(params.n_threads);       break;
         case 2: ret = whisper_bench_ggml_mul_mat(params.n_threads); break;
+        case 3: ret = whisper_bench_ggml_flash_attn(params.n_threads); break;
         default: fprintf(stderr, "error: unknown benchmark: %d\n", params.what); break;
     }
 
@@ -44,8 +44,10 @@ struct whisper_params {
     int32_t best_of       = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).greedy.best_of;
     int32_t beam_size     = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH).beam_search.beam_size;
     int32_t audio_ctx     = 0;
+    int32_t cache_mem_mb  = 0;
 
     float word_thold      =  0.01f;
+    float vad_thold       = 12.0f;
     float entropy_thold   =  2.40f;
     float logprob_thold   = -1.00f;
     float no_speech_thold =  0.6f;
@@ -76,6 +78,10 @@ struct whisper_params {
     bool log_score       = false;
     bool use_gpu         = true;
     bool flash_attn      = false;
+    bool use_mmap        = true;
+    bool mel_graph       = false;
+    bool stream_audio    = false;
+    bool vad             = false;
     bool suppress_nst    = false;
 
     std::string language  = "en";
@@ -93,6 +99,9 @@ struct whisper_params {
 
     std::string openvino_encode_device = "CPU";
 
+    std::string repack_cache_dir;
+    std::string cache_dir;
+
     std::string dtw = "";
 
     std::vector<std::string> fname_inp = {};
@@ -182,6 +191,14 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-ls"   || arg == "--log-score")       { params.log_score       = true; }
         else if (arg == "-ng"   || arg == "--no-gpu")          { params.use_gpu         = false; }
         else if (arg == "-fa"   || arg == "--flash-attn")      { params.flash_attn      = true; }
+        else if (arg == "-nmm"  || arg == "--no-mmap")         { params.use_mmap        = false; }
+        else if (arg == "-mg"   || arg == "--mel-graph")       { params.mel_graph       = true; }
+        else if (arg == "-sa"   || arg == "--stream-audio")    { params.stream_audio    = true; }
+        else if (arg == "-vad"  || arg == "--vad")             { params.vad             = true; }
+        else if (arg == "-vt"   || arg == "--vad-thold")       { params.vad_thold       = std::stof(ARGV_NEXT); }
+        else if (                  arg == "--repack-cache")    { params.repack_cache_dir = ARGV_NEXT; }
+        else if (                  arg == "--cache-mem")       { params.cache_mem_mb    = std::stoi(ARGV_NEXT); }
+        else if (                  arg == "--cache-dir")       { params.cache_dir       = ARGV_NEXT; }
         else if (arg == "-sns"  || arg == "--suppress-nst")    { params.suppress_nst    = true; }
         else if (                  arg == "--suppress-regex")  { params.suppress_regex  = ARGV_NEXT; }
         else if (                  arg == "--grammar")         { params.grammar         = ARGV_NEXT; }
@@ -213,7 +230,7 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "  -sow,      --split-on-word     [%-7s] split on word rather than on token\n",             params.split_on_word ? "true" : "false");
     fprintf(stderr, "  -bo N,     --best-of N         [%-7d] number of best candidates to keep\n",              params.best_of);
     fprintf(stderr, "  -bs N,     --beam-size N       [%-7d] beam size for beam search\n",                      params.beam_size);
-    fprintf(stderr, "  -ac N,     --audio-ctx N       [%-7d] audio context size (0 - all)\n",                   params.audio_ctx);
+    fprintf(stderr, "  -ac N,     --audio-ctx N       [%-7d] audio context size (0 - all, -1 - auto)\n",        params.audio_ctx);
     fprintf(stderr, "  -wt N,     --word-thold N      [%-7.2f] word timestamp probability threshold\n",         params.word_thold);
     fprintf(stderr, "  -et N,     --entropy-thold N   [%-7.2f] entropy threshold for decoder fail\n",           params.entropy_thold);
     fprintf(stderr, "  -lpt N,    --logprob-thold N   [%-7.2f] log probability threshold for decoder fail\n",   params.logprob_thold);
@@ -250,6 +267,14 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "  -ls,       --log-score         [%-7s] log best decoder scores of tokens\n",              params.log_score?"true":"false");
     fprintf(stderr, "  -ng,       --no-gpu            [%-7s] disable GPU\n",                                    params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,       --flash-attn        [%-7s] flash attention\n",                                params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -nmm,      --no-mmap           [%-7s] do not memory-map the model file\n",               params.use_mmap ? "false" : "true");
+    fprintf(stderr, "  -mg,       --mel-graph         [%-7s] compute the mel spectrogram on the backend\n",     params.mel_graph ? "true" : "false");
+    fprintf(stderr, "  -sa,       --stream-audio      [%-7s] stream WAV input instead of loading it\n",         params.stream_audio ? "true" : "false");
+    fprintf(stderr, "  -vad,      --vad               [%-7s] skip the audio without speech\n",                  params.vad ? "true" : "false");
+    fprintf(stderr, "  -vt N,     --vad-thold N       [%-7.2f] VAD threshold, in dB above the noise floor\n",   params.vad_thold);
+    fprintf(stderr, "  --repack-cache DIR             [%-7s] cache the repacked CPU weights in DIR\n",          params.repack_cache_dir.c_str());
+    fprintf(stderr, "  --cache-mem N                  [%-7d] MB of encoder outputs and results cached in memory\n", params.cache_mem_mb);
+    fprintf(stderr, "  --cache-dir DIR                [%-7s] also cache the encoder outputs and results in DIR\n", params.cache_dir.c_str());
     fprintf(stderr, "  -sns,      --suppress-nst      [%-7s] suppress non-speech tokens\n",                     params.suppress_nst ? "true" : "false");
     fprintf(stderr, "  --suppress-regex REGEX         [%-7s] regular expression matching tokens to suppress\n", params.suppress_regex.c_str());
     fprintf(stderr, "  --grammar GRAMMAR              [%-7s] GBNF grammar to guide decoding\n",                 params.grammar.c_str());
@@ -1005,6 +1030,20 @@ int main(int argc, char ** argv) {
 
     cparams.use_gpu    = params.use_gpu;
     cparams.flash_attn = params.flash_attn;
+    cparams.use_mmap   = params.use_mmap;
+    cparams.mel_graph  = params.mel_graph;
+
+    cparams.n_threads_load = params.n_threads;
+
+    if (!params.repack_cache_dir.empty()) {
+        cparams.repack_cache_dir = params.repack_cache_dir.c_str();
+    }
+
+    cparams.cache_mem_size = (size_t) params.cache_mem_mb*1024*1024;
+
+    if (!params.cache_dir.empty()) {
+        cparams.cache_dir = params.cache_dir.c_str();
+    }
 
     if (!params.dtw.empty()) {
         cparams.dtw_token_timestamps = true;
@@ -1069,7 +1108,26 @@ int main(int argc, char ** argv) {
         std::vector<float> pcmf32;               // mono-channel F32 PCM
         std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
 
-        if (!::read_wav(fname_inp, pcmf32, pcmf32s, params.diarize)) {
+        // diarization needs the full stereo audio and parallel processing needs the full mono audio
+        bool stream_audio = params.stream_audio && !params.diarize && params.n_processors == 1;
+
+        std::unique_ptr<audio_reader> reader;
+
+        if (stream_audio) {
+            reader = audio_reader_open(fname_inp);
+            if (!reader && fname_inp == "-") {
+                fprintf(stderr, "error: failed to read WAV data from stdin\n");
+                continue;
+            }
+
+            // only WAV files are streamed - the other formats are decoded as a whole
+            if (!reader) {
+                fprintf(stderr, "%s: '%s' is not a WAV file - loading it as a whole\n", __func__, fname_inp.c_str());
+                stream_audio = false;
+            }
+        }
+
+        if (!stream_audio && !::read_wav(fname_inp, pcmf32, pcmf32s, params.diarize)) {
             fprintf(stderr, "error: failed to read WAV file '%s'\n", fname_inp.c_str());
             continue;
         }
@@ -1093,13 +1151,23 @@ int main(int argc, char ** argv) {
 
             // print some info about the processing
             fprintf(stderr, "\n");
-            fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, %d beams + best of %d, lang = %s, task = %s, %stimestamps = %d ...\n",
-                    __func__, fname_inp.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE,
-                    params.n_threads, params.n_processors, params.beam_size, params.best_of,
-                    params.language.c_str(),
-                    params.translate ? "translate" : "transcribe",
-                    params.tinydiarize ? "tdrz = 1, " : "",
-                    params.no_timestamps ? 0 : 1);
+            if (stream_audio) {
+                fprintf(stderr, "%s: streaming '%s', %d threads, %d beams + best of %d, lang = %s, task = %s, %stimestamps = %d ...\n",
+                        __func__, fname_inp.c_str(),
+                        params.n_threads, params.beam_size, params.best_of,
+                        params.language.c_str(),
+                        params.translate ? "translate" : "transcribe",
+                        params.tinydiarize ? "tdrz = 1, " : "",
+                        params.no_timestamps ? 0 : 1);
+            } else {
+                fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, %d beams + best of %d, lang = %s, task = %s, %stimestamps = %d ...\n",
+                        __func__, fname_inp.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE,
+                        params.n_threads, params.n_processors, params.beam_size, params.best_of,
+                        params.language.c_str(),
+                        params.translate ? "translate" : "transcribe",
+                        params.tinydiarize ? "tdrz = 1, " : "",
+                        params.no_timestamps ? 0 : 1);
+            }
 
             fprintf(stderr, "\n");
         }
@@ -1151,6 +1219,9 @@ int main(int argc, char ** argv) {
 
             wparams.suppress_nst     = params.suppress_nst;
 
+            wparams.vad.type         = params.vad ? WHISPER_VAD_ENERGY : WHISPER_VAD_NONE;
+            wparams.vad.thold        = params.vad_thold;
+
             whisper_print_user_data user_data = { &params, &pcmf32s, 0 };
 
             const auto & grammar_parsed = params.grammar_parsed;
@@ -1203,7 +1274,18 @@ int main(int argc, char ** argv) {
                 wparams.abort_callback_user_data = &is_aborted;
             }
 
-            if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
+            if (stream_audio) {
+                whisper_audio_source source;
+                source.read = [](float * dst, int n_samples, void * user_data) {
+                    return ((audio_reader *) user_data)->read(dst, n_samples);
+                };
+                source.user_data = reader.get();
+
+                if (whisper_full_from_source(ctx, wparams, source) != 0) {
+                    fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+                    return 10;
+                }
+            } else if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
                 fprintf(stderr, "%s: failed to process audio\n", argv[0]);
                 return 10;
             }
@@ -1234,7 +1316,10 @@ int main(int argc, char ** argv) {
             // output to WTS file
             if (params.output_wts) {
                 const auto fname_wts = fname_out + ".wts";
-                output_wts(ctx, fname_wts.c_str(), fname_inp.c_str(), params, float(pcmf32.size() + 1000)/WHISPER_SAMPLE_RATE, pcmf32s);
+                const int n_segments = whisper_full_n_segments(ctx);
+                const float t_sec = stream_audio ? (n_segments > 0 ? 0.01f*whisper_full_get_segment_t1(ctx, n_segments - 1) : 0.0f) + 1000.0f/WHISPER_SAMPLE_RATE
+                                                 : float(pcmf32.size() + 1000)/WHISPER_SAMPLE_RATE;
+                output_wts(ctx, fname_wts.c_str(), fname_inp.c_str(), params, t_sec, pcmf32s);
             }
 
             // output to CSV file
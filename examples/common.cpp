@@ -10,6 +10,7 @@
 #include <cmath>
 #include <cstring>
 #include <fstream>
+#include <limits>
 #include <regex>
 #include <locale>
 #include <codecvt>
@@ -639,6 +640,192 @@ bool is_wav_buffer(const std::string buf) {
     return true;
 }
 
+// zeroth order modified Bessel function of the first kind, for the Kaiser window
+static double bessel_i0(double x) {
+    double sum  = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 64; k++) {
+        term *= (x/(2*k))*(x/(2*k));
+        sum  += term;
+        if (term < sum*1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+static int gcd(int a, int b) {
+    while (b != 0) {
+        const int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+resampler::resampler(int sample_rate_in, int sample_rate_out) {
+    // the output sample j is at the input position j*M/L
+    const int g = gcd(sample_rate_in, sample_rate_out);
+    L = sample_rate_out / g;
+    M = sample_rate_in  / g;
+
+    if (L == M) {
+        return;
+    }
+
+    // Kaiser-windowed sinc, with the cutoff just below the lower of the two Nyquist frequencies
+    const int    n_zeros = 16;    // zero crossings of the sinc on each side
+    const double beta    = 8.6;   // ~90 dB stopband
+    const double cutoff  = 0.95*std::min(1.0, double(sample_rate_out)/sample_rate_in); // relative to the input Nyquist
+
+    // taps on each side of the output position and number of phases of the filter
+    // for rates with a large L, the fractional position is rounded to one of n_phase phases
+    n_half  = (int) std::ceil(n_zeros/cutoff);
+    n_taps  = 2*n_half;
+    n_phase = std::min<int64_t>(L, 4096);
+
+    // coefficients of phase p for the input samples [base - n_half + 1, base + n_half], where base = floor(j*M/L)
+    coefs.resize(n_phase*n_taps);
+    for (int64_t p = 0; p < n_phase; p++) {
+        const double frac = double(p)/n_phase;
+
+        double sum = 0.0;
+        for (int k = 0; k < n_taps; k++) {
+            const double t = frac - (k - n_half + 1); // distance to the output position, in input samples
+            const double x = M_PI*cutoff*t;
+            const double r = t/(n_half + 1);
+
+            const double sinc   = std::abs(x) < 1e-9 ? 1.0 : std::sin(x)/x;
+            const double window = std::abs(r) < 1.0 ? bessel_i0(beta*std::sqrt(1.0 - r*r))/bessel_i0(beta) : 0.0;
+
+            coefs[p*n_taps + k] = float(cutoff*sinc*window);
+            sum += cutoff*sinc*window;
+        }
+
+        // unity gain at DC for every phase
+        for (int k = 0; k < n_taps; k++) {
+            coefs[p*n_taps + k] = float(coefs[p*n_taps + k]/sum);
+        }
+    }
+
+    // zeros before the start of the signal
+    hist.assign(n_half, 0.0f);
+    hist_start = -n_half;
+}
+
+void resampler::process(const float * in, size_t n, std::vector<float> & out) {
+    n_in += n;
+
+    if (L == M) {
+        out.insert(out.end(), in, in + n);
+        return;
+    }
+
+    hist.insert(hist.end(), in, in + n);
+
+    emit(out);
+}
+
+void resampler::flush(std::vector<float> & out) {
+    if (L == M || flushed) {
+        return;
+    }
+
+    // zeros past the end of the signal
+    hist.insert(hist.end(), n_half + 1, 0.0f);
+    flushed = true;
+
+    emit(out);
+}
+
+void resampler::emit(std::vector<float> & out) {
+    const int64_t n_out_max = flushed ? (n_in*L + M - 1)/M : std::numeric_limits<int64_t>::max();
+
+    while (j_out < n_out_max) {
+        int64_t base = (j_out*M)/L;
+        int64_t p    = (j_out*M)%L;
+
+        if (n_phase != L) {
+            p = (p*n_phase + L/2)/L;
+            if (p == n_phase) {
+                p = 0;
+                base++;
+            }
+        }
+
+        // the input samples [base - n_half + 1, base + n_half] must be available
+        if (base + n_half >= hist_start + (int64_t) hist.size()) {
+            break;
+        }
+
+        const float * x = hist.data() + (base - n_half + 1 - hist_start);
+        const float * c = coefs.data() + p*n_taps;
+
+        // independent accumulators, so that the loop is vectorized
+        float acc[8] = { 0.0f };
+        int k = 0;
+        for (; k + 8 <= n_taps; k += 8) {
+            for (int l = 0; l < 8; l++) {
+                acc[l] += x[k + l]*c[k + l];
+            }
+        }
+        for (; k < n_taps; k++) {
+            acc[0] += x[k]*c[k];
+        }
+
+        out.push_back(((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7])));
+
+        j_out++;
+    }
+
+    // drop the samples that are not needed anymore
+    const int64_t i_keep = std::min<int64_t>((j_out*M)/L - n_half, hist_start + (int64_t) hist.size());
+    if (i_keep > hist_start) {
+        hist.erase(hist.begin(), hist.begin() + (i_keep - hist_start));
+        hist_start = i_keep;
+    }
+}
+
+void resample(const std::vector<float> & in, int sample_rate_in, int sample_rate_out, std::vector<float> & out) {
+    resampler r(sample_rate_in, sample_rate_out);
+
+    out.clear();
+    out.reserve((in.size()*sample_rate_out)/sample_rate_in + 1);
+
+    r.process(in.data(), in.size(), out);
+    r.flush(out);
+}
+
+bool wav_pcm16_view(const std::string & buf, const int16_t ** samples, int * n_samples) {
+    if (!is_wav_buffer(buf)) {
+        return false;
+    }
+
+    drwav wav;
+    if (drwav_init_memory(&wav, buf.data(), buf.size(), nullptr) == false) {
+        return false;
+    }
+
+    const bool ok = wav.translatedFormatTag == DR_WAVE_FORMAT_PCM &&
+                    wav.bitsPerSample == 16 &&
+                    wav.channels == 1 &&
+                    wav.sampleRate == COMMON_SAMPLE_RATE &&
+                    wav.dataChunkDataPos < buf.size() &&
+                    (uintptr_t) (buf.data() + wav.dataChunkDataPos) % alignof(int16_t) == 0;
+
+    if (ok) {
+        // the size in the header is not reliable for streamed WAV data
+        const uint64_t n = std::min<uint64_t>(wav.totalPCMFrameCount, (buf.size() - wav.dataChunkDataPos)/sizeof(int16_t));
+
+        *samples   = (const int16_t *) (buf.data() + wav.dataChunkDataPos);
+        *n_samples = (int) std::min<uint64_t>(n, std::numeric_limits<int>::max());
+    }
+
+    drwav_uninit(&wav);
+
+    return ok;
+}
+
 bool read_wav(const std::string & fname, std::vector<float>& pcmf32, std::vector<std::vector<float>>& pcmf32s, bool stereo) {
     drwav wav;
     std::vector<uint8_t> wav_data; // used for pipe input from stdin or ffmpeg decoding output
@@ -689,8 +876,8 @@ bool read_wav(const std::string & fname, std::vector<float>& pcmf32, std::vector
 #endif
     }
 
-    if (wav.channels != 1 && wav.channels != 2) {
-        fprintf(stderr, "%s: WAV file '%s' must be mono or stereo\n", __func__, fname.c_str());
+    if (wav.channels < 1 || wav.sampleRate == 0) {
+        fprintf(stderr, "%s: WAV file '%s' has no audio\n", __func__, fname.c_str());
         drwav_uninit(&wav);
         return false;
     }
@@ -701,52 +888,183 @@ bool read_wav(const std::string & fname, std::vector<float>& pcmf32, std::vector
         return false;
     }
 
-    if (wav.sampleRate != COMMON_SAMPLE_RATE) {
-        fprintf(stderr, "%s: WAV file '%s' must be %i kHz\n", __func__, fname.c_str(), COMMON_SAMPLE_RATE/1000);
-        drwav_uninit(&wav);
-        return false;
-    }
+    const int n_channels  = wav.channels;
+    const int sample_rate = wav.sampleRate;
 
-    if (wav.bitsPerSample != 16) {
-        fprintf(stderr, "%s: WAV file '%s' must be 16-bit\n", __func__, fname.c_str());
-        drwav_uninit(&wav);
-        return false;
-    }
+    // decode any format supported by dr_wav to interleaved float
+    // the frame count in the header is not reliable for piped input, so read until the end of the data
+    std::vector<float> pcm;
+    {
+        const uint64_t n_chunk = 16*1024;
 
-    const uint64_t n = wav_data.empty() ? wav.totalPCMFrameCount : wav_data.size()/(wav.channels*wav.bitsPerSample/8);
+        uint64_t n = 0;
+        while (true) {
+            pcm.resize((n + n_chunk)*n_channels);
 
-    std::vector<int16_t> pcm16;
-    pcm16.resize(n*wav.channels);
-    drwav_read_pcm_frames_s16(&wav, n, pcm16.data());
+            const uint64_t n_read = drwav_read_pcm_frames_f32(&wav, n_chunk, pcm.data() + n*n_channels);
+            n += n_read;
+
+            if (n_read < n_chunk) {
+                break;
+            }
+        }
+
+        pcm.resize(n*n_channels);
+    }
     drwav_uninit(&wav);
 
-    // convert to mono, float
-    pcmf32.resize(n);
-    if (wav.channels == 1) {
+    const uint64_t n = pcm.size()/n_channels;
+
+    // convert to mono
+    std::vector<float> mono(n);
+    if (n_channels == 1) {
+        mono = pcm;
+    } else if (n_channels == 2) {
         for (uint64_t i = 0; i < n; i++) {
-            pcmf32[i] = float(pcm16[i])/32768.0f;
+            mono[i] = (pcm[2*i] + pcm[2*i + 1])*0.5f;
         }
     } else {
+        const float scale = 1.0f/n_channels;
         for (uint64_t i = 0; i < n; i++) {
-            pcmf32[i] = float(pcm16[2*i] + pcm16[2*i + 1])/65536.0f;
+            float sum = 0.0f;
+            for (int c = 0; c < n_channels; c++) {
+                sum += pcm[i*n_channels + c];
+            }
+            mono[i] = sum*scale;
         }
     }
 
+    resample(mono, sample_rate, COMMON_SAMPLE_RATE, pcmf32);
+
     if (stereo) {
-        // convert to stereo, float
+        // convert to stereo
         pcmf32s.resize(2);
 
-        pcmf32s[0].resize(n);
-        pcmf32s[1].resize(n);
-        for (uint64_t i = 0; i < n; i++) {
-            pcmf32s[0][i] = float(pcm16[2*i])/32768.0f;
-            pcmf32s[1][i] = float(pcm16[2*i + 1])/32768.0f;
+        for (int c = 0; c < 2; c++) {
+            std::vector<float> channel(n);
+            for (uint64_t i = 0; i < n; i++) {
+                channel[i] = pcm[2*i + c];
+            }
+
+            resample(channel, sample_rate, COMMON_SAMPLE_RATE, pcmf32s[c]);
         }
     }
 
     return true;
 }
 
+// dr_wav callbacks for WAV data from stdin - it can only be skipped forward
+static size_t audio_reader_stdin_read(void * /*user_data*/, void * dst, size_t n) {
+    return fread(dst, 1, n, stdin);
+}
+
+static drwav_bool32 audio_reader_stdin_seek(void * /*user_data*/, int offset, drwav_seek_origin origin) {
+    if (origin != drwav_seek_origin_current || offset < 0) {
+        return DRWAV_FALSE;
+    }
+
+    char buf[4096];
+    while (offset > 0) {
+        const size_t n = fread(buf, 1, std::min<size_t>(offset, sizeof(buf)), stdin);
+        if (n == 0) {
+            return DRWAV_FALSE;
+        }
+        offset -= n;
+    }
+
+    return DRWAV_TRUE;
+}
+
+class audio_reader_wav : public audio_reader {
+public:
+    ~audio_reader_wav() override {
+        if (opened) {
+            drwav_uninit(&wav);
+        }
+    }
+
+    bool open(const std::string & fname) {
+        if (fname == "-") {
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+#endif
+            opened = drwav_init(&wav, audio_reader_stdin_read, audio_reader_stdin_seek, nullptr, nullptr);
+        } else {
+            opened = drwav_init_file(&wav, fname.c_str(), nullptr);
+        }
+
+        if (!opened || wav.channels < 1 || wav.sampleRate == 0) {
+            return false;
+        }
+
+        res = std::unique_ptr<resampler>(new resampler(wav.sampleRate, COMMON_SAMPLE_RATE));
+
+        return true;
+    }
+
+    int read(float * dst, int n_samples) override {
+        const uint64_t n_chunk = 16*1024;
+
+        const int n_channels = wav.channels;
+
+        while ((int) (out.size() - out_pos) < n_samples && !eof) {
+            // drop the samples that were already returned
+            out.erase(out.begin(), out.begin() + out_pos);
+            out_pos = 0;
+
+            pcm.resize(n_chunk*n_channels);
+
+            const uint64_t n = drwav_read_pcm_frames_f32(&wav, n_chunk, pcm.data());
+            if (n == 0) {
+                res->flush(out);
+                eof = true;
+                break;
+            }
+
+            // convert to mono
+            if (n_channels > 1) {
+                const float scale = 1.0f/n_channels;
+                for (uint64_t i = 0; i < n; i++) {
+                    float sum = 0.0f;
+                    for (int c = 0; c < n_channels; c++) {
+                        sum += pcm[i*n_channels + c];
+                    }
+                    pcm[i] = sum*scale;
+                }
+            }
+
+            res->process(pcm.data(), n, out);
+        }
+
+        const int n = std::min<int>(n_samples, out.size() - out_pos);
+
+        std::copy(out.begin() + out_pos, out.begin() + out_pos + n, dst);
+        out_pos += n;
+
+        return n;
+    }
+
+private:
+    drwav wav;
+    bool  opened = false;
+    bool  eof    = false;
+
+    std::unique_ptr<resampler> res;
+
+    std::vector<float> pcm; // decoded frames
+    std::vector<float> out; // resampled samples, returned from out_pos
+    size_t out_pos = 0;
+};
+
+std::unique_ptr<audio_reader> audio_reader_open(const std::string & fname) {
+    std::unique_ptr<audio_reader_wav> reader(new audio_reader_wav());
+    if (reader->open(fname)) {
+        return reader;
+    }
+
+    return nullptr;
+}
+
 void high_pass_filter(std::vector<float> & data, float cutoff, float sample_rate) {
     const float rc = 1.0f / (2.0f * M_PI * cutoff);
     const float dt = 1.0f / sample_rate;
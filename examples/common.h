@@ -4,6 +4,7 @@
 
 #include <string>
 #include <map>
+#include <memory>
 #include <vector>
 #include <random>
 #include <thread>
@@ -139,9 +140,49 @@ gpt_vocab::id gpt_sample_top_k_top_p_repeat(
 // Check if a buffer is a WAV audio file
 bool is_wav_buffer(const std::string buf);
 
+// Polyphase windowed-sinc resampler of a signal that is passed in pieces
+class resampler {
+public:
+    resampler(int sample_rate_in, int sample_rate_out);
+
+    // resample the next samples of the signal and append the output samples that are complete to out
+    void process(const float * in, size_t n, std::vector<float> & out);
+
+    // end of the signal - append the remaining output samples to out
+    void flush(std::vector<float> & out);
+
+private:
+    void emit(std::vector<float> & out);
+
+    int64_t L = 1;
+    int64_t M = 1;
+
+    int     n_half  = 0;
+    int     n_taps  = 0;
+    int64_t n_phase = 0;
+
+    std::vector<float> coefs; // [n_phase][n_taps]
+
+    std::vector<float> hist;  // input samples from hist_start
+    int64_t hist_start = 0;
+
+    int64_t n_in  = 0; // number of input samples
+    int64_t j_out = 0; // index of the next output sample
+
+    bool flushed = false;
+};
+
+// Resample PCM data with a polyphase windowed-sinc filter
+void resample(
+        const std::vector<float> & in,
+        int sample_rate_in,
+        int sample_rate_out,
+        std::vector<float> & out);
+
 // Read WAV audio file and store the PCM data into pcmf32
 // fname can be a buffer of WAV data instead of a filename
-// The sample rate of the audio must be equal to COMMON_SAMPLE_RATE
+// Any sample rate, sample format and number of channels supported by dr_wav is accepted - the audio is
+// converted to mono and resampled to COMMON_SAMPLE_RATE
 // If stereo flag is set and the audio has 2 channels, the pcmf32s will contain 2 channel PCM
 bool read_wav(
         const std::string & fname,
@@ -149,6 +190,26 @@ bool read_wav(
         std::vector<std::vector<float>> & pcmf32s,
         bool stereo);
 
+// If buf is a WAV buffer of 16-bit PCM, mono and COMMON_SAMPLE_RATE, point samples to the PCM data inside buf and
+// return true - the audio can then be passed to whisper_full_pcm16() without converting or copying it
+bool wav_pcm16_view(const std::string & buf, const int16_t ** samples, int * n_samples);
+
+// Pull-based reader of an audio file: the audio is decoded, converted to mono and resampled to COMMON_SAMPLE_RATE
+// while it is read, so that the whole file is never in memory
+// only WAV files are supported, decoded with dr_wav - use read_wav() for the other formats
+class audio_reader {
+public:
+    virtual ~audio_reader() = default;
+
+    // read up to n_samples samples into dst
+    // returns the number of samples read, 0 at the end of the audio and -1 on error
+    virtual int read(float * dst, int n_samples) = 0;
+};
+
+// fname can be "-" for stdin
+// returns nullptr if fname cannot be opened as a WAV file
+std::unique_ptr<audio_reader> audio_reader_open(const std::string & fname);
+
 // Write PCM data into WAV audio file
 class wav_writer {
 private:
@@ -0,0 +1,306 @@
+// convert a Whisper ggml model file (.bin) to GGUF
+//
+// the hparams, the mel filters and the vocab are stored as GGUF key-value pairs (see README.md)
+// the tensors are copied one at a time, so the model is never fully loaded in memory
+//
+#include "ggml.h"
+#include "gguf.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// default hparams (Whisper tiny)
+struct whisper_hparams {
+    int32_t n_vocab       = 51864;
+    int32_t n_audio_ctx   = 1500;
+    int32_t n_audio_state = 384;
+    int32_t n_audio_head  = 6;
+    int32_t n_audio_layer = 4;
+    int32_t n_text_ctx    = 448;
+    int32_t n_text_state  = 384;
+    int32_t n_text_head   = 6;
+    int32_t n_text_layer  = 4;
+    int32_t n_mels        = 80;
+    int32_t ftype         = 1;
+};
+
+struct whisper_filters {
+    int32_t n_mel;
+    int32_t n_fft;
+
+    std::vector<float> data;
+};
+
+// location of the data of a tensor in the input file
+struct tensor_record {
+    ggml_tensor * tensor;
+    size_t        offs;
+};
+
+template<typename T>
+static void read_safe(std::ifstream & fin, T & dest) {
+    fin.read((char *) &dest, sizeof(T));
+}
+
+static bool whisper_model_convert(const std::string & fname_inp, const std::string & fname_out) {
+    printf("%s: loading model from '%s'\n", __func__, fname_inp.c_str());
+
+    auto finp = std::ifstream(fname_inp, std::ios::binary);
+    if (!finp) {
+        fprintf(stderr, "%s: failed to open '%s' for reading\n", __func__, fname_inp.c_str());
+        return false;
+    }
+
+    // verify magic
+    {
+        uint32_t magic;
+        read_safe(finp, magic);
+        if (magic != GGML_FILE_MAGIC) {
+            fprintf(stderr, "%s: invalid model file '%s' (bad magic)\n", __func__, fname_inp.c_str());
+            return false;
+        }
+    }
+
+    gguf_context * gguf = gguf_init_empty();
+
+    gguf_set_val_str(gguf, "general.architecture", "whisper");
+
+    // hparams
+    {
+        whisper_hparams hparams;
+
+        read_safe(finp, hparams.n_vocab);
+        read_safe(finp, hparams.n_audio_ctx);
+        read_safe(finp, hparams.n_audio_state);
+        read_safe(finp, hparams.n_audio_head);
+        read_safe(finp, hparams.n_audio_layer);
+        read_safe(finp, hparams.n_text_ctx);
+        read_safe(finp, hparams.n_text_state);
+        read_safe(finp, hparams.n_text_head);
+        read_safe(finp, hparams.n_text_layer);
+        read_safe(finp, hparams.n_mels);
+        read_safe(finp, hparams.ftype);
+
+        const int32_t qntvr = hparams.ftype / GGML_QNT_VERSION_FACTOR;
+        const int32_t ftype = hparams.ftype % GGML_QNT_VERSION_FACTOR;
+
+        fprintf(stderr, "%s: n_vocab       = %d\n", __func__, hparams.n_vocab);
+        fprintf(stderr, "%s: n_audio_ctx   = %d\n", __func__, hparams.n_audio_ctx);
+        fprintf(stderr, "%s: n_audio_state = %d\n", __func__, hparams.n_audio_state);
+        fprintf(stderr, "%s: n_audio_head  = %d\n", __func__, hparams.n_audio_head);
+        fprintf(stderr, "%s: n_audio_layer = %d\n", __func__, hparams.n_audio_layer);
+        fprintf(stderr, "%s: n_text_ctx    = %d\n", __func__, hparams.n_text_ctx);
+        fprintf(stderr, "%s: n_text_state  = %d\n", __func__, hparams.n_text_state);
+        fprintf(stderr, "%s: n_text_head   = %d\n", __func__, hparams.n_text_head);
+        fprintf(stderr, "%s: n_text_layer  = %d\n", __func__, hparams.n_text_layer);
+        fprintf(stderr, "%s: n_mels        = %d\n", __func__, hparams.n_mels);
+        fprintf(stderr, "%s: ftype         = %d\n", __func__, ftype);
+        fprintf(stderr, "%s: qntvr         = %d\n", __func__, qntvr);
+
+        gguf_set_val_i32(gguf, "general.file_type",              ftype);
+        gguf_set_val_i32(gguf, "general.quantization_version",   qntvr);
+        gguf_set_val_i32(gguf, "whisper.vocab_size",             hparams.n_vocab);
+        gguf_set_val_i32(gguf, "whisper.audio.context_length",   hparams.n_audio_ctx);
+        gguf_set_val_i32(gguf, "whisper.audio.embedding_length", hparams.n_audio_state);
+        gguf_set_val_i32(gguf, "whisper.audio.head_count",       hparams.n_audio_head);
+        gguf_set_val_i32(gguf, "whisper.audio.block_count",      hparams.n_audio_layer);
+        gguf_set_val_i32(gguf, "whisper.text.context_length",    hparams.n_text_ctx);
+        gguf_set_val_i32(gguf, "whisper.text.embedding_length",  hparams.n_text_state);
+        gguf_set_val_i32(gguf, "whisper.text.head_count",        hparams.n_text_head);
+        gguf_set_val_i32(gguf, "whisper.text.block_count",       hparams.n_text_layer);
+        gguf_set_val_i32(gguf, "whisper.mel_count",              hparams.n_mels);
+    }
+
+    // mel filters
+    {
+        whisper_filters filters;
+
+        read_safe(finp, filters.n_mel);
+        read_safe(finp, filters.n_fft);
+
+        filters.data.resize(filters.n_mel * filters.n_fft);
+        finp.read((char *) filters.data.data(), filters.data.size() * sizeof(float));
+
+        gguf_set_val_i32 (gguf, "whisper.mel_filters.n_mel", filters.n_mel);
+        gguf_set_val_i32 (gguf, "whisper.mel_filters.n_fft", filters.n_fft);
+        gguf_set_arr_data(gguf, "whisper.mel_filters", GGUF_TYPE_FLOAT32, filters.data.data(), filters.data.size());
+    }
+
+    // vocab
+    {
+        int32_t n_vocab = 0;
+        read_safe(finp, n_vocab);
+
+        std::vector<uint32_t> token_len(n_vocab);
+        std::vector<uint8_t>  token_data;
+
+        for (int i = 0; i < n_vocab; i++) {
+            read_safe(finp, token_len[i]);
+
+            const size_t offs = token_data.size();
+            token_data.resize(offs + token_len[i]);
+            finp.read((char *) token_data.data() + offs, token_len[i]);
+        }
+
+        fprintf(stderr, "%s: n_tokens      = %d\n", __func__, n_vocab);
+
+        gguf_set_arr_data(gguf, "whisper.vocab.token_len",  GGUF_TYPE_UINT32, token_len.data(),  token_len.size());
+        gguf_set_arr_data(gguf, "whisper.vocab.token_data", GGUF_TYPE_UINT8,  token_data.data(), token_data.size());
+    }
+
+    if (!finp) {
+        fprintf(stderr, "%s: failed to read the header of '%s'\n", __func__, fname_inp.c_str());
+        gguf_free(gguf);
+        return false;
+    }
+
+    // tensor meta data
+    std::vector<tensor_record> records;
+
+    ggml_context * ctx = nullptr;
+    {
+        const size_t n_tensors_max = 4096;
+
+        struct ggml_init_params params = {
+            /*.mem_size   =*/ n_tensors_max*ggml_tensor_overhead(),
+            /*.mem_buffer =*/ nullptr,
+            /*.no_alloc   =*/ true,
+        };
+
+        ctx = ggml_init(params);
+
+        while (true) {
+            int32_t n_dims;
+            int32_t length;
+            int32_t ttype;
+
+            read_safe(finp, n_dims);
+            read_safe(finp, length);
+            read_safe(finp, ttype);
+
+            if (finp.eof()) {
+                break;
+            }
+
+            if (n_dims < 1 || n_dims > 4 || ttype < 0 || ttype >= GGML_TYPE_COUNT || records.size() == n_tensors_max) {
+                fprintf(stderr, "%s: invalid tensor record in '%s'\n", __func__, fname_inp.c_str());
+                ggml_free(ctx);
+                gguf_free(gguf);
+                return false;
+            }
+
+            int64_t ne[4] = { 1, 1, 1, 1 };
+            for (int i = 0; i < n_dims; ++i) {
+                int32_t ne_cur;
+                read_safe(finp, ne_cur);
+                ne[i] = ne_cur;
+            }
+
+            std::string name(length, 0);
+            finp.read(&name[0], length);
+
+            ggml_tensor * tensor = ggml_new_tensor(ctx, (ggml_type) ttype, n_dims, ne);
+            ggml_set_name(tensor, name.c_str());
+
+            records.push_back({ tensor, (size_t) finp.tellg() });
+
+            gguf_add_tensor(gguf, tensor);
+
+            printf("%48s - [%5d, %5d, %5d], type = %6s, %6.2f MB\n", name.c_str(),
+                    (int) ne[0], (int) ne[1], (int) ne[2], ggml_type_name((ggml_type) ttype), ggml_nbytes(tensor)/1e6);
+
+            finp.seekg(ggml_nbytes(tensor), std::ios::cur);
+        }
+    }
+
+    finp.clear();
+
+    auto fout = std::ofstream(fname_out, std::ios::binary);
+    if (!fout) {
+        fprintf(stderr, "%s: failed to open '%s' for writing\n", __func__, fname_out.c_str());
+        ggml_free(ctx);
+        gguf_free(gguf);
+        return false;
+    }
+
+    // header + kv pairs + tensor infos, padded to the alignment of the data section
+    {
+        std::vector<uint8_t> meta(gguf_get_meta_size(gguf));
+        gguf_get_meta_data(gguf, meta.data());
+
+        fout.write((const char *) meta.data(), meta.size());
+    }
+
+    // tensor data
+    {
+        const size_t alignment = gguf_get_alignment(gguf);
+
+        std::vector<char> buf;
+        std::vector<char> pad(alignment, 0);
+
+        size_t total_size = 0;
+
+        for (const auto & record : records) {
+            const size_t nbytes = ggml_nbytes(record.tensor);
+
+            buf.resize(nbytes);
+
+            finp.seekg(record.offs);
+            finp.read(buf.data(), nbytes);
+
+            if (!finp) {
+                fprintf(stderr, "%s: failed to read tensor '%s'\n", __func__, ggml_get_name(record.tensor));
+                ggml_free(ctx);
+                gguf_free(gguf);
+                return false;
+            }
+
+            fout.write(buf.data(), nbytes);
+            fout.write(pad.data(), GGML_PAD(nbytes, alignment) - nbytes);
+
+            total_size += nbytes;
+        }
+
+        printf("%s: model size  = %8.2f MB\n", __func__, total_size/1e6);
+        printf("%s: tensors     = %8zu\n", __func__, records.size());
+    }
+
+    ggml_free(ctx);
+    gguf_free(gguf);
+
+    if (!fout) {
+        fprintf(stderr, "%s: failed to write '%s'\n", __func__, fname_out.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s model.bin model.gguf\n", argv[0]);
+        return 1;
+    }
+
+    const std::string fname_inp = argv[1];
+    const std::string fname_out = argv[2];
+
+    ggml_time_init();
+
+    const int64_t t_main_start_us = ggml_time_us();
+
+    if (!whisper_model_convert(fname_inp, fname_out)) {
+        fprintf(stderr, "%s: failed to convert model from '%s'\n", __func__, fname_inp.c_str());
+        return 1;
+    }
+
+    const int64_t t_main_end_us = ggml_time_us();
+
+    printf("\n");
+    printf("%s: total time = %8.2f ms\n", __func__, (t_main_end_us - t_main_start_us)/1000.0f);
+
+    return 0;
+}
@@ -110,7 +110,7 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -sow,      --split-on-word     [%-7s] split on word rather than on token\n",             params.split_on_word ? "true" : "false");
     fprintf(stderr, "  -bo N,     --best-of N         [%-7d] number of best candidates to keep\n",              params.best_of);
     fprintf(stderr, "  -bs N,     --beam-size N       [%-7d] beam size for beam search\n",                      params.beam_size);
-    fprintf(stderr, "  -ac N,     --audio-ctx N       [%-7d] audio context size (0 - all)\n",                   params.audio_ctx);
+    fprintf(stderr, "  -ac N,     --audio-ctx N       [%-7d] audio context size (0 - all, -1 - auto)\n",        params.audio_ctx);
     fprintf(stderr, "  -wt N,     --word-thold N      [%-7.2f] word timestamp probability threshold\n",         params.word_thold);
     fprintf(stderr, "  -et N,     --entropy-thold N   [%-7.2f] entropy threshold for decoder fail\n",           params.entropy_thold);
     fprintf(stderr, "  -lpt N,    --logprob-thold N   [%-7.2f] log probability threshold for decoder fail\n",   params.logprob_thold);
@@ -707,8 +707,12 @@ int main(int argc, char ** argv) {
         std::vector<float> pcmf32;               // mono-channel F32 PCM
         std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
 
-        if (sparams.ffmpeg_converter) {
-            // if file is not wav, convert to wav
+        // 16 kHz mono 16-bit WAV uploads are processed in place with whisper_full_pcm16()
+        const int16_t * pcm16   = nullptr;
+        int             n_pcm16 = 0;
+
+        if (sparams.ffmpeg_converter && !is_wav_buffer(audio_file.content)) {
+            // if file is not wav, convert to wav (read_wav handles any sample rate and format of wav data)
             // write to temporary file
             const std::string temp_filename = generate_temp_filename("whisper-server", ".wav");
             std::ofstream temp_file{temp_filename, std::ios::binary};
@@ -733,6 +737,8 @@ int main(int argc, char ** argv) {
             }
             // remove temp file
             std::remove(temp_filename.c_str());
+        } else if (!params.diarize && params.n_processors == 1 && wav_pcm16_view(audio_file.content, &pcm16, &n_pcm16)) {
+            // no conversion needed
         } else {
             if (!::read_wav(audio_file.content, pcmf32, pcmf32s, params.diarize))
             {
@@ -745,6 +751,8 @@ int main(int argc, char ** argv) {
 
         printf("Successfully loaded %s\n", filename.c_str());
 
+        const int n_samples = pcm16 ? n_pcm16 : (int) pcmf32.size();
+
         // print system information
         {
             fprintf(stderr, "\n");
@@ -766,7 +774,7 @@ int main(int argc, char ** argv) {
                 params.language = "auto";
             }
             fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, lang = %s, task = %s, %stimestamps = %d ...\n",
-                    __func__, filename.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE,
+                    __func__, filename.c_str(), n_samples, float(n_samples)/WHISPER_SAMPLE_RATE,
                     params.n_threads, params.n_processors,
                     params.language.c_str(),
                     params.translate ? "translate" : "transcribe",
@@ -858,7 +866,10 @@ int main(int argc, char ** argv) {
                 wparams.abort_callback_user_data = &is_aborted;
             }
 
-            if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
+            const int ret = pcm16 ? whisper_full_pcm16(ctx, wparams, pcm16, n_pcm16) :
+                                    whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors);
+
+            if (ret != 0) {
                 fprintf(stderr, "%s: failed to process audio\n", argv[0]);
                 const std::string error_resp = "{\"error\":\"failed to process audio\"}";
                 res.set_content(error_resp, "application/json");
@@ -921,7 +932,7 @@ int main(int argc, char ** argv) {
             json jres = json{
                 {"task", params.translate ? "translate" : "transcribe"},
                 {"language", whisper_lang_str_full(whisper_full_lang_id(ctx))},
-                {"duration", float(pcmf32.size())/WHISPER_SAMPLE_RATE},
+                {"duration", float(n_samples)/WHISPER_SAMPLE_RATE},
                 {"text", results},
                 {"segments", json::array()}
             };
@@ -27,6 +27,7 @@ public:
     bool save_sync = false;
     bool use_gpu = false;
     bool flash_attn = false;
+    bool stream_encoder = false;
 
     std::string model = "models/ggml-base.en.bin";
     // std::string model = "models/ggml-medium.bin";
@@ -59,6 +60,10 @@ public:
                  [this](const std::string&) { flash_attn = true; },
                  [this]() { return flash_attn ? "true" : "false"; });
 
+        addParam("--stream-encoder", "", "Encode only the new audio on each step (experimental)",
+                 [this](const std::string&) { stream_encoder = true; },
+                 [this]() { return stream_encoder ? "true" : "false"; });
+
         addParam("-m", "--model", "Path to the model file",
                  [this](const std::string& val) { model = val; },
                  [this]() { return model; });
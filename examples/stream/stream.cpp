@@ -129,13 +129,38 @@ int main(int argc, char ** argv) {
     temp_file.open("temp.txt", std::ios::trunc);
     // first remove the file if it exists
 
+    // number of samples of the audio buffer that are already in the spectrogram
+    // only the new samples are converted by whisper_pcm_to_mel_append(), instead of the whole buffer on every step
+    size_t n_appended = 0;
+
     while (audio_manager.pollEvents()) {
         std::vector<float> audio_context;
 
         audio_manager.wait(audio_context);
 
         if (!audio_context.empty()) {
-            if (whisper_full(ctx, wparams, audio_context.data(), audio_context.size()) != 0) {
+            if (audio_context.size() < n_appended) {
+                whisper_pcm_to_mel_append_reset(ctx, 0);
+                n_appended = 0;
+            }
+
+            if (whisper_pcm_to_mel_append(ctx, audio_context.data() + n_appended, audio_context.size() - n_appended, wparams.n_threads) < 0) {
+                std::cerr << "Failed to compute the spectrogram\n";
+                continue;
+            }
+
+            n_appended = audio_context.size();
+
+            if (params.stream_encoder) {
+                // encode the new blocks only and let whisper_full() reuse the result
+                const int n_ctx = whisper_encode_stream(ctx, wparams.n_threads);
+                if (n_ctx <= 0) {
+                    continue;
+                }
+                wparams.audio_ctx = n_ctx;
+            }
+
+            if (whisper_full(ctx, wparams, nullptr, 0) != 0) {
                 std::cerr << "Failed to recognize audio\n";
                 continue;
             }
@@ -164,6 +189,8 @@ int main(int argc, char ** argv) {
 
                 temp_file << translated_text << "\n\n" << std::flush;
                 audio_manager.resetBuffer();
+                whisper_pcm_to_mel_append_reset(ctx, 0);
+                n_appended = 0;
                 time_start = time_now;
             }   
         }
@@ -478,6 +478,7 @@ extern "C" {
         GGML_OP_ROPE_BACK,
         GGML_OP_CLAMP,
         GGML_OP_CONV_TRANSPOSE_1D,
+        GGML_OP_CONV_1D_DIRECT,
         GGML_OP_IM2COL,
         GGML_OP_IM2COL_BACK,
         GGML_OP_CONV_TRANSPOSE_2D,
@@ -1589,6 +1590,20 @@ extern "C" {
             int                   s,  // stride
             int                   d); // dilation
 
+    // conv_1d without the im2col intermediate, with an optional bias and GELU applied to the output
+    // a: [OC, IC, K], b: [N, IC, IL], c: [OC] or NULL
+    // result: [N, OC, OL]
+    // only the CPU backend implements it
+    GGML_API struct ggml_tensor * ggml_conv_1d_direct(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,    // convolution kernel
+            struct ggml_tensor  * b,    // data
+            struct ggml_tensor  * c,    // bias
+            int                   s0,   // stride
+            int                   p0,   // padding
+            int                   d0,   // dilation
+            bool                  gelu);
+
     // depthwise
     // TODO: this is very likely wrong for some cases! - needs more testing
     GGML_API struct ggml_tensor * ggml_conv_1d_dw(
@@ -9080,10 +9080,6 @@ static void ggml_compute_forward_clamp_f32(
 
     const struct ggml_tensor * src0 = dst->src[0];
 
-    if (params->ith != 0) {
-        return;
-    }
-
     float min;
     float max;
     memcpy(&min, (float *) dst->op_params + 0, sizeof(float));
@@ -9878,6 +9874,212 @@ static void ggml_compute_forward_conv_transpose_1d(
     }
 }
 
+// ggml_compute_forward_conv_1d_direct
+// src0: kernel [OC, IC, K]
+// src1: data   [N, IC, IL]
+// src2: bias   [OC] (optional)
+// dst:  result [N, OC, OL]
+//
+// the output is computed in tiles of GGML_CONV_1D_DIRECT_TILE positions x GGML_CONV_1D_DIRECT_RC channels
+// the input of a tile is first copied to the thread's work buffer, split by phase (position % s0) and
+// zero-padded, so that the taps of the kernel can be applied with contiguous vector loads for any stride
+
+#define GGML_CONV_1D_DIRECT_RC 4 // output channels per block
+#define GGML_CONV_1D_DIRECT_RO 4 // vectors of output positions per tile
+
+#if defined(GGML_SIMD)
+#define GGML_CONV_1D_DIRECT_TILE (GGML_CONV_1D_DIRECT_RO*GGML_F32_EPR)
+#else
+#define GGML_CONV_1D_DIRECT_TILE GGML_CONV_1D_DIRECT_RO
+#endif
+
+static size_t ggml_conv_1d_direct_wsize(const struct ggml_tensor * dst) {
+    const int32_t s0 = ((const int32_t *)(dst->op_params))[0];
+    const int32_t d0 = ((const int32_t *)(dst->op_params))[2];
+
+    const int64_t K  = dst->src[0]->ne[0];
+    const int64_t IC = dst->src[0]->ne[1];
+
+    const int64_t L = GGML_CONV_1D_DIRECT_TILE + (K - 1)*d0/s0;
+
+    // input tile + kernel block + output tile
+    return IC*s0*L + GGML_CONV_1D_DIRECT_RC*IC*K + GGML_CONV_1D_DIRECT_RC*GGML_CONV_1D_DIRECT_TILE;
+}
+
+static void ggml_compute_forward_conv_1d_direct(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+    const struct ggml_tensor * src2 = dst->src[2];
+
+    GGML_ASSERT(src0->type == GGML_TYPE_F16 || src0->type == GGML_TYPE_F32);
+    GGML_ASSERT(src1->type == GGML_TYPE_F32);
+    GGML_ASSERT( dst->type == GGML_TYPE_F32);
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    GGML_ASSERT(nb00 == ggml_type_size(src0->type));
+    GGML_ASSERT(nb10 == sizeof(float));
+    GGML_ASSERT(nb0  == sizeof(float));
+
+    const int32_t s0   = ((const int32_t *)(dst->op_params))[0];
+    const int32_t p0   = ((const int32_t *)(dst->op_params))[1];
+    const int32_t d0   = ((const int32_t *)(dst->op_params))[2];
+    const bool    gelu = ((const int32_t *)(dst->op_params))[3] != 0;
+
+    GGML_ASSERT(s0 > 0 && d0 > 0);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t K  = ne00;
+    const int64_t IC = ne01;
+    const int64_t OC = ne02;
+    const int64_t IL = ne10;
+    const int64_t OL = ne0;
+    const int64_t N  = ne2;
+
+    const int64_t RC = GGML_CONV_1D_DIRECT_RC;
+    const int64_t TO = GGML_CONV_1D_DIRECT_TILE;
+
+    // length of one phase of the input tile
+    const int64_t L = TO + (K - 1)*d0/s0;
+
+    float * const xt = (float *) params->wdata + (ggml_conv_1d_direct_wsize(dst) + CACHE_LINE_SIZE_F32)*ith;
+    float * const wt = xt + IC*s0*L;
+    float * const yt = wt + RC*IC*K;
+
+    const float * bias = src2 ? (const float *) src2->data : NULL;
+
+    // work items are (tile, group of channel blocks) - split the channels as well when there are few tiles
+    const int64_t n_tiles  = N*((OL + TO - 1)/TO);
+    const int64_t n_blocks = (OC + RC - 1)/RC;
+    const int64_t n_groups = MIN(n_blocks, MAX(1, (4*nth + n_tiles - 1)/n_tiles));
+    const int64_t n_gblk   = (n_blocks + n_groups - 1)/n_groups;
+
+    const int64_t nr = n_tiles*n_groups;
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    int64_t it_prev = -1;
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t it = ir/n_groups;
+        const int64_t ig = ir%n_groups;
+
+        const int64_t i2  = it/((OL + TO - 1)/TO);
+        const int64_t ol0 = (it%((OL + TO - 1)/TO))*TO;
+
+        if (it != it_prev) {
+            // xt[ic][phase][j] = x[i2][ic][(ol0 + j)*s0 + phase - p0]
+            for (int64_t ic = 0; ic < IC; ++ic) {
+                const float * x = (const float *)((const char *) src1->data + i2*nb12 + ic*nb11);
+                for (int64_t ph = 0; ph < s0; ++ph) {
+                    float * xp = xt + (ic*s0 + ph)*L;
+                    for (int64_t j = 0; j < L; ++j) {
+                        const int64_t il = (ol0 + j)*s0 + ph - p0;
+                        xp[j] = il >= 0 && il < IL ? x[il] : 0.0f;
+                    }
+                }
+            }
+            it_prev = it;
+        }
+
+        const int64_t ib0 = ig*n_gblk;
+        const int64_t ib1 = MIN(ib0 + n_gblk, n_blocks);
+
+        for (int64_t ib = ib0; ib < ib1; ++ib) {
+            const int64_t oc0 = ib*RC;
+            const int64_t nc  = MIN(RC, OC - oc0);
+
+            // wt[k][ic][c] = w[oc0 + c][ic][k]
+            for (int64_t c = 0; c < RC; ++c) {
+                for (int64_t ic = 0; ic < IC; ++ic) {
+                    const char * w = (const char *) src0->data + (oc0 + c)*nb02 + ic*nb01;
+                    for (int64_t k = 0; k < K; ++k) {
+                        float v = 0.0f;
+                        if (c < nc) {
+                            v = src0->type == GGML_TYPE_F16 ? GGML_FP16_TO_FP32(((const ggml_fp16_t *) w)[k]) : ((const float *) w)[k];
+                        }
+                        wt[(k*IC + ic)*RC + c] = v;
+                    }
+                }
+            }
+
+#if defined(GGML_SIMD)
+            GGML_F32_VEC acc[GGML_CONV_1D_DIRECT_RC][GGML_CONV_1D_DIRECT_RO];
+
+            for (int c = 0; c < GGML_CONV_1D_DIRECT_RC; ++c) {
+                for (int r = 0; r < GGML_CONV_1D_DIRECT_RO; ++r) {
+                    acc[c][r] = GGML_F32_VEC_ZERO;
+                }
+            }
+
+            for (int64_t k = 0; k < K; ++k) {
+                const float * xk = xt + ((k*d0)%s0)*L + (k*d0)/s0;
+                const float * wk = wt + k*IC*RC;
+
+                for (int64_t ic = 0; ic < IC; ++ic) {
+                    GGML_F32_VEC ax[GGML_CONV_1D_DIRECT_RO];
+
+                    for (int r = 0; r < GGML_CONV_1D_DIRECT_RO; ++r) {
+                        ax[r] = GGML_F32_VEC_LOAD(xk + ic*s0*L + r*GGML_F32_EPR);
+                    }
+
+                    for (int c = 0; c < GGML_CONV_1D_DIRECT_RC; ++c) {
+                        const GGML_F32_VEC aw = GGML_F32_VEC_SET1(wk[ic*RC + c]);
+                        for (int r = 0; r < GGML_CONV_1D_DIRECT_RO; ++r) {
+                            acc[c][r] = GGML_F32_VEC_FMA(acc[c][r], ax[r], aw);
+                        }
+                    }
+                }
+            }
+
+            for (int c = 0; c < GGML_CONV_1D_DIRECT_RC; ++c) {
+                for (int r = 0; r < GGML_CONV_1D_DIRECT_RO; ++r) {
+                    GGML_F32_VEC_STORE(yt + c*TO + r*GGML_F32_EPR, acc[c][r]);
+                }
+            }
+#else
+            memset(yt, 0, RC*TO*sizeof(float));
+
+            for (int64_t k = 0; k < K; ++k) {
+                const float * xk = xt + ((k*d0)%s0)*L + (k*d0)/s0;
+                const float * wk = wt + k*IC*RC;
+
+                for (int64_t ic = 0; ic < IC; ++ic) {
+                    for (int64_t c = 0; c < RC; ++c) {
+                        const float w = wk[ic*RC + c];
+                        for (int64_t j = 0; j < TO; ++j) {
+                            yt[c*TO + j] += w*xk[ic*s0*L + j];
+                        }
+                    }
+                }
+            }
+#endif
+
+            const int64_t no = MIN(TO, OL - ol0);
+
+            for (int64_t c = 0; c < nc; ++c) {
+                float * y = (float *)((char *) dst->data + i2*nb2 + (oc0 + c)*nb1) + ol0;
+
+                const float b = bias ? bias[oc0 + c] : 0.0f;
+                for (int64_t j = 0; j < no; ++j) {
+                    y[j] = yt[c*TO + j] + b;
+                }
+
+                if (gelu) {
+                    ggml_vec_gelu_f32(no, y, y);
+                }
+            }
+        }
+    }
+}
+
 // ggml_compute_forward_im2col_f32
 // src0: kernel [OC, IC, KH, KW]
 // src1: image [N, IC, IH, IW]
@@ -11027,6 +11229,276 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     }
 }
 
+// tiled variant for many queries per head (e.g. encoder self-attention)
+//
+// the queries are processed in blocks of GGML_FA_TILE_Q rows against tiles of GGML_FA_TILE_KV K/V rows:
+// each K/V tile is converted to F32 once per query block (K transposed), so that both KQ and the V update
+// are row x tile products with vector accumulators, and the online softmax is applied per tile with the
+// vectorized ggml_vec_soft_max_f32. a thread works on consecutive query blocks of the same head, so the
+// K/V of the head stay in the cache
+//
+// the V accumulation is in F32, unlike the F16 accumulators of the generic kernel, so it is used only when
+// GGML_PREC_F32 is requested with ggml_flash_attn_ext_set_prec() and there are GGML_FA_TILED_MIN_Q or more
+// queries per head
+
+#define GGML_FA_TILE_Q      64
+#define GGML_FA_TILE_KV     64
+#define GGML_FA_TILED_MIN_Q 32
+
+static bool ggml_flash_attn_ext_use_tiled(const struct ggml_tensor * dst) {
+    const struct ggml_tensor * q = dst->src[0];
+    const struct ggml_tensor * k = dst->src[1];
+    const struct ggml_tensor * v = dst->src[2];
+
+    return ggml_get_op_params_i32(dst, 3) == GGML_PREC_F32 &&
+        q->type == GGML_TYPE_F32 && q->ne[1] >= GGML_FA_TILED_MIN_Q &&
+        ggml_get_type_traits(k->type)->to_float && ggml_get_type_traits(v->type)->to_float;
+}
+
+static size_t ggml_flash_attn_ext_tiled_wsize(const struct ggml_tensor * dst) {
+    const int64_t D = dst->src[0]->ne[0];
+
+    // Q + K^T + V + KQ + VKQ + M + S + K row
+    return GGML_FA_TILE_Q*D + 2*D*GGML_FA_TILE_KV + GGML_FA_TILE_Q*GGML_FA_TILE_KV + GGML_FA_TILE_Q*D + 2*GGML_FA_TILE_Q + D;
+}
+
+// y[0:n] += sum_i x[i]*A[i*lda + 0:n], i < m
+inline static void ggml_vec_mad_tile_f32(const int n, float * GGML_RESTRICT y, const float * GGML_RESTRICT x, const float * GGML_RESTRICT A, const int lda, const int m) {
+    int j = 0;
+
+#if defined(GGML_SIMD)
+    for (; j + GGML_F32_STEP <= n; j += GGML_F32_STEP) {
+        GGML_F32_VEC ay[GGML_F32_ARR];
+
+        for (int r = 0; r < GGML_F32_ARR; ++r) {
+            ay[r] = GGML_F32_VEC_LOAD(y + j + r*GGML_F32_EPR);
+        }
+
+        for (int i = 0; i < m; ++i) {
+            const GGML_F32_VEC ax = GGML_F32_VEC_SET1(x[i]);
+            for (int r = 0; r < GGML_F32_ARR; ++r) {
+                ay[r] = GGML_F32_VEC_FMA(ay[r], GGML_F32_VEC_LOAD(A + i*lda + j + r*GGML_F32_EPR), ax);
+            }
+        }
+
+        for (int r = 0; r < GGML_F32_ARR; ++r) {
+            GGML_F32_VEC_STORE(y + j + r*GGML_F32_EPR, ay[r]);
+        }
+    }
+
+    for (; j + GGML_F32_EPR <= n; j += GGML_F32_EPR) {
+        GGML_F32_VEC ay = GGML_F32_VEC_LOAD(y + j);
+
+        for (int i = 0; i < m; ++i) {
+            ay = GGML_F32_VEC_FMA(ay, GGML_F32_VEC_LOAD(A + i*lda + j), GGML_F32_VEC_SET1(x[i]));
+        }
+
+        GGML_F32_VEC_STORE(y + j, ay);
+    }
+#endif
+
+    for (; j < n; ++j) {
+        float sum = y[j];
+        for (int i = 0; i < m; ++i) {
+            sum += x[i]*A[i*lda + j];
+        }
+        y[j] = sum;
+    }
+}
+
+static void ggml_compute_forward_flash_attn_ext_tiled(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * q,
+        const struct ggml_tensor * k,
+        const struct ggml_tensor * v,
+        const struct ggml_tensor * mask,
+        struct ggml_tensor * dst) {
+
+    GGML_TENSOR_LOCALS(int64_t, neq, q,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nek, k,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbk, k,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nev, v,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbv, v,   nb)
+    GGML_TENSOR_LOCALS(int64_t, ne,  dst, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb)
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t D = neq0;
+    const int64_t N = neq1;
+
+    const int64_t TQ = GGML_FA_TILE_Q;
+    const int64_t TK = GGML_FA_TILE_KV;
+
+    GGML_ASSERT(ne0 == D);
+    GGML_ASSERT(ne2 == N);
+
+    GGML_ASSERT(nbq0 == sizeof(float));
+    GGML_ASSERT(nbk0 == ggml_type_size(k->type));
+    GGML_ASSERT(nbv0 == ggml_type_size(v->type));
+
+    GGML_ASSERT(nek0 == D);
+    GGML_ASSERT(nev0 == D);
+    GGML_ASSERT(nek1 == nev1);
+
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    const int64_t rk2 = neq2/nek2;
+    const int64_t rk3 = neq3/nek3;
+
+    const int64_t rv2 = neq2/nev2;
+    const int64_t rv3 = neq3/nev3;
+
+    float scale         = 1.0f;
+    float max_bias      = 0.0f;
+    float logit_softcap = 0.0f;
+
+    memcpy(&scale,         (float *) dst->op_params + 0, sizeof(float));
+    memcpy(&max_bias,      (float *) dst->op_params + 1, sizeof(float));
+    memcpy(&logit_softcap, (float *) dst->op_params + 2, sizeof(float));
+
+    if (logit_softcap != 0) {
+        scale /= logit_softcap;
+    }
+
+    const uint32_t n_head      = neq2;
+    const uint32_t n_head_log2 = 1u << (uint32_t) floor(log2(n_head));
+
+    const float m0 = powf(2.0f, -(max_bias       ) / n_head_log2);
+    const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_head_log2);
+
+    ggml_to_float_t const k_to_float = ggml_get_type_traits(k->type)->to_float;
+    ggml_to_float_t const v_to_float = ggml_get_type_traits(v->type)->to_float;
+
+    float * const Qt  = (float *) params->wdata + (ggml_flash_attn_ext_tiled_wsize(dst) + CACHE_LINE_SIZE_F32)*ith;
+    float * const KTt = Qt  + TQ*D;  // [D][TK]
+    float * const Vt  = KTt + D*TK;  // [TK][D]
+    float * const St  = Vt  + TK*D;  // [TQ][TK]
+    float * const Ot  = St  + TQ*TK; // [TQ][D]
+    float * const Mt  = Ot  + TQ*D;
+    float * const Lt  = Mt  + TQ;
+    float * const Kr  = Lt  + TQ;
+
+    // work items are (batch, head, query block), consecutive blocks of the same head go to the same thread
+    const int64_t n_qb = (N + TQ - 1)/TQ;
+
+    const int64_t nr = n_qb*neq2*neq3;
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t iq3 = ir/(n_qb*neq2);
+        const int64_t iq2 = (ir - iq3*n_qb*neq2)/n_qb;
+        const int64_t iq1 = (ir - iq3*n_qb*neq2 - iq2*n_qb)*TQ;
+
+        const int64_t nq = MIN(TQ, N - iq1);
+
+        const uint32_t h = iq2; // head index
+        const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+
+        const int64_t ik2 = iq2/rk2;
+        const int64_t ik3 = iq3/rk3;
+
+        const int64_t iv2 = iq2/rv2;
+        const int64_t iv3 = iq3/rv3;
+
+        for (int64_t r = 0; r < nq; ++r) {
+            const float * pq = (const float *) ((const char *) q->data + ((iq1 + r)*nbq1 + iq2*nbq2 + iq3*nbq3));
+            memcpy(Qt + r*D, pq, D*sizeof(float));
+            ggml_vec_scale_f32(D, Qt + r*D, scale);
+
+            Mt[r] = -INFINITY;
+            Lt[r] = 0.0f;
+        }
+
+        memset(Ot, 0, TQ*D*sizeof(float));
+
+        for (int64_t ic0 = 0; ic0 < nek1; ic0 += TK) {
+            const int64_t nk = MIN(TK, nek1 - ic0);
+
+            // KTt[d][j] = K[ic0 + j][d], V[ic0 + j] -> Vt[j]
+            for (int64_t j = 0; j < nk; ++j) {
+                k_to_float((const char *) k->data + ((ic0 + j)*nbk1 + ik2*nbk2 + ik3*nbk3), Kr, D);
+                for (int64_t d = 0; d < D; ++d) {
+                    KTt[d*TK + j] = Kr[d];
+                }
+
+                v_to_float((const char *) v->data + ((ic0 + j)*nbv1 + iv2*nbv2 + iv3*nbv3), Vt + j*D, D);
+            }
+
+            for (int64_t j = nk; j < TK; ++j) {
+                for (int64_t d = 0; d < D; ++d) {
+                    KTt[d*TK + j] = 0.0f;
+                }
+            }
+
+            for (int64_t r = 0; r < nq; ++r) {
+                float * s = St + r*TK;
+
+                // KQ for a row of the block
+                memset(s, 0, TK*sizeof(float));
+                ggml_vec_mad_tile_f32(TK, s, Qt + r*D, KTt, TK, D);
+
+                if (logit_softcap != 0.0f) {
+                    for (int64_t j = 0; j < nk; ++j) {
+                        s[j] = logit_softcap*tanhf(s[j]);
+                    }
+                }
+
+                if (mask) {
+                    const ggml_fp16_t * mp = (const ggml_fp16_t *)((const char *) mask->data + (iq1 + r)*mask->nb[1]) + ic0;
+                    for (int64_t j = 0; j < nk; ++j) {
+                        s[j] += slope*GGML_FP16_TO_FP32(mp[j]);
+                    }
+                }
+
+                float smax = -INFINITY;
+                ggml_vec_max_f32(nk, &smax, s);
+
+                if (smax == -INFINITY) {
+                    continue;
+                }
+
+                // online softmax - rescale the accumulators when the maximum grows
+                const float Mold = Mt[r];
+                const float Mnew = MAX(Mold, smax);
+
+                if (Mnew > Mold) {
+                    const float ms = expf(Mold - Mnew);
+
+                    ggml_vec_scale_f32(D, Ot + r*D, ms);
+                    Lt[r] *= ms;
+                    Mt[r]  = Mnew;
+                }
+
+                Lt[r] += (float) ggml_vec_soft_max_f32(nk, s, s, Mnew);
+
+                // VKQ += softmax(KQ)*V
+                ggml_vec_mad_tile_f32(D, Ot + r*D, s, Vt, D, nk);
+            }
+        }
+
+        for (int64_t r = 0; r < nq; ++r) {
+            const int64_t i1 = iq1 + r;
+            const int64_t i2 = iq2;
+            const int64_t i3 = iq3;
+
+            // V /= S
+            ggml_vec_scale_f32(D, Ot + r*D, Lt[r] > 0.0f ? 1.0f/Lt[r] : 0.0f);
+
+            // permute(0, 2, 1, 3)
+            memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, Ot + r*D, nb1);
+        }
+    }
+}
+
 static void ggml_compute_forward_flash_attn_ext(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * q,
@@ -11039,7 +11511,11 @@ static void ggml_compute_forward_flash_attn_ext(
         case GGML_PREC_F32:
             {
                 // uses F32 accumulators
-                ggml_compute_forward_flash_attn_ext_f16(params, q, k, v, mask, dst);
+                if (ggml_flash_attn_ext_use_tiled(dst)) {
+                    ggml_compute_forward_flash_attn_ext_tiled(params, q, k, v, mask, dst);
+                } else {
+                    ggml_compute_forward_flash_attn_ext_f16(params, q, k, v, mask, dst);
+                }
             } break;
         default:
             {
@@ -12917,6 +13393,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_conv_transpose_1d(params, tensor);
             } break;
+        case GGML_OP_CONV_1D_DIRECT:
+            {
+                ggml_compute_forward_conv_1d_direct(params, tensor);
+            } break;
         case GGML_OP_IM2COL:
             {
                 ggml_compute_forward_im2col(params, tensor);
@@ -13287,6 +13767,7 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_IM2COL:
         case GGML_OP_IM2COL_BACK:
         case GGML_OP_CONV_TRANSPOSE_1D:
+        case GGML_OP_CONV_1D_DIRECT:
         case GGML_OP_CONV_TRANSPOSE_2D:
             {
                 n_tasks = n_threads;
@@ -13744,6 +14225,10 @@ struct ggml_cplan ggml_graph_plan(
                     {
                         cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
                     } break;
+                case GGML_OP_CONV_1D_DIRECT:
+                    {
+                        cur = sizeof(float)*(ggml_conv_1d_direct_wsize(node) + CACHE_LINE_SIZE_F32)*n_tasks;
+                    } break;
                 case GGML_OP_CONV_TRANSPOSE_1D:
                     {
                         GGML_ASSERT(node->src[0]->ne[3] == 1);
@@ -13787,7 +14272,11 @@ struct ggml_cplan ggml_graph_plan(
                     {
                         const int64_t ne00 = node->src[0]->ne[0]; // D
 
-                        cur = 3*sizeof(float)*ne00*n_tasks; // 3x head size/thread
+                        if (ggml_flash_attn_ext_use_tiled(node)) {
+                            cur = sizeof(float)*(ggml_flash_attn_ext_tiled_wsize(node) + CACHE_LINE_SIZE_F32)*n_tasks;
+                        } else {
+                            cur = 3*sizeof(float)*ne00*n_tasks; // 3x head size/thread
+                        }
                     } break;
                 case GGML_OP_FLASH_ATTN_BACK:
                     {
@@ -113,6 +113,15 @@ extern "C" {
         const whisper_ahead * heads;
     } whisper_aheads;
 
+    // The weights of the model are split in two parts that can be loaded and evicted independently:
+    //   - WHISPER_MODEL_PART_ENCODER: the weights used by whisper_encode() - the audio encoder and the
+    //                                 cross-attention key/value projections of the text decoder
+    //   - WHISPER_MODEL_PART_DECODER: the weights used by whisper_decode() - the rest of the text decoder
+    enum whisper_model_part {
+        WHISPER_MODEL_PART_ENCODER,
+        WHISPER_MODEL_PART_DECODER,
+    };
+
     struct whisper_context_params {
         bool  use_gpu;
         bool  flash_attn;
@@ -126,6 +135,30 @@ extern "C" {
         struct whisper_aheads dtw_aheads;
 
         size_t dtw_mem_size; // TODO: remove
+
+        // note: new fields go at the end, the bindings (e.g. JNA) map the fields above by offset
+        bool  use_mmap;    // map the model file into memory when loading from a file (CPU weights are not copied)
+        int   n_threads_load; // number of threads used to read the model weights (when loading from a file)
+
+        // directory of an on-disk cache for the CPU weights converted to the layout of the extra buffer types
+        // (e.g. repacked Q4_0), so that the conversion runs only on the first load (NULL = disabled)
+        // the weights are placed in the extra buffer types only when this is set
+        const char * repack_cache_dir;
+
+        // load the weights of each model part on first use instead of in whisper_init (see whisper_model_part_load)
+        // requires a GGUF model or a model mapped with use_mmap - otherwise all weights are loaded upfront
+        bool lazy_load;
+
+        // compute the log mel spectrogram of whisper_pcm_to_mel() with ggml on the backend of the encoder and keep it there,
+        // instead of computing it on the CPU and uploading it for each encoder call (not used with CoreML / OpenVINO)
+        bool mel_graph;
+
+        // [EXPERIMENTAL] cache of the results of whisper_full() and of the encoder output of its windows, keyed by a hash
+        // of the input and of the parameters, so that repeated audio is not processed again (see whisper_full_params.cache_*)
+        // the cache is shared by all states of the context and evicts the least recently used entries first
+        size_t       cache_mem_size;  // bytes kept in memory (0 and no cache_dir = disabled)
+        const char * cache_dir;       // directory of the on-disk tier (NULL = memory only)
+        size_t       cache_disk_size; // bytes kept in cache_dir (0 = unlimited)
     };
 
     typedef struct whisper_token_data {
@@ -253,6 +286,19 @@ extern "C" {
                     const char * device,
                     const char * cache_dir);
 
+    // Load the weights of a part of the model, if they are not loaded yet.
+    // With whisper_context_params.lazy_load, this happens automatically on first use.
+    // Returns 0 on success
+    WHISPER_API int whisper_model_part_load(struct whisper_context * ctx, enum whisper_model_part part);
+
+    // Free the memory used by the weights of a part of the model. They are loaded again when needed.
+    // Requires a GGUF model or a model mapped with use_mmap, so that the weights can be read again from the file.
+    // Must not be called while the context is used by another thread.
+    // Returns 0 on success
+    WHISPER_API int whisper_model_part_evict(struct whisper_context * ctx, enum whisper_model_part part);
+
+    WHISPER_API bool whisper_model_part_is_loaded(struct whisper_context * ctx, enum whisper_model_part part);
+
     // Frees all allocated memory
     WHISPER_API void whisper_free      (struct whisper_context * ctx);
     WHISPER_API void whisper_free_state(struct whisper_state * state);
@@ -275,6 +321,50 @@ extern "C" {
                                int   n_samples,
                                int   n_threads);
 
+    // Same as whisper_pcm_to_mel(), with 16-bit PCM samples
+    // The scaling to [-1, 1] is applied together with the window function, so the audio is not converted to float
+    WHISPER_API int whisper_pcm16_to_mel(
+            struct whisper_context * ctx,
+                     const int16_t * samples,
+                               int   n_samples,
+                               int   n_threads);
+
+    WHISPER_API int whisper_pcm16_to_mel_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                     const int16_t * samples,
+                               int   n_samples,
+                               int   n_threads);
+
+    // Append RAW PCM audio to the log mel spectrogram of a stream, computing only the frames of the new samples.
+    // The samples that are not yet covered by a complete frame are kept in the state until the next call, so the
+    // frames are the same as with whisper_pcm_to_mel() on the whole audio.
+    // Only the last frames of the stream are kept, up to the window set with whisper_pcm_to_mel_append_reset()
+    // (30 seconds by default). The spectrogram of the state is set to the frames of the window, normalized and padded
+    // with silence in the same way as whisper_pcm_to_mel(), so it can be used with whisper_full() with n_samples == 0.
+    // The timestamps of the results are then relative to the start of the window (see whisper_pcm_to_mel_append_offset()).
+    // Returns the number of frames in the window, or a negative value on failure
+    WHISPER_API int whisper_pcm_to_mel_append(
+            struct whisper_context * ctx,
+                       const float * samples,
+                               int   n_samples,
+                               int   n_threads);
+
+    WHISPER_API int whisper_pcm_to_mel_append_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                       const float * samples,
+                               int   n_samples,
+                               int   n_threads);
+
+    // Start a new stream for whisper_pcm_to_mel_append(), keeping at most window_ms of spectrogram (0 - 30 seconds)
+    WHISPER_API void whisper_pcm_to_mel_append_reset           (struct whisper_context * ctx, int window_ms);
+    WHISPER_API void whisper_pcm_to_mel_append_reset_with_state(struct whisper_state   * state, int window_ms);
+
+    // Number of frames (10 ms each) dropped from the start of the stream, i.e. the start of the current window
+    WHISPER_API int64_t whisper_pcm_to_mel_append_offset           (struct whisper_context * ctx);
+    WHISPER_API int64_t whisper_pcm_to_mel_append_offset_from_state(struct whisper_state   * state);
+
     // This can be used to set a custom log mel spectrogram inside the default state of the provided whisper context.
     // Use this instead of whisper_pcm_to_mel() if you want to provide your own log mel spectrogram.
     // n_mel must be 80
@@ -307,6 +397,57 @@ extern "C" {
                                int   offset,
                                int   n_threads);
 
+    // Run the Whisper encoder on n_states windows in a single graph evaluation - larger matrix multiplications make
+    // better use of the CPU than one window at a time.
+    // Window i starts at frame offsets[i] in the spectrogram of states[i] and its result is stored in states[i], so the
+    // windows can come from one audio (one state per window) or from different requests. Each state must have a
+    // spectrogram on the host (no mel_graph, no external encoder) and the same audio context size.
+    // The compute buffers are kept in states[0]. whisper_full_with_state() called with n_samples == 0 reuses the result
+    // for its first window.
+    // Returns 0 on success
+    WHISPER_API int whisper_encode_batch(
+            struct whisper_context * ctx,
+             struct whisper_state ** states,
+                         const int * offsets,
+                               int   n_states,
+                               int   n_threads);
+
+    // [EXPERIMENTAL] Block-causal streaming encoder
+    // Encode the spectrogram of the state in blocks of block_ms, where each block attends to itself and to at most
+    // left_ms of audio before it instead of to the whole window. The keys and values of the past blocks are kept in
+    // the state, so each call only encodes the blocks completed since the previous call and extends the
+    // cross-attention cache with them - the cost of a call does not grow with the window.
+    // The spectrogram is expected to grow with whisper_pcm_to_mel_append(). When its window slides by whole positions
+    // (append multiples of 20 ms), the encoded positions are moved with it and keep the keys and values computed at
+    // their previous place in the window. The stream starts again from the start of the window when the window slides
+    // by an odd number of frames, and when the floor of the spectrogram normalization moves (a louder frame arrives or
+    // the loudest one slides out), since the encoded positions no longer match the spectrogram.
+    // The output is an approximation of the full encoder, which attends to the whole window.
+    // Returns the number of encoded positions (20 ms each) - pass it as whisper_full_params.audio_ctx to
+    // whisper_full_with_state() with n_samples == 0 to decode them - or a negative value on failure
+    WHISPER_API int whisper_encode_stream(
+            struct whisper_context * ctx,
+                               int   n_threads);
+
+    WHISPER_API int whisper_encode_stream_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                               int   n_threads);
+
+    // Start a new stream for whisper_encode_stream() with blocks of block_ms (0 - 1000 ms) and left_ms of left
+    // context (0 - 10000 ms)
+    // Returns 0 on success
+    WHISPER_API int whisper_encode_stream_reset(
+            struct whisper_context * ctx,
+                               int   block_ms,
+                               int   left_ms);
+
+    WHISPER_API int whisper_encode_stream_reset_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                               int   block_ms,
+                               int   left_ms);
+
     // Run the Whisper decoder to obtain the logits and probabilities for the next token.
     // Make sure to call whisper_encode() first.
     // tokens + n_tokens is the provided context for the decoder.
@@ -328,6 +469,30 @@ extern "C" {
                                int   n_past,
                                int   n_threads);
 
+    // Serialize the state after encoding - the cross-attention KV cache, the accumulated prompt (prompt_past) and the
+    // language - into a binary blob. It can be restored with whisper_state_load() into another state, in the same or in
+    // another process, with the same model and context params, and then used with whisper_decode_with_state() without
+    // running the encoder again.
+    // If with_kv_self is true, the self-attention KV cache of the decoder is also included, so that decoding can be
+    // continued where it stopped (see n_past of whisper_decode_with_state()).
+    // Call with dst == NULL to get the required size.
+    // Returns the number of bytes written, or 0 on failure
+    WHISPER_API size_t whisper_state_save(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                           uint8_t * dst,
+                            size_t   dst_size,
+                              bool   with_kv_self);
+
+    // Restore a state serialized with whisper_state_save().
+    // If the blob is invalid or was saved with a different model or context params, the state is not modified.
+    // Returns 0 on success
+    WHISPER_API int whisper_state_load(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                     const uint8_t * src,
+                            size_t   src_size);
+
     // Convert the provided text into tokens.
     // The tokens pointer must be large enough to hold the resulting tokens.
     // Returns the number of tokens on success, no more than n_max_tokens
@@ -446,6 +611,12 @@ extern "C" {
         WHISPER_SAMPLING_BEAM_SEARCH, // similar to OpenAI's BeamSearchDecoder
     };
 
+    // Voice activity detection used by whisper_full() to skip the non-speech parts of the audio
+    enum whisper_vad_type {
+        WHISPER_VAD_NONE,   // process all of the audio
+        WHISPER_VAD_ENERGY, // energy of the speech band of the mel spectrogram, relative to the noise floor
+    };
+
     // Text segment callback
     // Called on every newly generated text segment
     // Use the whisper_full_...() functions to obtain the text segments
@@ -501,7 +672,7 @@ extern "C" {
         // [EXPERIMENTAL] speed-up techniques
         // note: these can significantly reduce the quality of the output
         bool debug_mode;        // enable debug_mode provides extra info (eg. Dump log_mel)
-        int  audio_ctx;         // overwrite the audio context size (0 = use default)
+        int  audio_ctx;         // overwrite the audio context size (0 = use default, < 0 = smallest bucket that covers the audio)
 
         // [EXPERIMENTAL] [TDRZ] tinydiarize
         bool tdrz_enable;       // enable tinydiarize speaker turn detection
@@ -570,6 +741,24 @@ extern "C" {
         size_t                           n_grammar_rules;
         size_t                           i_start_rule;
         float                            grammar_penalty;
+
+        // note: new fields go at the end, the bindings (e.g. JNA) map the fields above by offset
+
+        // [EXPERIMENTAL] speech regions are detected before decoding and the windows without speech are skipped
+        // the timestamps of the results are those of the original audio
+        struct {
+            enum whisper_vad_type type;
+
+            float thold;          // speech is the frames louder than the noise floor by this many dB
+            int   min_speech_ms;  // shorter speech regions are dropped
+            int   min_silence_ms; // shorter gaps between speech regions are not skipped
+            int   pad_ms;         // audio kept before and after each speech region
+        } vad;
+
+        // [EXPERIMENTAL] use the cache of whisper_context_params.cache_mem_size / cache_dir (no effect if it is disabled)
+        bool cache_encoder; // reuse the encoder output of windows with the same spectrogram
+        bool cache_results; // reuse the results of calls with the same audio and parameters (not with a logits filter or
+                            // a whisper_audio_source, and only with no_context)
     };
 
     // NOTE: this function allocates memory, and it is the responsibility of the caller to free the pointer - see whisper_free_context_params & whisper_free_params()
@@ -594,6 +783,45 @@ extern "C" {
                            const float * samples,
                                    int   n_samples);
 
+    // Same as whisper_full(), with 16-bit PCM samples (see whisper_pcm16_to_mel())
+    WHISPER_API int whisper_full_pcm16(
+                struct whisper_context * ctx,
+            struct whisper_full_params   params,
+                         const int16_t * samples,
+                                   int   n_samples);
+
+    WHISPER_API int whisper_full_pcm16_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+                         const int16_t * samples,
+                                   int   n_samples);
+
+    // Pull-based audio input of whisper_full_from_source()
+    // Reads up to n_samples samples of 16 kHz mono float PCM into dst and returns the number of samples read,
+    // 0 at the end of the audio or a negative value on error
+    typedef int (*whisper_audio_source_read_callback)(float * dst, int n_samples, void * user_data);
+
+    struct whisper_audio_source {
+        whisper_audio_source_read_callback read;
+        void * user_data;
+    };
+
+    // Same as whisper_full(), but the audio is read from the source while it is processed, so that the memory
+    // use does not depend on the length of the audio. Only a sliding window of 60 seconds of spectrogram (and of
+    // samples, with token_timestamps) is kept, and the spectrogram is normalized over this window.
+    // Returns -10 if the source fails
+    WHISPER_API int whisper_full_from_source(
+                struct whisper_context * ctx,
+            struct whisper_full_params   params,
+           struct whisper_audio_source   source);
+
+    WHISPER_API int whisper_full_from_source_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+           struct whisper_audio_source   source);
+
     // Split the input audio in chunks and process each chunk separately using whisper_full_with_state()
     // Result is stored in the default state of the context
     // Not thread safe if executed in parallel on the same context.
@@ -660,6 +888,8 @@ extern "C" {
     WHISPER_API const char * whisper_bench_memcpy_str      (int n_threads);
     WHISPER_API int          whisper_bench_ggml_mul_mat    (int n_threads);
     WHISPER_API const char * whisper_bench_ggml_mul_mat_str(int n_threads);
+    WHISPER_API int          whisper_bench_ggml_flash_attn    (int n_threads);
+    WHISPER_API const char * whisper_bench_ggml_flash_attn_str(int n_threads);
 
     // Control logging output; default behavior is to print to stderr
 
@@ -5,6 +5,7 @@
 #include "ggml.h"
 #include "ggml-alloc.h"
 #include "ggml-backend.h"
+#include "gguf.h"
 
 #ifdef WHISPER_USE_COREML
 #include "coreml/whisper-encoder.h"
@@ -17,21 +18,56 @@
 #include <atomic>
 #include <algorithm>
 #include <cassert>
+#include <cfloat>
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include <cstdio>
 #include <cstdarg>
 #include <cstring>
+#include <condition_variable>
 #include <fstream>
+#include <list>
 #include <map>
 #include <set>
 #include <string>
 #include <thread>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 #include <regex>
 #include <random>
 #include <functional>
 #include <codecvt>
+#include <memory>
+#include <mutex>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __has_include
+    #if __has_include(<unistd.h>)
+        #include <unistd.h>
+        #if defined(_POSIX_MAPPED_FILES)
+            #include <sys/mman.h>
+            #include <fcntl.h>
+        #endif
+    #endif
+#endif
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <dirent.h>
+#endif
+
+// version of the library, see src/CMakeLists.txt
+#ifndef WHISPER_VERSION
+#define WHISPER_VERSION "unknown"
+#endif
 
 // dummy
 
@@ -142,6 +178,14 @@ static void whisper_log_callback_default(ggml_log_level level, const char * text
 
 #define WHISPER_MAX_DECODERS 8
 #define WHISPER_MAX_NODES 4096
+#define WHISPER_MAX_ENCODE_BATCH 16
+#define WHISPER_PROMPT_CACHE_SIZE 16
+
+// audio context sizes used by the automatic mode (whisper_full_params.audio_ctx < 0), smallest first
+// a 30 s window is 1500 encoder frames, so these cover ~5 s, ~10 s and ~20 s of audio
+static const int g_audio_ctx_buckets[] = { 256, 512, 1024 };
+
+#define WHISPER_N_AUDIO_CTX_BUCKETS (int) (sizeof(g_audio_ctx_buckets)/sizeof(g_audio_ctx_buckets[0]))
 
 //
 // ggml helpers
@@ -166,10 +210,12 @@ static bool ggml_graph_compute_helper(
     return ggml_graph_compute(graph, &plan);
 }
 
+// keep_alloc - leave the graph allocated in the scheduler, so that it can be computed again (see whisper_sched.graph)
 static bool ggml_graph_compute_helper(
       ggml_backend_sched_t   sched,
         struct ggml_cgraph * graph,
-                       int   n_threads) {
+                       int   n_threads,
+                      bool   keep_alloc = false) {
 
     for (int i = 0; i < ggml_backend_sched_get_n_backends(sched); ++i) {
         ggml_backend_t backend = ggml_backend_sched_get_backend(sched, i);
@@ -183,7 +229,9 @@ static bool ggml_graph_compute_helper(
     }
 
     bool t = ggml_backend_sched_graph_compute(sched, graph) == GGML_STATUS_SUCCESS;
-    ggml_backend_sched_reset(sched);
+    if (!t || !keep_alloc) {
+        ggml_backend_sched_reset(sched);
+    }
     return t;
 }
 
@@ -392,6 +440,36 @@ struct whisper_filters {
     int32_t n_fft;
 
     std::vector<float> data;
+
+    // sparse representation of the filters, built at load time (see init_bands())
+    // filter j is non-zero only on the bins [band_start[j], band_start[j] + band_len[j]) and its weights on these bins
+    // are stored at band_data[band_offs[j]]
+    std::vector<int32_t> band_start;
+    std::vector<int32_t> band_len;
+    std::vector<int32_t> band_offs;
+    std::vector<float>   band_data;
+
+    void init_bands() {
+        band_start.resize(n_mel);
+        band_len  .resize(n_mel);
+        band_offs .resize(n_mel);
+        band_data .clear();
+
+        for (int j = 0; j < n_mel; ++j) {
+            const float * w = data.data() + j*n_fft;
+
+            int k0 = 0;
+            int k1 = n_fft;
+            while (k0 < k1 && w[k0]     == 0.0f) k0++;
+            while (k1 > k0 && w[k1 - 1] == 0.0f) k1--;
+
+            band_start[j] = k0;
+            band_len  [j] = k1 - k0;
+            band_offs [j] = band_data.size();
+
+            band_data.insert(band_data.end(), w + k0, w + k1);
+        }
+    }
 };
 
 struct whisper_vocab {
@@ -400,8 +478,14 @@ struct whisper_vocab {
 
     int n_vocab = 51864;
 
-    std::map<token, id> token_to_id;
-    std::map<id, token> id_to_token;
+    // the text of all tokens is stored in one array: token i is data[offs[i], offs[i + 1] - 1), followed by a '\0'
+    // so that it can also be used as a C string (the text itself can contain '\0' bytes)
+    std::vector<char>     data;
+    std::vector<uint32_t> offs = { 0 };
+
+    // open addressing hash table text -> id, with linear probing (-1 = empty slot)
+    // the size is a power of 2 and the table is kept at most half full, so the probe sequences are short
+    std::vector<id> index;
 
     // reference: https://github.com/openai/whisper/blob/248b6cb124225dd263bb9bd32d060b6517e067f8/whisper/tokenizer.py#L334-L349
     id token_eot        = 50256;
@@ -416,6 +500,116 @@ struct whisper_vocab {
     id token_not        = 50362; // no timestamps
     id token_beg        = 50363; // begin timestamps
 
+    id token_space      = -1;    // " " - suppressed at the beginning of the text
+
+    int size() const {
+        return (int) offs.size() - 1;
+    }
+
+    bool is_valid(id i) const {
+        return i >= 0 && i < size();
+    }
+
+    const char * token_c_str(id i) const {
+        return data.data() + offs[i];
+    }
+
+    size_t token_len(id i) const {
+        return offs[i + 1] - offs[i] - 1;
+    }
+
+    token token_str(id i) const {
+        return token(token_c_str(i), token_len(i));
+    }
+
+    // returns -1 if there is no such token
+    id find(const char * text, size_t len) const {
+        if (index.empty()) {
+            return -1;
+        }
+
+        const size_t mask = index.size() - 1;
+
+        for (size_t k = hash(text, len) & mask; index[k] >= 0; k = (k + 1) & mask) {
+            const id i = index[k];
+            if (token_len(i) == len && memcmp(token_c_str(i), text, len) == 0) {
+                return i;
+            }
+        }
+
+        return -1;
+    }
+
+    id find(const token & text) const {
+        return find(text.data(), text.size());
+    }
+
+    // append a token with the next id - if the text is already in the vocab, the lookup returns the new id
+    void add(const char * text, size_t len) {
+        const id i = size();
+
+        data.insert(data.end(), text, text + len);
+        data.push_back('\0');
+        offs.push_back(data.size());
+
+        if (2*size() > (int) index.size()) {
+            index.assign(std::max<size_t>(1024, 2*index.size()), -1);
+
+            // re-insert in id order, so that repeated texts keep resolving to the last id
+            for (id j = 0; j < i; ++j) {
+                insert(j);
+            }
+        }
+
+        insert(i);
+    }
+
+    void add(const token & text) {
+        add(text.data(), text.size());
+    }
+
+    void reserve(size_t n_tokens, size_t n_bytes) {
+        data.reserve(n_bytes + n_tokens);
+        offs.reserve(n_tokens + 1);
+
+        size_t n_index = 1024;
+        while (n_index < 2*n_tokens) {
+            n_index *= 2;
+        }
+
+        if (n_index > index.size()) {
+            index.assign(n_index, -1);
+
+            for (id i = 0; i < size(); ++i) {
+                insert(i);
+            }
+        }
+    }
+
+    void insert(id i) {
+        const size_t mask = index.size() - 1;
+
+        size_t k = hash(token_c_str(i), token_len(i)) & mask;
+        for (; index[k] >= 0; k = (k + 1) & mask) {
+            const id j = index[k];
+            if (token_len(j) == token_len(i) && memcmp(token_c_str(j), token_c_str(i), token_len(i)) == 0) {
+                break;
+            }
+        }
+
+        index[k] = i;
+    }
+
+    // FNV-1a
+    static uint32_t hash(const char * text, size_t len) {
+        uint32_t h = 2166136261u;
+        for (size_t k = 0; k < len; ++k) {
+            h ^= (uint8_t) text[k];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
     bool is_multilingual() const {
         return n_vocab >= 51865;
     }
@@ -503,10 +697,37 @@ struct whisper_pair {
 };
 
 // ggml_backend_sched wrapper for whisper usage
+// everything a cached graph depends on besides the data of its inputs
+struct whisper_graph_key {
+    int32_t n_tokens        = 0;
+    int32_t n_kv            = 0;
+    int32_t n_kv_size       = 0;
+    int32_t n_audio_ctx     = 0;
+    int32_t n_cross_ctx     = 0;
+    bool    alignment_heads = false;
+
+    // whisper_model.weights_gen - the graphs hold views of the weights, which move when a part is loaded again
+    uint64_t weights_gen    = 0;
+
+    bool operator==(const whisper_graph_key & other) const {
+        return n_tokens        == other.n_tokens &&
+               n_kv            == other.n_kv &&
+               n_kv_size       == other.n_kv_size &&
+               n_audio_ctx     == other.n_audio_ctx &&
+               n_cross_ctx     == other.n_cross_ctx &&
+               alignment_heads == other.alignment_heads &&
+               weights_gen     == other.weights_gen;
+    }
+};
+
 struct whisper_sched {
     ggml_backend_sched_t sched = nullptr;
 
     std::vector<uint8_t> meta;
+
+    // the last graph built in `meta` and allocated in `sched`, reused as is while the key of the next graph matches
+    ggml_cgraph *     graph = nullptr;
+    whisper_graph_key key;
 };
 
 static size_t whisper_sched_size(struct whisper_sched & allocr) {
@@ -523,6 +744,8 @@ static bool whisper_sched_graph_init(struct whisper_sched & allocr, std::vector<
     auto & sched = allocr.sched;
     auto & meta  = allocr.meta;
 
+    allocr.graph = nullptr;
+
     sched = ggml_backend_sched_new(backends.data(), nullptr, backends.size(), WHISPER_MAX_NODES, false);
 
     meta.resize(ggml_tensor_overhead()*WHISPER_MAX_NODES + ggml_graph_overhead());
@@ -540,6 +763,49 @@ static bool whisper_sched_graph_init(struct whisper_sched & allocr, std::vector<
     return true;
 }
 
+// the graph cached in allocr if it was built with the same key (nullptr - never cached), nullptr otherwise
+// a cached graph is still allocated, so both the construction and the scheduling can be skipped
+static ggml_cgraph * whisper_sched_graph_cached(const whisper_sched & allocr, const whisper_graph_key * key) {
+    return key != nullptr && allocr.graph != nullptr && allocr.key == *key ? allocr.graph : nullptr;
+}
+
+// allocate a newly built graph and remember it under key (nullptr - do not cache)
+static bool whisper_sched_graph_alloc(whisper_sched & allocr, ggml_cgraph * gf, const whisper_graph_key * key) {
+    allocr.graph = nullptr;
+
+    ggml_backend_sched_reset(allocr.sched);
+
+    if (!ggml_backend_sched_alloc_graph(allocr.sched, gf)) {
+        return false;
+    }
+
+    if (key != nullptr) {
+        allocr.graph = gf;
+        allocr.key   = *key;
+    }
+
+    return true;
+}
+
+// compute a graph allocated with whisper_sched_graph_alloc()
+static bool whisper_sched_graph_compute(whisper_sched & allocr, ggml_cgraph * gf, int n_threads) {
+    const bool keep = allocr.graph == gf;
+
+    if (!ggml_graph_compute_helper(allocr.sched, gf, n_threads, keep)) {
+        allocr.graph = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+// the graphs that use the weights of the encoder part, reserved for a single audio context size
+struct whisper_sched_enc {
+    whisper_sched conv;
+    whisper_sched encode;
+    whisper_sched cross;
+};
+
 // medium
 // hparams: {
 // 'n_mels': 80,
@@ -684,6 +950,173 @@ struct whisper_kv_cache {
     std::vector<uint8_t> ctx_buf;
 };
 
+// read-only memory mapping of a model file
+// the tensor data of the CPU backend can point directly into the mapping, so that multiple processes loading the
+// same model share a single copy of the weights in the page cache
+// the mapping also acts as a sequential reader for the loader (see whisper_init_from_file_with_params_no_state)
+struct whisper_mmap {
+    void * addr = nullptr;
+    size_t size = 0;
+
+    // read cursor
+    size_t offs = 0;
+
+#if defined(_POSIX_MAPPED_FILES) && !defined(GGML_BIG_ENDIAN)
+    static constexpr bool SUPPORTED = true;
+
+    bool init(const char * path, bool prefetch_all = true) {
+        const int fd = open(path, O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+
+        size = st.st_size;
+
+        addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (addr == MAP_FAILED) {
+            addr = nullptr;
+            return false;
+        }
+
+        if (prefetch_all) {
+            prefetch(0, size);
+        }
+
+        return true;
+    }
+
+    // start reading ahead the range in the background - this is only a hint
+    void prefetch(size_t offs, size_t n) const {
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+        const size_t begin = offs & ~(page_size - 1);
+
+        posix_madvise((uint8_t *) addr + begin, offs + n - begin, POSIX_MADV_WILLNEED);
+    }
+
+    // drop the pages fully within the range from the memory of the process - they are read again from the file
+    // on the next access
+    void release(size_t offs, size_t n) const {
+#ifdef MADV_DONTNEED
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+        const size_t begin = GGML_PAD(offs, page_size);
+        const size_t end   = (offs + n) & ~(page_size - 1);
+
+        if (begin < end) {
+            madvise((uint8_t *) addr + begin, end - begin, MADV_DONTNEED);
+        }
+#else
+        GGML_UNUSED(offs);
+        GGML_UNUSED(n);
+#endif
+    }
+
+    ~whisper_mmap() {
+        if (addr) {
+            munmap(addr, size);
+        }
+    }
+#elif defined(_WIN32) && !defined(GGML_BIG_ENDIAN)
+    static constexpr bool SUPPORTED = true;
+
+    bool init(const char * path, bool prefetch_all = true) {
+        GGML_UNUSED(prefetch_all);
+
+        std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+        std::wstring path_wide = converter.from_bytes(path);
+
+        HANDLE hFile = CreateFileW(path_wide.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(hFile, &file_size) || file_size.QuadPart == 0) {
+            CloseHandle(hFile);
+            return false;
+        }
+
+        size = (size_t) file_size.QuadPart;
+
+        HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(hFile);
+
+        if (hMapping == NULL) {
+            return false;
+        }
+
+        addr = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(hMapping);
+
+        return addr != NULL;
+    }
+
+    void prefetch(size_t /*offs*/, size_t /*n*/) const {}
+    void release (size_t /*offs*/, size_t /*n*/) const {}
+
+    ~whisper_mmap() {
+        if (addr) {
+            UnmapViewOfFile(addr);
+        }
+    }
+#else
+    static constexpr bool SUPPORTED = false;
+
+    bool init(const char * /*path*/, bool /*prefetch_all*/ = true) {
+        return false;
+    }
+
+    void prefetch(size_t /*offs*/, size_t /*n*/) const {}
+    void release (size_t /*offs*/, size_t /*n*/) const {}
+#endif
+
+    whisper_mmap() = default;
+    whisper_mmap(const whisper_mmap &) = delete;
+    whisper_mmap & operator=(const whisper_mmap &) = delete;
+
+    size_t read(void * dst, size_t n) {
+        n = std::min(n, size - offs);
+        memcpy(dst, (const uint8_t *) addr + offs, n);
+        offs += n;
+
+        return n;
+    }
+
+    bool eof() const {
+        return offs >= size;
+    }
+};
+
+// location of the data of a model tensor inside the model file
+struct whisper_tensor_record {
+    ggml_tensor * tensor;
+    size_t        offs;
+};
+
+// the weights of a part of the model (see whisper_model_part) and the buffers that store them
+struct whisper_model_part_weights {
+    std::vector<ggml_tensor *> tensors;
+
+    // set when the data of the tensors can be read again from the model file, so that they can be evicted
+    std::vector<whisper_tensor_record> records;
+
+    std::vector<ggml_backend_buffer_t> buffers;
+
+    // weights stored in the layout of the extra CPU buffer types (e.g. repacked Q4_0)
+    std::vector<ggml_backend_buffer_t> buffers_extra;
+
+    bool loaded = false;
+};
+
+#define WHISPER_MODEL_PART_COUNT 2
+
 struct whisper_model {
     e_model type = MODEL_UNKNOWN;
 
@@ -722,7 +1155,18 @@ struct whisper_model {
     struct ggml_context * ctx = nullptr;
 
     // the model backend data is read-only and can be shared between processors
-    ggml_backend_buffer_t buffer = nullptr;
+    // each part is stored in its own buffers, so that it can be loaded and evicted independently
+    whisper_model_part_weights parts[WHISPER_MODEL_PART_COUNT];
+
+    // guards the loading and the eviction of the parts
+    std::mutex mutex_parts;
+
+    // mapped model file (optional) and the CPU buffer that wraps it
+    std::unique_ptr<whisper_mmap> mapping;
+    ggml_backend_buffer_t buffer_mmap = nullptr;
+
+    // incremented each time the weights of a part are freed - the graphs cached with an older value are rebuilt
+    uint64_t weights_gen = 0;
 
     // tensors
     int n_loaded;
@@ -794,6 +1238,171 @@ struct whisper_aheads_masks {
     ggml_backend_buffer_t buffer = nullptr;
 };
 
+// LRU cache of tokenized prompts, so that repeated calls with the same initial_prompt do not tokenize it again
+struct whisper_prompt_cache {
+    using entry = std::pair<std::string, std::vector<whisper_token>>;
+
+    std::list<entry> entries; // most recently used first
+
+    std::unordered_map<std::string, std::list<entry>::iterator> index;
+};
+
+// long-lived worker threads for the short parallel tasks of a state (mel frames, processing of the logits of the
+// decoders), so that they do not create and join new threads every time
+// run() calls fn(ith) for ith in [0, n_threads) - ith == 0 on the calling thread - and returns when all calls are done
+// the workers are created on first use and are blocked on a condition variable between the tasks
+// run() must not be called concurrently on the same pool
+struct whisper_thread_pool {
+    std::vector<std::thread> workers;
+
+    std::mutex              mutex;
+    std::condition_variable cv_start;
+    std::condition_variable cv_done;
+
+    const std::function<void(int)> * task = nullptr;
+
+    int      n_task    = 0; // number of threads of the current task
+    int      n_pending = 0; // number of workers that have not finished the current task
+    uint64_t n_runs    = 0;
+
+    bool stop = false;
+
+    ~whisper_thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+
+        cv_start.notify_all();
+
+        for (auto & worker : workers) {
+            worker.join();
+        }
+    }
+
+    void run(int n_threads, const std::function<void(int)> & fn) {
+        if (n_threads <= 1) {
+            fn(0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            while ((int) workers.size() < n_threads - 1) {
+                workers.emplace_back(&whisper_thread_pool::worker, this, (int) workers.size() + 1, n_runs);
+            }
+
+            task      = &fn;
+            n_task    = n_threads;
+            n_pending = n_threads - 1;
+            n_runs++;
+        }
+
+        cv_start.notify_all();
+
+        fn(0);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv_done.wait(lock, [&] { return n_pending == 0; });
+
+            task = nullptr;
+        }
+    }
+
+    void worker(int ith, uint64_t n_seen) {
+        while (true) {
+            const std::function<void(int)> * fn = nullptr;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv_start.wait(lock, [&] { return stop || n_runs != n_seen; });
+
+                if (stop) {
+                    return;
+                }
+
+                n_seen = n_runs;
+
+                if (ith >= n_task) {
+                    continue;
+                }
+
+                fn = task;
+            }
+
+            (*fn)(ith);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--n_pending == 0) {
+                    cv_done.notify_one();
+                }
+            }
+        }
+    }
+};
+
+// incremental log mel spectrogram (see whisper_pcm_to_mel_append())
+struct whisper_mel_stream {
+    // samples of the padded signal that are not yet covered by a complete frame
+    std::vector<float> samples;
+
+    // log10 values of the frames in the window, before the normalization: [n_frames][n_mel]
+    std::vector<float> frames;
+
+    int32_t n_frames_max   = 100*WHISPER_CHUNK_SIZE;
+    int64_t n_frames_total = 0; // since the start of the stream
+
+    // maximum of the log10 values of the window and the tail - the normalization floors the spectrogram at mmax - 8
+    float mmax = 0.0f;
+
+    bool padded = false; // the reflective padding at the start of the stream has been added
+};
+
+// [EXPERIMENTAL] block-causal streaming encoder (see whisper_encode_stream_with_state())
+struct whisper_enc_stream {
+    int n_block = 0; // positions (20 ms each) per block
+    int n_left  = 0; // positions before a block that it attends to
+
+    int n_past  = 0; // positions encoded so far - the next block starts here
+    int n_cross = 0; // positions written to kv_cross
+
+    // start of the encoded window in the stream (see whisper_pcm_to_mel_append_offset()), -1 - nothing encoded
+    int64_t mel_offset = -1;
+
+    // whisper_mel_stream.mmax of the spectrogram the positions were encoded from
+    float mmax = 0.0f;
+
+    // keys and values of each layer for the encoded positions, preceded by n_left positions of zeros
+    whisper_kv_cache kv;
+
+    // output of the encoder for the encoded positions: [n_audio_state, n_audio_ctx]
+    ggml_context        * ctx    = nullptr;
+    ggml_backend_buffer_t buffer = nullptr;
+    ggml_tensor         * embd   = nullptr;
+
+    whisper_sched sched_encode;
+    whisper_sched sched_cross;
+};
+
+// log mel spectrogram computed on the backend (see whisper_context_params.mel_graph)
+struct whisper_mel_graph {
+    ggml_context * ctx = nullptr;
+
+    ggml_backend_buffer_t buffer = nullptr;
+
+    struct ggml_tensor * basis   = nullptr; // [frame_size, 2*n_fft] Hann-windowed DFT basis: the cos rows, then the sin rows
+    struct ggml_tensor * filters = nullptr; // [n_fft, n_mel]        mel filterbank, scaled by 1e4 (see log_mel_spectrogram_graph())
+    struct ggml_tensor * samples = nullptr; // [n_samples_max]       padded PCM samples
+    struct ggml_tensor * mel     = nullptr; // [n_len_max, n_mel]    log10 mel spectrogram + 4, before the clamping
+    struct ggml_tensor * mmax    = nullptr; // [1]                   maximum of the spectrogram
+
+    // whisper_state.mel describes the spectrogram in `mel` (its data is empty)
+    bool active = false;
+};
+
 struct whisper_state {
     int64_t t_sample_us = 0;
     int64_t t_encode_us = 0;
@@ -824,6 +1433,10 @@ struct whisper_state {
     whisper_kv_cache kv_pad;
 
     whisper_mel mel;
+    whisper_mel_stream mel_stream;
+    whisper_mel_graph  mel_graph;
+
+    whisper_thread_pool thread_pool;
 
     whisper_batch batch;
 
@@ -832,11 +1445,32 @@ struct whisper_state {
     std::vector<ggml_backend_t> backends;
 
     // - stores meta info about the intermediate tensors into the `meta` buffers
-    whisper_sched sched_conv;
-    whisper_sched sched_encode;
-    whisper_sched sched_cross;
+    whisper_sched sched_mel;
     whisper_sched sched_decode;
 
+    // the views of the decoder graph that store the batch in kv_self at kv_head: { tensor, offset at kv_head = 0, stride }
+    // they are moved to the current kv_head when the graph is reused
+    std::vector<std::tuple<ggml_tensor *, size_t, size_t>> decode_kv_views;
+
+    // [0] - the full (or a custom) audio context, [1 + i] - g_audio_ctx_buckets[i]
+    // each set is reserved the first time it is used and kept for the lifetime of the state
+    whisper_sched_enc sched_enc[1 + WHISPER_N_AUDIO_CTX_BUCKETS];
+
+    // batched encoder graphs (see whisper_encode_batch), reserved for n_batch_enc windows of n_ctx_enc_batch frames
+    whisper_sched_enc sched_enc_batch;
+
+    int n_batch_enc     = 0;
+    int n_ctx_enc_batch = 0;
+
+    // the window held in kv_cross: mel offset and audio context size, -1 - unknown
+    int enc_mel_offset = -1;
+    int enc_n_ctx      = -1;
+
+    // positions per layer in kv_cross when it was filled by the streaming encoder, 0 - the audio context of the window
+    int kv_cross_n_ctx = 0;
+
+    whisper_enc_stream enc_stream;
+
     // result of the encoder
     struct ggml_tensor * embd_conv = nullptr;
     struct ggml_tensor * embd_enc  = nullptr;
@@ -851,6 +1485,8 @@ struct whisper_state {
     std::vector<whisper_segment> result_all;
     std::vector<whisper_token>   prompt_past;
 
+    whisper_prompt_cache prompt_cache;
+
     int lang_id = 0; // english by default
 
     std::string path_model; // populated by whisper_init_from_file_with_params()
@@ -870,6 +1506,7 @@ struct whisper_state {
     whisper_token tid_last;
 
     std::vector<float> energy; // PCM signal energy
+    int64_t energy_offset = 0; // index in the audio of the first sample of energy
     float no_speech_prob = 0.0f;
 
     // [EXPERIMENTAL] Token-level timestamps with DTW
@@ -881,6 +1518,470 @@ struct whisper_state {
     int32_t exp_n_audio_ctx = 0; // 0 - use default
 };
 
+// content-addressed cache of whisper_full() - see whisper_context_params.cache_mem_size
+//
+// maps a key - the SHA-256 digest of everything the value depends on - to a blob, with a memory tier and an optional
+// disk tier in whisper_context_params.cache_dir, both evicting the least recently used entries. the whole digest is
+// compared on each lookup. the entries of the disk tier are files named after the key, starting with a
+// whisper_cache_file_header that repeats it. the files found in the directory when the context is created are ordered
+// by modification time
+// the cache is shared by all states of the context - the files are read and written without holding its mutex, which
+// only guards the indices
+//
+
+#define WHISPER_CACHE_MAGIC   0x68636377 // "wcch"
+#define WHISPER_CACHE_VERSION 2
+
+// SHA-256 (FIPS 180-4) of the key material of the entries of whisper_cache and of the repack cache
+struct whisper_sha256 {
+    uint32_t h[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    uint8_t  buf[64];
+    size_t   n_buf = 0;
+    uint64_t n     = 0; // bytes hashed so far
+
+    void update(const void * data, size_t size) {
+        const uint8_t * p = (const uint8_t *) data;
+
+        n += size;
+
+        while (size > 0) {
+            const size_t k = std::min(size, sizeof(buf) - n_buf);
+
+            memcpy(buf + n_buf, p, k);
+
+            n_buf += k;
+            p     += k;
+            size  -= k;
+
+            if (n_buf == sizeof(buf)) {
+                block(buf);
+                n_buf = 0;
+            }
+        }
+    }
+
+    // the 32 bytes of the digest - the object must not be used after this
+    std::string digest() {
+        const uint64_t n_bits = n*8;
+
+        const uint8_t one  = 0x80;
+        const uint8_t zero = 0x00;
+
+        update(&one, 1);
+        while (n_buf != 56) {
+            update(&zero, 1);
+        }
+
+        uint8_t len[8];
+        for (int i = 0; i < 8; ++i) {
+            len[i] = (uint8_t) (n_bits >> (56 - 8*i));
+        }
+        update(len, sizeof(len));
+
+        std::string result(32, '\0');
+        for (int i = 0; i < 8; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                result[4*i + j] = (char) (h[i] >> (24 - 8*j));
+            }
+        }
+
+        return result;
+    }
+
+private:
+    static uint32_t rotr(uint32_t x, int k) {
+        return (x >> k) | (x << (32 - k));
+    }
+
+    void block(const uint8_t * p) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t) p[4*i] << 24 | (uint32_t) p[4*i + 1] << 16 | (uint32_t) p[4*i + 2] << 8 | p[4*i + 3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            const uint32_t s0 = rotr(w[i - 15],  7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >>  3);
+            const uint32_t s1 = rotr(w[i -  2], 17) ^ rotr(w[i -  2], 19) ^ (w[i -  2] >> 10);
+
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+
+        for (int i = 0; i < 64; ++i) {
+            const uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+            hh = g;
+            g  = f;
+            f  = e;
+            e  = d + t1;
+            d  = c;
+            c  = b;
+            b  = a;
+            a  = t1 + t2;
+        }
+
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+};
+
+#define WHISPER_CACHE_KEY_SIZE 32
+
+template<typename T>
+static void whisper_cache_key_val(whisper_sha256 & key, const T & val) {
+    key.update(&val, sizeof(T));
+}
+
+static void whisper_cache_key_str(whisper_sha256 & key, const char * str) {
+    whisper_cache_key_val(key, str != nullptr);
+    if (str) {
+        key.update(str, strlen(str) + 1);
+    }
+}
+
+// the digest of the key material, empty - no key
+using whisper_cache_key = std::string;
+
+struct whisper_cache_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t  key[WHISPER_CACHE_KEY_SIZE];
+    uint64_t size;
+};
+
+struct whisper_cache {
+    struct entry {
+        whisper_cache_key key;
+        size_t            size;
+
+        std::vector<uint8_t> data; // empty for the entries of the disk tier
+    };
+
+    using entry_list = std::list<entry>;
+
+    std::mutex mutex;
+
+    whisper_cache_key key_model; // digest of the model and of the context parameters, part of all keys
+
+    // memory tier, most recently used first
+    size_t     mem_size_max = 0;
+    size_t     mem_size     = 0;
+    entry_list mem;
+    std::unordered_map<whisper_cache_key, entry_list::iterator> mem_index;
+
+    // disk tier, most recently used first
+    std::string dir;               // empty if there is no disk tier
+    size_t     disk_size_max = 0; // 0 = unlimited
+    size_t     disk_size     = 0;
+    entry_list disk;
+    std::unordered_map<whisper_cache_key, entry_list::iterator> disk_index;
+
+    int64_t n_hit  = 0;
+    int64_t n_miss = 0;
+
+    std::string path(const whisper_cache_key & key) const {
+        std::string name = "whisper-cache-";
+        for (const char c : key) {
+            char hex[4];
+            snprintf(hex, sizeof(hex), "%02x", (uint8_t) c);
+            name += hex;
+        }
+
+        return dir + "/" + name + ".bin";
+    }
+
+    // the key of a file name created by path(), empty if it is not one
+    static whisper_cache_key parse(const std::string & name) {
+        const std::string prefix = "whisper-cache-";
+        const std::string suffix = ".bin";
+
+        if (name.size() != prefix.size() + 2*WHISPER_CACHE_KEY_SIZE + suffix.size() ||
+            name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            return {};
+        }
+
+        whisper_cache_key key(WHISPER_CACHE_KEY_SIZE, '\0');
+        for (int i = 0; i < WHISPER_CACHE_KEY_SIZE; ++i) {
+            const std::string hex = name.substr(prefix.size() + 2*i, 2);
+            if (!isxdigit((uint8_t) hex[0]) || !isxdigit((uint8_t) hex[1])) {
+                return {};
+            }
+            key[i] = (char) std::stoi(hex, nullptr, 16);
+        }
+
+        return key;
+    }
+
+    bool get(const whisper_cache_key & key, std::vector<uint8_t> & data) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto it = mem_index.find(key);
+            if (it != mem_index.end()) {
+                mem.splice(mem.begin(), mem, it->second);
+                data = it->second->data;
+                n_hit++;
+                return true;
+            }
+
+            if (dir.empty()) {
+                n_miss++;
+                return false;
+            }
+        }
+
+        // the file may also have been written by another process since the scan
+        const bool ok = disk_read(key, data);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!ok) {
+            disk_forget(key);
+            n_miss++;
+            return false;
+        }
+
+        mem_put(key, data);
+        disk_touch(key, sizeof(whisper_cache_file_header) + data.size());
+        n_hit++;
+        return true;
+    }
+
+    void put(const whisper_cache_key & key, const std::vector<uint8_t> & data) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            mem_put(key, data);
+
+            if (dir.empty()) {
+                return;
+            }
+        }
+
+        if (!disk_write(key, data)) {
+            return;
+        }
+
+        std::vector<std::string> fnames;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            disk_touch(key, sizeof(whisper_cache_file_header) + data.size());
+            fnames = disk_evict();
+        }
+
+        for (const auto & fname : fnames) {
+            std::remove(fname.c_str());
+        }
+    }
+
+    // indexes the files in dir - called once, before the cache is shared
+    void disk_scan() {
+        std::vector<std::string> names;
+
+#if defined(_WIN32)
+        WIN32_FIND_DATAA data;
+        HANDLE handle = FindFirstFileA((dir + "\\whisper-cache-*.bin").c_str(), &data);
+        if (handle != INVALID_HANDLE_VALUE) {
+            do {
+                names.push_back(data.cFileName);
+            } while (FindNextFileA(handle, &data));
+            FindClose(handle);
+        }
+#else
+        DIR * d = opendir(dir.c_str());
+        if (d) {
+            while (const struct dirent * e = readdir(d)) {
+                names.push_back(e->d_name);
+            }
+            closedir(d);
+        }
+#endif
+
+        struct file {
+            whisper_cache_key key;
+            size_t            size;
+            time_t            mtime;
+        };
+
+        std::vector<file> files;
+        for (const auto & name : names) {
+            const whisper_cache_key key = parse(name);
+            if (key.empty()) {
+                continue;
+            }
+
+            struct stat st;
+            if (stat(path(key).c_str(), &st) == 0) {
+                files.push_back({ key, (size_t) st.st_size, st.st_mtime });
+            }
+        }
+
+        // oldest first, so that the most recent ends up in front
+        std::sort(files.begin(), files.end(), [](const file & a, const file & b) { return a.mtime < b.mtime; });
+
+        for (const auto & f : files) {
+            disk_touch(f.key, f.size);
+        }
+
+        for (const auto & fname : disk_evict()) {
+            std::remove(fname.c_str());
+        }
+    }
+
+private:
+    void mem_put(const whisper_cache_key & key, const std::vector<uint8_t> & data) {
+        if (data.size() > mem_size_max) {
+            return;
+        }
+
+        auto it = mem_index.find(key);
+        if (it != mem_index.end()) {
+            mem_size -= it->second->size;
+            mem.erase(it->second);
+        }
+
+        mem.push_front({ key, data.size(), data });
+        mem_index[key] = mem.begin();
+        mem_size += data.size();
+
+        while (mem_size > mem_size_max) {
+            mem_size -= mem.back().size;
+            mem_index.erase(mem.back().key);
+            mem.pop_back();
+        }
+    }
+
+    // moves the entry to the front of the disk tier, adding it if needed
+    void disk_touch(const whisper_cache_key & key, size_t size) {
+        auto it = disk_index.find(key);
+        if (it != disk_index.end()) {
+            disk_size -= it->second->size;
+            disk.erase(it->second);
+        }
+
+        disk.push_front({ key, size, {} });
+        disk_index[key] = disk.begin();
+        disk_size += size;
+    }
+
+    void disk_forget(const whisper_cache_key & key) {
+        auto it = disk_index.find(key);
+        if (it != disk_index.end()) {
+            disk_size -= it->second->size;
+            disk.erase(it->second);
+            disk_index.erase(it);
+        }
+    }
+
+    // drops the least recently used entries over the limit - returns their files, for the caller to remove
+    std::vector<std::string> disk_evict() {
+        std::vector<std::string> fnames;
+
+        while (disk_size_max > 0 && disk_size > disk_size_max && !disk.empty()) {
+            fnames.push_back(path(disk.back().key));
+            disk_size -= disk.back().size;
+            disk_index.erase(disk.back().key);
+            disk.pop_back();
+        }
+
+        return fnames;
+    }
+
+    // the file of the entry - the indices are not used, so that the mutex need not be held
+    bool disk_read(const whisper_cache_key & key, std::vector<uint8_t> & data) const {
+        const std::string fname = path(key);
+
+        std::ifstream fin(fname, std::ios::binary | std::ios::ate);
+        if (!fin) {
+            return false;
+        }
+
+        const uint64_t n_file = (uint64_t) fin.tellg();
+        fin.seekg(0);
+
+        whisper_cache_file_header header = {};
+        fin.read((char *) &header, sizeof(header));
+
+        // the size in the header is only trusted if the file holds exactly that much after it
+        bool ok = fin &&
+            header.magic   == WHISPER_CACHE_MAGIC &&
+            header.version == WHISPER_CACHE_VERSION &&
+            key.size() == WHISPER_CACHE_KEY_SIZE && memcmp(header.key, key.data(), WHISPER_CACHE_KEY_SIZE) == 0 &&
+            header.size == n_file - sizeof(header);
+
+        if (ok) {
+            data.resize(header.size);
+            fin.read((char *) data.data(), data.size());
+            ok = fin.gcount() == (std::streamsize) data.size();
+        }
+
+        if (!ok) {
+            WHISPER_LOG_WARN("%s: invalid cache file '%s' - removing it\n", __func__, fname.c_str());
+            fin.close();
+            std::remove(fname.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    // writes the file of the entry, without the indices - false if it was not created
+    bool disk_write(const whisper_cache_key & key, const std::vector<uint8_t> & data) const {
+        whisper_cache_file_header header = {
+            /*.magic   =*/ WHISPER_CACHE_MAGIC,
+            /*.version =*/ WHISPER_CACHE_VERSION,
+            /*.key     =*/ {},
+            /*.size    =*/ data.size(),
+        };
+
+        memcpy(header.key, key.data(), std::min<size_t>(key.size(), WHISPER_CACHE_KEY_SIZE));
+
+        const std::string fname = path(key);
+
+        // write to a temporary file first, so that concurrent readers never see a partial entry
+        static std::atomic<uint64_t> n_tmp(0);
+        const std::string fname_tmp = fname + ".tmp" + std::to_string(ggml_time_us()) + "-" + std::to_string(n_tmp++);
+
+        {
+            std::ofstream fout(fname_tmp, std::ios::binary);
+
+            fout.write((const char *) &header, sizeof(header));
+            fout.write((const char *) data.data(), data.size());
+
+            if (!fout) {
+                WHISPER_LOG_WARN("%s: failed to write cache file '%s'\n", __func__, fname_tmp.c_str());
+                fout.close();
+                std::remove(fname_tmp.c_str());
+                return false;
+            }
+        }
+
+        if (std::rename(fname_tmp.c_str(), fname.c_str()) != 0) {
+            WHISPER_LOG_WARN("%s: failed to create cache file '%s'\n", __func__, fname.c_str());
+            std::remove(fname_tmp.c_str());
+            return false;
+        }
+
+        return true;
+    }
+};
+
 struct whisper_context {
     int64_t t_load_us  = 0;
     int64_t t_start_us = 0;
@@ -895,6 +1996,8 @@ struct whisper_context {
 
     whisper_state * state = nullptr;
 
+    std::unique_ptr<whisper_cache> cache; // nullptr if the cache is disabled
+
     std::string path_model; // populated by whisper_init_from_file_with_params()
 };
 
@@ -963,6 +2066,24 @@ static void whisper_kv_cache_free(struct whisper_kv_cache & cache) {
     ggml_backend_buffer_free(cache.buffer);
 }
 
+// forget the graphs cached by the schedulers of the state - they hold views of the KV caches, so this must be done
+// each time one of the caches is (re)allocated
+static void whisper_state_graphs_reset(whisper_state & wstate) {
+    wstate.sched_decode.graph = nullptr;
+
+    for (auto & se : wstate.sched_enc) {
+        se.conv.graph   = nullptr;
+        se.encode.graph = nullptr;
+        se.cross.graph  = nullptr;
+    }
+
+    wstate.sched_enc_batch.conv.graph   = nullptr;
+    wstate.sched_enc_batch.encode.graph = nullptr;
+    wstate.sched_enc_batch.cross.graph  = nullptr;
+
+    wstate.decode_kv_views.clear();
+}
+
 static bool whisper_kv_cache_find_slot(
            struct whisper_kv_cache & cache,
         const struct whisper_batch & batch) {
@@ -1323,2526 +2444,6212 @@ static ggml_backend_buffer_type_t whisper_default_buffer_type(const whisper_cont
     return result;
 }
 
-// load the model from a ggml file
-//
-// file format:
-//
-//   - hparams
-//   - pre-computed mel filters
-//   - vocab
-//   - weights
-//
-// see the convert-pt-to-ggml.py script for details
-//
-static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx) {
-    WHISPER_LOG_INFO("%s: loading model\n", __func__);
+static std::ifstream whisper_ifstream_open(const char * path) {
+#ifdef _MSC_VER
+    // Convert UTF-8 path to wide string (UTF-16) for Windows, resolving character encoding issues.
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+    std::wstring path_wide = converter.from_bytes(path);
+    return std::ifstream(path_wide, std::ios::binary);
+#else
+    return std::ifstream(path, std::ios::binary);
+#endif
+}
 
-    const int64_t t_start_us = ggml_time_us();
+// read the header of the next tensor record in the model file and find the corresponding model tensor
+// on success, tensor is set to nullptr when the end of the file has been reached
+static bool whisper_model_read_tensor_header(struct whisper_model_loader * loader, whisper_model & model, ggml_tensor *& tensor) {
+    int32_t n_dims;
+    int32_t length;
+    int32_t ttype;
 
-    wctx.t_start_us = t_start_us;
+    read_safe(loader, n_dims);
+    read_safe(loader, length);
+    read_safe(loader, ttype);
 
-    auto & model = wctx.model;
-    auto & vocab = wctx.vocab;
+    tensor = nullptr;
 
-    // verify magic
-    {
-        uint32_t magic;
-        read_safe(loader, magic);
-        if (magic != GGML_FILE_MAGIC) {
-            WHISPER_LOG_ERROR("%s: invalid model data (bad magic)\n", __func__);
-            return false;
-        }
+    if (loader->eof(loader->context)) {
+        return true;
     }
 
-    //load hparams
-    {
-        auto & hparams = model.hparams;
+    int32_t nelements = 1;
+    int32_t ne[4] = { 1, 1, 1, 1 };
+    for (int i = 0; i < n_dims; ++i) {
+        read_safe(loader, ne[i]);
+        nelements *= ne[i];
+    }
 
-        read_safe(loader, hparams.n_vocab);
-        read_safe(loader, hparams.n_audio_ctx);
-        read_safe(loader, hparams.n_audio_state);
-        read_safe(loader, hparams.n_audio_head);
-        read_safe(loader, hparams.n_audio_layer);
-        read_safe(loader, hparams.n_text_ctx);
-        read_safe(loader, hparams.n_text_state);
-        read_safe(loader, hparams.n_text_head);
-        read_safe(loader, hparams.n_text_layer);
-        read_safe(loader, hparams.n_mels);
-        read_safe(loader, hparams.ftype);
+    std::string name;
+    std::vector<char> tmp(length); // create a buffer
+    loader->read(loader->context, &tmp[0], tmp.size()); // read to buffer
+    name.assign(&tmp[0], tmp.size());
 
-        assert(hparams.n_text_state == hparams.n_audio_state);
+    if (model.tensors.find(name) == model.tensors.end()) {
+        WHISPER_LOG_ERROR("%s: unknown tensor '%s' in model file\n", __func__, name.data());
+        return false;
+    }
 
-        std::string mver = "";
+    tensor = model.tensors[name.data()];
 
-        if (hparams.n_audio_layer == 4) {
-            model.type = e_model::MODEL_TINY;
-        }
+    if (ggml_nelements(tensor) != nelements) {
+        WHISPER_LOG_ERROR("%s: tensor '%s' has wrong size in model file\n", __func__, name.data());
+        WHISPER_LOG_ERROR("%s: shape: [%d, %d, %d], expected: [%d, %d, %d]\n",
+                __func__, ne[0], ne[1], ne[2], (int) tensor->ne[0], (int) tensor->ne[1], (int) tensor->ne[2]);
+        return false;
+    }
 
-        if (hparams.n_audio_layer == 6) {
-            model.type = e_model::MODEL_BASE;
-        }
+    if (tensor->ne[0] != ne[0] || tensor->ne[1] != ne[1] || tensor->ne[2] != ne[2]) {
+        WHISPER_LOG_ERROR("%s: tensor '%s' has wrong shape in model file: got [%d, %d, %d], expected [%d, %d, %d]\n",
+                __func__, name.data(), (int) tensor->ne[0], (int) tensor->ne[1], (int) tensor->ne[2], ne[0], ne[1], ne[2]);
+        return false;
+    }
 
-        if (hparams.n_audio_layer == 12) {
-            model.type = e_model::MODEL_SMALL;
-        }
+    const size_t bpe = ggml_type_size(ggml_type(ttype));
 
-        if (hparams.n_audio_layer == 24) {
-            model.type = e_model::MODEL_MEDIUM;
-        }
+    if ((nelements*bpe)/ggml_blck_size(tensor->type) != ggml_nbytes(tensor)) {
+        WHISPER_LOG_ERROR("%s: tensor '%s' has wrong size in model file: got %zu, expected %zu\n",
+                __func__, name.data(), ggml_nbytes(tensor), nelements*bpe);
+        return false;
+    }
 
-        if (hparams.n_audio_layer == 32) {
-            model.type = e_model::MODEL_LARGE;
+    //printf("%48s - [%5d, %5d, %5d], type = %6s, %6.2f MB\n", name.data(), ne[0], ne[1], ne[2], ggml_type_name((ggml_type) ttype), ggml_nbytes(tensor)/1e6);
 
-            if (hparams.n_vocab == 51866) {
-                mver = " v3";
-            }
-        }
+    return true;
+}
 
-        const int32_t qntvr = hparams.ftype / GGML_QNT_VERSION_FACTOR;
+// minimum alignment of the tensor data expected by the CPU kernels
+// tensors in a mapped file that do not satisfy it are copied out of the mapping
+static size_t whisper_tensor_data_align(ggml_type type) {
+    return type == GGML_TYPE_F32 ? sizeof(float) : sizeof(ggml_fp16_t);
+}
 
-        hparams.ftype %= GGML_QNT_VERSION_FACTOR;
+// call fn(ith, i) for all i in [0, n) using n_threads threads, where ith is the index of the calling thread
+// the items are handed out one by one, so that a few large tensors do not leave the other threads idle
+static void whisper_parallel_for(int n_threads, int n, const std::function<void(int, int)> & fn) {
+    n_threads = std::max(1, std::min(n_threads, n));
 
-        // for the big tensors, we have the option to store the data in 16-bit floats or quantized
-        // in order to save memory and also to speed up the computation
-        wctx.wtype = ggml_ftype_to_ggml_type((ggml_ftype) (model.hparams.ftype));
-        if (wctx.wtype == GGML_TYPE_COUNT) {
-            WHISPER_LOG_ERROR("%s: invalid model (bad ftype value %d)\n", __func__, model.hparams.ftype);
-            return false;
+    std::atomic<int> next(0);
+
+    auto worker = [&](int ith) {
+        for (int i = next++; i < n; i = next++) {
+            fn(ith, i);
         }
+    };
 
-        WHISPER_LOG_INFO("%s: n_vocab       = %d\n", __func__, hparams.n_vocab);
-        WHISPER_LOG_INFO("%s: n_audio_ctx   = %d\n", __func__, hparams.n_audio_ctx);
-        WHISPER_LOG_INFO("%s: n_audio_state = %d\n", __func__, hparams.n_audio_state);
-        WHISPER_LOG_INFO("%s: n_audio_head  = %d\n", __func__, hparams.n_audio_head);
-        WHISPER_LOG_INFO("%s: n_audio_layer = %d\n", __func__, hparams.n_audio_layer);
-        WHISPER_LOG_INFO("%s: n_text_ctx    = %d\n", __func__, hparams.n_text_ctx);
-        WHISPER_LOG_INFO("%s: n_text_state  = %d\n", __func__, hparams.n_text_state);
-        WHISPER_LOG_INFO("%s: n_text_head   = %d\n", __func__, hparams.n_text_head);
-        WHISPER_LOG_INFO("%s: n_text_layer  = %d\n", __func__, hparams.n_text_layer);
-        WHISPER_LOG_INFO("%s: n_mels        = %d\n", __func__, hparams.n_mels);
-        WHISPER_LOG_INFO("%s: ftype         = %d\n", __func__, model.hparams.ftype);
-        WHISPER_LOG_INFO("%s: qntvr         = %d\n", __func__, qntvr);
-        WHISPER_LOG_INFO("%s: type          = %d (%s%s)\n", __func__, model.type, g_model_name.at(model.type).c_str(), mver.c_str());
+    std::vector<std::thread> workers;
+    workers.reserve(n_threads - 1);
+
+    for (int ith = 1; ith < n_threads; ++ith) {
+        workers.emplace_back(worker, ith);
     }
 
-    // load mel filters
-    {
-        auto & filters = wctx.model.filters;
+    worker(0);
 
-        read_safe(loader, filters.n_mel);
-        read_safe(loader, filters.n_fft);
-
-        filters.data.resize(filters.n_mel * filters.n_fft);
-        loader->read(loader->context, filters.data.data(), filters.data.size() * sizeof(float));
-        BYTESWAP_FILTERS(filters);
+    for (auto & w : workers) {
+        w.join();
     }
+}
 
-    // load vocab
-    {
-        int32_t n_vocab = 0;
-        read_safe(loader, n_vocab);
+// the data of tensors in buffers of the CPU device can be set from multiple threads concurrently
+static bool whisper_buft_is_cpu(ggml_backend_buffer_type_t buft) {
+    ggml_backend_dev_t dev = ggml_backend_buft_get_device(buft);
 
-        //if (n_vocab != model.hparams.n_vocab) {
-        //    WHISPER_LOG_ERROR("%s: invalid model file '%s' (bad vocab size %d != %d)\n",
-        //            __func__, fname.c_str(), n_vocab, model.hparams.n_vocab);
-        //    return false;
-        //}
+    return dev != nullptr && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU;
+}
 
-        std::string word;
-        std::vector<char> tmp;
+static const char * whisper_model_part_name(whisper_model_part part) {
+    return part == WHISPER_MODEL_PART_ENCODER ? "encoder" : "decoder";
+}
 
-        tmp.reserve(128);
+// the cross-attention key/value projections of the decoder are applied to the output of the encoder only once per
+// audio window (see whisper_build_graph_cross), so they belong to the encoder part
+static whisper_model_part whisper_model_tensor_part(const char * name) {
+    if (strncmp(name, "encoder.", 8) == 0 || strstr(name, ".cross_attn.key.") || strstr(name, ".cross_attn.value.")) {
+        return WHISPER_MODEL_PART_ENCODER;
+    }
 
-        for (int i = 0; i < n_vocab; i++) {
-            uint32_t len;
-            read_safe(loader, len);
+    return WHISPER_MODEL_PART_DECODER;
+}
 
-            if (len > 0) {
-                tmp.resize(len);
-                loader->read(loader->context, &tmp[0], tmp.size()); // read to buffer
-                word.assign(&tmp[0], tmp.size());
-            } else {
-                // seems like we have an empty-string token in multi-language models (i = 50256)
-                //WHISPER_LOG_WARN("%s: warning: empty-string token in vocab, i = %d\n", __func__, i);
-                word = "";
-            }
+// the matrix weights of the model - they are used only as the first argument of ggml_mul_mat, so they can be stored
+// in the extra buffer types of the CPU backend, which use a different data layout (e.g. repacked Q4_0)
+static std::vector<ggml_tensor *> whisper_model_matmul_weights(const whisper_model & model) {
+    std::vector<ggml_tensor *> result;
 
-            vocab.token_to_id[word] = i;
-            vocab.id_to_token[i] = word;
+    for (const auto & layer : model.layers_encoder) {
+        result.insert(result.end(), {
+            layer.attn_q_w, layer.attn_k_w, layer.attn_v_w, layer.attn_ln_1_w,
+            layer.mlp_0_w,  layer.mlp_1_w,
+        });
+    }
 
-            //printf("%s: vocab[%d] = '%s'\n", __func__, i, word.c_str());
-        }
+    for (const auto & layer : model.layers_decoder) {
+        result.insert(result.end(), {
+            layer.attn_q_w,       layer.attn_k_w,       layer.attn_v_w,       layer.attn_ln_1_w,
+            layer.cross_attn_q_w, layer.cross_attn_k_w, layer.cross_attn_v_w, layer.cross_attn_ln_1_w,
+            layer.mlp_0_w,        layer.mlp_1_w,
+        });
+    }
 
-        vocab.n_vocab = model.hparams.n_vocab;
-        if (vocab.is_multilingual()) {
-            vocab.token_eot++;
-            vocab.token_sot++;
-
-            // account for variable number of language tokens
-            const int dt = vocab.num_languages() - 98;
-
-            vocab.token_translate  += dt;
-            vocab.token_transcribe += dt;
-            vocab.token_solm       += dt;
-            vocab.token_prev       += dt;
-            vocab.token_nosp       += dt;
-            vocab.token_not        += dt;
-            vocab.token_beg        += dt;
-        }
-
-        if (n_vocab < model.hparams.n_vocab) {
-            WHISPER_LOG_INFO("%s: adding %d extra tokens\n", __func__, model.hparams.n_vocab - n_vocab);
-            for (int i = n_vocab; i < model.hparams.n_vocab; i++) {
-                if (i > vocab.token_beg) {
-                    word = "[_TT_" + std::to_string(i - vocab.token_beg) + "]";
-                } else if (i == vocab.token_eot) {
-                    word = "[_EOT_]";
-                } else if (i == vocab.token_sot) {
-                    word = "[_SOT_]";
-                } else if (i == vocab.token_translate) {
-                    word = "[_TRANSLATE_]";
-                } else if (i == vocab.token_transcribe) {
-                    word = "[_TRANSCRIBE_]";
-                } else if (i == vocab.token_solm) {
-                    word = "[_SOLM_]";
-                } else if (i == vocab.token_prev) {
-                    word = "[_PREV_]";
-                } else if (i == vocab.token_nosp) {
-                    word = "[_NOSP_]";
-                } else if (i == vocab.token_not) {
-                    word = "[_NOT_]";
-                } else if (i == vocab.token_beg) {
-                    word = "[_BEG_]";
-                } else if (i > vocab.token_sot && i <= vocab.token_sot + vocab.num_languages()) {
-                    word = "[_LANG_" + std::string(whisper_lang_str(i - vocab.token_sot - 1)) + "]";
-                } else {
-                    word = "[_extra_token_" + std::to_string(i) + "]";
-                }
-                vocab.token_to_id[word] = i;
-                vocab.id_to_token[i] = word;
-            }
-        }
+    return result;
+}
 
-        WHISPER_LOG_INFO("%s: n_langs       = %d\n", __func__, vocab.num_languages());
-    }
+// check if the CPU backend can compute ggml_mul_mat(w, x) when w is stored in a buffer of type buft
+static bool whisper_cpu_extra_buft_supported(ggml_backend_dev_t dev, ggml_backend_buffer_type_t buft, ggml_tensor * w) {
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 2*ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
 
-    const ggml_type wtype = wctx.wtype;
-    const ggml_type vtype = wctx.wtype == GGML_TYPE_F32 ? GGML_TYPE_F32 : GGML_TYPE_F16; // conv type
+    ggml_context * ctx = ggml_init(params);
+    if (!ctx) {
+        return false;
+    }
 
-    // create the ggml context
-    {
-        const auto & hparams = model.hparams;
+    ggml_tensor * x  = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, w->ne[0], 512);
+    ggml_tensor * op = ggml_mul_mat(ctx, w, x);
 
-        const int n_audio_layer = hparams.n_audio_layer;
-        const int n_text_layer  = hparams.n_text_layer;
+    // the buffer type is checked through the buffer of the weight
+    w->buffer = ggml_backend_buft_alloc_buffer(buft, 0);
 
-        const size_t n_tensors = 10 /* input */ + 15 + 15*n_audio_layer + 24*n_text_layer;
+    const bool result = ggml_backend_dev_supports_op(dev, op);
 
-        struct ggml_init_params params = {
-            /*.mem_size   =*/ n_tensors*ggml_tensor_overhead(),
-            /*.mem_buffer =*/ nullptr,
-            /*.no_alloc   =*/ true,
-        };
+    ggml_backend_buffer_free(w->buffer);
+    w->buffer = nullptr;
 
-        model.ctx = ggml_init(params);
-        if (!model.ctx) {
-            WHISPER_LOG_ERROR("%s: ggml_init() failed\n", __func__);
-            return false;
-        }
-    }
+    ggml_free(ctx);
 
-    // prepare tensors for the weights
-    {
-        auto & ctx = model.ctx;
+    return result;
+}
 
-        const auto & hparams = model.hparams;
+// allocate the tensors in buffers of type buft - a new buffer is started when the maximum buffer size is reached
+static bool whisper_alloc_tensors(ggml_backend_buffer_type_t buft, const std::vector<ggml_tensor *> & tensors, std::vector<ggml_backend_buffer_t> & buffers, size_t & size) {
+    const size_t alignment = ggml_backend_buft_get_alignment(buft);
+    const size_t max_size  = ggml_backend_buft_get_max_size(buft);
 
-        const int n_vocab = hparams.n_vocab;
+    size = 0;
 
-        const int n_audio_ctx   = hparams.n_audio_ctx;
-        const int n_audio_state = hparams.n_audio_state;
-        const int n_audio_layer = hparams.n_audio_layer;
+    for (size_t i0 = 0, i1 = 0; i0 < tensors.size(); i0 = i1) {
+        size_t size_cur = 0;
 
-        const int n_text_ctx   = hparams.n_text_ctx;
-        const int n_text_state = hparams.n_text_state;
-        const int n_text_layer = hparams.n_text_layer;
+        for (; i1 < tensors.size(); ++i1) {
+            const size_t n = GGML_PAD(ggml_backend_buft_get_alloc_size(buft, tensors[i1]), alignment);
 
-        const int n_mels = hparams.n_mels;
+            if (i1 > i0 && size_cur + n > max_size) {
+                break;
+            }
 
-        model.layers_encoder.resize(n_audio_layer);
-        model.layers_decoder.resize(n_text_layer);
+            size_cur += n;
+        }
 
-        // encoder
-        {
-            model.e_pe = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_audio_state, n_audio_ctx);
+        ggml_backend_buffer_t buffer = ggml_backend_buft_alloc_buffer(buft, size_cur);
+        if (!buffer) {
+            WHISPER_LOG_ERROR("%s: failed to allocate %s buffer of size %.2f MB\n", __func__, ggml_backend_buft_name(buft), size_cur / 1e6);
+            return false;
+        }
 
-            model.e_conv_1_w     = ggml_new_tensor_3d(ctx, vtype,         3, n_mels,     n_audio_state);
-            model.e_conv_1_b     = ggml_new_tensor_2d(ctx, GGML_TYPE_F32,         1,     n_audio_state);
+        buffers.push_back(buffer);
 
-            model.e_conv_2_w     = ggml_new_tensor_3d(ctx, vtype,         3, n_audio_state, n_audio_state);
-            model.e_conv_2_b     = ggml_new_tensor_2d(ctx, GGML_TYPE_F32,                1, n_audio_state);
+        struct ggml_tallocr talloc = ggml_tallocr_new(buffer);
+        for (size_t i = i0; i < i1; ++i) {
+            ggml_tallocr_alloc(&talloc, tensors[i]);
+        }
 
-            model.e_ln_w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_audio_state);
-            model.e_ln_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_audio_state);
+        size += size_cur;
+    }
 
-            // map by name
-            model.tensors["encoder.positional_embedding"] = model.e_pe;
+    return true;
+}
 
-            model.tensors["encoder.conv1.weight"]         = model.e_conv_1_w;
-            model.tensors["encoder.conv1.bias"]           = model.e_conv_1_b;
+// allocate the matrix weights of the part that the CPU backend supports in one of its extra buffer types
+// this must happen before the other weights are allocated or mapped
+// only with the repack cache - otherwise the weights stay in the regular buffers (or the mapping), as before the cache
+static bool whisper_model_alloc_part_extra(whisper_context & wctx, whisper_model_part part) {
+    auto & model   = wctx.model;
+    auto & weights = model.parts[part];
 
-            model.tensors["encoder.conv2.weight"]         = model.e_conv_2_w;
-            model.tensors["encoder.conv2.bias"]           = model.e_conv_2_b;
+    if (wctx.params.repack_cache_dir == nullptr) {
+        return true;
+    }
 
-            model.tensors["encoder.ln_post.weight"]       = model.e_ln_w;
-            model.tensors["encoder.ln_post.bias"]         = model.e_ln_b;
+    if (whisper_default_buffer_type(wctx.params) != ggml_backend_cpu_buffer_type()) {
+        return true;
+    }
 
-            for (int i = 0; i < n_audio_layer; ++i) {
-                auto & layer = model.layers_encoder[i];
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    if (!dev) {
+        return true;
+    }
 
-                layer.mlp_ln_w    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
-                layer.mlp_ln_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
+    auto * get_extra_bufts = (ggml_backend_dev_get_extra_bufts_t) ggml_backend_reg_get_proc_address(ggml_backend_dev_backend_reg(dev), "ggml_backend_dev_get_extra_bufts");
+    if (!get_extra_bufts) {
+        return true;
+    }
 
-                layer.mlp_0_w     = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, 4*n_audio_state);
-                layer.mlp_0_b     = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 4*n_audio_state);
+    std::vector<ggml_tensor *> matmul_weights;
+    for (ggml_tensor * w : whisper_model_matmul_weights(model)) {
+        if (whisper_model_tensor_part(ggml_get_name(w)) == part) {
+            matmul_weights.push_back(w);
+        }
+    }
 
-                layer.mlp_1_w     = ggml_new_tensor_2d(ctx, wtype,         4*n_audio_state, n_audio_state);
-                layer.mlp_1_b     = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
+    for (ggml_backend_buffer_type_t * buft = get_extra_bufts(dev); buft && *buft; ++buft) {
+        std::vector<ggml_tensor *> tensors;
 
-                layer.attn_ln_0_w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
-                layer.attn_ln_0_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
+        for (ggml_tensor * w : matmul_weights) {
+            if (w->data == nullptr && whisper_cpu_extra_buft_supported(dev, *buft, w)) {
+                tensors.push_back(w);
+            }
+        }
 
-                layer.attn_q_w    = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
-                layer.attn_q_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
+        if (tensors.empty()) {
+            continue;
+        }
 
-                layer.attn_k_w    = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
+        size_t size = 0;
+        if (!whisper_alloc_tensors(*buft, tensors, weights.buffers_extra, size)) {
+            return false;
+        }
 
-                layer.attn_v_w    = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
-                layer.attn_v_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
+        WHISPER_LOG_INFO("%s: %12s total size = %8.2f MB (%s, %d tensors)\n", __func__, ggml_backend_buft_name(*buft), size / 1e6,
+                whisper_model_part_name(part), (int) tensors.size());
+    }
 
-                layer.attn_ln_1_w = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
-                layer.attn_ln_1_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
+    return true;
+}
 
-                // map by name
-                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp_ln.weight"]     = layer.mlp_ln_w;
-                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp_ln.bias"]       = layer.mlp_ln_b;
+// allocate the weights of the part:
+//
+//   - first the matrix weights supported by the extra buffer types of the CPU backend
+//   - then, with the CPU backend and a mapped model file, the tensors are placed directly in the mapping (zero-copy)
+//   - the remaining tensors (other backends, misaligned data) are allocated in a regular buffer
+//
+static bool whisper_model_alloc_part(whisper_context & wctx, whisper_model_part part) {
+    auto & model   = wctx.model;
+    auto & weights = model.parts[part];
 
-                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp.0.weight"]      = layer.mlp_0_w;
-                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp.0.bias"]        = layer.mlp_0_b;
+    if (!whisper_model_alloc_part_extra(wctx, part)) {
+        return false;
+    }
 
-                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp.2.weight"]      = layer.mlp_1_w;
-                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp.2.bias"]        = layer.mlp_1_b;
+    ggml_backend_buffer_type_t buft = whisper_default_buffer_type(wctx.params);
 
-                model.tensors["encoder.blocks." + std::to_string(i) + ".attn_ln.weight"]    = layer.attn_ln_0_w;
-                model.tensors["encoder.blocks." + std::to_string(i) + ".attn_ln.bias"]      = layer.attn_ln_0_b;
+    if (model.mapping && buft == ggml_backend_cpu_buffer_type()) {
+        auto & mapping = *model.mapping;
 
-                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.query.weight"] = layer.attn_q_w;
-                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.query.bias"]   = layer.attn_q_b;
+        if (!model.buffer_mmap) {
+            model.buffer_mmap = ggml_backend_cpu_buffer_from_ptr(mapping.addr, mapping.size);
+            if (!model.buffer_mmap) {
+                WHISPER_LOG_ERROR("%s: failed to create a buffer for the mapped model\n", __func__);
+                return false;
+            }
 
-                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.key.weight"]   = layer.attn_k_w;
+            ggml_backend_buffer_set_usage(model.buffer_mmap, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+        }
 
-                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.value.weight"] = layer.attn_v_w;
-                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.value.bias"]   = layer.attn_v_b;
+        size_t size_mapped = 0;
 
-                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.out.weight"]   = layer.attn_ln_1_w;
-                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.out.bias"]     = layer.attn_ln_1_b;
+        for (const auto & record : weights.records) {
+            // skip the tensors in the extra buffer types and the misaligned ones
+            if (record.tensor->data != nullptr || record.offs % whisper_tensor_data_align(record.tensor->type) != 0) {
+                continue;
             }
+
+            ggml_backend_tensor_alloc(model.buffer_mmap, record.tensor, (uint8_t *) mapping.addr + record.offs);
+            size_mapped += ggml_nbytes(record.tensor);
         }
 
-        // decoder
-        {
-            model.d_pe   = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_text_state, n_text_ctx);
+        WHISPER_LOG_INFO("%s: %12s mapped size = %8.2f MB (%s)\n", __func__, "mmap", size_mapped / 1e6, whisper_model_part_name(part));
+    }
 
-            model.d_te   = ggml_new_tensor_2d(ctx, wtype,         n_text_state, n_vocab);
+    std::vector<ggml_tensor *> tensors;
+    for (ggml_tensor * t : weights.tensors) {
+        if (t->data == nullptr) {
+            tensors.push_back(t);
+        }
+    }
 
-            model.d_ln_w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_text_state);
-            model.d_ln_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_text_state);
+    if (tensors.empty()) {
+        return true;
+    }
 
-            // map by name
-            model.tensors["decoder.positional_embedding"]   = model.d_pe;
+    size_t size = 0;
+    if (!whisper_alloc_tensors(buft, tensors, weights.buffers, size)) {
+        WHISPER_LOG_ERROR("%s: failed to allocate memory for the %s weights\n", __func__, whisper_model_part_name(part));
+        return false;
+    }
 
-            model.tensors["decoder.token_embedding.weight"] = model.d_te;
+    WHISPER_LOG_INFO("%s: %12s total size = %8.2f MB (%s)\n", __func__, ggml_backend_buft_name(buft), size / 1e6, whisper_model_part_name(part));
 
-            model.tensors["decoder.ln.weight"]              = model.d_ln_w;
-            model.tensors["decoder.ln.bias"]                = model.d_ln_b;
+    return true;
+}
 
-            for (int i = 0; i < n_text_layer; ++i) {
-                auto & layer = model.layers_decoder[i];
+// free the memory of the weights of the part - the tensors keep their shape and can be allocated again
+static void whisper_model_free_part(whisper_model & model, whisper_model_part part) {
+    auto & weights = model.parts[part];
 
-                layer.mlp_ln_w          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
-                layer.mlp_ln_b          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+    for (ggml_tensor * t : weights.tensors) {
+        if (model.buffer_mmap && t->buffer == model.buffer_mmap) {
+            model.mapping->release((const uint8_t *) t->data - (const uint8_t *) model.mapping->addr, ggml_nbytes(t));
+        }
 
-                layer.mlp_0_w           = ggml_new_tensor_2d(ctx, wtype,           n_text_state, 4*n_text_state);
-                layer.mlp_0_b           = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 4*n_text_state);
+        t->buffer = nullptr;
+        t->data   = nullptr;
+        t->extra  = nullptr;
+    }
 
-                layer.mlp_1_w           = ggml_new_tensor_2d(ctx, wtype,         4*n_text_state, n_text_state);
-                layer.mlp_1_b           = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+    for (auto & buffer : weights.buffers) {
+        ggml_backend_buffer_free(buffer);
+    }
+    for (auto & buffer : weights.buffers_extra) {
+        ggml_backend_buffer_free(buffer);
+    }
 
-                layer.attn_ln_0_w       = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
-                layer.attn_ln_0_b       = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+    weights.buffers.clear();
+    weights.buffers_extra.clear();
 
-                layer.attn_q_w          = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
-                layer.attn_q_b          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+    weights.loaded = false;
 
-                layer.attn_k_w          = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+    model.weights_gen++;
+}
 
-                layer.attn_v_w          = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
-                layer.attn_v_b          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+static void whisper_model_set_usage_weights(whisper_model_part_weights & weights) {
+    for (auto & buffer : weights.buffers) {
+        ggml_backend_buffer_set_usage(buffer, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+    }
+    for (auto & buffer : weights.buffers_extra) {
+        ggml_backend_buffer_set_usage(buffer, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+    }
+}
 
-                layer.attn_ln_1_w       = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
-                layer.attn_ln_1_b       = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+// on-disk cache of the weights in the extra buffer types
+//
+// with whisper_context_params.repack_cache_dir, the matrix weights are placed in the extra buffer types of the CPU
+// backend and their data is converted to the layout of the buffer type (e.g. Q4_0 repacked for AVX2/NEON). the
+// converted data is written to a file in that directory after the first load, and the next loads copy it from the
+// mapped file instead
+//
+// the file name is the SHA-256 of everything the converted data depends on: the model file (path, size, modification
+// time and samples of its content), the hparams, the buffer types and shapes of the converted tensors, the CPU
+// features, the library version and the sources of the conversions in ggml (WHISPER_GGML_CPU_DIGEST)
+// each model part has its own file, since the parts are loaded independently
+//
 
-                layer.cross_attn_ln_0_w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
-                layer.cross_attn_ln_0_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+#define WHISPER_REPACK_CACHE_MAGIC     0x63727077 // "wprc"
+#define WHISPER_REPACK_CACHE_VERSION   2
+#define WHISPER_REPACK_CACHE_ALIGN     64
+#define WHISPER_REPACK_CACHE_N_SAMPLES 64
+#define WHISPER_REPACK_CACHE_SAMPLE    4096
 
-                layer.cross_attn_q_w    = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
-                layer.cross_attn_q_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+// digest of the ggml sources that define the layouts of the extra buffer types, set by the build
+#ifndef WHISPER_GGML_CPU_DIGEST
+#define WHISPER_GGML_CPU_DIGEST "unknown"
+#endif
 
-                layer.cross_attn_k_w    = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+struct whisper_repack_cache {
+    std::string       path; // empty if the cache is not used
+    whisper_cache_key key;
 
-                layer.cross_attn_v_w    = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
-                layer.cross_attn_v_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+    std::set<const ggml_tensor *> loaded; // tensors read from the cache
+};
 
-                layer.cross_attn_ln_1_w = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
-                layer.cross_attn_ln_1_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+// samples of the content of the model file, spread evenly over the whole file
+// hashing all of it would cost as much as the conversion that the cache saves - a file that is rewritten in place with
+// the same size and modification time is detected only if it differs in one of the samples
+static bool whisper_repack_cache_key_content(whisper_sha256 & key, const std::string & path, size_t size) {
+    std::ifstream fin = whisper_ifstream_open(path.c_str());
+    if (!fin) {
+        return false;
+    }
 
-                // map by name
-                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp_ln.weight"]           = layer.mlp_ln_w;
-                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp_ln.bias"]             = layer.mlp_ln_b;
+    std::vector<char> buf(WHISPER_REPACK_CACHE_SAMPLE);
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp.0.weight"]            = layer.mlp_0_w;
-                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp.0.bias"]              = layer.mlp_0_b;
+    for (int i = 0; i < WHISPER_REPACK_CACHE_N_SAMPLES; ++i) {
+        const size_t offs = size > buf.size() ? (size - buf.size())*i/(WHISPER_REPACK_CACHE_N_SAMPLES - 1) : 0;
+        const size_t n    = std::min(size, buf.size());
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp.2.weight"]            = layer.mlp_1_w;
-                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp.2.bias"]              = layer.mlp_1_b;
+        fin.seekg(offs);
+        fin.read(buf.data(), n);
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".attn_ln.weight"]          = layer.attn_ln_0_w;
-                model.tensors["decoder.blocks." + std::to_string(i) + ".attn_ln.bias"]            = layer.attn_ln_0_b;
+        if (!fin) {
+            return false;
+        }
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.query.weight"]       = layer.attn_q_w;
-                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.query.bias"]         = layer.attn_q_b;
+        key.update(buf.data(), n);
+    }
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.key.weight"]         = layer.attn_k_w;
+    return true;
+}
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.value.weight"]       = layer.attn_v_w;
-                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.value.bias"]         = layer.attn_v_b;
+// the tensors of the part stored in the extra buffer types, in the order of the model context
+static std::vector<ggml_tensor *> whisper_model_tensors_extra(const whisper_model_part_weights & weights) {
+    std::vector<ggml_tensor *> result;
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.out.weight"]         = layer.attn_ln_1_w;
-                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.out.bias"]           = layer.attn_ln_1_b;
+    for (ggml_tensor * t : weights.tensors) {
+        if (std::find(weights.buffers_extra.begin(), weights.buffers_extra.end(), t->buffer) != weights.buffers_extra.end()) {
+            result.push_back(t);
+        }
+    }
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn_ln.weight"]    = layer.cross_attn_ln_0_w;
-                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn_ln.bias"]      = layer.cross_attn_ln_0_b;
+    return result;
+}
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.query.weight"] = layer.cross_attn_q_w;
-                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.query.bias"]   = layer.cross_attn_q_b;
+struct whisper_repack_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t  key[WHISPER_CACHE_KEY_SIZE];
+    uint64_t n_tensors;
+};
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.key.weight"]   = layer.cross_attn_k_w;
+// followed by n_tensors entries: { uint64_t offs, uint64_t size }, then the aligned data
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.value.weight"] = layer.cross_attn_v_w;
-                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.value.bias"]   = layer.cross_attn_v_b;
+static void whisper_repack_cache_init(whisper_context & wctx, whisper_model_part part, whisper_repack_cache & cache) {
+    const auto & model   = wctx.model;
+    const auto & params  = wctx.params;
+    const auto & weights = model.parts[part];
 
-                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.out.weight"]   = layer.cross_attn_ln_1_w;
-                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.out.bias"]     = layer.cross_attn_ln_1_b;
-            }
-        }
+    if (params.repack_cache_dir == nullptr || weights.buffers_extra.empty()) {
+        return;
     }
 
-    // allocate tensors in the backend buffers
-    model.buffer = ggml_backend_alloc_ctx_tensors_from_buft(model.ctx, whisper_default_buffer_type(wctx.params));
-    if (!model.buffer) {
-        WHISPER_LOG_ERROR("%s: failed to allocate memory for the model\n", __func__);
-        return false;
+    if (!whisper_mmap::SUPPORTED) {
+        WHISPER_LOG_WARN("%s: the repack cache requires mmap support - disabled\n", __func__);
+        return;
     }
 
-    size_t size_main = ggml_backend_buffer_get_size(model.buffer);
-    WHISPER_LOG_INFO("%s: %8s total size = %8.2f MB\n", __func__, ggml_backend_buffer_name(model.buffer), size_main / 1e6);
-
-    // load weights
-    {
-        size_t total_size = 0;
+    struct stat st;
+    if (wctx.path_model.empty() || stat(wctx.path_model.c_str(), &st) != 0) {
+        WHISPER_LOG_WARN("%s: the repack cache requires a model loaded from a file - disabled\n", __func__);
+        return;
+    }
 
-        model.n_loaded = 0;
+    const auto tensors = whisper_model_tensors_extra(weights);
 
-        std::vector<char> read_buf;
+    whisper_sha256 key;
 
-        while (true) {
-            int32_t n_dims;
-            int32_t length;
-            int32_t ttype;
+    whisper_cache_key_str(key, WHISPER_VERSION);
+    whisper_cache_key_str(key, WHISPER_GGML_CPU_DIGEST);
+    whisper_cache_key_val(key, (int32_t) GGML_QNT_VERSION);
+    whisper_cache_key_str(key, whisper_print_system_info());
+    whisper_cache_key_str(key, wctx.path_model.c_str());
+    whisper_cache_key_val(key, (int64_t) st.st_size);
+    whisper_cache_key_val(key, (int64_t) st.st_mtime);
 
-            read_safe(loader, n_dims);
-            read_safe(loader, length);
-            read_safe(loader, ttype);
+    if (!whisper_repack_cache_key_content(key, wctx.path_model, st.st_size)) {
+        WHISPER_LOG_WARN("%s: failed to read '%s' - the repack cache is disabled\n", __func__, wctx.path_model.c_str());
+        return;
+    }
 
-            if (loader->eof(loader->context)) {
-                break;
-            }
+    whisper_cache_key_val(key, model.hparams);
 
-            int32_t nelements = 1;
-            int32_t ne[4] = { 1, 1, 1, 1 };
-            for (int i = 0; i < n_dims; ++i) {
-                read_safe(loader, ne[i]);
-                nelements *= ne[i];
-            }
+    for (const ggml_tensor * t : tensors) {
+        whisper_cache_key_str(key, ggml_get_name(t));
+        whisper_cache_key_str(key, ggml_backend_buffer_name(t->buffer));
+        whisper_cache_key_val(key, t->type);
+        whisper_cache_key_val(key, t->ne);
+    }
 
-            std::string name;
-            std::vector<char> tmp(length); // create a buffer
-            loader->read(loader->context, &tmp[0], tmp.size()); // read to buffer
-            name.assign(&tmp[0], tmp.size());
+    cache.key = key.digest();
 
-            if (model.tensors.find(name) == model.tensors.end()) {
-                WHISPER_LOG_ERROR("%s: unknown tensor '%s' in model file\n", __func__, name.data());
-                return false;
-            }
+    std::string name = "whisper-repack-";
+    for (char c : cache.key) {
+        char hex[3];
+        snprintf(hex, sizeof(hex), "%02x", (uint8_t) c);
+        name += hex;
+    }
+    name += ".bin";
 
-            auto tensor = model.tensors[name.data()];
+    cache.path = std::string(params.repack_cache_dir) + "/" + name;
 
-            if (ggml_nelements(tensor) != nelements) {
-                WHISPER_LOG_ERROR("%s: tensor '%s' has wrong size in model file\n", __func__, name.data());
-                WHISPER_LOG_ERROR("%s: shape: [%d, %d, %d], expected: [%d, %d, %d]\n",
-                        __func__, ne[0], ne[1], ne[2], (int) tensor->ne[0], (int) tensor->ne[1], (int) tensor->ne[2]);
-                return false;
-            }
+    whisper_mmap mapping;
+    if (!mapping.init(cache.path.c_str())) {
+        WHISPER_LOG_INFO("%s: repack cache miss, will create '%s'\n", __func__, cache.path.c_str());
+        return;
+    }
 
-            if (tensor->ne[0] != ne[0] || tensor->ne[1] != ne[1] || tensor->ne[2] != ne[2]) {
-                WHISPER_LOG_ERROR("%s: tensor '%s' has wrong shape in model file: got [%d, %d, %d], expected [%d, %d, %d]\n",
-                        __func__, name.data(), (int) tensor->ne[0], (int) tensor->ne[1], (int) tensor->ne[2], ne[0], ne[1], ne[2]);
-                return false;
-            }
+    // validate the whole file before touching the tensors
+    const size_t n_tensors = tensors.size();
 
-            const size_t bpe = ggml_type_size(ggml_type(ttype));
+    whisper_repack_cache_header header = {};
 
-            if ((nelements*bpe)/ggml_blck_size(tensor->type) != ggml_nbytes(tensor)) {
-                WHISPER_LOG_ERROR("%s: tensor '%s' has wrong size in model file: got %zu, expected %zu\n",
-                        __func__, name.data(), ggml_nbytes(tensor), nelements*bpe);
-                return false;
-            }
+    std::vector<uint64_t> entries(2*n_tensors);
 
-            //ggml_backend_t backend = wctx.backend;
+    bool ok = mapping.read(&header, sizeof(header)) == sizeof(header) &&
+        header.magic     == WHISPER_REPACK_CACHE_MAGIC   &&
+        header.version   == WHISPER_REPACK_CACHE_VERSION &&
+        memcmp(header.key, cache.key.data(), WHISPER_CACHE_KEY_SIZE) == 0 &&
+        header.n_tensors == n_tensors &&
+        mapping.read(entries.data(), entries.size()*sizeof(uint64_t)) == entries.size()*sizeof(uint64_t);
 
-            //printf("%s: [%5.5s] %s\n", __func__, ggml_backend_name(backend), name.c_str());
+    for (size_t i = 0; ok && i < n_tensors; ++i) {
+        const uint64_t offs = entries[2*i + 0];
+        const uint64_t size = entries[2*i + 1];
 
-            if (ggml_backend_buffer_is_host(model.buffer)) {
-                // for the CPU and Metal backend, we can read directly into the tensor
-                loader->read(loader->context, tensor->data, ggml_nbytes(tensor));
-                BYTESWAP_TENSOR(tensor);
-            } else {
-                // read into a temporary buffer first, then copy to device memory
-                read_buf.resize(ggml_nbytes(tensor));
+        ok = size == ggml_backend_buft_get_alloc_size(ggml_backend_buffer_get_type(tensors[i]->buffer), tensors[i]) &&
+             offs + size <= mapping.size;
+    }
 
-                loader->read(loader->context, read_buf.data(), read_buf.size());
+    if (!ok) {
+        WHISPER_LOG_WARN("%s: invalid repack cache '%s' - it will be recreated\n", __func__, cache.path.c_str());
+        return;
+    }
 
-                ggml_backend_tensor_set(tensor, read_buf.data(), 0, ggml_nbytes(tensor));
-            }
+    whisper_parallel_for(params.n_threads_load, n_tensors, [&](int /*ith*/, int i) {
+        memcpy(tensors[i]->data, (const uint8_t *) mapping.addr + entries[2*i + 0], entries[2*i + 1]);
+    });
 
-            //printf("%48s - [%5d, %5d, %5d], type = %6s, %6.2f MB\n", name.data(), ne[0], ne[1], ne[2], ggml_type_name((ggml_type) ttype), ggml_nbytes(tensor)/1e6);
-            total_size += ggml_nbytes(tensor);
-            model.n_loaded++;
-        }
+    cache.loaded.insert(tensors.begin(), tensors.end());
 
-        WHISPER_LOG_INFO("%s: model size    = %7.2f MB\n", __func__, total_size/1e6);
+    WHISPER_LOG_INFO("%s: loaded %zu tensors from repack cache '%s'\n", __func__, n_tensors, cache.path.c_str());
+}
 
-        if (model.n_loaded == 0) {
-            WHISPER_LOG_WARN("%s: WARN no tensors loaded from model file - assuming empty model for testing\n", __func__);
-        } else if (model.n_loaded != (int) model.tensors.size()) {
-            WHISPER_LOG_ERROR("%s: ERROR not all tensors loaded from model file - expected %zu, got %d\n", __func__, model.tensors.size(), model.n_loaded);
-            return false;
-        }
+static void whisper_repack_cache_save(const whisper_context & wctx, whisper_model_part part, const whisper_repack_cache & cache) {
+    if (cache.path.empty() || !cache.loaded.empty()) {
+        return;
     }
 
-    ggml_backend_buffer_set_usage(model.buffer, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+    const auto tensors = whisper_model_tensors_extra(wctx.model.parts[part]);
 
-    wctx.t_load_us = ggml_time_us() - t_start_us;
+    const size_t n_tensors = tensors.size();
 
-    return true;
-}
+    whisper_repack_cache_header header = {
+        /*.magic     =*/ WHISPER_REPACK_CACHE_MAGIC,
+        /*.version   =*/ WHISPER_REPACK_CACHE_VERSION,
+        /*.key       =*/ {},
+        /*.n_tensors =*/ n_tensors,
+    };
+    memcpy(header.key, cache.key.data(), WHISPER_CACHE_KEY_SIZE);
 
-static bool whisper_encode_external(const whisper_state & wstate) {
-    GGML_UNUSED(wstate);
+    std::vector<uint64_t> entries(2*n_tensors);
 
-#ifndef WHISPER_USE_COREML
-    const bool use_coreml = false;
-#else
-    const bool use_coreml = wstate.ctx_coreml != nullptr;
-#endif
+    size_t offs = GGML_PAD(sizeof(header) + entries.size()*sizeof(uint64_t), WHISPER_REPACK_CACHE_ALIGN);
+    for (size_t i = 0; i < n_tensors; ++i) {
+        const size_t size = ggml_backend_buft_get_alloc_size(ggml_backend_buffer_get_type(tensors[i]->buffer), tensors[i]);
 
-#ifndef WHISPER_USE_OPENVINO
-    const bool use_openvino = false;
-#else
-    const bool use_openvino = wstate.ctx_openvino != nullptr;
-#endif
+        entries[2*i + 0] = offs;
+        entries[2*i + 1] = size;
 
-    return use_coreml || use_openvino;
-}
+        offs = GGML_PAD(offs + size, WHISPER_REPACK_CACHE_ALIGN);
+    }
 
-static struct ggml_cgraph * whisper_build_graph_conv(
-        whisper_context & wctx,
-          whisper_state & wstate) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+    // write to a temporary file first, so that concurrent loads never see a partial cache
+    const std::string path_tmp = cache.path + ".tmp" + std::to_string(ggml_time_us());
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
-    const int n_state = hparams.n_audio_state; GGML_UNUSED(n_state);
+    {
+        std::ofstream fout(path_tmp, std::ios::binary);
 
-    const int n_mels = hparams.n_mels;
+        fout.write((const char *) &header, sizeof(header));
+        fout.write((const char *) entries.data(), entries.size()*sizeof(uint64_t));
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_conv.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_conv.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
+        const char zeros[WHISPER_REPACK_CACHE_ALIGN] = {};
 
-    struct ggml_context * ctx0 = ggml_init(params);
+        for (size_t i = 0; i < n_tensors; ++i) {
+            fout.write(zeros, entries[2*i + 0] - fout.tellp());
+            fout.write((const char *) tensors[i]->data, entries[2*i + 1]);
+        }
 
-    ggml_cgraph * gf = ggml_new_graph(ctx0);
+        if (!fout) {
+            WHISPER_LOG_WARN("%s: failed to write repack cache '%s'\n", __func__, path_tmp.c_str());
+            fout.close();
+            std::remove(path_tmp.c_str());
+            return;
+        }
+    }
 
-    struct ggml_tensor * mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels);
-    ggml_set_name(mel, "mel");
-    ggml_set_input(mel);
+    if (std::rename(path_tmp.c_str(), cache.path.c_str()) != 0) {
+        WHISPER_LOG_WARN("%s: failed to create repack cache '%s'\n", __func__, cache.path.c_str());
+        std::remove(path_tmp.c_str());
+        return;
+    }
 
-    struct ggml_tensor * cur = nullptr;
+    WHISPER_LOG_INFO("%s: saved %zu tensors to repack cache '%s'\n", __func__, n_tensors, cache.path.c_str());
+}
 
-    if (!whisper_encode_external(wstate)) {
-        // convolution + gelu
-        {
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_1_w, mel, 1, 1);
-            cur = ggml_add(ctx0, cur, model.e_conv_1_b);
+// index all tensor records of a mapped ggml file without touching their data
+static bool whisper_model_index_tensors_mmap(struct whisper_model_loader * loader, whisper_model & model, std::vector<whisper_tensor_record> & records) {
+    auto & mapping = *model.mapping;
 
-            cur = ggml_gelu(ctx0, cur);
+    records.reserve(model.tensors.size());
 
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_2_w, cur, 2, 1);
-            cur = ggml_add(ctx0, cur, model.e_conv_2_b);
+    std::set<const ggml_tensor *> seen;
 
-            cur = ggml_gelu(ctx0, cur);
+    while (true) {
+        ggml_tensor * tensor = nullptr;
+
+        if (!whisper_model_read_tensor_header(loader, model, tensor)) {
+            return false;
         }
 
-        ggml_set_name(cur, "embd_conv");
-        wstate.embd_conv = cur;
-    } else {
-        ggml_build_forward_expand(gf, mel);
+        if (tensor == nullptr) {
+            break;
+        }
 
-        cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
-        ggml_set_input(cur); // the external encoder will write into this tensor
+        const size_t offs = mapping.offs;
 
-        ggml_set_name(cur, "embd_enc");
-        wstate.embd_enc = cur;
-    }
+        if (offs + ggml_nbytes(tensor) > mapping.size) {
+            WHISPER_LOG_ERROR("%s: tensor '%s' data is not within the file bounds\n", __func__, ggml_get_name(tensor));
+            return false;
+        }
 
-    ggml_set_output(cur);
+        if (!seen.insert(tensor).second) {
+            WHISPER_LOG_ERROR("%s: duplicate tensor '%s' in model file\n", __func__, ggml_get_name(tensor));
+            return false;
+        }
 
-    ggml_build_forward_expand(gf, cur);
+        records.push_back({ tensor, offs });
 
-    ggml_free(ctx0);
+        mapping.offs += ggml_nbytes(tensor);
+    }
 
-    return gf;
+    return true;
 }
 
-static struct ggml_cgraph * whisper_build_graph_encoder(
-        whisper_context & wctx,
-          whisper_state & wstate) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+// assign the tensor records to the model parts, so that each part can be loaded on its own
+static void whisper_model_set_records(whisper_model & model, const std::vector<whisper_tensor_record> & records) {
+    for (const auto & record : records) {
+        model.parts[whisper_model_tensor_part(ggml_get_name(record.tensor))].records.push_back(record);
+    }
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
-    const int n_state = hparams.n_audio_state;
-    const int n_head  = hparams.n_audio_head;
-    const int n_layer = hparams.n_audio_layer;
+    model.n_loaded = records.size();
+}
 
-    const int n_state_head = n_state/n_head;
+// read the data of the tensors of the part from the model file - from the mapping if there is one, otherwise with
+// one stream per thread
+static bool whisper_model_read_part(whisper_context & wctx, whisper_model_part part, const whisper_repack_cache & cache) {
+    auto & model   = wctx.model;
+    auto & weights = model.parts[part];
 
-    auto & kv_pad = wstate.kv_pad;
+    std::vector<whisper_tensor_record> records;
+    for (const auto & record : weights.records) {
+        if ((!model.buffer_mmap || record.tensor->buffer != model.buffer_mmap) && cache.loaded.count(record.tensor) == 0) {
+            records.push_back(record);
+        }
+    }
 
-    WHISPER_ASSERT(!!kv_pad.buffer);
+    // the tensors are independent, so they are set in parallel for the CPU backend - with the other backends, the
+    // uploads are kept on the main thread
+    const int n_threads = whisper_buft_is_cpu(whisper_default_buffer_type(wctx.params)) ? wctx.params.n_threads_load : 1;
 
-    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+    if (model.mapping) {
+        auto & mapping = *model.mapping;
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_encode.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_encode.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
+        // note: for the tensors in the extra buffer types, this converts the data to their layout
+        whisper_parallel_for(n_threads, records.size(), [&](int /*ith*/, int i) {
+            const auto & record = records[i];
 
-    struct ggml_context * ctx0 = ggml_init(params);
+            ggml_backend_tensor_set(record.tensor, (const uint8_t *) mapping.addr + record.offs, 0, ggml_nbytes(record.tensor));
+        });
 
-    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+        return true;
+    }
 
-    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_conv);
+    std::vector<std::ifstream> streams(std::max(1, std::min(n_threads, (int) records.size())));
+    for (auto & stream : streams) {
+        stream = whisper_ifstream_open(wctx.path_model.c_str());
+        if (!stream) {
+            WHISPER_LOG_ERROR("%s: failed to open '%s'\n", __func__, wctx.path_model.c_str());
+            return false;
+        }
+    }
 
-    const float KQscale = 1.0f/sqrtf(float(n_state_head));
+    std::vector<std::vector<char>> read_bufs(streams.size());
 
-    // ===================================================================
-    // NOTE: experimenting with partial evaluation of the encoder (ignore)
-    //static int iter = -1;
-    //const int n_iter = 1500/n_ctx;
+    std::atomic<bool> ok(true);
 
-    //iter = (iter + 1) % n_iter;
+    whisper_parallel_for(n_threads, records.size(), [&](int ith, int i) {
+        ggml_tensor * tensor = records[i].tensor;
 
-    //if (iter == 0) {
-    //    memset(model.memory_cross_k->data, 0, ggml_nbytes(model.memory_cross_k));
-    //    memset(model.memory_cross_v->data, 0, ggml_nbytes(model.memory_cross_v));
-    //}
+        std::ifstream & cur = streams[ith];
 
-    static int iter = 0;
+        cur.seekg(records[i].offs);
 
-    const size_t e_pe_stride = model.e_pe->ne[0]*ggml_element_size(model.e_pe);
-    const size_t e_pe_offset = model.e_pe->ne[0]*ggml_element_size(model.e_pe)*n_ctx*iter;
+        if (ggml_backend_buffer_is_host(tensor->buffer)) {
+            cur.read((char *) tensor->data, ggml_nbytes(tensor));
+        } else {
+            auto & read_buf = read_bufs[ith];
 
-    struct ggml_tensor * e_pe = ggml_view_2d(ctx0, model.e_pe, model.e_pe->ne[0], n_ctx, e_pe_stride, e_pe_offset);
-    cur = ggml_add(ctx0, e_pe, ggml_cont(ctx0, ggml_transpose(ctx0, cur)));
+            read_buf.resize(ggml_nbytes(tensor));
 
-    // ===================================================================
+            cur.read(read_buf.data(), read_buf.size());
 
-    // original:
-    //cur = ggml_add(ctx0, model.e_pe, ggml_transpose(ctx0, cur));
+            ggml_backend_tensor_set(tensor, read_buf.data(), 0, ggml_nbytes(tensor));
+        }
 
-    struct ggml_tensor * inpL = cur;
+        if (!cur) {
+            WHISPER_LOG_ERROR("%s: failed to read tensor '%s'\n", __func__, ggml_get_name(tensor));
+            ok = false;
+        }
+    });
 
-    for (int il = 0; il < n_layer; ++il) {
-        const auto & layer = model.layers_encoder[il];
+    return ok;
+}
 
-        // norm
-        {
-            cur = ggml_norm(ctx0, inpL, hparams.eps);
+// load the weights of a part of the model from its tensor records
+// must be called with model.mutex_parts locked, unless the model is being initialized
+static bool whisper_model_load_part(whisper_context & wctx, whisper_model_part part) {
+    auto & model   = wctx.model;
+    auto & weights = model.parts[part];
 
-            // cur = ln_0_w*cur + ln_0_b
-            cur = ggml_add(ctx0,
-                    ggml_mul(ctx0, cur, layer.attn_ln_0_w),
-                    layer.attn_ln_0_b);
+    if (weights.loaded) {
+        return true;
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    if (model.mapping) {
+        for (const auto & record : weights.records) {
+            model.mapping->prefetch(record.offs, ggml_nbytes(record.tensor));
         }
+    }
 
-        // self-attention
-        {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
-                    layer.attn_q_w,
-                    cur);
+    if (!whisper_model_alloc_part(wctx, part)) {
+        whisper_model_free_part(model, part);
+        return false;
+    }
 
-            Qcur = ggml_add(ctx0, Qcur, layer.attn_q_b);
+    whisper_repack_cache cache;
+    whisper_repack_cache_init(wctx, part, cache);
 
-            //Qcur = ggml_scale(ctx0, Qcur, pow(float(n_state_head), -0.25));
+    if (!whisper_model_read_part(wctx, part, cache)) {
+        whisper_model_free_part(model, part);
+        return false;
+    }
 
-            // note: no bias for Key
-            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0,
-                    layer.attn_k_w,
-                    cur);
+    whisper_repack_cache_save(wctx, part, cache);
 
-            //Kcur = ggml_scale(ctx0, Kcur, pow(float(n_state_head), -0.25));
+    whisper_model_set_usage_weights(weights);
 
-            struct ggml_tensor * Vcur = ggml_mul_mat(ctx0,
-                    layer.attn_v_w,
-                    cur);
+    weights.loaded = true;
 
-            Vcur = ggml_add(ctx0, Vcur, layer.attn_v_b);
+    size_t total_size = 0;
+    for (const ggml_tensor * t : weights.tensors) {
+        total_size += ggml_nbytes(t);
+    }
 
-            // ------
+    const int64_t t_load_us = ggml_time_us() - t_start_us;
 
-            struct ggml_tensor * Q =
-                ggml_permute(ctx0,
-                        ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_ctx),
-                        0, 2, 1, 3);
+    WHISPER_LOG_INFO("%s: %s size  = %7.2f MB, loaded in %.2f ms\n", __func__, whisper_model_part_name(part), total_size/1e6, t_load_us/1000.0f);
 
-            if (wctx.params.flash_attn) {
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, ggml_view_1d(ctx0, kv_pad.k, n_ctx*n_state, 0)));
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, ggml_view_1d(ctx0, kv_pad.v, n_ctx*n_state, 0)));
+    wctx.t_load_us += t_load_us;
 
-                struct ggml_tensor * K =
-                    ggml_view_3d(ctx0, kv_pad.k,
-                            n_state_head, n_ctx_pad, n_head,
-                            ggml_element_size(kv_pad.k)*n_state,
-                            ggml_element_size(kv_pad.k)*n_state_head,
-                            0);
+    return true;
+}
 
-                struct ggml_tensor * V =
-                    ggml_view_3d(ctx0, kv_pad.v,
-                            n_state_head, n_ctx_pad, n_head,
-                            ggml_element_size(kv_pad.v)*n_state,
-                            ggml_element_size(kv_pad.v)*n_state_head,
-                            0);
+// load all parts of the model from the tensor records, unless they are loaded lazily
+static bool whisper_model_load_parts(whisper_context & wctx) {
+    auto & model = wctx.model;
 
-                cur = ggml_flash_attn_ext(ctx0, Q, K, V, nullptr, KQscale, 0.0f, 0.0f);
+    if (model.n_loaded == 0) {
+        WHISPER_LOG_WARN("%s: WARN no tensors loaded from model file - assuming empty model for testing\n", __func__);
+    } else if (model.n_loaded != (int) model.tensors.size()) {
+        WHISPER_LOG_ERROR("%s: ERROR not all tensors loaded from model file - expected %zu, got %d\n", __func__, model.tensors.size(), model.n_loaded);
+        return false;
+    }
 
-                cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx);
-            } else {
-                struct ggml_tensor * K =
-                    ggml_permute(ctx0,
-                            ggml_cast(ctx0,
-                                ggml_reshape_3d(ctx0, Kcur, n_state_head, n_head, n_ctx),
-                                wctx.itype),
-                            0, 2, 1, 3);
+    if (wctx.params.lazy_load) {
+        WHISPER_LOG_INFO("%s: the weights will be loaded on first use\n", __func__);
+        return true;
+    }
 
-                // K * Q
-                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
+    for (int part = 0; part < WHISPER_MODEL_PART_COUNT; ++part) {
+        if (!whisper_model_load_part(wctx, (whisper_model_part) part)) {
+            return false;
+        }
+    }
 
-                struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, nullptr, KQscale, 0.0f);
+    return true;
+}
 
-                struct ggml_tensor * V =
-                    ggml_cast(ctx0,
-                            ggml_permute(ctx0,
-                                ggml_reshape_3d(ctx0,
-                                    Vcur,
-                                    n_state_head, n_head, n_ctx),
-                                1, 2, 0, 3),
-                            wctx.itype);
+// make sure that the weights of the part are loaded - called before each computation that uses them
+static bool whisper_model_require_part(whisper_context & wctx, whisper_model_part part) {
+    std::lock_guard<std::mutex> lock(wctx.model.mutex_parts);
 
-                struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+    return whisper_model_load_part(wctx, part);
+}
 
-                struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+// validate the hyperparameters read from the model file and derive the model type and the weight type
+static bool whisper_model_init_hparams(whisper_context & wctx) {
+    auto & model   = wctx.model;
+    auto & hparams = model.hparams;
 
-                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_ctx);
-            }
-        }
+    assert(hparams.n_text_state == hparams.n_audio_state);
 
-        // projection
-        {
-            cur = ggml_mul_mat(ctx0,
-                    layer.attn_ln_1_w,
-                    cur);
+    std::string mver = "";
 
-            cur = ggml_add(ctx0, cur, layer.attn_ln_1_b);
-        }
+    if (hparams.n_audio_layer == 4) {
+        model.type = e_model::MODEL_TINY;
+    }
 
-        // add the input
-        cur = ggml_add(ctx0, cur, inpL);
+    if (hparams.n_audio_layer == 6) {
+        model.type = e_model::MODEL_BASE;
+    }
 
-        struct ggml_tensor * inpFF = cur;
+    if (hparams.n_audio_layer == 12) {
+        model.type = e_model::MODEL_SMALL;
+    }
 
-        // feed-forward network
-        {
-            // norm
-            {
-                cur = ggml_norm(ctx0, inpFF, hparams.eps);
+    if (hparams.n_audio_layer == 24) {
+        model.type = e_model::MODEL_MEDIUM;
+    }
 
-                // cur = mlp_ln_w*cur + mlp_ln_b
-                cur = ggml_add(ctx0,
-                        ggml_mul(ctx0, cur, layer.mlp_ln_w),
-                        layer.mlp_ln_b);
-            }
+    if (hparams.n_audio_layer == 32) {
+        model.type = e_model::MODEL_LARGE;
 
-            // fully connected
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_0_w,
-                    cur);
+        if (hparams.n_vocab == 51866) {
+            mver = " v3";
+        }
+    }
 
-            cur = ggml_add(ctx0, cur, layer.mlp_0_b);
+    const int32_t qntvr = hparams.ftype / GGML_QNT_VERSION_FACTOR;
 
-            // GELU activation
-            cur = ggml_gelu(ctx0, cur);
+    hparams.ftype %= GGML_QNT_VERSION_FACTOR;
 
-            // projection
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_1_w,
-                    cur);
+    // for the big tensors, we have the option to store the data in 16-bit floats or quantized
+    // in order to save memory and also to speed up the computation
+    wctx.wtype = ggml_ftype_to_ggml_type((ggml_ftype) (model.hparams.ftype));
+    if (wctx.wtype == GGML_TYPE_COUNT) {
+        WHISPER_LOG_ERROR("%s: invalid model (bad ftype value %d)\n", __func__, model.hparams.ftype);
+        return false;
+    }
 
-            cur = ggml_add(ctx0, cur, layer.mlp_1_b);
-        }
+    WHISPER_LOG_INFO("%s: n_vocab       = %d\n", __func__, hparams.n_vocab);
+    WHISPER_LOG_INFO("%s: n_audio_ctx   = %d\n", __func__, hparams.n_audio_ctx);
+    WHISPER_LOG_INFO("%s: n_audio_state = %d\n", __func__, hparams.n_audio_state);
+    WHISPER_LOG_INFO("%s: n_audio_head  = %d\n", __func__, hparams.n_audio_head);
+    WHISPER_LOG_INFO("%s: n_audio_layer = %d\n", __func__, hparams.n_audio_layer);
+    WHISPER_LOG_INFO("%s: n_text_ctx    = %d\n", __func__, hparams.n_text_ctx);
+    WHISPER_LOG_INFO("%s: n_text_state  = %d\n", __func__, hparams.n_text_state);
+    WHISPER_LOG_INFO("%s: n_text_head   = %d\n", __func__, hparams.n_text_head);
+    WHISPER_LOG_INFO("%s: n_text_layer  = %d\n", __func__, hparams.n_text_layer);
+    WHISPER_LOG_INFO("%s: n_mels        = %d\n", __func__, hparams.n_mels);
+    WHISPER_LOG_INFO("%s: ftype         = %d\n", __func__, model.hparams.ftype);
+    WHISPER_LOG_INFO("%s: qntvr         = %d\n", __func__, qntvr);
+    WHISPER_LOG_INFO("%s: type          = %d (%s%s)\n", __func__, model.type, g_model_name.at(model.type).c_str(), mver.c_str());
 
-        inpL = ggml_add(ctx0, cur, inpFF);
-    }
+    return true;
+}
 
-    cur = inpL;
+// finalize the vocab after the first n_vocab tokens have been read from the model file
+static void whisper_vocab_init(whisper_context & wctx, int32_t n_vocab) {
+    const auto & model = wctx.model;
 
-    // norm
-    {
-        cur = ggml_norm(ctx0, cur, hparams.eps);
+    auto & vocab = wctx.vocab;
 
-        // cur = ln_f_g*cur + ln_f_b
-        cur = ggml_add(ctx0,
-                ggml_mul(ctx0, cur, model.e_ln_w),
-                model.e_ln_b);
+    std::string word;
+
+    vocab.n_vocab = model.hparams.n_vocab;
+    if (vocab.is_multilingual()) {
+        vocab.token_eot++;
+        vocab.token_sot++;
+
+        // account for variable number of language tokens
+        const int dt = vocab.num_languages() - 98;
+
+        vocab.token_translate  += dt;
+        vocab.token_transcribe += dt;
+        vocab.token_solm       += dt;
+        vocab.token_prev       += dt;
+        vocab.token_nosp       += dt;
+        vocab.token_not        += dt;
+        vocab.token_beg        += dt;
+    }
+
+    if (n_vocab < model.hparams.n_vocab) {
+        WHISPER_LOG_INFO("%s: adding %d extra tokens\n", __func__, model.hparams.n_vocab - n_vocab);
+        for (int i = n_vocab; i < model.hparams.n_vocab; i++) {
+            if (i > vocab.token_beg) {
+                word = "[_TT_" + std::to_string(i - vocab.token_beg) + "]";
+            } else if (i == vocab.token_eot) {
+                word = "[_EOT_]";
+            } else if (i == vocab.token_sot) {
+                word = "[_SOT_]";
+            } else if (i == vocab.token_translate) {
+                word = "[_TRANSLATE_]";
+            } else if (i == vocab.token_transcribe) {
+                word = "[_TRANSCRIBE_]";
+            } else if (i == vocab.token_solm) {
+                word = "[_SOLM_]";
+            } else if (i == vocab.token_prev) {
+                word = "[_PREV_]";
+            } else if (i == vocab.token_nosp) {
+                word = "[_NOSP_]";
+            } else if (i == vocab.token_not) {
+                word = "[_NOT_]";
+            } else if (i == vocab.token_beg) {
+                word = "[_BEG_]";
+            } else if (i > vocab.token_sot && i <= vocab.token_sot + vocab.num_languages()) {
+                word = "[_LANG_" + std::string(whisper_lang_str(i - vocab.token_sot - 1)) + "]";
+            } else {
+                word = "[_extra_token_" + std::to_string(i) + "]";
+            }
+            vocab.add(word);
+        }
     }
 
-    ggml_build_forward_expand(gf, cur);
+    vocab.token_space = vocab.find(" ");
 
-    wstate.embd_enc = cur;
+    WHISPER_LOG_INFO("%s: n_langs       = %d\n", __func__, vocab.num_languages());
+}
 
-    //ggml_graph_print(gf);
+// create the ggml context and the tensors of the model weights (without allocating their data)
+static bool whisper_model_init_tensors(whisper_context & wctx) {
+    auto & model = wctx.model;
 
-    ////////////////////////////////////////////////////////////////////////////
+    const ggml_type wtype = wctx.wtype;
+    const ggml_type vtype = wctx.wtype == GGML_TYPE_F32 ? GGML_TYPE_F32 : GGML_TYPE_F16; // conv type
 
-    //printf("%s: used_mem = %f MB, %f MB, %f MB %f MB %f MB\n", __func__,
-    //        ggml_used_mem(ctx0)/1e6,
-    //        wstate.get_buf_max_mem(0)/1e6,
-    //        wstate.get_buf_max_mem(1)/1e6,
-    //        wstate.get_buf_max_mem(2)/1e6,
-    //        wstate.get_buf_max_mem(3)/1e6);
+    // create the ggml context
+    {
+        const auto & hparams = model.hparams;
 
-    ggml_free(ctx0);
+        const int n_audio_layer = hparams.n_audio_layer;
+        const int n_text_layer  = hparams.n_text_layer;
 
-    return gf;
-}
+        const size_t n_tensors = 10 /* input */ + 15 + 15*n_audio_layer + 24*n_text_layer;
 
-// pre-compute cross-attention memory
-static struct ggml_cgraph * whisper_build_graph_cross(
-        whisper_context & wctx,
-          whisper_state & wstate) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+        struct ggml_init_params params = {
+            /*.mem_size   =*/ n_tensors*ggml_tensor_overhead(),
+            /*.mem_buffer =*/ nullptr,
+            /*.no_alloc   =*/ true,
+        };
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
-    const int n_state = hparams.n_audio_state;
-    const int n_head  = hparams.n_audio_head;
+        model.ctx = ggml_init(params);
+        if (!model.ctx) {
+            WHISPER_LOG_ERROR("%s: ggml_init() failed\n", __func__);
+            return false;
+        }
+    }
 
-    const int n_state_head = n_state/n_head;
+    // prepare tensors for the weights
+    {
+        auto & ctx = model.ctx;
 
-    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+        const auto & hparams = model.hparams;
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_cross.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_cross.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
+        const int n_vocab = hparams.n_vocab;
 
-    struct ggml_context * ctx0 = ggml_init(params);
+        const int n_audio_ctx   = hparams.n_audio_ctx;
+        const int n_audio_state = hparams.n_audio_state;
+        const int n_audio_layer = hparams.n_audio_layer;
 
-    ggml_cgraph * gf = ggml_new_graph(ctx0);
+        const int n_text_ctx   = hparams.n_text_ctx;
+        const int n_text_state = hparams.n_text_state;
+        const int n_text_layer = hparams.n_text_layer;
 
-    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_enc);
+        const int n_mels = hparams.n_mels;
 
-    const float  Kscale = pow(float(n_state_head), -0.25);
+        model.layers_encoder.resize(n_audio_layer);
+        model.layers_decoder.resize(n_text_layer);
 
-    for (int il = 0; il < model.hparams.n_text_layer; ++il) {
-        auto & layer = model.layers_decoder[il];
+        // encoder
+        {
+            model.e_pe = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_audio_state, n_audio_ctx);
 
-        struct ggml_tensor * Kcross = ggml_mul_mat(ctx0,
-                layer.cross_attn_k_w,
-                cur);
+            model.e_conv_1_w     = ggml_new_tensor_3d(ctx, vtype,         3, n_mels,     n_audio_state);
+            model.e_conv_1_b     = ggml_new_tensor_2d(ctx, GGML_TYPE_F32,         1,     n_audio_state);
 
-        Kcross = ggml_scale(ctx0, Kcross, Kscale);
+            model.e_conv_2_w     = ggml_new_tensor_3d(ctx, vtype,         3, n_audio_state, n_audio_state);
+            model.e_conv_2_b     = ggml_new_tensor_2d(ctx, GGML_TYPE_F32,                1, n_audio_state);
 
-        struct ggml_tensor * Vcross = ggml_mul_mat(ctx0,
-                layer.cross_attn_v_w,
-                cur);
+            model.e_ln_w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_audio_state);
+            model.e_ln_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_audio_state);
 
-        Vcross = ggml_add(ctx0,
-                    Vcross,
-                    layer.cross_attn_v_b);
+            // map by name
+            model.tensors["encoder.positional_embedding"] = model.e_pe;
 
-        struct ggml_tensor * k;
-        struct ggml_tensor * v;
+            model.tensors["encoder.conv1.weight"]         = model.e_conv_1_w;
+            model.tensors["encoder.conv1.bias"]           = model.e_conv_1_b;
 
-        if (wctx.params.flash_attn) {
-            k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx_pad));
+            model.tensors["encoder.conv2.weight"]         = model.e_conv_2_w;
+            model.tensors["encoder.conv2.bias"]           = model.e_conv_2_b;
 
-            v = ggml_view_1d(ctx0, wstate.kv_cross.v, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.v)*n_state)*(il*n_ctx_pad));
-        } else {
-            Vcross = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcross, n_state, n_ctx));
+            model.tensors["encoder.ln_post.weight"]       = model.e_ln_w;
+            model.tensors["encoder.ln_post.bias"]         = model.e_ln_b;
 
-            k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx));
+            for (int i = 0; i < n_audio_layer; ++i) {
+                auto & layer = model.layers_encoder[i];
 
-            v = ggml_view_2d(ctx0, wstate.kv_cross.v, n_ctx, n_state,
-                    (   n_ctx)*ggml_element_size(wstate.kv_cross.v),
-                    (il*n_ctx)*ggml_element_size(wstate.kv_cross.v)*n_state);
-        }
+                layer.mlp_ln_w    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
+                layer.mlp_ln_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
-        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcross, k));
-        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcross, v));
-    }
+                layer.mlp_0_w     = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, 4*n_audio_state);
+                layer.mlp_0_b     = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 4*n_audio_state);
 
-    //ggml_graph_print(gf);
+                layer.mlp_1_w     = ggml_new_tensor_2d(ctx, wtype,         4*n_audio_state, n_audio_state);
+                layer.mlp_1_b     = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
-    ggml_free(ctx0);
+                layer.attn_ln_0_w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
+                layer.attn_ln_0_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
-    return gf;
-}
+                layer.attn_q_w    = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
+                layer.attn_q_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
-// evaluate the encoder with the given state
-//
-// given audio recording (more specifically, its log mel spectrogram), runs forward pass of the encoder
-// part of the transformer model and returns the encoded features
-//
-//   - wctx:      the model
-//   - wstate:     the state of the encoder
-//   - n_threads:  number of threads to use
-//   - mel_offset: offset in the mel spectrogram (i.e. audio offset)
-//
-static bool whisper_encode_internal(
-        whisper_context & wctx,
-          whisper_state & wstate,
-              const int   mel_offset,
-              const int   n_threads,
-    ggml_abort_callback   abort_callback,
-                   void * abort_callback_data) {
-    const int64_t t_start_us = ggml_time_us();
+                layer.attn_k_w    = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
 
-    // conv
-    {
-        auto & sched = wstate.sched_conv.sched;
+                layer.attn_v_w    = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
+                layer.attn_v_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
-        ggml_cgraph * gf = whisper_build_graph_conv(wctx, wstate);
+                layer.attn_ln_1_w = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
+                layer.attn_ln_1_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
-        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-            // should never happen as we pre-allocate the memory
-            return false;
-        }
+                // map by name
+                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp_ln.weight"]     = layer.mlp_ln_w;
+                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp_ln.bias"]       = layer.mlp_ln_b;
 
-        struct ggml_tensor * mel = ggml_graph_get_tensor(gf, "mel");
+                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp.0.weight"]      = layer.mlp_0_w;
+                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp.0.bias"]        = layer.mlp_0_b;
 
-        // set the input
-        {
-            const auto & mel_inp = wstate.mel;
-            const int n_ctx      = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp.2.weight"]      = layer.mlp_1_w;
+                model.tensors["encoder.blocks." + std::to_string(i) + ".mlp.2.bias"]        = layer.mlp_1_b;
 
-            assert(mel->type == GGML_TYPE_F32);
-            assert(mel_inp.n_mel == wctx.model.hparams.n_mels);
+                model.tensors["encoder.blocks." + std::to_string(i) + ".attn_ln.weight"]    = layer.attn_ln_0_w;
+                model.tensors["encoder.blocks." + std::to_string(i) + ".attn_ln.bias"]      = layer.attn_ln_0_b;
 
-            wstate.inp_mel.resize(ggml_nelements(mel));
+                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.query.weight"] = layer.attn_q_w;
+                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.query.bias"]   = layer.attn_q_b;
 
-            float * dst = wstate.inp_mel.data();
-            memset(dst, 0, ggml_nbytes(mel));
+                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.key.weight"]   = layer.attn_k_w;
 
-            const int i0 = std::min(mel_offset,           mel_inp.n_len);
-            const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
+                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.value.weight"] = layer.attn_v_w;
+                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.value.bias"]   = layer.attn_v_b;
 
-            for (int j = 0; j < mel_inp.n_mel; ++j) {
-                for (int i = i0; i < i1; ++i) {
-                    dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
-                }
+                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.out.weight"]   = layer.attn_ln_1_w;
+                model.tensors["encoder.blocks." + std::to_string(i) + ".attn.out.bias"]     = layer.attn_ln_1_b;
             }
-
-            ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
         }
 
-        if (!whisper_encode_external(wstate)) {
-            if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
-                return false;
-            }
-        } else {
-#if defined(WHISPER_USE_COREML)
-            whisper_coreml_encode(wstate.ctx_coreml, mel->ne[0], mel->ne[1], (float *) mel->data, (float *) wstate.embd_enc->data);
-#elif defined(WHISPER_USE_OPENVINO)
-            whisper_openvino_encode(wstate.ctx_openvino, mel, wstate.embd_enc);
-#endif
-        }
-    }
-
-    // encoder
-    if (!whisper_encode_external(wstate)) {
-        auto & sched = wstate.sched_encode.sched;
+        // decoder
+        {
+            model.d_pe   = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_text_state, n_text_ctx);
 
-        ggml_cgraph * gf = whisper_build_graph_encoder(wctx, wstate);
+            model.d_te   = ggml_new_tensor_2d(ctx, wtype,         n_text_state, n_vocab);
 
-        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-            // should never happen as we pre-allocate the memory
-            return false;
-        }
+            model.d_ln_w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_text_state);
+            model.d_ln_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_text_state);
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
-            return false;
-        }
-    }
+            // map by name
+            model.tensors["decoder.positional_embedding"]   = model.d_pe;
 
-    // cross
-    {
-        auto & sched = wstate.sched_cross.sched;
+            model.tensors["decoder.token_embedding.weight"] = model.d_te;
 
-        ggml_cgraph * gf = whisper_build_graph_cross(wctx, wstate);
+            model.tensors["decoder.ln.weight"]              = model.d_ln_w;
+            model.tensors["decoder.ln.bias"]                = model.d_ln_b;
 
-        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-            // should never happen as we pre-allocate the memory
-            return false;
-        }
+            for (int i = 0; i < n_text_layer; ++i) {
+                auto & layer = model.layers_decoder[i];
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
-            return false;
-        }
-    }
+                layer.mlp_ln_w          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+                layer.mlp_ln_b          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-    wstate.t_encode_us += ggml_time_us() - t_start_us;
-    wstate.n_encode++;
+                layer.mlp_0_w           = ggml_new_tensor_2d(ctx, wtype,           n_text_state, 4*n_text_state);
+                layer.mlp_0_b           = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 4*n_text_state);
 
-    return !(abort_callback && abort_callback(abort_callback_data));
-}
+                layer.mlp_1_w           = ggml_new_tensor_2d(ctx, wtype,         4*n_text_state, n_text_state);
+                layer.mlp_1_b           = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-static struct ggml_cgraph * whisper_build_graph_decoder(
-         whisper_context & wctx,
-         whisper_state   & wstate,
-     const whisper_batch & batch,
-                    bool   save_alignment_heads_QKs,
-                    bool   worst_case) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+                layer.attn_ln_0_w       = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+                layer.attn_ln_0_b       = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-    auto & kv_self = wstate.kv_self;
+                layer.attn_q_w          = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.attn_q_b          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-    WHISPER_ASSERT(!!kv_self.buffer);
+                layer.attn_k_w          = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
 
-    const int n_ctx   = kv_self.size;
-    const int n_state = hparams.n_text_state;
-    const int n_head  = hparams.n_text_head;
-    const int n_layer = hparams.n_text_layer;
+                layer.attn_v_w          = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.attn_v_b          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-    const int n_state_head = n_state/n_head;
+                layer.attn_ln_1_w       = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.attn_ln_1_b       = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-    const int n_tokens    = batch.n_tokens;
-    const int n_audio_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+                layer.cross_attn_ln_0_w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
+                layer.cross_attn_ln_0_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-    const int n_audio_ctx_pad = GGML_PAD(n_audio_ctx, 256);
+                layer.cross_attn_q_w    = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.cross_attn_q_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-    const int32_t n_kv    = worst_case ? n_ctx            : kv_self.n;
-    const int32_t kv_head = worst_case ? n_ctx - n_tokens : kv_self.head;
+                layer.cross_attn_k_w    = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
 
-    //WHISPER_LOG_DEBUG("%s: n_past = %d, n_tokens = %d, n_audio_ctx = %d, n_ctx = %d\n", __func__, n_past, n_tokens, n_audio_ctx, n_ctx);
+                layer.cross_attn_v_w    = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.cross_attn_v_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_decode.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_decode.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
+                layer.cross_attn_ln_1_w = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.cross_attn_ln_1_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-    struct ggml_context * ctx0 = ggml_init(params);
+                // map by name
+                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp_ln.weight"]           = layer.mlp_ln_w;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp_ln.bias"]             = layer.mlp_ln_b;
 
-    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp.0.weight"]            = layer.mlp_0_w;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp.0.bias"]              = layer.mlp_0_b;
 
-    struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
-    ggml_set_name(embd, "embd");
-    ggml_set_input(embd);
+                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp.2.weight"]            = layer.mlp_1_w;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".mlp.2.bias"]              = layer.mlp_1_b;
 
-    struct ggml_tensor * position = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
-    ggml_set_name(position, "position");
-    ggml_set_input(position);
+                model.tensors["decoder.blocks." + std::to_string(i) + ".attn_ln.weight"]          = layer.attn_ln_0_w;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".attn_ln.bias"]            = layer.attn_ln_0_b;
 
-    const float KQscale = pow(float(n_state_head), -0.25);
+                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.query.weight"]       = layer.attn_q_w;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.query.bias"]         = layer.attn_q_b;
 
-    struct ggml_tensor * KQ_mask = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_kv, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD), 1);
-    ggml_set_name(KQ_mask, "KQ_mask");
-    ggml_set_input(KQ_mask);
+                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.key.weight"]         = layer.attn_k_w;
 
-    struct ggml_tensor * KQ_mask_f16 = ggml_cast(ctx0, KQ_mask, GGML_TYPE_F16);
+                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.value.weight"]       = layer.attn_v_w;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.value.bias"]         = layer.attn_v_b;
 
-    // token encoding + position encoding
-    struct ggml_tensor * cur =
-        ggml_add(ctx0,
-                ggml_get_rows(ctx0, model.d_te, embd),
-                ggml_get_rows(ctx0, model.d_pe, position));
+                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.out.weight"]         = layer.attn_ln_1_w;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".attn.out.bias"]           = layer.attn_ln_1_b;
 
-    struct ggml_tensor * inpL = cur;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn_ln.weight"]    = layer.cross_attn_ln_0_w;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn_ln.bias"]      = layer.cross_attn_ln_0_b;
 
-    // [EXPERIMENTAL] Token-level timestamps with DTW
-    struct ggml_tensor * aheads_cross_QKs = nullptr;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.query.weight"] = layer.cross_attn_q_w;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.query.bias"]   = layer.cross_attn_q_b;
 
-    for (int il = 0; il < n_layer; ++il) {
-        const auto & layer = model.layers_decoder[il];
+                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.key.weight"]   = layer.cross_attn_k_w;
 
-        // norm
-        {
-            cur = ggml_norm(ctx0, inpL, hparams.eps);
+                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.value.weight"] = layer.cross_attn_v_w;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.value.bias"]   = layer.cross_attn_v_b;
 
-            // cur = ln_0_w*cur + ln_0_b
-            cur = ggml_add(ctx0,
-                    ggml_mul(ctx0,
-                        cur,
-                        layer.attn_ln_0_w),
-                    layer.attn_ln_0_b);
+                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.out.weight"]   = layer.cross_attn_ln_1_w;
+                model.tensors["decoder.blocks." + std::to_string(i) + ".cross_attn.out.bias"]     = layer.cross_attn_ln_1_b;
+            }
         }
+    }
 
-        // self-attention
-        {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
-                    layer.attn_q_w,
-                    cur);
+    for (auto & t : model.tensors) {
+        ggml_set_name(t.second, t.first.c_str());
+    }
 
-            Qcur = ggml_add(ctx0,
-                        Qcur,
-                        layer.attn_q_b);
+    for (ggml_tensor * t = ggml_get_first_tensor(model.ctx); t != nullptr; t = ggml_get_next_tensor(model.ctx, t)) {
+        model.parts[whisper_model_tensor_part(ggml_get_name(t))].tensors.push_back(t);
+    }
 
-            Qcur = ggml_scale(ctx0, Qcur, KQscale);
+    return true;
+}
 
-            // note: no bias for Key
-            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0,
-                    layer.attn_k_w,
-                    cur);
+// "GGUF" read as a little-endian uint32
+#define WHISPER_GGUF_MAGIC 0x46554747
+
+// keys of the whisper metadata in GGUF model files (see examples/convert-gguf)
+#define WHISPER_GGUF_KEY_ARCH          "general.architecture"
+#define WHISPER_GGUF_KEY_FTYPE         "general.file_type"
+#define WHISPER_GGUF_KEY_QNTVR         "general.quantization_version"
+#define WHISPER_GGUF_KEY_N_VOCAB       "whisper.vocab_size"
+#define WHISPER_GGUF_KEY_N_AUDIO_CTX   "whisper.audio.context_length"
+#define WHISPER_GGUF_KEY_N_AUDIO_STATE "whisper.audio.embedding_length"
+#define WHISPER_GGUF_KEY_N_AUDIO_HEAD  "whisper.audio.head_count"
+#define WHISPER_GGUF_KEY_N_AUDIO_LAYER "whisper.audio.block_count"
+#define WHISPER_GGUF_KEY_N_TEXT_CTX    "whisper.text.context_length"
+#define WHISPER_GGUF_KEY_N_TEXT_STATE  "whisper.text.embedding_length"
+#define WHISPER_GGUF_KEY_N_TEXT_HEAD   "whisper.text.head_count"
+#define WHISPER_GGUF_KEY_N_TEXT_LAYER  "whisper.text.block_count"
+#define WHISPER_GGUF_KEY_N_MELS        "whisper.mel_count"
+#define WHISPER_GGUF_KEY_FILTERS_N_MEL "whisper.mel_filters.n_mel"
+#define WHISPER_GGUF_KEY_FILTERS_N_FFT "whisper.mel_filters.n_fft"
+#define WHISPER_GGUF_KEY_FILTERS       "whisper.mel_filters"
+#define WHISPER_GGUF_KEY_TOKEN_LEN     "whisper.vocab.token_len"
+#define WHISPER_GGUF_KEY_TOKEN_DATA    "whisper.vocab.token_data"
 
-            Kcur = ggml_scale(ctx0, Kcur, KQscale);
+// load the model from a ggml file
+//
+// file format:
+//
+//   - hparams
+//   - pre-computed mel filters
+//   - vocab
+//   - weights
+//
+// see the convert-pt-to-ggml.py script for details
+//
+static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx) {
+    WHISPER_LOG_INFO("%s: loading model\n", __func__);
 
-            // store key and value to memory
-            {
-                struct ggml_tensor * Vcur = ggml_mul_mat(ctx0,
-                        layer.attn_v_w,
-                        cur);
+    const int64_t t_start_us = ggml_time_us();
 
-                Vcur = ggml_add(ctx0,
-                            Vcur,
-                            layer.attn_v_b);
+    wctx.t_start_us = t_start_us;
 
-                struct ggml_tensor * k;
-                struct ggml_tensor * v;
+    auto & model = wctx.model;
+    auto & vocab = wctx.vocab;
 
-                if (wctx.params.flash_attn) {
-                    k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+    // verify magic
+    {
+        uint32_t magic;
+        read_safe(loader, magic);
+        if (magic == WHISPER_GGUF_MAGIC) {
+            WHISPER_LOG_ERROR("%s: GGUF models can only be loaded from a file (see whisper_init_from_file_with_params)\n", __func__);
+            return false;
+        }
+        if (magic != GGML_FILE_MAGIC) {
+            WHISPER_LOG_ERROR("%s: invalid model data (bad magic)\n", __func__);
+            return false;
+        }
+    }
 
-                    v = ggml_view_1d(ctx0, kv_self.v, n_tokens*n_state,
-                            (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + kv_head));
-                } else {
-                    Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_state, n_tokens));
+    //load hparams
+    {
+        auto & hparams = model.hparams;
 
-                    k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+        read_safe(loader, hparams.n_vocab);
+        read_safe(loader, hparams.n_audio_ctx);
+        read_safe(loader, hparams.n_audio_state);
+        read_safe(loader, hparams.n_audio_head);
+        read_safe(loader, hparams.n_audio_layer);
+        read_safe(loader, hparams.n_text_ctx);
+        read_safe(loader, hparams.n_text_state);
+        read_safe(loader, hparams.n_text_head);
+        read_safe(loader, hparams.n_text_layer);
+        read_safe(loader, hparams.n_mels);
+        read_safe(loader, hparams.ftype);
 
-                    v = ggml_view_2d(ctx0, kv_self.v, n_tokens, n_state,
-                            (   n_ctx)*ggml_element_size(kv_self.v),
-                            (il*n_ctx)*ggml_element_size(kv_self.v)*n_state + kv_head*ggml_element_size(kv_self.v));
-                }
+        if (!whisper_model_init_hparams(wctx)) {
+            return false;
+        }
+    }
 
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, k));
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, v));
-            }
+    // load mel filters
+    {
+        auto & filters = wctx.model.filters;
 
-            // ------
+        read_safe(loader, filters.n_mel);
+        read_safe(loader, filters.n_fft);
 
-            struct ggml_tensor * Q =
-                ggml_permute(ctx0,
-                        ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_tokens),
-                        0, 2, 1, 3);
+        filters.data.resize(filters.n_mel * filters.n_fft);
+        loader->read(loader->context, filters.data.data(), filters.data.size() * sizeof(float));
+        BYTESWAP_FILTERS(filters);
 
-            struct ggml_tensor * K =
-                ggml_view_3d(ctx0, kv_self.k,
-                        n_state_head, n_kv, n_head,
-                        ggml_element_size(kv_self.k)*n_state,
-                        ggml_element_size(kv_self.k)*n_state_head,
-                        ggml_element_size(kv_self.k)*n_state*n_ctx*il);
+        filters.init_bands();
+    }
 
-            if (wctx.params.flash_attn) {
-                struct ggml_tensor * V =
-                    ggml_view_3d(ctx0, kv_self.v,
-                            n_state_head, n_kv, n_head,
-                            ggml_element_size(kv_self.v)*n_state,
-                            ggml_element_size(kv_self.v)*n_state_head,
-                            ggml_element_size(kv_self.v)*n_state*n_ctx*il);
+    // load vocab
+    {
+        int32_t n_vocab = 0;
+        read_safe(loader, n_vocab);
 
-                cur = ggml_flash_attn_ext(ctx0, Q, K, V, KQ_mask_f16, 1.0f, 0.0f, 0.0f);
+        //if (n_vocab != model.hparams.n_vocab) {
+        //    WHISPER_LOG_ERROR("%s: invalid model file '%s' (bad vocab size %d != %d)\n",
+        //            __func__, fname.c_str(), n_vocab, model.hparams.n_vocab);
+        //    return false;
+        //}
 
-                cur = ggml_reshape_2d(ctx0, cur, n_state, n_tokens);
+        std::string word;
+        std::vector<char> tmp;
+
+        tmp.reserve(128);
+
+        vocab.reserve(std::max(n_vocab, model.hparams.n_vocab), 0);
+
+        for (int i = 0; i < n_vocab; i++) {
+            uint32_t len;
+            read_safe(loader, len);
+
+            if (len > 0) {
+                tmp.resize(len);
+                loader->read(loader->context, &tmp[0], tmp.size()); // read to buffer
+                word.assign(&tmp[0], tmp.size());
             } else {
-                // K * Q
-                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
+                // seems like we have an empty-string token in multi-language models (i = 50256)
+                //WHISPER_LOG_WARN("%s: warning: empty-string token in vocab, i = %d\n", __func__, i);
+                word = "";
+            }
 
-                struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, KQ_mask, 1.0f, 0.0f);
+            vocab.add(word);
 
-                struct ggml_tensor * V =
-                    ggml_view_3d(ctx0, kv_self.v,
-                            n_kv, n_state_head, n_head,
-                            n_ctx*ggml_element_size(kv_self.v),
-                            n_ctx*ggml_element_size(kv_self.v)*n_state_head,
-                            n_ctx*ggml_element_size(kv_self.v)*n_state*il);
+            //printf("%s: vocab[%d] = '%s'\n", __func__, i, word.c_str());
+        }
 
-                struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+        whisper_vocab_init(wctx, n_vocab);
+    }
 
-                struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+    if (!whisper_model_init_tensors(wctx)) {
+        return false;
+    }
 
-                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_tokens);
-            }
+    if (model.mapping) {
+        std::vector<whisper_tensor_record> records;
+
+        if (!whisper_model_index_tensors_mmap(loader, model, records)) {
+            return false;
         }
 
-        // projection
-        {
-            cur = ggml_mul_mat(ctx0,
-                    layer.attn_ln_1_w,
-                    cur);
+        whisper_model_set_records(model, records);
 
-            cur = ggml_add(ctx0,
-                    cur,
-                    layer.attn_ln_1_b);
+        if (!whisper_model_load_parts(wctx)) {
+            return false;
+        }
+    } else {
+        if (wctx.params.lazy_load) {
+            WHISPER_LOG_WARN("%s: lazy loading requires a GGUF model or mmap - loading all weights\n", __func__);
         }
 
-        // add the input
-        struct ggml_tensor * inpCA = ggml_add(ctx0, cur, inpL);
+        // allocate tensors in the backend buffers
+        whisper_repack_cache caches[WHISPER_MODEL_PART_COUNT];
 
-        // norm
-        {
-            cur = ggml_norm(ctx0, inpCA, hparams.eps); // note: we use inpCA here
+        for (int part = 0; part < WHISPER_MODEL_PART_COUNT; ++part) {
+            if (!whisper_model_alloc_part(wctx, (whisper_model_part) part)) {
+                return false;
+            }
 
-            // cur = ln_0_w*cur + ln_0_b
-            cur = ggml_add(ctx0,
-                    ggml_mul(ctx0,
-                        cur,
-                        layer.cross_attn_ln_0_w),
-                    layer.cross_attn_ln_0_b);
+            whisper_repack_cache_init(wctx, (whisper_model_part) part, caches[part]);
         }
 
-        // cross-attention
-        {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
-                    layer.cross_attn_q_w,
-                    cur);
+        // load weights
+        size_t total_size = 0;
 
-            Qcur = ggml_add(ctx0,
-                        Qcur,
-                        layer.cross_attn_q_b);
+        model.n_loaded = 0;
 
-            struct ggml_tensor * Q =
-                ggml_permute(ctx0,
-                        ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_tokens),
-                        0, 2, 1, 3);
+        std::vector<char> read_buf;
 
-            if (wctx.params.flash_attn) {
-                struct ggml_tensor * Kcross =
-                    ggml_view_3d(ctx0, wstate.kv_cross.k,
-                            n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx_pad*il);
+        while (true) {
+            ggml_tensor * tensor = nullptr;
 
-                struct ggml_tensor * Vcross =
-                    ggml_view_3d(ctx0, wstate.kv_cross.v,
-                            n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state,
-                            ggml_element_size(wstate.kv_cross.v)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state*n_audio_ctx_pad*il);
+            if (!whisper_model_read_tensor_header(loader, model, tensor)) {
+                return false;
+            }
 
-                cur = ggml_flash_attn_ext(ctx0, Q, Kcross, Vcross, nullptr, KQscale, 0.0f, 0.0f);
+            if (tensor == nullptr) {
+                break;
+            }
 
-                cur = ggml_reshape_2d(ctx0, cur, n_state, n_tokens);
+            if (caches[whisper_model_tensor_part(ggml_get_name(tensor))].loaded.count(tensor) > 0) {
+                // already read from the repack cache - skip the data
+                read_buf.resize(ggml_nbytes(tensor));
+
+                loader->read(loader->context, read_buf.data(), read_buf.size());
+            } else if (ggml_backend_buffer_is_host(tensor->buffer)) {
+                // for the CPU and Metal backend, we can read directly into the tensor
+                loader->read(loader->context, tensor->data, ggml_nbytes(tensor));
+                BYTESWAP_TENSOR(tensor);
             } else {
-                struct ggml_tensor * Kcross =
-                    ggml_view_3d(ctx0, wstate.kv_cross.k,
-                            n_state_head, n_audio_ctx, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx*il);
+                // read into a temporary buffer first, then copy to device memory
+                read_buf.resize(ggml_nbytes(tensor));
 
-                struct ggml_tensor * Vcross =
-                    ggml_view_3d(ctx0, wstate.kv_cross.v,
-                            n_audio_ctx, n_state_head, n_head,
-                            n_audio_ctx*ggml_element_size(wstate.kv_cross.v),
-                            n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state_head,
-                            n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state*il);
+                loader->read(loader->context, read_buf.data(), read_buf.size());
 
-                // ------
+                ggml_backend_tensor_set(tensor, read_buf.data(), 0, ggml_nbytes(tensor));
+            }
 
-                // K * Q
-                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, Kcross, Q);
+            total_size += ggml_nbytes(tensor);
+            model.n_loaded++;
+        }
 
-                struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, nullptr, KQscale, 0.0f);
+        WHISPER_LOG_INFO("%s: model size    = %7.2f MB\n", __func__, total_size/1e6);
 
-                // [EXPERIMENTAL] Token-level timestamps with DTW
-                if (wctx.params.dtw_token_timestamps) {
-                    if (wstate.aheads_masks.m[il] != nullptr) {
-                        struct ggml_tensor * aheads_KQs = ggml_reshape_2d(ctx0, KQ_soft_max, KQ_soft_max->ne[0] * KQ_soft_max->ne[1], KQ_soft_max->ne[2]);
-                        aheads_KQs = ggml_transpose(ctx0, aheads_KQs);
-                        aheads_KQs = ggml_cont(ctx0, aheads_KQs);
-                        aheads_KQs = ggml_mul_mat(ctx0, wstate.aheads_masks.m[il], aheads_KQs);
-                        aheads_KQs = ggml_transpose(ctx0, aheads_KQs);
-                        aheads_KQs = ggml_cont(ctx0, aheads_KQs);
-                        aheads_KQs = ggml_reshape_3d(ctx0, aheads_KQs, KQ_soft_max->ne[0], KQ_soft_max->ne[1], wstate.aheads_masks.m[il]->ne[1]);
-                        if (aheads_cross_QKs == NULL) {
-                            aheads_cross_QKs = aheads_KQs;
-                        } else {
-                            aheads_cross_QKs = ggml_concat(ctx0, aheads_cross_QKs, aheads_KQs, 2);
-                        }
-                    }
-                }
+        if (model.n_loaded == 0) {
+            WHISPER_LOG_WARN("%s: WARN no tensors loaded from model file - assuming empty model for testing\n", __func__);
+        } else if (model.n_loaded != (int) model.tensors.size()) {
+            WHISPER_LOG_ERROR("%s: ERROR not all tensors loaded from model file - expected %zu, got %d\n", __func__, model.tensors.size(), model.n_loaded);
+            return false;
+        }
 
-                struct ggml_tensor * KQV = ggml_mul_mat(ctx0, Vcross, KQ_soft_max);
+        for (int part = 0; part < WHISPER_MODEL_PART_COUNT; ++part) {
+            if (model.n_loaded > 0) {
+                whisper_repack_cache_save(wctx, (whisper_model_part) part, caches[part]);
+            }
 
-                struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+            whisper_model_set_usage_weights(model.parts[part]);
 
-                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_tokens);
-            }
+            model.parts[part].loaded = true;
+        }
+    }
+
+    wctx.t_load_us = ggml_time_us() - t_start_us;
+
+    return true;
+}
+
+static bool whisper_gguf_get_i32(const gguf_context * meta, const char * key, int32_t & dest) {
+    const int64_t id = gguf_find_key(meta, key);
+    if (id < 0 || gguf_get_kv_type(meta, id) != GGUF_TYPE_INT32) {
+        WHISPER_LOG_ERROR("%s: missing or invalid key '%s'\n", __func__, key);
+        return false;
+    }
+
+    dest = gguf_get_val_i32(meta, id);
+
+    return true;
+}
+
+static const void * whisper_gguf_get_arr(const gguf_context * meta, const char * key, gguf_type type, size_t n) {
+    const int64_t id = gguf_find_key(meta, key);
+    if (id < 0 || gguf_get_kv_type(meta, id) != GGUF_TYPE_ARRAY || gguf_get_arr_type(meta, id) != type || gguf_get_arr_n(meta, id) != n) {
+        WHISPER_LOG_ERROR("%s: missing or invalid array '%s'\n", __func__, key);
+        return nullptr;
+    }
+
+    return gguf_get_arr_data(meta, id);
+}
+
+// load the model from a GGUF file
+//
+// compared to the ggml format:
+//
+//   - the hparams, the mel filters and the vocab are stored as GGUF key-value pairs
+//   - the tensor data is aligned and its location is known upfront, so no pass over the file is needed to find it
+//     and the tensors can be loaded individually
+//
+// the vocab is stored as an array of token lengths and an array with the concatenated token bytes instead of a
+// GGUF string array, because the byte-level tokens are not valid C strings (e.g. the "\0" token)
+//
+static bool whisper_model_load_gguf(const char * path_model, whisper_context & wctx) {
+    WHISPER_LOG_INFO("%s: loading model\n", __func__);
+
+    const int64_t t_start_us = ggml_time_us();
+
+    wctx.t_start_us = t_start_us;
+
+    auto & model = wctx.model;
+    auto & vocab = wctx.vocab;
+
+    ggml_context * ctx_meta = nullptr;
+
+    struct gguf_init_params params = {
+        /*.no_alloc =*/ true,
+        /*.ctx      =*/ &ctx_meta,
+    };
+
+    std::unique_ptr<gguf_context, decltype(&gguf_free)> meta(gguf_init_from_file(path_model, params), &gguf_free);
+    if (!meta) {
+        WHISPER_LOG_ERROR("%s: failed to read the GGUF metadata\n", __func__);
+        return false;
+    }
+
+    std::unique_ptr<ggml_context, decltype(&ggml_free)> ctx_meta_ptr(ctx_meta, &ggml_free);
+
+    {
+        const int64_t id = gguf_find_key(meta.get(), WHISPER_GGUF_KEY_ARCH);
+        if (id < 0 || gguf_get_kv_type(meta.get(), id) != GGUF_TYPE_STRING || strcmp(gguf_get_val_str(meta.get(), id), "whisper") != 0) {
+            WHISPER_LOG_ERROR("%s: not a whisper model\n", __func__);
+            return false;
+        }
+    }
+
+    // load hparams
+    {
+        auto & hparams = model.hparams;
+
+        int32_t qntvr = 0;
+
+        if (!whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_N_VOCAB,       hparams.n_vocab)       ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_N_AUDIO_CTX,   hparams.n_audio_ctx)   ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_N_AUDIO_STATE, hparams.n_audio_state) ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_N_AUDIO_HEAD,  hparams.n_audio_head)  ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_N_AUDIO_LAYER, hparams.n_audio_layer) ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_N_TEXT_CTX,    hparams.n_text_ctx)    ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_N_TEXT_STATE,  hparams.n_text_state)  ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_N_TEXT_HEAD,   hparams.n_text_head)   ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_N_TEXT_LAYER,  hparams.n_text_layer)  ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_N_MELS,        hparams.n_mels)        ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_FTYPE,         hparams.ftype)         ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_QNTVR,         qntvr)) {
+            return false;
+        }
+
+        hparams.ftype += qntvr*GGML_QNT_VERSION_FACTOR;
+
+        if (!whisper_model_init_hparams(wctx)) {
+            return false;
+        }
+    }
+
+    // load mel filters
+    {
+        auto & filters = wctx.model.filters;
+
+        if (!whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_FILTERS_N_MEL, filters.n_mel) ||
+            !whisper_gguf_get_i32(meta.get(), WHISPER_GGUF_KEY_FILTERS_N_FFT, filters.n_fft)) {
+            return false;
+        }
+
+        const float * data = (const float *) whisper_gguf_get_arr(meta.get(), WHISPER_GGUF_KEY_FILTERS, GGUF_TYPE_FLOAT32, filters.n_mel * filters.n_fft);
+        if (!data) {
+            return false;
+        }
+
+        filters.data.assign(data, data + filters.n_mel * filters.n_fft);
+        filters.init_bands();
+    }
+
+    // load vocab
+    {
+        const int64_t id = gguf_find_key(meta.get(), WHISPER_GGUF_KEY_TOKEN_LEN);
+        if (id < 0 || gguf_get_kv_type(meta.get(), id) != GGUF_TYPE_ARRAY) {
+            WHISPER_LOG_ERROR("%s: missing or invalid array '%s'\n", __func__, WHISPER_GGUF_KEY_TOKEN_LEN);
+            return false;
+        }
+
+        const int32_t n_vocab = gguf_get_arr_n(meta.get(), id);
+
+        const uint32_t * token_len = (const uint32_t *) whisper_gguf_get_arr(meta.get(), WHISPER_GGUF_KEY_TOKEN_LEN, GGUF_TYPE_UINT32, n_vocab);
+        if (!token_len) {
+            return false;
+        }
+
+        size_t n_bytes = 0;
+        for (int i = 0; i < n_vocab; i++) {
+            n_bytes += token_len[i];
+        }
+
+        const char * token_data = (const char *) whisper_gguf_get_arr(meta.get(), WHISPER_GGUF_KEY_TOKEN_DATA, GGUF_TYPE_UINT8, n_bytes);
+        if (!token_data) {
+            return false;
+        }
+
+        vocab.reserve(std::max(n_vocab, model.hparams.n_vocab), n_bytes);
+
+        for (int i = 0; i < n_vocab; i++) {
+            vocab.add(token_data, token_len[i]);
+            token_data += token_len[i];
         }
 
-        // projection
-        {
-            cur = ggml_mul_mat(ctx0,
-                    layer.cross_attn_ln_1_w,
-                    cur);
+        whisper_vocab_init(wctx, n_vocab);
+    }
+
+    if (!whisper_model_init_tensors(wctx)) {
+        return false;
+    }
+
+    // locate the tensor data
+    std::vector<whisper_tensor_record> records;
+
+    {
+        const size_t data_offset = gguf_get_data_offset(meta.get());
+        const int64_t n_tensors  = gguf_get_n_tensors(meta.get());
+
+        records.reserve(n_tensors);
+
+        for (int64_t i = 0; i < n_tensors; ++i) {
+            const char * name = gguf_get_tensor_name(meta.get(), i);
+
+            if (model.tensors.find(name) == model.tensors.end()) {
+                WHISPER_LOG_ERROR("%s: unknown tensor '%s' in model file\n", __func__, name);
+                return false;
+            }
+
+            ggml_tensor * tensor = model.tensors[name];
+            ggml_tensor * cur    = ggml_get_tensor(ctx_meta, name);
+
+            if (!ggml_are_same_shape(tensor, cur)) {
+                WHISPER_LOG_ERROR("%s: tensor '%s' has wrong shape in model file: got [%d, %d, %d], expected [%d, %d, %d]\n",
+                        __func__, name, (int) cur->ne[0], (int) cur->ne[1], (int) cur->ne[2], (int) tensor->ne[0], (int) tensor->ne[1], (int) tensor->ne[2]);
+                return false;
+            }
+
+            if (tensor->type != cur->type) {
+                WHISPER_LOG_ERROR("%s: tensor '%s' has wrong type in model file: got %s, expected %s\n",
+                        __func__, name, ggml_type_name(cur->type), ggml_type_name(tensor->type));
+                return false;
+            }
+
+            records.push_back({ tensor, data_offset + gguf_get_tensor_offset(meta.get(), i) });
+        }
+    }
+
+    if (model.mapping) {
+        for (const auto & record : records) {
+            if (record.offs + ggml_nbytes(record.tensor) > model.mapping->size) {
+                WHISPER_LOG_ERROR("%s: tensor '%s' data is not within the file bounds\n", __func__, ggml_get_name(record.tensor));
+                return false;
+            }
+        }
+    }
+
+    // the tensors are read from the file (or the mapping) by whisper_model_load_part, now or on first use
+    whisper_model_set_records(model, records);
+
+    if (!whisper_model_load_parts(wctx)) {
+        return false;
+    }
+
+    wctx.t_load_us = ggml_time_us() - t_start_us;
+
+    return true;
+}
+
+static bool whisper_encode_external(const whisper_state & wstate) {
+    GGML_UNUSED(wstate);
+
+#ifndef WHISPER_USE_COREML
+    const bool use_coreml = false;
+#else
+    const bool use_coreml = wstate.ctx_coreml != nullptr;
+#endif
+
+#ifndef WHISPER_USE_OPENVINO
+    const bool use_openvino = false;
+#else
+    const bool use_openvino = wstate.ctx_openvino != nullptr;
+#endif
+
+    return use_coreml || use_openvino;
+}
+
+// log10 mel spectrogram (+ 4) of the frames [i0, i0 + n_frames), written into wstate.mel_graph.mel
+static struct ggml_cgraph * whisper_build_graph_mel(
+        whisper_context & wctx,
+          whisper_state & wstate,
+              const int   i0,
+              const int   n_frames) {
+    const auto & mg = wstate.mel_graph;
+
+    const int n_fft = wctx.model.filters.n_fft;
+    const int n_mel = wctx.model.filters.n_mel;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_mel.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_mel.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    // overlapping frames of the padded signal: [frame_size, n_frames]
+    // (the first argument of im2col is used only for the frame size)
+    struct ggml_tensor * cur = ggml_view_1d(ctx0, mg.samples, (int64_t) (n_frames - 1)*WHISPER_HOP_LENGTH + WHISPER_N_FFT,
+            (size_t) i0*WHISPER_HOP_LENGTH*ggml_element_size(mg.samples));
+
+    cur = ggml_im2col(ctx0, ggml_view_2d(ctx0, mg.basis, WHISPER_N_FFT, 1, mg.basis->nb[1], 0), cur,
+            WHISPER_HOP_LENGTH, 0, 0, 0, 1, 0, false, GGML_TYPE_F32);
+
+    // windowed DFT as a matrix multiplication: [2*n_fft, n_frames]
+    cur = ggml_mul_mat(ctx0, mg.basis, cur);
+    cur = ggml_sqr(ctx0, cur);
+
+    // power spectrum: [n_fft, n_frames]
+    cur = ggml_add(ctx0,
+            ggml_view_2d(ctx0, cur, n_fft, n_frames, cur->nb[1], 0),
+            ggml_view_2d(ctx0, cur, n_fft, n_frames, cur->nb[1], n_fft*ggml_element_size(cur)));
+
+    // mel filterbank: [n_mel, n_frames]
+    cur = ggml_mul_mat(ctx0, mg.filters, cur);
+
+    // the filters are scaled by 1e4, so this is log10(max(x, 1e-10)) + 4
+    cur = ggml_clamp(ctx0, cur, 1e-6f, FLT_MAX);
+    cur = ggml_log  (ctx0, cur);
+    cur = ggml_scale(ctx0, cur, 1.0f/logf(10.0f));
+
+    cur = ggml_cpy(ctx0, ggml_transpose(ctx0, cur),
+            ggml_view_2d(ctx0, mg.mel, n_frames, n_mel, mg.mel->nb[1], (size_t) i0*ggml_element_size(mg.mel)));
+
+    ggml_build_forward_expand(gf, cur);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// maximum of the first n_len frames of wstate.mel_graph.mel, written into wstate.mel_graph.mmax
+static struct ggml_cgraph * whisper_build_graph_mel_max(
+        whisper_context & wctx,
+          whisper_state & wstate,
+              const int   n_len) {
+    const auto & mg = wstate.mel_graph;
+
+    const int n_mel = wctx.model.filters.n_mel;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_mel.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_mel.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    struct ggml_tensor * cur = ggml_view_2d(ctx0, mg.mel, n_len, n_mel, mg.mel->nb[1], 0);
+
+    cur = ggml_pool_1d(ctx0, cur, GGML_OP_POOL_MAX, n_len, n_len, 0);
+    cur = ggml_pool_1d(ctx0, ggml_reshape_1d(ctx0, cur, n_mel), GGML_OP_POOL_MAX, n_mel, n_mel, 0);
+
+    cur = ggml_cpy(ctx0, cur, mg.mmax);
+
+    ggml_build_forward_expand(gf, cur);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// the encoder compute buffers reserved for the current audio context size
+static whisper_sched_enc & whisper_sched_enc_cur(whisper_state & wstate, int n_batch) {
+    if (n_batch > 1) {
+        return wstate.sched_enc_batch;
+    }
+
+    for (int i = 0; i < WHISPER_N_AUDIO_CTX_BUCKETS; ++i) {
+        if (wstate.exp_n_audio_ctx == g_audio_ctx_buckets[i]) {
+            return wstate.sched_enc[1 + i];
+        }
+    }
+
+    return wstate.sched_enc[0];
+}
+
+// ggml_conv_1d_ph() for an input of N sequences: [IL, IC, N] -> [OL, OC, N]
+// ggml_conv_1d() does not order the output of a batch, so for N > 1 the product is taken the other way around
+static struct ggml_tensor * whisper_conv_1d_ph(
+    struct ggml_context * ctx0,
+     struct ggml_tensor * a,
+     struct ggml_tensor * b,
+                    int   s) {
+    if (b->ne[2] == 1) {
+        return ggml_conv_1d_ph(ctx0, a, b, s, 1);
+    }
+
+    struct ggml_tensor * im2col = ggml_im2col(ctx0, a, b, s, 0, a->ne[0]/2, 0, 1, 0, false, GGML_TYPE_F16); // [N, OL, IC*K]
+
+    struct ggml_tensor * cur = ggml_mul_mat(ctx0, ggml_reshape_2d(ctx0, a, a->ne[0]*a->ne[1], a->ne[2]), im2col); // [N, OL, OC]
+
+    return ggml_cont(ctx0, ggml_permute(ctx0, cur, 1, 0, 2, 3));
+}
+
+// conv + bias + gelu of the encoder front
+// when the device of the weights implements ggml_conv_1d_direct (the CPU), it is computed without the im2col
+// intermediate - the op goes to the backend of its weights, and with mel_graph the device must also read the
+// spectrogram buffer
+static struct ggml_tensor * whisper_conv_1d_gelu(
+    struct ggml_context * ctx0,
+    const whisper_state & wstate,
+     struct ggml_tensor * a,
+     struct ggml_tensor * b,
+     struct ggml_tensor * bias,
+                    int   s) {
+    if (a->buffer) {
+        // CPU buffers wrapping host memory (mmap) have no device
+        ggml_backend_dev_t dev = ggml_backend_buft_get_device(ggml_backend_buffer_get_type(a->buffer));
+        if (dev == nullptr && ggml_backend_buffer_is_host(a->buffer)) {
+            dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+        }
+
+        struct ggml_tensor * cur = ggml_conv_1d_direct(ctx0, a, b, bias, s, a->ne[0]/2, 1, true);
+
+        const bool direct = dev != nullptr && ggml_backend_dev_supports_op(dev, cur) &&
+            (!wstate.mel_graph.active || ggml_backend_dev_supports_buft(dev, ggml_backend_buffer_get_type(wstate.mel_graph.buffer)));
+
+        if (direct) {
+            return cur;
+        }
+    }
+
+    struct ggml_tensor * cur = whisper_conv_1d_ph(ctx0, a, b, s);
+    cur = ggml_add(ctx0, cur, bias);
+
+    return ggml_gelu(ctx0, cur);
+}
+
+// input of several matrix multiplications with quantized weights on the CPU
+// the CPU backend converts the F32 input of ggml_mul_mat to the vec_dot type of the weights (e.g. Q8_0) for every
+// multiplication - quantize it once here instead and let the multiplications use it directly
+static struct ggml_tensor * whisper_mul_mat_input(
+        struct ggml_context * ctx0,
+         struct ggml_tensor * cur,
+    const std::vector<ggml_tensor *> & ws) {
+    if (ws.size() < 2 || cur->type != GGML_TYPE_F32 || !ggml_is_contiguous(cur)) {
+        return cur;
+    }
+
+    const ggml_type vec_dot_type = ggml_get_type_traits_cpu(ws[0]->type)->vec_dot_type;
+
+    for (const auto * w : ws) {
+        if (!ggml_is_quantized(w->type) || ggml_get_type_traits_cpu(w->type)->vec_dot_type != vec_dot_type) {
+            return cur;
+        }
+
+        if (!w->buffer || !ggml_backend_buffer_is_host(w->buffer)) {
+            return cur;
+        }
+
+        // CPU buffers wrapping host memory (mmap) have no device
+        ggml_backend_dev_t dev = ggml_backend_buft_get_device(ggml_backend_buffer_get_type(w->buffer));
+        if (dev != nullptr && ggml_backend_dev_type(dev) != GGML_BACKEND_DEVICE_TYPE_CPU) {
+            return cur;
+        }
+    }
+
+    if (cur->ne[0] % ggml_blck_size(vec_dot_type) != 0) {
+        return cur;
+    }
+
+    return ggml_cast(ctx0, cur, vec_dot_type);
+}
+
+// with n_batch > 1, the input holds n_batch windows of 2*n_ctx frames (see whisper_encode_batch_internal)
+static struct ggml_cgraph * whisper_build_graph_conv(
+        whisper_context & wctx,
+          whisper_state & wstate,
+              const int   mel_offset,
+              const int   n_batch) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_state = hparams.n_audio_state; GGML_UNUSED(n_state);
+
+    const int n_mels = hparams.n_mels;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ whisper_sched_enc_cur(wstate, n_batch).conv.meta.size(),
+        /*.mem_buffer =*/ whisper_sched_enc_cur(wstate, n_batch).conv.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    struct ggml_tensor * mel = nullptr;
+
+    if (wstate.mel_graph.active) {
+        WHISPER_ASSERT(n_batch == 1);
+
+        // the spectrogram is already on the backend - clamp and normalize the frames [mel_offset, mel_offset + 2*n_ctx)
+        const auto & mg = wstate.mel_graph;
+
+        const int n_len = wstate.mel.n_len;
+
+        const int i0 = std::min(mel_offset, n_len - 1);
+        const int n  = std::min(2*n_ctx, n_len - i0);
+
+        mel = ggml_view_2d(ctx0, mg.mel, n, n_mels, mg.mel->nb[1], (size_t) i0*ggml_element_size(mg.mel));
+
+        // (max(x, mmax - 8) + 4)/4 - the +4 is already in mg.mel and mg.mmax
+        mel = ggml_sub  (ctx0, mel, mg.mmax);
+        mel = ggml_clamp(ctx0, mel, -8.0f, FLT_MAX);
+        mel = ggml_add  (ctx0, mel, mg.mmax);
+        mel = ggml_scale(ctx0, mel, mel_offset < n_len ? 0.25f : 0.0f);
+
+        // zero frames past the end of the spectrogram
+        if (n < 2*n_ctx) {
+            mel = ggml_pad(ctx0, mel, 2*n_ctx - n, 0, 0, 0);
+        }
+    } else {
+        mel = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels, n_batch);
+        ggml_set_input(mel);
+    }
+
+    ggml_set_name(mel, "mel");
+
+    struct ggml_tensor * cur = nullptr;
+
+    if (!whisper_encode_external(wstate)) {
+        // convolution + gelu
+        {
+            cur = whisper_conv_1d_gelu(ctx0, wstate, model.e_conv_1_w, mel, model.e_conv_1_b, 1);
+            cur = whisper_conv_1d_gelu(ctx0, wstate, model.e_conv_2_w, cur, model.e_conv_2_b, 2);
+        }
+
+        ggml_set_name(cur, "embd_conv");
+        wstate.embd_conv = cur;
+    } else {
+        ggml_build_forward_expand(gf, mel);
+
+        cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
+        ggml_set_input(cur); // the external encoder will write into this tensor
+
+        ggml_set_name(cur, "embd_enc");
+        wstate.embd_enc = cur;
+    }
+
+    ggml_set_output(cur);
+
+    ggml_build_forward_expand(gf, cur);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+static struct ggml_cgraph * whisper_build_graph_encoder(
+        whisper_context & wctx,
+          whisper_state & wstate,
+              const int   n_batch) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_state = hparams.n_audio_state;
+    const int n_head  = hparams.n_audio_head;
+    const int n_layer = hparams.n_audio_layer;
+
+    const int n_state_head = n_state/n_head;
+
+    auto & kv_pad = wstate.kv_pad;
+
+    WHISPER_ASSERT(!!kv_pad.buffer);
+
+    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ whisper_sched_enc_cur(wstate, n_batch).encode.meta.size(),
+        /*.mem_buffer =*/ whisper_sched_enc_cur(wstate, n_batch).encode.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_conv);
+
+    const float KQscale = 1.0f/sqrtf(float(n_state_head));
+
+    // only the first n_ctx positions are used when the audio context is reduced
+    struct ggml_tensor * e_pe = ggml_view_2d(ctx0, model.e_pe, model.e_pe->ne[0], n_ctx, model.e_pe->nb[1], 0);
+
+    cur = ggml_add(ctx0, ggml_cont(ctx0, ggml_transpose(ctx0, cur)), e_pe);
+
+    // the windows of a batch are stacked, so that the matrix multiplications see n_batch*n_ctx rows
+    cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx*n_batch);
+
+    struct ggml_tensor * inpL = cur;
+
+    for (int il = 0; il < n_layer; ++il) {
+        const auto & layer = model.layers_encoder[il];
+
+        // norm
+        {
+            cur = ggml_norm(ctx0, inpL, hparams.eps);
+
+            // cur = ln_0_w*cur + ln_0_b
+            cur = ggml_add(ctx0,
+                    ggml_mul(ctx0, cur, layer.attn_ln_0_w),
+                    layer.attn_ln_0_b);
+        }
+
+        // self-attention
+        {
+            struct ggml_tensor * inpSA = whisper_mul_mat_input(ctx0, cur, { layer.attn_q_w, layer.attn_k_w, layer.attn_v_w });
+
+            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
+                    layer.attn_q_w,
+                    inpSA);
+
+            Qcur = ggml_add(ctx0, Qcur, layer.attn_q_b);
+
+            //Qcur = ggml_scale(ctx0, Qcur, pow(float(n_state_head), -0.25));
+
+            // note: no bias for Key
+            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0,
+                    layer.attn_k_w,
+                    inpSA);
+
+            //Kcur = ggml_scale(ctx0, Kcur, pow(float(n_state_head), -0.25));
+
+            struct ggml_tensor * Vcur = ggml_mul_mat(ctx0,
+                    layer.attn_v_w,
+                    inpSA);
+
+            Vcur = ggml_add(ctx0, Vcur, layer.attn_v_b);
+
+            // ------
+
+            struct ggml_tensor * Q =
+                ggml_permute(ctx0,
+                        ggml_reshape_4d(ctx0, Qcur, n_state_head, n_head, n_ctx, n_batch),
+                        0, 2, 1, 3);
+
+            if (wctx.params.flash_attn && n_batch > 1) {
+                // kv_pad holds a single window - pad the batch in the graph, with the same layout
+                Kcur = ggml_cast(ctx0, ggml_pad(ctx0, ggml_reshape_3d(ctx0, Kcur, n_state, n_ctx, n_batch), 0, n_ctx_pad - n_ctx, 0, 0), wctx.itype);
+                Vcur = ggml_cast(ctx0, ggml_pad(ctx0, ggml_reshape_3d(ctx0, Vcur, n_state, n_ctx, n_batch), 0, n_ctx_pad - n_ctx, 0, 0), wctx.itype);
+
+                struct ggml_tensor * K =
+                    ggml_view_4d(ctx0, Kcur,
+                            n_state_head, n_ctx_pad, n_head, n_batch,
+                            ggml_element_size(Kcur)*n_state,
+                            ggml_element_size(Kcur)*n_state_head,
+                            ggml_element_size(Kcur)*n_state*n_ctx_pad,
+                            0);
+
+                struct ggml_tensor * V =
+                    ggml_view_4d(ctx0, Vcur,
+                            n_state_head, n_ctx_pad, n_head, n_batch,
+                            ggml_element_size(Vcur)*n_state,
+                            ggml_element_size(Vcur)*n_state_head,
+                            ggml_element_size(Vcur)*n_state*n_ctx_pad,
+                            0);
+
+                cur = ggml_flash_attn_ext(ctx0, Q, K, V, nullptr, KQscale, 0.0f, 0.0f);
+                ggml_flash_attn_ext_set_prec(cur, GGML_PREC_F32);
+
+                cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx*n_batch);
+            } else if (wctx.params.flash_attn) {
+                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, ggml_view_1d(ctx0, kv_pad.k, n_ctx*n_state, 0)));
+                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, ggml_view_1d(ctx0, kv_pad.v, n_ctx*n_state, 0)));
+
+                struct ggml_tensor * K =
+                    ggml_view_3d(ctx0, kv_pad.k,
+                            n_state_head, n_ctx_pad, n_head,
+                            ggml_element_size(kv_pad.k)*n_state,
+                            ggml_element_size(kv_pad.k)*n_state_head,
+                            0);
+
+                struct ggml_tensor * V =
+                    ggml_view_3d(ctx0, kv_pad.v,
+                            n_state_head, n_ctx_pad, n_head,
+                            ggml_element_size(kv_pad.v)*n_state,
+                            ggml_element_size(kv_pad.v)*n_state_head,
+                            0);
+
+                cur = ggml_flash_attn_ext(ctx0, Q, K, V, nullptr, KQscale, 0.0f, 0.0f);
+                ggml_flash_attn_ext_set_prec(cur, GGML_PREC_F32);
+
+                cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx);
+            } else {
+                struct ggml_tensor * K =
+                    ggml_permute(ctx0,
+                            ggml_cast(ctx0,
+                                ggml_reshape_4d(ctx0, Kcur, n_state_head, n_head, n_ctx, n_batch),
+                                wctx.itype),
+                            0, 2, 1, 3);
+
+                // K * Q
+                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
+
+                struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, nullptr, KQscale, 0.0f);
+
+                struct ggml_tensor * V =
+                    ggml_cast(ctx0,
+                            ggml_permute(ctx0,
+                                ggml_reshape_4d(ctx0,
+                                    Vcur,
+                                    n_state_head, n_head, n_ctx, n_batch),
+                                1, 2, 0, 3),
+                            wctx.itype);
+
+                struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+
+                struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+
+                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_ctx*n_batch);
+            }
+        }
+
+        // projection
+        {
+            cur = ggml_mul_mat(ctx0,
+                    layer.attn_ln_1_w,
+                    cur);
+
+            cur = ggml_add(ctx0, cur, layer.attn_ln_1_b);
+        }
+
+        // add the input
+        cur = ggml_add(ctx0, cur, inpL);
+
+        struct ggml_tensor * inpFF = cur;
+
+        // feed-forward network
+        {
+            // norm
+            {
+                cur = ggml_norm(ctx0, inpFF, hparams.eps);
+
+                // cur = mlp_ln_w*cur + mlp_ln_b
+                cur = ggml_add(ctx0,
+                        ggml_mul(ctx0, cur, layer.mlp_ln_w),
+                        layer.mlp_ln_b);
+            }
+
+            // fully connected
+            cur = ggml_mul_mat(ctx0,
+                    layer.mlp_0_w,
+                    cur);
+
+            cur = ggml_add(ctx0, cur, layer.mlp_0_b);
+
+            // GELU activation
+            cur = ggml_gelu(ctx0, cur);
+
+            // projection
+            cur = ggml_mul_mat(ctx0,
+                    layer.mlp_1_w,
+                    cur);
+
+            cur = ggml_add(ctx0, cur, layer.mlp_1_b);
+        }
+
+        inpL = ggml_add(ctx0, cur, inpFF);
+    }
+
+    cur = inpL;
+
+    // norm
+    {
+        cur = ggml_norm(ctx0, cur, hparams.eps);
+
+        // cur = ln_f_g*cur + ln_f_b
+        cur = ggml_add(ctx0,
+                ggml_mul(ctx0, cur, model.e_ln_w),
+                model.e_ln_b);
+    }
+
+    ggml_build_forward_expand(gf, cur);
+
+    wstate.embd_enc = cur;
+
+    //ggml_graph_print(gf);
+
+    ////////////////////////////////////////////////////////////////////////////
+
+    //printf("%s: used_mem = %f MB, %f MB, %f MB %f MB %f MB\n", __func__,
+    //        ggml_used_mem(ctx0)/1e6,
+    //        wstate.get_buf_max_mem(0)/1e6,
+    //        wstate.get_buf_max_mem(1)/1e6,
+    //        wstate.get_buf_max_mem(2)/1e6,
+    //        wstate.get_buf_max_mem(3)/1e6);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// the cross-attention key/value weights of all decoder layers - they are all applied to the output of the encoder
+static std::vector<ggml_tensor *> whisper_model_cross_kv_weights(const whisper_model & model) {
+    std::vector<ggml_tensor *> result;
+
+    for (const auto & layer : model.layers_decoder) {
+        result.push_back(layer.cross_attn_k_w);
+        result.push_back(layer.cross_attn_v_w);
+    }
+
+    return result;
+}
+
+// pre-compute cross-attention memory
+// window i of the batch is written to the cross-attention cache of dst[i]
+static struct ggml_cgraph * whisper_build_graph_cross(
+        whisper_context & wctx,
+          whisper_state & wstate,
+  whisper_state * const * dst,
+              const int   n_batch) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_state = hparams.n_audio_state;
+    const int n_head  = hparams.n_audio_head;
+
+    const int n_state_head = n_state/n_head;
+
+    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ whisper_sched_enc_cur(wstate, n_batch).cross.meta.size(),
+        /*.mem_buffer =*/ whisper_sched_enc_cur(wstate, n_batch).cross.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_enc);
+
+    cur = whisper_mul_mat_input(ctx0, cur, whisper_model_cross_kv_weights(model));
+
+    const float  Kscale = pow(float(n_state_head), -0.25);
+
+    for (int il = 0; il < model.hparams.n_text_layer; ++il) {
+        auto & layer = model.layers_decoder[il];
+
+        struct ggml_tensor * Kcross = ggml_mul_mat(ctx0,
+                layer.cross_attn_k_w,
+                cur);
+
+        Kcross = ggml_scale(ctx0, Kcross, Kscale);
+
+        struct ggml_tensor * Vcross = ggml_mul_mat(ctx0,
+                layer.cross_attn_v_w,
+                cur);
+
+        Vcross = ggml_add(ctx0,
+                    Vcross,
+                    layer.cross_attn_v_b);
+
+        for (int ib = 0; ib < n_batch; ++ib) {
+            auto & kv_cross = dst[ib]->kv_cross;
+
+            struct ggml_tensor * Kb = ggml_view_2d(ctx0, Kcross, n_state, n_ctx, Kcross->nb[1], ib*n_ctx*Kcross->nb[1]);
+            struct ggml_tensor * Vb = ggml_view_2d(ctx0, Vcross, n_state, n_ctx, Vcross->nb[1], ib*n_ctx*Vcross->nb[1]);
+
+            struct ggml_tensor * k;
+            struct ggml_tensor * v;
+
+            if (wctx.params.flash_attn) {
+                k = ggml_view_1d(ctx0, kv_cross.k, n_state*n_ctx,
+                        (ggml_element_size(kv_cross.k)*n_state)*(il*n_ctx_pad));
+
+                v = ggml_view_1d(ctx0, kv_cross.v, n_state*n_ctx,
+                        (ggml_element_size(kv_cross.v)*n_state)*(il*n_ctx_pad));
+            } else {
+                Vb = ggml_transpose(ctx0, Vb);
+
+                k = ggml_view_1d(ctx0, kv_cross.k, n_state*n_ctx,
+                        (ggml_element_size(kv_cross.k)*n_state)*(il*n_ctx));
+
+                v = ggml_view_2d(ctx0, kv_cross.v, n_ctx, n_state,
+                        (   n_ctx)*ggml_element_size(kv_cross.v),
+                        (il*n_ctx)*ggml_element_size(kv_cross.v)*n_state);
+            }
+
+            ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kb, k));
+            ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vb, v));
+        }
+    }
+
+    //ggml_graph_print(gf);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// [EXPERIMENTAL] block-causal streaming encoder: the block of n_block positions that starts at position n_past
+//
+// the block goes through the convolutions with one frame of the spectrogram on each side, and in each layer it attends
+// to itself and to the n_left positions before it, whose keys and values are kept in the stream. the output of the
+// block is stored in the stream for whisper_build_graph_cross_stream()
+//
+static struct ggml_cgraph * whisper_build_graph_encoder_stream(
+        whisper_context & wctx,
+          whisper_state & wstate) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    auto & es = wstate.enc_stream;
+
+    const int n_state = hparams.n_audio_state;
+    const int n_head  = hparams.n_audio_head;
+    const int n_layer = hparams.n_audio_layer;
+    const int n_mels  = hparams.n_mels;
+
+    const int n_state_head = n_state/n_head;
+
+    const int n_block = es.n_block;
+    const int n_kv    = es.n_left + n_block;
+    const int n_slots = es.n_left + hparams.n_audio_ctx; // positions per layer in es.kv
+    const int n_past  = es.n_past;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ es.sched_encode.meta.size(),
+        /*.mem_buffer =*/ es.sched_encode.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    // frames [2*n_past - 2, 2*n_past + 2*n_block] of the spectrogram
+    struct ggml_tensor * mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_block + 3, n_mels);
+    ggml_set_name(mel, "mel");
+    ggml_set_input(mel);
+
+    // 0 for the frames before the start of the audio, where the full encoder pads the second convolution with zeros
+    struct ggml_tensor * conv_mask = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_block + 3, 1);
+    ggml_set_name(conv_mask, "conv_mask");
+    ggml_set_input(conv_mask);
+
+    struct ggml_tensor * position = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_block);
+    ggml_set_name(position, "position");
+    ggml_set_input(position);
+
+    struct ggml_tensor * KQ_mask = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_kv, n_block);
+    ggml_set_name(KQ_mask, "KQ_mask");
+    ggml_set_input(KQ_mask);
+
+    struct ggml_tensor * cur = nullptr;
+
+    // convolution + gelu
+    {
+        cur = whisper_conv_1d_gelu(ctx0, wstate, model.e_conv_1_w, mel, model.e_conv_1_b, 1);
+        cur = ggml_mul(ctx0, cur, conv_mask);
+
+        cur = whisper_conv_1d_gelu(ctx0, wstate, model.e_conv_2_w, cur, model.e_conv_2_b, 2);
+
+        // outputs 1 .. n_block are the positions of the block
+        cur = ggml_view_2d(ctx0, cur, n_block, n_state, cur->nb[1], ggml_element_size(cur));
+    }
+
+    cur = ggml_add(ctx0, ggml_cont(ctx0, ggml_transpose(ctx0, cur)), ggml_get_rows(ctx0, model.e_pe, position));
+
+    const float KQscale = 1.0f/sqrtf(float(n_state_head));
+
+    struct ggml_tensor * inpL = cur;
+
+    for (int il = 0; il < n_layer; ++il) {
+        const auto & layer = model.layers_encoder[il];
+
+        // norm
+        {
+            cur = ggml_norm(ctx0, inpL, hparams.eps);
+
+            // cur = ln_0_w*cur + ln_0_b
+            cur = ggml_add(ctx0,
+                    ggml_mul(ctx0, cur, layer.attn_ln_0_w),
+                    layer.attn_ln_0_b);
+        }
+
+        // self-attention
+        {
+            struct ggml_tensor * inpSA = whisper_mul_mat_input(ctx0, cur, { layer.attn_q_w, layer.attn_k_w, layer.attn_v_w });
+
+            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
+                    layer.attn_q_w,
+                    inpSA);
+
+            Qcur = ggml_add(ctx0, Qcur, layer.attn_q_b);
+
+            // note: no bias for Key
+            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0,
+                    layer.attn_k_w,
+                    inpSA);
+
+            struct ggml_tensor * Vcur = ggml_mul_mat(ctx0,
+                    layer.attn_v_w,
+                    inpSA);
+
+            Vcur = ggml_add(ctx0, Vcur, layer.attn_v_b);
+
+            // store the keys and values of the block after the ones of the previous blocks
+            {
+                struct ggml_tensor * k = ggml_view_1d(ctx0, es.kv.k, n_block*n_state,
+                        (ggml_element_size(es.kv.k)*n_state)*(il*n_slots + es.n_left + n_past));
+
+                struct ggml_tensor * v = ggml_view_2d(ctx0, es.kv.v, n_block, n_state,
+                        n_slots*ggml_element_size(es.kv.v),
+                        (il*n_slots*n_state + es.n_left + n_past)*ggml_element_size(es.kv.v));
+
+                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, k));
+                ggml_build_forward_expand(gf, ggml_cpy(ctx0, ggml_transpose(ctx0, Vcur), v));
+            }
+
+            // ------
+
+            struct ggml_tensor * Q =
+                ggml_permute(ctx0,
+                        ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_block),
+                        0, 2, 1, 3);
+
+            // the n_left positions before the block and the block
+            struct ggml_tensor * K =
+                ggml_view_3d(ctx0, es.kv.k,
+                        n_state_head, n_kv, n_head,
+                        ggml_element_size(es.kv.k)*n_state,
+                        ggml_element_size(es.kv.k)*n_state_head,
+                        ggml_element_size(es.kv.k)*n_state*(il*n_slots + n_past));
+
+            // K * Q
+            struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
+
+            struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, KQ_mask, KQscale, 0.0f);
+
+            struct ggml_tensor * V =
+                ggml_view_3d(ctx0, es.kv.v,
+                        n_kv, n_state_head, n_head,
+                        n_slots*ggml_element_size(es.kv.v),
+                        n_slots*ggml_element_size(es.kv.v)*n_state_head,
+                        (il*n_slots*n_state + n_past)*ggml_element_size(es.kv.v));
+
+            struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+
+            struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+
+            cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_block);
+        }
+
+        // projection
+        {
+            cur = ggml_mul_mat(ctx0,
+                    layer.attn_ln_1_w,
+                    cur);
+
+            cur = ggml_add(ctx0, cur, layer.attn_ln_1_b);
+        }
+
+        // add the input
+        cur = ggml_add(ctx0, cur, inpL);
+
+        struct ggml_tensor * inpFF = cur;
+
+        // feed-forward network
+        {
+            // norm
+            {
+                cur = ggml_norm(ctx0, inpFF, hparams.eps);
+
+                // cur = mlp_ln_w*cur + mlp_ln_b
+                cur = ggml_add(ctx0,
+                        ggml_mul(ctx0, cur, layer.mlp_ln_w),
+                        layer.mlp_ln_b);
+            }
+
+            // fully connected
+            cur = ggml_mul_mat(ctx0,
+                    layer.mlp_0_w,
+                    cur);
+
+            cur = ggml_add(ctx0, cur, layer.mlp_0_b);
+
+            // GELU activation
+            cur = ggml_gelu(ctx0, cur);
+
+            // projection
+            cur = ggml_mul_mat(ctx0,
+                    layer.mlp_1_w,
+                    cur);
+
+            cur = ggml_add(ctx0, cur, layer.mlp_1_b);
+        }
+
+        inpL = ggml_add(ctx0, cur, inpFF);
+    }
+
+    cur = inpL;
+
+    // norm
+    {
+        cur = ggml_norm(ctx0, cur, hparams.eps);
+
+        // cur = ln_f_g*cur + ln_f_b
+        cur = ggml_add(ctx0,
+                ggml_mul(ctx0, cur, model.e_ln_w),
+                model.e_ln_b);
+    }
+
+    ggml_build_forward_expand(gf, ggml_cpy(ctx0, cur, ggml_view_2d(ctx0, es.embd, n_state, n_block, es.embd->nb[1], n_past*es.embd->nb[1])));
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// [EXPERIMENTAL] cross-attention memory for the positions [i0, i0 + n) of the streaming encoder
+// kv_cross is laid out for the full audio context, so that it can be extended without moving the previous positions
+static struct ggml_cgraph * whisper_build_graph_cross_stream(
+        whisper_context & wctx,
+          whisper_state & wstate,
+              const int   i0,
+              const int   n) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    auto & es       = wstate.enc_stream;
+    auto & kv_cross = wstate.kv_cross;
+
+    const int n_state = hparams.n_audio_state;
+    const int n_head  = hparams.n_audio_head;
+
+    const int n_state_head = n_state/n_head;
+
+    const int n_ctx_kv = GGML_PAD(hparams.n_audio_ctx, 256);
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ es.sched_cross.meta.size(),
+        /*.mem_buffer =*/ es.sched_cross.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    struct ggml_tensor * cur = ggml_view_2d(ctx0, es.embd, n_state, n, es.embd->nb[1], i0*es.embd->nb[1]);
+
+    cur = whisper_mul_mat_input(ctx0, cur, whisper_model_cross_kv_weights(model));
+
+    const float  Kscale = pow(float(n_state_head), -0.25);
+
+    for (int il = 0; il < model.hparams.n_text_layer; ++il) {
+        auto & layer = model.layers_decoder[il];
+
+        struct ggml_tensor * Kcross = ggml_mul_mat(ctx0,
+                layer.cross_attn_k_w,
+                cur);
+
+        Kcross = ggml_scale(ctx0, Kcross, Kscale);
+
+        struct ggml_tensor * Vcross = ggml_mul_mat(ctx0,
+                layer.cross_attn_v_w,
+                cur);
+
+        Vcross = ggml_add(ctx0,
+                    Vcross,
+                    layer.cross_attn_v_b);
+
+        struct ggml_tensor * k = ggml_view_1d(ctx0, kv_cross.k, n_state*n,
+                (ggml_element_size(kv_cross.k)*n_state)*(il*n_ctx_kv + i0));
+
+        struct ggml_tensor * v;
+
+        if (wctx.params.flash_attn) {
+            v = ggml_view_1d(ctx0, kv_cross.v, n_state*n,
+                    (ggml_element_size(kv_cross.v)*n_state)*(il*n_ctx_kv + i0));
+        } else {
+            Vcross = ggml_transpose(ctx0, Vcross);
+
+            v = ggml_view_2d(ctx0, kv_cross.v, n, n_state,
+                    n_ctx_kv*ggml_element_size(kv_cross.v),
+                    (il*n_ctx_kv*n_state + i0)*ggml_element_size(kv_cross.v));
+        }
+
+        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcross, k));
+        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcross, v));
+    }
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// prepare the compute buffers of the graphs that use the weights of the encoder part: conv, encoder and cross
+// for the current audio context size - each size gets its own buffers, so switching sizes does not re-reserve
+static bool whisper_sched_init_encode(whisper_context & wctx, whisper_state & wstate) {
+    auto & se = whisper_sched_enc_cur(wstate, 1);
+
+    whisper_state * dst = &wstate;
+
+    if (se.cross.sched) {
+        return true;
+    }
+
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+
+    bool ok = true;
+
+    // conv allocator
+    if (ok) {
+        ok = whisper_sched_graph_init(se.conv, wstate.backends,
+                [&]() {
+                    return whisper_build_graph_conv(wctx, wstate, 0, 1);
+                });
+
+        if (!ok) {
+            WHISPER_LOG_ERROR("%s: failed to init conv allocator\n", __func__);
+        } else {
+            WHISPER_LOG_INFO("%s: compute buffer (conv)   = %7.2f MB (n_ctx = %d)\n", __func__, whisper_sched_size(se.conv) / 1e6, n_ctx);
+        }
+    }
+
+    // encoder allocator
+    if (ok && !whisper_encode_external(wstate)) {
+        ok = whisper_sched_graph_init(se.encode, wstate.backends,
+                [&]() {
+                    return whisper_build_graph_encoder(wctx, wstate, 1);
+                });
+
+        if (!ok) {
+            WHISPER_LOG_ERROR("%s: failed to init encoder allocator\n", __func__);
+        } else {
+            WHISPER_LOG_INFO("%s: compute buffer (encode) = %7.2f MB (n_ctx = %d)\n", __func__, whisper_sched_size(se.encode) / 1e6, n_ctx);
+        }
+    }
+
+    // cross allocator
+    if (ok) {
+        ok = whisper_sched_graph_init(se.cross, wstate.backends,
+                [&]() {
+                    return whisper_build_graph_cross(wctx, wstate, &dst, 1);
+                });
+
+        if (!ok) {
+            WHISPER_LOG_ERROR("%s: failed to init cross allocator\n", __func__);
+        } else {
+            WHISPER_LOG_INFO("%s: compute buffer (cross)  = %7.2f MB (n_ctx = %d)\n", __func__, whisper_sched_size(se.cross) / 1e6, n_ctx);
+        }
+    }
+
+    if (!ok) {
+        for (auto * sched : { &se.conv, &se.encode, &se.cross }) {
+            ggml_backend_sched_free(sched->sched);
+            sched->sched = nullptr;
+        }
+    }
+
+    return ok;
+}
+
+// evaluate the encoder with the given state
+//
+// given audio recording (more specifically, its log mel spectrogram), runs forward pass of the encoder
+// part of the transformer model and returns the encoded features
+//
+//   - wctx:      the model
+//   - wstate:     the state of the encoder
+//   - n_threads:  number of threads to use
+//   - mel_offset: offset in the mel spectrogram (i.e. audio offset)
+//
+static bool whisper_encode_internal(
+        whisper_context & wctx,
+          whisper_state & wstate,
+              const int   mel_offset,
+              const int   n_threads,
+    ggml_abort_callback   abort_callback,
+                   void * abort_callback_data) {
+    if (!whisper_model_require_part(wctx, WHISPER_MODEL_PART_ENCODER) || !whisper_sched_init_encode(wctx, wstate)) {
+        return false;
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    // kv_cross is overwritten below - until the encode succeeds, it holds no known window
+    wstate.enc_mel_offset = -1;
+    wstate.enc_n_ctx      = -1;
+
+    auto & se = whisper_sched_enc_cur(wstate, 1);
+
+    // the three graphs depend only on the audio context size and are cached together - each one reads the output of
+    // the previous one, so they are all rebuilt if any of them is
+    // with mel_graph, the conv graph slices the spectrogram at mel_offset and is rebuilt every time
+    whisper_graph_key key_data;
+    key_data.n_audio_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+    key_data.weights_gen = wctx.model.weights_gen;
+
+    const whisper_graph_key * key = wstate.mel_graph.active || whisper_encode_external(wstate) ? nullptr : &key_data;
+
+    const bool cached =
+        whisper_sched_graph_cached(se.conv,   key) &&
+        whisper_sched_graph_cached(se.encode, key) &&
+        whisper_sched_graph_cached(se.cross,  key);
+
+    // conv
+    {
+        ggml_cgraph * gf = cached ? whisper_sched_graph_cached(se.conv, key) : nullptr;
+
+        if (!gf) {
+            gf = whisper_build_graph_conv(wctx, wstate, mel_offset, 1);
+
+            if (!whisper_sched_graph_alloc(se.conv, gf, key)) {
+                // should never happen as we pre-allocate the memory
+                return false;
+            }
+        }
+
+        struct ggml_tensor * mel = ggml_graph_get_tensor(gf, "mel");
+
+        // set the input
+        if (!wstate.mel_graph.active) {
+            const auto & mel_inp = wstate.mel;
+            const int n_ctx      = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+
+            assert(mel->type == GGML_TYPE_F32);
+            assert(mel_inp.n_mel == wctx.model.hparams.n_mels);
+
+            wstate.inp_mel.resize(ggml_nelements(mel));
+
+            float * dst = wstate.inp_mel.data();
+            memset(dst, 0, ggml_nbytes(mel));
+
+            const int i0 = std::min(mel_offset,           mel_inp.n_len);
+            const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
+
+            for (int j = 0; j < mel_inp.n_mel; ++j) {
+                for (int i = i0; i < i1; ++i) {
+                    dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
+                }
+            }
+
+            ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
+        }
+
+        if (!whisper_encode_external(wstate)) {
+            if (!whisper_sched_graph_compute(se.conv, gf, n_threads)) {
+                return false;
+            }
+        } else {
+#if defined(WHISPER_USE_COREML)
+            whisper_coreml_encode(wstate.ctx_coreml, mel->ne[0], mel->ne[1], (float *) mel->data, (float *) wstate.embd_enc->data);
+#elif defined(WHISPER_USE_OPENVINO)
+            whisper_openvino_encode(wstate.ctx_openvino, mel, wstate.embd_enc);
+#endif
+        }
+    }
+
+    // encoder
+    if (!whisper_encode_external(wstate)) {
+        ggml_cgraph * gf = cached ? whisper_sched_graph_cached(se.encode, key) : nullptr;
+
+        if (!gf) {
+            gf = whisper_build_graph_encoder(wctx, wstate, 1);
+
+            if (!whisper_sched_graph_alloc(se.encode, gf, key)) {
+                // should never happen as we pre-allocate the memory
+                return false;
+            }
+        }
+
+        if (!whisper_sched_graph_compute(se.encode, gf, n_threads)) {
+            return false;
+        }
+    }
+
+    // cross
+    {
+        ggml_cgraph * gf = cached ? whisper_sched_graph_cached(se.cross, key) : nullptr;
+
+        if (!gf) {
+            whisper_state * dst = &wstate;
+
+            gf = whisper_build_graph_cross(wctx, wstate, &dst, 1);
+
+            if (!whisper_sched_graph_alloc(se.cross, gf, key)) {
+                // should never happen as we pre-allocate the memory
+                return false;
+            }
+        }
+
+        if (!whisper_sched_graph_compute(se.cross, gf, n_threads)) {
+            return false;
+        }
+    }
+
+    wstate.t_encode_us += ggml_time_us() - t_start_us;
+    wstate.n_encode++;
+
+    wstate.enc_mel_offset = mel_offset;
+    wstate.enc_n_ctx      = wstate.exp_n_audio_ctx;
+    wstate.kv_cross_n_ctx = 0;
+
+    return !(abort_callback && abort_callback(abort_callback_data));
+}
+
+// evaluate the encoder on a batch of windows in a single graph
+//
+// window i starts at mel_offsets[i] in the spectrogram of states[i], and its cross-attention cache is written to
+// states[i]. the compute buffers are kept in states[0] and re-reserved only when the batch or the context grows
+//
+static bool whisper_encode_batch_internal(
+        whisper_context & wctx,
+  whisper_state * const * states,
+              const int * mel_offsets,
+              const int   n_batch,
+              const int   n_threads) {
+    whisper_state & wstate = *states[0];
+
+    if (n_batch == 1) {
+        return whisper_encode_internal(wctx, wstate, mel_offsets[0], n_threads, nullptr, nullptr);
+    }
+
+    if (n_batch < 1 || n_batch > WHISPER_MAX_ENCODE_BATCH) {
+        WHISPER_LOG_ERROR("%s: the batch must have 1 to %d windows, got %d\n", __func__, WHISPER_MAX_ENCODE_BATCH, n_batch);
+        return false;
+    }
+
+    for (int i = 0; i < n_batch; ++i) {
+        const auto & st = *states[i];
+
+        if (st.exp_n_audio_ctx != wstate.exp_n_audio_ctx) {
+            WHISPER_LOG_ERROR("%s: all states must use the same audio context size\n", __func__);
+            return false;
+        }
+
+        if (st.mel_graph.active || whisper_encode_external(st)) {
+            WHISPER_LOG_ERROR("%s: the spectrogram must be on the host and the encoder must not be external\n", __func__);
+            return false;
+        }
+
+        for (int j = 0; j < i; ++j) {
+            if (states[j] == states[i]) {
+                WHISPER_LOG_ERROR("%s: each window needs its own state\n", __func__);
+                return false;
+            }
+        }
+    }
+
+    if (!whisper_model_require_part(wctx, WHISPER_MODEL_PART_ENCODER)) {
+        return false;
+    }
+
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+
+    auto & se = wstate.sched_enc_batch;
+
+    if (se.cross.sched && (n_batch > wstate.n_batch_enc || n_ctx > wstate.n_ctx_enc_batch)) {
+        for (auto * sched : { &se.conv, &se.encode, &se.cross }) {
+            ggml_backend_sched_free(sched->sched);
+            sched->sched = nullptr;
+        }
+    }
+
+    if (!se.cross.sched) {
+        bool ok = true;
+
+        ok = ok && whisper_sched_graph_init(se.conv,   wstate.backends, [&]() { return whisper_build_graph_conv   (wctx, wstate, 0, n_batch); });
+        ok = ok && whisper_sched_graph_init(se.encode, wstate.backends, [&]() { return whisper_build_graph_encoder(wctx, wstate,    n_batch); });
+        ok = ok && whisper_sched_graph_init(se.cross,  wstate.backends, [&]() { return whisper_build_graph_cross  (wctx, wstate, states, n_batch); });
+
+        if (!ok) {
+            WHISPER_LOG_ERROR("%s: failed to init the batched encoder allocators\n", __func__);
+
+            for (auto * sched : { &se.conv, &se.encode, &se.cross }) {
+                ggml_backend_sched_free(sched->sched);
+                sched->sched = nullptr;
+            }
+
+            return false;
+        }
+
+        wstate.n_batch_enc     = n_batch;
+        wstate.n_ctx_enc_batch = n_ctx;
+
+        WHISPER_LOG_INFO("%s: compute buffer (batch)  = %7.2f MB (n_ctx = %d, n_batch = %d)\n", __func__,
+                (whisper_sched_size(se.conv) + whisper_sched_size(se.encode) + whisper_sched_size(se.cross)) / 1e6, n_ctx, n_batch);
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    // the kv_cross of all the states is overwritten below - until the encode succeeds, it holds no known window
+    for (int ib = 0; ib < n_batch; ++ib) {
+        states[ib]->enc_mel_offset = -1;
+        states[ib]->enc_n_ctx      = -1;
+    }
+
+    // conv
+    {
+        auto & sched = se.conv.sched;
+
+        ggml_cgraph * gf = whisper_build_graph_conv(wctx, wstate, 0, n_batch);
+
+        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+            return false;
+        }
+
+        struct ggml_tensor * mel = ggml_graph_get_tensor(gf, "mel");
+
+        wstate.inp_mel.resize(ggml_nelements(mel));
+
+        float * dst = wstate.inp_mel.data();
+        memset(dst, 0, ggml_nbytes(mel));
+
+        for (int ib = 0; ib < n_batch; ++ib) {
+            const auto & mel_inp = states[ib]->mel;
+
+            assert(mel_inp.n_mel == wctx.model.hparams.n_mels);
+
+            const int i0 = std::min(mel_offsets[ib],           mel_inp.n_len);
+            const int i1 = std::min(mel_offsets[ib] + 2*n_ctx, mel_inp.n_len);
+
+            for (int j = 0; j < mel_inp.n_mel; ++j) {
+                for (int i = i0; i < i1; ++i) {
+                    dst[(ib*mel_inp.n_mel + j)*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
+                }
+            }
+        }
+
+        ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
+
+        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+            return false;
+        }
+    }
+
+    // encoder
+    {
+        auto & sched = se.encode.sched;
+
+        ggml_cgraph * gf = whisper_build_graph_encoder(wctx, wstate, n_batch);
+
+        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+            return false;
+        }
+
+        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+            return false;
+        }
+    }
+
+    // cross
+    {
+        auto & sched = se.cross.sched;
+
+        ggml_cgraph * gf = whisper_build_graph_cross(wctx, wstate, states, n_batch);
+
+        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+            return false;
+        }
+
+        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+            return false;
+        }
+    }
+
+    wstate.t_encode_us += ggml_time_us() - t_start_us;
+    wstate.n_encode    += n_batch;
+
+    for (int ib = 0; ib < n_batch; ++ib) {
+        states[ib]->enc_mel_offset = mel_offsets[ib];
+        states[ib]->enc_n_ctx      = states[ib]->exp_n_audio_ctx;
+        states[ib]->kv_cross_n_ctx = 0;
+    }
+
+    return true;
+}
+
+// [EXPERIMENTAL] block-causal streaming encoder
+
+static void whisper_enc_stream_free(whisper_enc_stream & es) {
+    whisper_kv_cache_free(es.kv);
+    ggml_backend_buffer_free(es.buffer);
+    ggml_free(es.ctx);
+
+    ggml_backend_sched_free(es.sched_encode.sched);
+    ggml_backend_sched_free(es.sched_cross.sched);
+
+    es = whisper_enc_stream();
+}
+
+// (re)allocate the cache of the stream for blocks of n_block positions attending to n_left positions before them
+static bool whisper_enc_stream_init(whisper_context & wctx, whisper_state & wstate, int n_block, int n_left) {
+    const auto & hparams = wctx.model.hparams;
+
+    auto & es = wstate.enc_stream;
+
+    whisper_enc_stream_free(es);
+
+    es.n_block = n_block;
+    es.n_left  = n_left;
+
+    if (!whisper_kv_cache_init(es.kv, wstate.backends[0], wctx.itype,
+                hparams.n_audio_state,
+                hparams.n_audio_layer,
+                n_left + hparams.n_audio_ctx)) {
+        WHISPER_LOG_ERROR("%s: whisper_kv_cache_init() failed for the streaming encoder\n", __func__);
+        return false;
+    }
+
+    {
+        struct ggml_init_params params = {
+            /*.mem_size   =*/ ggml_tensor_overhead(),
+            /*.mem_buffer =*/ nullptr,
+            /*.no_alloc   =*/ true,
+        };
+
+        es.ctx  = ggml_init(params);
+        es.embd = ggml_new_tensor_2d(es.ctx, GGML_TYPE_F32, hparams.n_audio_state, hparams.n_audio_ctx);
+
+        es.buffer = ggml_backend_alloc_ctx_tensors(es.ctx, wstate.backends[0]);
+        if (!es.buffer) {
+            WHISPER_LOG_ERROR("%s: failed to allocate the output of the streaming encoder\n", __func__);
+            return false;
+        }
+    }
+
+    WHISPER_LOG_INFO("%s: stream cache size = %7.2f MB (block = %d, left context = %d)\n", __func__,
+            (ggml_nbytes(es.kv.k) + ggml_nbytes(es.kv.v) + ggml_nbytes(es.embd)) / 1e6, n_block, n_left);
+
+    if (!whisper_sched_graph_init(es.sched_encode, wstate.backends,
+                [&]() {
+                    return whisper_build_graph_encoder_stream(wctx, wstate);
+                })) {
+        WHISPER_LOG_ERROR("%s: failed to init stream encoder allocator\n", __func__);
+        return false;
+    }
+
+    WHISPER_LOG_INFO("%s: compute buffer (stream) = %7.2f MB\n", __func__, whisper_sched_size(es.sched_encode) / 1e6);
+
+    // the cross graph grows with the positions that are written at once - reserve for the whole context
+    if (!whisper_sched_graph_init(es.sched_cross, wstate.backends,
+                [&]() {
+                    return whisper_build_graph_cross_stream(wctx, wstate, 0, hparams.n_audio_ctx);
+                })) {
+        WHISPER_LOG_ERROR("%s: failed to init stream cross allocator\n", __func__);
+        return false;
+    }
+
+    WHISPER_LOG_INFO("%s: compute buffer (stream cross) = %7.2f MB\n", __func__, whisper_sched_size(es.sched_cross) / 1e6);
+
+    return true;
+}
+
+// encode the block at es.n_past
+static bool whisper_enc_stream_block(whisper_context & wctx, whisper_state & wstate, int n_threads) {
+    auto & es = wstate.enc_stream;
+
+    const auto & mel_inp = wstate.mel;
+
+    const int n_block  = es.n_block;
+    const int n_kv     = es.n_left + n_block;
+    const int n_frames = 2*n_block + 3;
+    const int f0       = 2*es.n_past - 2;
+
+    ggml_cgraph * gf = whisper_build_graph_encoder_stream(wctx, wstate);
+
+    if (!whisper_sched_graph_alloc(es.sched_encode, gf, nullptr)) {
+        // should never happen as we pre-allocate the memory
+        return false;
+    }
+
+    // set the inputs
+    {
+        struct ggml_tensor * mel = ggml_graph_get_tensor(gf, "mel");
+
+        wstate.inp_mel.assign(ggml_nelements(mel), 0.0f);
+
+        for (int j = 0; j < mel_inp.n_mel; ++j) {
+            for (int i = std::max(0, -f0); i < n_frames && f0 + i < mel_inp.n_len; ++i) {
+                wstate.inp_mel[j*n_frames + i] = mel_inp.data[j*mel_inp.n_len + f0 + i];
+            }
+        }
+
+        ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nbytes(mel));
+    }
+
+    {
+        struct ggml_tensor * conv_mask = ggml_graph_get_tensor(gf, "conv_mask");
+
+        wstate.inp_mask.resize(n_frames);
+
+        for (int i = 0; i < n_frames; ++i) {
+            wstate.inp_mask[i] = f0 + i < 0 ? 0.0f : 1.0f;
+        }
+
+        ggml_backend_tensor_set(conv_mask, wstate.inp_mask.data(), 0, ggml_nbytes(conv_mask));
+    }
+
+    {
+        struct ggml_tensor * position = ggml_graph_get_tensor(gf, "position");
+
+        std::vector<int32_t> pos(n_block);
+        for (int i = 0; i < n_block; ++i) {
+            pos[i] = es.n_past + i;
+        }
+
+        ggml_backend_tensor_set(position, pos.data(), 0, ggml_nbytes(position));
+    }
+
+    // the window of keys starts n_left positions before the block - mask the ones before the start of the audio
+    {
+        struct ggml_tensor * KQ_mask = ggml_graph_get_tensor(gf, "KQ_mask");
+
+        wstate.inp_mask.resize(ggml_nelements(KQ_mask));
+
+        for (int j = 0; j < n_block; ++j) {
+            for (int i = 0; i < n_kv; ++i) {
+                wstate.inp_mask[j*n_kv + i] = es.n_past - es.n_left + i < 0 ? -INFINITY : 0.0f;
+            }
+        }
+
+        ggml_backend_tensor_set(KQ_mask, wstate.inp_mask.data(), 0, ggml_nbytes(KQ_mask));
+    }
+
+    return whisper_sched_graph_compute(es.sched_encode, gf, n_threads);
+}
+
+// move n bytes from offset src to offset dst (the ranges may overlap) in each of n_rows rows of t, row_stride bytes apart
+// the backend buffers that are not in host memory are moved through a copy on the host
+static void whisper_tensor_move_rows(ggml_tensor * t, int64_t n_rows, size_t row_stride, size_t dst, size_t src, size_t n) {
+    if (ggml_backend_buffer_is_host(t->buffer)) {
+        for (int64_t i = 0; i < n_rows; ++i) {
+            memmove((char *) t->data + i*row_stride + dst, (const char *) t->data + i*row_stride + src, n);
+        }
+
+        return;
+    }
+
+    std::vector<uint8_t> data(ggml_nbytes(t));
+    ggml_backend_tensor_get(t, data.data(), 0, data.size());
+
+    for (int64_t i = 0; i < n_rows; ++i) {
+        memmove(data.data() + i*row_stride + dst, data.data() + i*row_stride + src, n);
+    }
+
+    ggml_backend_tensor_set(t, data.data(), 0, data.size());
+}
+
+// the window of the spectrogram slid to mel_offset - move the encoded positions that are still in the window to their
+// new place, so that only the new blocks are encoded. the moved positions keep the keys, values and outputs computed
+// at their previous place in the window (with its positional embeddings), like the past blocks of a growing window
+// only the slides by whole positions (2 frames) are supported - returns false if the stream has to start over
+static bool whisper_enc_stream_rebase(whisper_context & wctx, whisper_state & wstate, int64_t mel_offset) {
+    const auto & hparams = wctx.model.hparams;
+
+    auto & es = wstate.enc_stream;
+
+    const int64_t n_frames = mel_offset - es.mel_offset;
+
+    if (n_frames == 0) {
+        return true;
+    }
+
+    if (n_frames < 0 || n_frames % 2 != 0 || n_frames/2 >= es.n_past) {
+        return false;
+    }
+
+    const int n_shift = n_frames/2;
+    const int n_keep  = es.n_past - n_shift;
+
+    const int n_state = hparams.n_audio_state;
+    const int n_layer = hparams.n_audio_layer;
+    const int n_slots = es.n_left + hparams.n_audio_ctx; // positions per layer in es.kv
+
+    // position p of a layer is at slot n_left + p - the n_left slots before position 0 stay zero
+    {
+        const size_t esize = ggml_element_size(es.kv.k);
+
+        whisper_tensor_move_rows(es.kv.k, n_layer, esize*n_slots*n_state,
+                esize*n_state*es.n_left, esize*n_state*(es.n_left + n_shift), esize*n_state*n_keep);
+    }
+
+    // V is transposed: a row of n_slots positions per state and layer
+    {
+        const size_t esize = ggml_element_size(es.kv.v);
+
+        whisper_tensor_move_rows(es.kv.v, (int64_t) n_layer*n_state, esize*n_slots,
+                esize*es.n_left, esize*(es.n_left + n_shift), esize*n_keep);
+    }
+
+    whisper_tensor_move_rows(es.embd, 1, 0, 0, es.embd->nb[1]*n_shift, es.embd->nb[1]*n_keep);
+
+    es.n_past  = n_keep;
+    es.n_cross = 0; // kv_cross is written again from the moved outputs
+
+    return true;
+}
+
+// encode the completed blocks and extend kv_cross with them, returns the number of encoded positions or -1
+static int whisper_enc_stream_update(whisper_context & wctx, whisper_state & wstate, int n_threads) {
+    const auto & hparams = wctx.model.hparams;
+
+    auto & es = wstate.enc_stream;
+
+    const int64_t t_start_us = ggml_time_us();
+
+    // kv_cross is overwritten below - until the update succeeds, it holds no known window
+    wstate.enc_mel_offset = -1;
+    wstate.enc_n_ctx      = -1;
+
+    const int64_t mel_offset = whisper_pcm_to_mel_append_offset_from_state(&wstate);
+
+    // a louder frame arrived or the loudest one slid out: the floor of the normalization moved, and with it the
+    // spectrogram of the encoded positions - they are encoded again
+    // otherwise, when the window slid, the encoded positions are moved with it
+    if (es.mel_offset < 0 || es.mmax != wstate.mel_stream.mmax || !whisper_enc_stream_rebase(wctx, wstate, mel_offset)) {
+        ggml_backend_buffer_clear(es.kv.buffer, 0);
+
+        es.n_past  = 0;
+        es.n_cross = 0;
+    }
+
+    es.mel_offset = mel_offset;
+    es.mmax       = wstate.mel_stream.mmax;
+
+    // the last frame of a block is followed by one frame of audio, which is also seen by the convolutions
+    const int n_avail = std::min(hparams.n_audio_ctx, (wstate.mel.n_len_org - 1)/2);
+
+    while (es.n_past + es.n_block <= n_avail) {
+        if (!whisper_enc_stream_block(wctx, wstate, n_threads)) {
+            return -1;
+        }
+
+        es.n_past += es.n_block;
+        wstate.n_encode++;
+    }
+
+    if (es.n_past == 0) {
+        return 0;
+    }
+
+    const int n_ctx_kv = GGML_PAD(hparams.n_audio_ctx, 256);
+
+    // kv_cross was overwritten by the full encoder - write all the positions again
+    if (wstate.kv_cross_n_ctx != n_ctx_kv) {
+        ggml_backend_buffer_clear(wstate.kv_cross.buffer, 0);
+
+        es.n_cross = 0;
+    }
+
+    if (es.n_cross < es.n_past) {
+        ggml_cgraph * gf = whisper_build_graph_cross_stream(wctx, wstate, es.n_cross, es.n_past - es.n_cross);
+
+        if (!whisper_sched_graph_alloc(es.sched_cross, gf, nullptr) ||
+            !whisper_sched_graph_compute(es.sched_cross, gf, n_threads)) {
+            return -1;
+        }
+
+        es.n_cross = es.n_past;
+    }
+
+    wstate.t_encode_us += ggml_time_us() - t_start_us;
+
+    // whisper_full_with_state() with audio_ctx == n_past decodes this window without encoding it again
+    wstate.exp_n_audio_ctx = es.n_past;
+    wstate.enc_mel_offset  = 0;
+    wstate.enc_n_ctx       = es.n_past;
+    wstate.kv_cross_n_ctx  = n_ctx_kv;
+
+    return es.n_past;
+}
+
+static struct ggml_cgraph * whisper_build_graph_decoder(
+         whisper_context & wctx,
+         whisper_state   & wstate,
+     const whisper_batch & batch,
+                    bool   save_alignment_heads_QKs,
+                    bool   worst_case) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    auto & kv_self = wstate.kv_self;
+
+    WHISPER_ASSERT(!!kv_self.buffer);
+
+    const int n_ctx   = kv_self.size;
+    const int n_state = hparams.n_text_state;
+    const int n_head  = hparams.n_text_head;
+    const int n_layer = hparams.n_text_layer;
+
+    const int n_state_head = n_state/n_head;
+
+    const int n_tokens    = batch.n_tokens;
+    const int n_audio_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+
+    const int n_audio_ctx_pad = GGML_PAD(n_audio_ctx, 256);
+
+    // positions per layer in kv_cross
+    const int n_audio_ctx_kv = wstate.kv_cross_n_ctx > 0 ? wstate.kv_cross_n_ctx : wctx.params.flash_attn ? n_audio_ctx_pad : n_audio_ctx;
+
+    const int32_t n_kv    = worst_case ? n_ctx            : kv_self.n;
+    const int32_t kv_head = worst_case ? n_ctx - n_tokens : kv_self.head;
+
+    //WHISPER_LOG_DEBUG("%s: n_past = %d, n_tokens = %d, n_audio_ctx = %d, n_ctx = %d\n", __func__, n_past, n_tokens, n_audio_ctx, n_ctx);
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_decode.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_decode.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    wstate.decode_kv_views.clear();
+
+    struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    ggml_set_name(embd, "embd");
+    ggml_set_input(embd);
+
+    struct ggml_tensor * position = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    ggml_set_name(position, "position");
+    ggml_set_input(position);
+
+    const float KQscale = pow(float(n_state_head), -0.25);
+
+    struct ggml_tensor * KQ_mask = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_kv, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD), 1);
+    ggml_set_name(KQ_mask, "KQ_mask");
+    ggml_set_input(KQ_mask);
+
+    struct ggml_tensor * KQ_mask_f16 = ggml_cast(ctx0, KQ_mask, GGML_TYPE_F16);
+
+    // token encoding + position encoding
+    struct ggml_tensor * cur =
+        ggml_add(ctx0,
+                ggml_get_rows(ctx0, model.d_te, embd),
+                ggml_get_rows(ctx0, model.d_pe, position));
+
+    struct ggml_tensor * inpL = cur;
+
+    // [EXPERIMENTAL] Token-level timestamps with DTW
+    struct ggml_tensor * aheads_cross_QKs = nullptr;
+
+    for (int il = 0; il < n_layer; ++il) {
+        const auto & layer = model.layers_decoder[il];
+
+        // norm
+        {
+            cur = ggml_norm(ctx0, inpL, hparams.eps);
+
+            // cur = ln_0_w*cur + ln_0_b
+            cur = ggml_add(ctx0,
+                    ggml_mul(ctx0,
+                        cur,
+                        layer.attn_ln_0_w),
+                    layer.attn_ln_0_b);
+        }
+
+        // self-attention
+        {
+            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
+                    layer.attn_q_w,
+                    cur);
+
+            Qcur = ggml_add(ctx0,
+                        Qcur,
+                        layer.attn_q_b);
+
+            Qcur = ggml_scale(ctx0, Qcur, KQscale);
+
+            // note: no bias for Key
+            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0,
+                    layer.attn_k_w,
+                    cur);
+
+            Kcur = ggml_scale(ctx0, Kcur, KQscale);
+
+            // store key and value to memory
+            {
+                struct ggml_tensor * Vcur = ggml_mul_mat(ctx0,
+                        layer.attn_v_w,
+                        cur);
+
+                Vcur = ggml_add(ctx0,
+                            Vcur,
+                            layer.attn_v_b);
+
+                struct ggml_tensor * k;
+                struct ggml_tensor * v;
+
+                if (wctx.params.flash_attn) {
+                    k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
+                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+
+                    v = ggml_view_1d(ctx0, kv_self.v, n_tokens*n_state,
+                            (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + kv_head));
+                } else {
+                    Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_state, n_tokens));
+
+                    k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
+                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+
+                    v = ggml_view_2d(ctx0, kv_self.v, n_tokens, n_state,
+                            (   n_ctx)*ggml_element_size(kv_self.v),
+                            (il*n_ctx)*ggml_element_size(kv_self.v)*n_state + kv_head*ggml_element_size(kv_self.v));
+                }
+
+                struct ggml_tensor * k_cpy = ggml_cpy(ctx0, Kcur, k);
+                struct ggml_tensor * v_cpy = ggml_cpy(ctx0, Vcur, v);
+
+                ggml_build_forward_expand(gf, k_cpy);
+                ggml_build_forward_expand(gf, v_cpy);
+
+                const size_t k_stride = ggml_element_size(kv_self.k)*n_state;
+                const size_t v_stride = ggml_element_size(kv_self.v)*(wctx.params.flash_attn ? n_state : 1);
+
+                for (auto * t : { k, k_cpy }) {
+                    wstate.decode_kv_views.emplace_back(t, t->view_offs - kv_head*k_stride, k_stride);
+                }
+                for (auto * t : { v, v_cpy }) {
+                    wstate.decode_kv_views.emplace_back(t, t->view_offs - kv_head*v_stride, v_stride);
+                }
+            }
+
+            // ------
+
+            struct ggml_tensor * Q =
+                ggml_permute(ctx0,
+                        ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_tokens),
+                        0, 2, 1, 3);
+
+            struct ggml_tensor * K =
+                ggml_view_3d(ctx0, kv_self.k,
+                        n_state_head, n_kv, n_head,
+                        ggml_element_size(kv_self.k)*n_state,
+                        ggml_element_size(kv_self.k)*n_state_head,
+                        ggml_element_size(kv_self.k)*n_state*n_ctx*il);
+
+            if (wctx.params.flash_attn) {
+                struct ggml_tensor * V =
+                    ggml_view_3d(ctx0, kv_self.v,
+                            n_state_head, n_kv, n_head,
+                            ggml_element_size(kv_self.v)*n_state,
+                            ggml_element_size(kv_self.v)*n_state_head,
+                            ggml_element_size(kv_self.v)*n_state*n_ctx*il);
+
+                cur = ggml_flash_attn_ext(ctx0, Q, K, V, KQ_mask_f16, 1.0f, 0.0f, 0.0f);
+
+                cur = ggml_reshape_2d(ctx0, cur, n_state, n_tokens);
+            } else {
+                // K * Q
+                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
+
+                struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, KQ_mask, 1.0f, 0.0f);
+
+                struct ggml_tensor * V =
+                    ggml_view_3d(ctx0, kv_self.v,
+                            n_kv, n_state_head, n_head,
+                            n_ctx*ggml_element_size(kv_self.v),
+                            n_ctx*ggml_element_size(kv_self.v)*n_state_head,
+                            n_ctx*ggml_element_size(kv_self.v)*n_state*il);
+
+                struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+
+                struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+
+                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_tokens);
+            }
+        }
+
+        // projection
+        {
+            cur = ggml_mul_mat(ctx0,
+                    layer.attn_ln_1_w,
+                    cur);
+
+            cur = ggml_add(ctx0,
+                    cur,
+                    layer.attn_ln_1_b);
+        }
+
+        // add the input
+        struct ggml_tensor * inpCA = ggml_add(ctx0, cur, inpL);
+
+        // norm
+        {
+            cur = ggml_norm(ctx0, inpCA, hparams.eps); // note: we use inpCA here
+
+            // cur = ln_0_w*cur + ln_0_b
+            cur = ggml_add(ctx0,
+                    ggml_mul(ctx0,
+                        cur,
+                        layer.cross_attn_ln_0_w),
+                    layer.cross_attn_ln_0_b);
+        }
+
+        // cross-attention
+        {
+            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
+                    layer.cross_attn_q_w,
+                    cur);
+
+            Qcur = ggml_add(ctx0,
+                        Qcur,
+                        layer.cross_attn_q_b);
+
+            struct ggml_tensor * Q =
+                ggml_permute(ctx0,
+                        ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_tokens),
+                        0, 2, 1, 3);
+
+            if (wctx.params.flash_attn) {
+                struct ggml_tensor * Kcross =
+                    ggml_view_3d(ctx0, wstate.kv_cross.k,
+                            n_state_head, n_audio_ctx_pad, n_head,
+                            ggml_element_size(wstate.kv_cross.k)*n_state,
+                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
+                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx_kv*il);
+
+                struct ggml_tensor * Vcross =
+                    ggml_view_3d(ctx0, wstate.kv_cross.v,
+                            n_state_head, n_audio_ctx_pad, n_head,
+                            ggml_element_size(wstate.kv_cross.v)*n_state,
+                            ggml_element_size(wstate.kv_cross.v)*n_state_head,
+                            ggml_element_size(wstate.kv_cross.v)*n_state*n_audio_ctx_kv*il);
+
+                cur = ggml_flash_attn_ext(ctx0, Q, Kcross, Vcross, nullptr, KQscale, 0.0f, 0.0f);
+
+                cur = ggml_reshape_2d(ctx0, cur, n_state, n_tokens);
+            } else {
+                struct ggml_tensor * Kcross =
+                    ggml_view_3d(ctx0, wstate.kv_cross.k,
+                            n_state_head, n_audio_ctx, n_head,
+                            ggml_element_size(wstate.kv_cross.k)*n_state,
+                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
+                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx_kv*il);
+
+                struct ggml_tensor * Vcross =
+                    ggml_view_3d(ctx0, wstate.kv_cross.v,
+                            n_audio_ctx, n_state_head, n_head,
+                            n_audio_ctx_kv*ggml_element_size(wstate.kv_cross.v),
+                            n_audio_ctx_kv*ggml_element_size(wstate.kv_cross.v)*n_state_head,
+                            n_audio_ctx_kv*ggml_element_size(wstate.kv_cross.v)*n_state*il);
+
+                // ------
+
+                // K * Q
+                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, Kcross, Q);
+
+                struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, nullptr, KQscale, 0.0f);
+
+                // [EXPERIMENTAL] Token-level timestamps with DTW
+                if (wctx.params.dtw_token_timestamps) {
+                    if (wstate.aheads_masks.m[il] != nullptr) {
+                        struct ggml_tensor * aheads_KQs = ggml_reshape_2d(ctx0, KQ_soft_max, KQ_soft_max->ne[0] * KQ_soft_max->ne[1], KQ_soft_max->ne[2]);
+                        aheads_KQs = ggml_transpose(ctx0, aheads_KQs);
+                        aheads_KQs = ggml_cont(ctx0, aheads_KQs);
+                        aheads_KQs = ggml_mul_mat(ctx0, wstate.aheads_masks.m[il], aheads_KQs);
+                        aheads_KQs = ggml_transpose(ctx0, aheads_KQs);
+                        aheads_KQs = ggml_cont(ctx0, aheads_KQs);
+                        aheads_KQs = ggml_reshape_3d(ctx0, aheads_KQs, KQ_soft_max->ne[0], KQ_soft_max->ne[1], wstate.aheads_masks.m[il]->ne[1]);
+                        if (aheads_cross_QKs == NULL) {
+                            aheads_cross_QKs = aheads_KQs;
+                        } else {
+                            aheads_cross_QKs = ggml_concat(ctx0, aheads_cross_QKs, aheads_KQs, 2);
+                        }
+                    }
+                }
+
+                struct ggml_tensor * KQV = ggml_mul_mat(ctx0, Vcross, KQ_soft_max);
+
+                struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+
+                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_tokens);
+            }
+        }
+
+        // projection
+        {
+            cur = ggml_mul_mat(ctx0,
+                    layer.cross_attn_ln_1_w,
+                    cur);
+
+            cur = ggml_add(ctx0,
+                    cur,
+                    layer.cross_attn_ln_1_b);
+        }
+
+        // add the input
+        cur = ggml_add(ctx0, cur, inpCA);
+
+        struct ggml_tensor * inpFF = cur;
+
+        // feed-forward network
+        {
+            // norm
+            {
+                cur = ggml_norm(ctx0, inpFF, hparams.eps);
+
+                // cur = mlp_ln_w*cur + mlp_ln_b
+                cur = ggml_add(ctx0,
+                        ggml_mul(ctx0,
+                            cur,
+                            layer.mlp_ln_w),
+                        layer.mlp_ln_b);
+            }
+
+            // fully connected
+            cur = ggml_mul_mat(ctx0,
+                    layer.mlp_0_w,
+                    cur);
+
+            cur = ggml_add(ctx0,
+                    cur,
+                    layer.mlp_0_b);
+
+            // GELU activation
+            cur = ggml_gelu(ctx0, cur);
+
+            // projection
+            cur = ggml_mul_mat(ctx0,
+                    layer.mlp_1_w,
+                    cur);
+
+            cur = ggml_add(ctx0,
+                    cur,
+                    layer.mlp_1_b);
+        }
+
+        inpL = ggml_add(ctx0, cur, inpFF);
+    }
+
+    cur = inpL;
+
+    // norm
+    {
+        cur = ggml_norm(ctx0, cur, hparams.eps);
+
+        cur = ggml_add(ctx0,
+                ggml_mul(ctx0,
+                    cur,
+                    model.d_ln_w),
+                model.d_ln_b);
+    }
+
+    // compute logits only for the last token
+    // comment this line to compute logits for all n_tokens
+    // might be useful in the future
+    //cur = ggml_view_2d(ctx0, cur, cur->ne[0], 1, cur->nb[1], (cur->ne[1] - 1)*cur->nb[1]);
+
+    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te, cur);
+
+    // [EXPERIMENTAL] Token-level timestamps with DTW
+    if (wctx.params.dtw_token_timestamps && aheads_cross_QKs != nullptr) {
+        aheads_cross_QKs = ggml_transpose(ctx0, aheads_cross_QKs);
+        aheads_cross_QKs = ggml_cont(ctx0, aheads_cross_QKs);
+        if (save_alignment_heads_QKs) {
+            ggml_build_forward_expand(gf, aheads_cross_QKs);
+            wstate.aheads_cross_QKs = aheads_cross_QKs;
+        }
+    }
+
+    ggml_build_forward_expand(gf, logits);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// evaluate the decoder
+//
+// given text prompt + audio features -> computes the logits for the next token
+//
+//   - model:      the model
+//   - n_threads:  number of threads to use
+//   - tokens:     text prompt
+//   - n_tokens:   number of tokens in the prompt
+//   - n_past:     number of past tokens to prefix the prompt with
+//
+// prepare the compute buffer of the decoder graph
+static bool whisper_sched_init_decode(whisper_context & wctx, whisper_state & wstate) {
+    if (wstate.sched_decode.sched) {
+        return true;
+    }
+
+    const auto & hparams = wctx.model.hparams;
+
+    // use a separate batch, since the one of the state can hold the tokens of the pending decode
+    whisper_batch batch = whisper_batch_init(hparams.n_text_ctx, WHISPER_MAX_DECODERS);
+
+    bool ok = whisper_sched_graph_init(wstate.sched_decode, wstate.backends,
+            [&]() {
+                // TODO: make sure this is the worst-case scenario
+                const int n_tokens = hparams.n_text_ctx;
+                const int n_past   = 0;
+
+                whisper_batch_prep_legacy(batch, nullptr, n_tokens, n_past, 0);
+
+                return whisper_build_graph_decoder(wctx, wstate, batch, wctx.params.dtw_token_timestamps, true);
+            });
+
+    whisper_batch_free(batch);
+
+    if (!ok) {
+        WHISPER_LOG_ERROR("%s: failed to init decoder allocator\n", __func__);
+
+        ggml_backend_sched_free(wstate.sched_decode.sched);
+        wstate.sched_decode.sched = nullptr;
+
+        return false;
+    }
+
+    WHISPER_LOG_INFO("%s: compute buffer (decode) = %7.2f MB\n", __func__, whisper_sched_size(wstate.sched_decode) / 1e6);
+
+    return true;
+}
+
+static bool whisper_decode_internal(
+        whisper_context & wctx,
+          whisper_state & wstate,
+    const whisper_batch & batch,
+              const int   n_threads,
+                   bool   save_alignment_heads_QKs,
+    ggml_abort_callback   abort_callback,
+                   void * abort_callback_data) {
+    if (!whisper_model_require_part(wctx, WHISPER_MODEL_PART_DECODER) || !whisper_sched_init_decode(wctx, wstate)) {
+        return false;
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_vocab  = hparams.n_vocab;
+    const int n_tokens = batch.n_tokens;
+
+    auto & logits_out = wstate.logits;
+
+    struct ggml_tensor * logits;
+
+    // find KV slot for the batch
+    {
+        auto & kv_self = wstate.kv_self;
+
+        if (!whisper_kv_cache_find_slot(kv_self, batch)) {
+            return false;
+        }
+
+        const uint32_t pad = whisper_kv_cache_get_padding(wctx);
+        kv_self.n = std::min(kv_self.size, std::max(pad, GGML_PAD(whisper_kv_cache_cell_max(kv_self), pad)));
+
+        //kv_self.n = std::min((int32_t) hparams.n_text_ctx, std::max(32, whisper_kv_cache_cell_max(kv_self)));
+        //printf("n_tokens = %5d, kv_self.head = %5d, kv_self.n = %5d, seq_id = %5d\n", batch.n_tokens, kv_self.head, kv_self.n, batch.seq_id[0][0]);
+    }
+
+    // decoder
+    {
+        auto & kv_self = wstate.kv_self;
+
+        // everything else in the graph is either an input or fixed for the state
+        whisper_graph_key key;
+        key.n_tokens        = n_tokens;
+        key.n_kv            = kv_self.n;
+        key.n_kv_size       = kv_self.size;
+        key.n_audio_ctx     = wstate.exp_n_audio_ctx;
+        key.n_cross_ctx     = wstate.kv_cross_n_ctx;
+        key.alignment_heads = save_alignment_heads_QKs;
+        key.weights_gen     = model.weights_gen;
+
+        ggml_cgraph * gf = whisper_sched_graph_cached(wstate.sched_decode, &key);
+
+        if (gf) {
+            // the batch goes to a different place in the KV cache
+            for (const auto & kv_view : wstate.decode_kv_views) {
+                ggml_tensor * t = std::get<0>(kv_view);
+
+                t->view_offs = std::get<1>(kv_view) + kv_self.head*std::get<2>(kv_view);
+                t->data      = (char *) t->view_src->data + t->view_offs;
+            }
+        } else {
+            gf = whisper_build_graph_decoder(wctx, wstate, batch, save_alignment_heads_QKs, false);
+
+            if (!whisper_sched_graph_alloc(wstate.sched_decode, gf, &key)) {
+                // should never happen as we pre-allocate the memory
+                return false;
+            }
+
+            // the views of the KV cache are moved in place above, which is only valid if they are the tensors that
+            // are computed - with more than one split, the scheduler may copy them to another backend
+            if (ggml_backend_sched_get_n_splits(wstate.sched_decode.sched) != 1 || !ggml_backend_buffer_is_host(kv_self.buffer)) {
+                wstate.sched_decode.graph = nullptr;
+            }
+        }
+
+        // set the inputs
+        {
+            struct ggml_tensor * embd = ggml_graph_get_tensor(gf, "embd");
+            ggml_backend_tensor_set(embd, batch.token, 0, n_tokens*ggml_element_size(embd));
+        }
+
+        {
+            struct ggml_tensor * position = ggml_graph_get_tensor(gf, "position");
+            for (int i = 0; i < n_tokens; ++i) {
+                const int32_t val = batch.pos[i];
+                ggml_backend_tensor_set(position, &val, i*sizeof(int32_t), sizeof(int32_t));
+            }
+        }
+
+        {
+            struct ggml_tensor * KQ_mask = ggml_graph_get_tensor(gf, "KQ_mask");
+
+            auto & kv_self = wstate.kv_self;
+
+            const int32_t n_kv = kv_self.n;
+
+            wstate.inp_mask.resize(ggml_nelements(KQ_mask));
+
+            float * data = wstate.inp_mask.data();
+            memset(data, 0, ggml_nbytes(KQ_mask));
+
+            for (int h = 0; h < 1; ++h) {
+                for (int j = 0; j < n_tokens; ++j) {
+                    const whisper_pos    pos    = batch.pos[j];
+                    const whisper_seq_id seq_id = batch.seq_id[j][0];
+
+                    for (int i = 0; i < n_kv; ++i) {
+                        if (!kv_self.cells[i].has_seq_id(seq_id) || kv_self.cells[i].pos > pos) {
+                            data[h*(n_kv*n_tokens) + j*n_kv + i] = -INFINITY;
+                        }
+                    }
+                }
+
+                for (int i = n_tokens; i < GGML_PAD(n_tokens, GGML_KQ_MASK_PAD); ++i) {
+                    for (int j = 0; j < n_kv; ++j) {
+                        data[h*(n_kv*n_tokens) + i*n_kv + j] = -INFINITY;
+                    }
+                }
+            }
+
+            ggml_backend_tensor_set(KQ_mask, wstate.inp_mask.data(), 0, ggml_nelements(KQ_mask)*sizeof(float));
+        }
+
+        logits = ggml_graph_node(gf, -1);
+
+        if (!whisper_sched_graph_compute(wstate.sched_decode, gf, n_threads)) {
+            return false;
+        }
+    }
+
+    logits_out.resize(n_tokens*n_vocab);
+    for (int i = 0; i < n_tokens; i++) {
+        if (batch.logits[i] == 0) {
+            continue;
+        }
+        ggml_backend_tensor_get(logits, logits_out.data() + (n_vocab*i), sizeof(float)*(n_vocab*i), sizeof(float)*n_vocab);
+    }
+
+    if (batch.n_tokens > 1) {
+        //printf("%s: used_mem = %f MB, %f MB, %f MB %f MB %f MB\n", __func__,
+        //        ggml_used_mem(ctx0)/1e6,
+        //        wstate.get_buf_max_mem(0)/1e6,
+        //        wstate.get_buf_max_mem(1)/1e6,
+        //        wstate.get_buf_max_mem(2)/1e6,
+        //        wstate.get_buf_max_mem(3)/1e6);
+    }
+
+    if (batch.n_tokens == 1) {
+        wstate.t_decode_us += ggml_time_us() - t_start_us;
+        wstate.n_decode++;
+    } else if (batch.n_tokens < 16) {
+        wstate.t_batchd_us += ggml_time_us() - t_start_us;
+        wstate.n_batchd += n_tokens;
+    } else {
+        wstate.t_prompt_us += ggml_time_us() - t_start_us;
+        wstate.n_prompt += n_tokens;
+    }
+
+    return !(abort_callback && abort_callback(abort_callback_data));
+}
+
+//  500 -> 00:05.000
+// 6000 -> 01:00.000
+static std::string to_timestamp(int64_t t, bool comma = false) {
+    int64_t msec = t * 10;
+    int64_t hr = msec / (1000 * 60 * 60);
+    msec = msec - hr * (1000 * 60 * 60);
+    int64_t min = msec / (1000 * 60);
+    msec = msec - min * (1000 * 60);
+    int64_t sec = msec / 1000;
+    msec = msec - sec * 1000;
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%02d:%02d:%02d%s%03d", (int) hr, (int) min, (int) sec, comma ? "," : ".", (int) msec);
+
+    return std::string(buf);
+}
+
+// iterative mixed-radix FFT of real input
+//
+// the N real samples are packed into N/2 complex values z[k] = x[2k] + i*x[2k + 1], which are transformed with a
+// complex FFT of size N/2 and then split into the N/2 + 1 bins of the real FFT
+//
+// the complex FFT is a Stockham autosort FFT (no bit reversal) with radix 4, 2, 3, 5 and a generic odd radix butterfly
+// the data is stored as separate real and imaginary arrays, so that the inner loop of each stage runs over contiguous
+// memory and can be vectorized by the compiler
+// the twiddle factors are precomputed for the given N, in double precision
+struct whisper_fft_plan {
+    struct stage {
+        int radix;
+        int n;       // length of the sub-transforms of the stage
+        int s;       // stride
+        size_t offs; // offset of the twiddles of the stage in tw_re / tw_im
+    };
+
+    int N = 0;
+
+    std::vector<stage> stages;
+
+    // for each stage: w_n^(p*u) for p < n/radix, 1 <= u < radix,
+    // followed by w_radix^j for j < radix for the generic radix
+    std::vector<float> tw_re;
+    std::vector<float> tw_im;
+
+    // w_N^k for k <= N/2, used to split the result into the bins of the real FFT
+    std::vector<float> split_re;
+    std::vector<float> split_im;
+
+    void init(int n_fft) {
+        WHISPER_ASSERT(n_fft % 2 == 0);
+
+        N = n_fft;
+
+        const int M = N/2;
+
+        stages.clear();
+        tw_re.clear();
+        tw_im.clear();
+
+        int n = M;
+        int s = 1;
+        while (n > 1) {
+            int radix = n;
+            for (int r : { 4, 2, 3, 5 }) {
+                if (n % r == 0) {
+                    radix = r;
+                    break;
+                }
+            }
+            if (radix == n) {
+                for (int r = 7; r*r <= n; r += 2) {
+                    if (n % r == 0) {
+                        radix = r;
+                        break;
+                    }
+                }
+            }
+
+            stages.push_back({ radix, n, s, tw_re.size() });
+
+            for (int p = 0; p < n/radix; ++p) {
+                for (int u = 1; u < radix; ++u) {
+                    const double theta = -2.0*M_PI*p*u/n;
+                    tw_re.push_back(cos(theta));
+                    tw_im.push_back(sin(theta));
+                }
+            }
+
+            for (int j = 0; j < radix; ++j) {
+                const double theta = -2.0*M_PI*j/radix;
+                tw_re.push_back(cos(theta));
+                tw_im.push_back(sin(theta));
+            }
+
+            n /= radix;
+            s *= radix;
+        }
+
+        split_re.resize(M + 1);
+        split_im.resize(M + 1);
+
+        for (int k = 0; k <= M; ++k) {
+            const double theta = -2.0*M_PI*k/N;
+            split_re[k] = cos(theta);
+            split_im[k] = sin(theta);
+        }
+    }
+
+    // size of the work buffer of compute(), in floats
+    size_t n_work() const {
+        return 2*N;
+    }
+
+    // in:  N real samples
+    // out: N/2 + 1 complex bins (interleaved real and imaginary parts)
+    void compute(const float * in, float * out, float * work) const {
+        const int M = N/2;
+
+        float * xr = work;
+        float * xi = work + M;
+        float * yr = work + 2*M;
+        float * yi = work + 3*M;
+
+        for (int k = 0; k < M; ++k) {
+            xr[k] = in[2*k + 0];
+            xi[k] = in[2*k + 1];
+        }
+
+        for (const auto & st : stages) {
+            compute_stage(st, xr, xi, yr, yi);
+            std::swap(xr, yr);
+            std::swap(xi, yi);
+        }
+
+        // X[k] = (Z[k] + conj(Z[M - k]))/2 + w_N^k*(Z[k] - conj(Z[M - k]))/(2i)
+        for (int k = 0; k <= M; ++k) {
+            const int k0 = k % M;
+            const int k1 = (M - k) % M;
+
+            const float er = 0.5f*(xr[k0] + xr[k1]);
+            const float ei = 0.5f*(xi[k0] - xi[k1]);
+            const float or_ = 0.5f*(xi[k0] + xi[k1]);
+            const float oi = -0.5f*(xr[k0] - xr[k1]);
+
+            out[2*k + 0] = er + split_re[k]*or_ - split_im[k]*oi;
+            out[2*k + 1] = ei + split_re[k]*oi  + split_im[k]*or_;
+        }
+    }
+
+    // y[q + s*(radix*p + u)] = w_n^(p*u) * sum_t x[q + s*(p + t*m)] * w_radix^(t*u), with m = n/radix
+    void compute_stage(const stage & st, const float * xr, const float * xi, float * yr, float * yi) const {
+        const int r = st.radix;
+        const int s = st.s;
+        const int m = st.n/r;
+
+        const float * twr = tw_re.data() + st.offs;
+        const float * twi = tw_im.data() + st.offs;
+
+        switch (r) {
+            case 2:
+                for (int p = 0; p < m; ++p) {
+                    const float w1r = twr[p], w1i = twi[p];
+
+                    const float * x0r = xr + s*p; const float * x1r = x0r + s*m;
+                    const float * x0i = xi + s*p; const float * x1i = x0i + s*m;
+
+                    float * y0r = yr + s*2*p; float * y1r = y0r + s;
+                    float * y0i = yi + s*2*p; float * y1i = y0i + s;
+
+                    for (int q = 0; q < s; ++q) {
+                        const float br = x0r[q] - x1r[q];
+                        const float bi = x0i[q] - x1i[q];
+
+                        y0r[q] = x0r[q] + x1r[q];
+                        y0i[q] = x0i[q] + x1i[q];
+                        y1r[q] = br*w1r - bi*w1i;
+                        y1i[q] = br*w1i + bi*w1r;
+                    }
+                }
+                break;
+            case 3:
+                {
+                    const float h = 0.86602540378443864676f; // sin(2*pi/3)
+
+                    for (int p = 0; p < m; ++p) {
+                        const float w1r = twr[2*p + 0], w1i = twi[2*p + 0];
+                        const float w2r = twr[2*p + 1], w2i = twi[2*p + 1];
+
+                        const float * x0r = xr + s*p; const float * x1r = x0r + s*m; const float * x2r = x1r + s*m;
+                        const float * x0i = xi + s*p; const float * x1i = x0i + s*m; const float * x2i = x1i + s*m;
+
+                        float * y0r = yr + s*3*p; float * y1r = y0r + s; float * y2r = y1r + s;
+                        float * y0i = yi + s*3*p; float * y1i = y0i + s; float * y2i = y1i + s;
+
+                        for (int q = 0; q < s; ++q) {
+                            const float tr = x1r[q] + x2r[q];
+                            const float ti = x1i[q] + x2i[q];
+                            const float dr = h*(x1r[q] - x2r[q]);
+                            const float di = h*(x1i[q] - x2i[q]);
+
+                            const float cr = x0r[q] - 0.5f*tr;
+                            const float ci = x0i[q] - 0.5f*ti;
+
+                            const float b1r = cr + di, b1i = ci - dr;
+                            const float b2r = cr - di, b2i = ci + dr;
+
+                            y0r[q] = x0r[q] + tr;
+                            y0i[q] = x0i[q] + ti;
+                            y1r[q] = b1r*w1r - b1i*w1i;
+                            y1i[q] = b1r*w1i + b1i*w1r;
+                            y2r[q] = b2r*w2r - b2i*w2i;
+                            y2i[q] = b2r*w2i + b2i*w2r;
+                        }
+                    }
+                }
+                break;
+            case 4:
+                for (int p = 0; p < m; ++p) {
+                    const float w1r = twr[3*p + 0], w1i = twi[3*p + 0];
+                    const float w2r = twr[3*p + 1], w2i = twi[3*p + 1];
+                    const float w3r = twr[3*p + 2], w3i = twi[3*p + 2];
+
+                    const float * x0r = xr + s*p; const float * x1r = x0r + s*m; const float * x2r = x1r + s*m; const float * x3r = x2r + s*m;
+                    const float * x0i = xi + s*p; const float * x1i = x0i + s*m; const float * x2i = x1i + s*m; const float * x3i = x2i + s*m;
+
+                    float * y0r = yr + s*4*p; float * y1r = y0r + s; float * y2r = y1r + s; float * y3r = y2r + s;
+                    float * y0i = yi + s*4*p; float * y1i = y0i + s; float * y2i = y1i + s; float * y3i = y2i + s;
+
+                    for (int q = 0; q < s; ++q) {
+                        const float s02r = x0r[q] + x2r[q], s02i = x0i[q] + x2i[q];
+                        const float d02r = x0r[q] - x2r[q], d02i = x0i[q] - x2i[q];
+                        const float s13r = x1r[q] + x3r[q], s13i = x1i[q] + x3i[q];
+                        const float d13r = x1r[q] - x3r[q], d13i = x1i[q] - x3i[q];
+
+                        // b1 = d02 - i*d13, b2 = s02 - s13, b3 = d02 + i*d13
+                        const float b1r = d02r + d13i, b1i = d02i - d13r;
+                        const float b2r = s02r - s13r, b2i = s02i - s13i;
+                        const float b3r = d02r - d13i, b3i = d02i + d13r;
+
+                        y0r[q] = s02r + s13r;
+                        y0i[q] = s02i + s13i;
+                        y1r[q] = b1r*w1r - b1i*w1i;
+                        y1i[q] = b1r*w1i + b1i*w1r;
+                        y2r[q] = b2r*w2r - b2i*w2i;
+                        y2i[q] = b2r*w2i + b2i*w2r;
+                        y3r[q] = b3r*w3r - b3i*w3i;
+                        y3i[q] = b3r*w3i + b3i*w3r;
+                    }
+                }
+                break;
+            case 5:
+                {
+                    const float c1 =  0.30901699437494742410f; // cos(2*pi/5)
+                    const float c2 = -0.80901699437494742410f; // cos(4*pi/5)
+                    const float s1 =  0.95105651629515357212f; // sin(2*pi/5)
+                    const float s2 =  0.58778525229247312917f; // sin(4*pi/5)
+
+                    for (int p = 0; p < m; ++p) {
+                        const float * w = twr + 4*p;
+                        const float * v = twi + 4*p;
+
+                        const float * x0r = xr + s*p; const float * x1r = x0r + s*m; const float * x2r = x1r + s*m; const float * x3r = x2r + s*m; const float * x4r = x3r + s*m;
+                        const float * x0i = xi + s*p; const float * x1i = x0i + s*m; const float * x2i = x1i + s*m; const float * x3i = x2i + s*m; const float * x4i = x3i + s*m;
+
+                        float * y0r = yr + s*5*p; float * y1r = y0r + s; float * y2r = y1r + s; float * y3r = y2r + s; float * y4r = y3r + s;
+                        float * y0i = yi + s*5*p; float * y1i = y0i + s; float * y2i = y1i + s; float * y3i = y2i + s; float * y4i = y3i + s;
+
+                        for (int q = 0; q < s; ++q) {
+                            const float t1r = x1r[q] + x4r[q], t1i = x1i[q] + x4i[q];
+                            const float t2r = x2r[q] + x3r[q], t2i = x2i[q] + x3i[q];
+                            const float t3r = x1r[q] - x4r[q], t3i = x1i[q] - x4i[q];
+                            const float t4r = x2r[q] - x3r[q], t4i = x2i[q] - x3i[q];
+
+                            const float a1r = x0r[q] + c1*t1r + c2*t2r, a1i = x0i[q] + c1*t1i + c2*t2i;
+                            const float a2r = x0r[q] + c2*t1r + c1*t2r, a2i = x0i[q] + c2*t1i + c1*t2i;
+
+                            const float e1r = s1*t3r + s2*t4r, e1i = s1*t3i + s2*t4i;
+                            const float e2r = s2*t3r - s1*t4r, e2i = s2*t3i - s1*t4i;
+
+                            // b1 = a1 - i*e1, b4 = a1 + i*e1, b2 = a2 - i*e2, b3 = a2 + i*e2
+                            const float b1r = a1r + e1i, b1i = a1i - e1r;
+                            const float b4r = a1r - e1i, b4i = a1i + e1r;
+                            const float b2r = a2r + e2i, b2i = a2i - e2r;
+                            const float b3r = a2r - e2i, b3i = a2i + e2r;
+
+                            y0r[q] = x0r[q] + t1r + t2r;
+                            y0i[q] = x0i[q] + t1i + t2i;
+                            y1r[q] = b1r*w[0] - b1i*v[0];
+                            y1i[q] = b1r*v[0] + b1i*w[0];
+                            y2r[q] = b2r*w[1] - b2i*v[1];
+                            y2i[q] = b2r*v[1] + b2i*w[1];
+                            y3r[q] = b3r*w[2] - b3i*v[2];
+                            y3i[q] = b3r*v[2] + b3i*w[2];
+                            y4r[q] = b4r*w[3] - b4i*v[3];
+                            y4i[q] = b4r*v[3] + b4i*w[3];
+                        }
+                    }
+                }
+                break;
+            default:
+                {
+                    // generic odd radix - direct DFT of the r points
+                    const float * rwr = twr + m*(r - 1);
+                    const float * rwi = twi + m*(r - 1);
+
+                    for (int p = 0; p < m; ++p) {
+                        for (int q = 0; q < s; ++q) {
+                            for (int u = 0; u < r; ++u) {
+                                float br = 0.0f;
+                                float bi = 0.0f;
+
+                                for (int t = 0; t < r; ++t) {
+                                    const int j = (t*u) % r;
+
+                                    const float ar = xr[q + s*(p + t*m)];
+                                    const float ai = xi[q + s*(p + t*m)];
+
+                                    br += ar*rwr[j] - ai*rwi[j];
+                                    bi += ar*rwi[j] + ai*rwr[j];
+                                }
+
+                                const float wr = u == 0 ? 1.0f : twr[(r - 1)*p + u - 1];
+                                const float wi = u == 0 ? 0.0f : twi[(r - 1)*p + u - 1];
+
+                                yr[q + s*(r*p + u)] = br*wr - bi*wi;
+                                yi[q + s*(r*p + u)] = br*wi + bi*wr;
+                            }
+                        }
+                    }
+                }
+                break;
+        }
+    }
+};
+
+namespace {
+struct whisper_global_cache {
+    // FFT of size WHISPER_N_FFT, with precomputed twiddle factors
+    whisper_fft_plan fft_plan;
+
+    // Hann window (Use cosf to eliminate difference)
+    // ref: https://pytorch.org/docs/stable/generated/torch.hann_window.html
+    // ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L147
+    float hann_window[WHISPER_N_FFT];
+
+    // Hann window scaled by 1/32768, applied directly to int16 samples (exact, the scale is a power of 2)
+    float hann_window_s16[WHISPER_N_FFT];
+
+    whisper_global_cache() {
+        fft_plan.init(WHISPER_N_FFT);
+        fill_hann_window(sizeof(hann_window)/sizeof(hann_window[0]), true, hann_window);
+
+        for (int i = 0; i < WHISPER_N_FFT; i++) {
+            hann_window_s16[i] = hann_window[i]/32768.0f;
+        }
+    }
+
+    void fill_hann_window(int length, bool periodic, float * output) {
+        int offset = -1;
+        if (periodic) {
+            offset = 0;
+        }
+        for (int i = 0; i < length; i++) {
+            output[i] = 0.5 * (1.0 - cosf((2.0 * M_PI * i) / (length + offset)));
+        }
+    }
+} global_cache;
+}
+
+// dot product with 8 independent accumulators, so that the compiler can vectorize it without reassociating the sum
+static float whisper_vec_dot_f32(const float * x, const float * y, int n) {
+    float acc[8] = { 0.0f };
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int k = 0; k < 8; ++k) {
+            acc[k] += x[i + k]*y[i + k];
+        }
+    }
+    for (; i < n; ++i) {
+        acc[0] += x[i]*y[i];
+    }
+
+    return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+}
+
+// work buffers of log_mel_frame()
+struct log_mel_frame_buffers {
+    std::vector<float> fft_in;
+    std::vector<float> fft_out;
+    std::vector<float> fft_work;
+
+    log_mel_frame_buffers(int frame_size) :
+        fft_in(frame_size, 0.0),
+        fft_out(2*(frame_size/2 + 1)),
+        fft_work(global_cache.fft_plan.n_work()) {}
+};
+
+// log10 mel of the frame of frame_size samples that starts at samples[offset] - the samples past n_samples are zero
+// the n_mel values are written to out[j*out_stride], returns their maximum
+// T is float or int16_t - hann includes the scaling of the samples to [-1, 1]
+template<typename T>
+static float log_mel_frame(const float * hann, const T * samples, int n_samples, int offset, int frame_size,
+                           const whisper_filters & filters, log_mel_frame_buffers & buf, float * out, int out_stride) {
+    const auto & fft_plan = global_cache.fft_plan;
+
+    auto & fft_in  = buf.fft_in;
+    auto & fft_out = buf.fft_out;
+
+    const int n_fft = filters.n_fft;
+
+    // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
+    assert(n_fft == 1 + (frame_size / 2));
+    assert(frame_size == fft_plan.N);
+
+    // apply Hann window (~10% faster)
+    for (int j = 0; j < std::min(frame_size, n_samples - offset); j++) {
+        fft_in[j] = hann[j] * samples[offset + j];
+    }
+
+    // fill the rest with zeros
+    if (n_samples - offset < frame_size) {
+        std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0);
+    }
+
+    // FFT
+    fft_plan.compute(fft_in.data(), fft_out.data(), buf.fft_work.data());
+
+    // Calculate modulus^2 of complex numbers
+    // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
+    for (int j = 0; j < n_fft; j++) {
+        fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
+    }
+
+    float mmax = -1e20f;
+
+    // mel spectrogram - each filter is applied only on the bins where it is non-zero
+    for (int j = 0; j < filters.n_mel; j++) {
+        const float sum = whisper_vec_dot_f32(
+                fft_out.data() + filters.band_start[j], filters.band_data.data() + filters.band_offs[j], filters.band_len[j]);
+
+        const float val = log10f(std::max(sum, 1e-10f));
+        out[j * out_stride] = val;
+        mmax = std::max(mmax, val);
+    }
+
+    return mmax;
+}
+
+// log10 mel of frame i of the samples padded as in log_mel_spectrogram(), without materializing the padding:
+// reflected by frame_size/2 samples at the beginning and zeros past the end
+template<typename T>
+static float log_mel_frame_padded(const float * hann, const T * samples, int n_samples, int i, int frame_size, int frame_step,
+                                  const whisper_filters & filters, log_mel_frame_buffers & buf, float * out, int out_stride) {
+    const int pad    = frame_size / 2;
+    const int offset = i * frame_step - pad;
+
+    if (offset >= 0) {
+        return log_mel_frame(hann, samples, n_samples, offset, frame_size, filters, buf, out, out_stride);
+    }
+
+    // the first frames overlap the reflective padding
+    std::vector<T> frame(frame_size, T(0));
+    for (int j = 0; j < frame_size; j++) {
+        const int k = offset + j;
+        const int src = k < 0 ? -k : k;
+        if (src < n_samples) {
+            frame[j] = samples[src];
+        }
+    }
+
+    return log_mel_frame(hann, frame.data(), frame_size, 0, frame_size, filters, buf, out, out_stride);
+}
+
+// computes the log10 mel frames ith, ith + n_threads, ... and their maximum (mmax)
+template<typename T>
+static void log_mel_spectrogram_worker_thread(int ith, const float * hann, const T * samples,
+                                              int n_samples, int frame_size, int frame_step, int n_threads,
+                                              const whisper_filters & filters, whisper_mel & mel, float & mmax) {
+    log_mel_frame_buffers buf(frame_size);
+
+    int i = ith;
+
+    // calculate FFT only when fft_in are not all zero
+    for (; i < std::min((n_samples + frame_size / 2) / frame_step + 1, mel.n_len); i += n_threads) {
+        const float val = log_mel_frame_padded(hann, samples, n_samples, i, frame_size, frame_step, filters, buf, mel.data.data() + i, mel.n_len);
+        mmax = std::max(mmax, val);
+    }
+
+    // Otherwise fft_out are all zero
+    const float val = log10f(1e-10f);
+    if (i < mel.n_len) {
+        mmax = std::max(mmax, val);
+    }
+    for (; i < mel.n_len; i += n_threads) {
+        for (int j = 0; j < mel.n_mel; j++) {
+            mel.data[j * mel.n_len + i] = val;
+        }
+    }
+}
+
+// ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L110-L157
+// T is float or int16_t, with the matching Hann window of global_cache
+template<typename T>
+static bool log_mel_spectrogram(
+              whisper_state & wstate,
+              const T     * samples,
+              const int   n_samples,
+              const int   /*sample_rate*/,
+              const int   frame_size,
+              const int   frame_step,
+              const int   n_mel,
+              const int   n_threads,
+              const whisper_filters & filters,
+              const float * hann,
+              const bool   debug,
+              whisper_mel & mel) {
+    const int64_t t_start_us = ggml_time_us();
+
+    WHISPER_ASSERT(frame_size == WHISPER_N_FFT && "Unsupported frame_size");
+
+    // Calculate the length of padding
+    int64_t stage_1_pad = WHISPER_SAMPLE_RATE * 30;
+    int64_t stage_2_pad = frame_size / 2;
+
+    // the samples are padded with 30 seconds of zeros at the end of audio (480,000 samples) and reflected by 200 samples
+    // at the beginning - the padding is not materialized, see log_mel_frame_padded()
+    const int64_t n_samples_padded = n_samples + stage_1_pad + stage_2_pad * 2;
+
+    mel.n_mel     = n_mel;
+    // https://github.com/pytorch/pytorch/blob/main/aten/src/ATen/native/SpectralOps.cpp#L936
+    // Calculate number of frames + remove the last frame
+    mel.n_len     = (n_samples_padded - frame_size) / frame_step;
+    // Calculate semi-padded sample length to ensure compatibility
+    mel.n_len_org = 1 + (n_samples + stage_2_pad - frame_size) / frame_step;
+    mel.data.resize(mel.n_mel * mel.n_len);
+
+    // maximum of the frames of each thread
+    std::vector<float> mmax_thread(n_threads, -1e20f);
+
+    wstate.thread_pool.run(n_threads, [&](int ith) {
+        log_mel_spectrogram_worker_thread(ith, hann, samples, n_samples, frame_size, frame_step, n_threads, filters, mel, mmax_thread[ith]);
+    });
+
+    // clamping and normalization, in a single pass
+    {
+        const float mmin = *std::max_element(mmax_thread.begin(), mmax_thread.end()) - 8.0f;
+
+        float * data = mel.data.data();
+        for (size_t i = 0; i < mel.data.size(); i++) {
+            data[i] = (std::max(data[i], mmin) + 4.0f)*0.25f;
+        }
+    }
+
+    wstate.t_mel_us += ggml_time_us() - t_start_us;
+
+    // Dump log_mel_spectrogram
+    if (debug) {
+        std::ofstream outFile("log_mel_spectrogram.json");
+        outFile << "[";
+        for (uint64_t i = 0; i < mel.data.size() - 1; i++) {
+            outFile << mel.data[i] << ", ";
+        }
+        outFile << mel.data[mel.data.size() - 1] << "]";
+        outFile.close();
+    }
+
+    return true;
+}
+
+// (re)allocates the tensors of wstate.mel_graph for at least n_samples padded samples and n_len frames
+static bool whisper_mel_graph_init(whisper_context & wctx, whisper_state & wstate, int64_t n_samples, int n_len) {
+    auto & mg = wstate.mel_graph;
+
+    if (mg.ctx && mg.samples->ne[0] >= n_samples && mg.mel->ne[0] >= n_len) {
+        return true;
+    }
+
+    const auto & filters = wctx.model.filters;
+
+    const int frame_size = WHISPER_N_FFT;
+    const int n_fft      = filters.n_fft;
+    const int n_mel      = filters.n_mel;
+
+    ggml_backend_buffer_free(mg.buffer);
+    ggml_free(mg.ctx);
+
+    mg.buffer = nullptr;
+    mg.active = false;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 5*ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+
+    mg.ctx = ggml_init(params);
+    if (!mg.ctx) {
+        WHISPER_LOG_ERROR("%s: failed to allocate memory for the mel graph context\n", __func__);
+        return false;
+    }
+
+    mg.basis   = ggml_new_tensor_2d(mg.ctx, GGML_TYPE_F32, frame_size, 2*n_fft);
+    mg.filters = ggml_new_tensor_2d(mg.ctx, GGML_TYPE_F32, n_fft, n_mel);
+    mg.samples = ggml_new_tensor_1d(mg.ctx, GGML_TYPE_F32, n_samples);
+    mg.mel     = ggml_new_tensor_2d(mg.ctx, GGML_TYPE_F32, n_len, n_mel);
+    mg.mmax    = ggml_new_tensor_1d(mg.ctx, GGML_TYPE_F32, 1);
+
+    mg.buffer = ggml_backend_alloc_ctx_tensors(mg.ctx, wstate.backends[0]);
+    if (!mg.buffer) {
+        WHISPER_LOG_ERROR("%s: failed to allocate memory for the mel graph\n", __func__);
+        return false;
+    }
+
+    {
+        const float * hann = global_cache.hann_window;
+
+        std::vector<float> basis((size_t) 2*n_fft*frame_size);
+        for (int k = 0; k < n_fft; k++) {
+            for (int i = 0; i < frame_size; i++) {
+                // k*i mod frame_size keeps the argument small
+                const double theta = (2.0*M_PI*((k*i) % frame_size))/frame_size;
+
+                basis[(size_t) (k        )*frame_size + i] = hann[i]*cos(theta);
+                basis[(size_t) (k + n_fft)*frame_size + i] = hann[i]*sin(theta);
+            }
+        }
+
+        ggml_backend_tensor_set(mg.basis, basis.data(), 0, ggml_nbytes(mg.basis));
+    }
+
+    {
+        std::vector<float> data(filters.data.size());
+        for (size_t i = 0; i < data.size(); i++) {
+            data[i] = filters.data[i]*1e4f;
+        }
+
+        ggml_backend_tensor_set(mg.filters, data.data(), 0, ggml_nbytes(mg.filters));
+    }
+
+    WHISPER_LOG_INFO("%s: mel graph buffer = %7.2f MB\n", __func__, ggml_backend_buffer_get_size(mg.buffer)/1e6);
+
+    return true;
+}
+
+// same as log_mel_spectrogram(), computed with ggml on the backend - the spectrogram stays in wstate.mel_graph
+//
+// the DFT of the frames is a matrix multiplication with a precomputed basis, which is more work than the FFT,
+// but it runs on any backend and the spectrogram does not have to be uploaded for each encoder call
+//
+// the filterbank is scaled by 1e4, which adds the +4 of the normalization to the log10 values, so that the
+// clamping and the normalization in whisper_build_graph_conv() need only the maximum of the spectrogram
+static bool log_mel_spectrogram_graph(
+            whisper_context & wctx,
+              whisper_state & wstate,
+                const float * samples,
+                  const int   n_samples,
+                  const int   n_threads) {
+    const int64_t t_start_us = ggml_time_us();
+
+    const int frame_size = WHISPER_N_FFT;
+    const int frame_step = WHISPER_HOP_LENGTH;
+
+    // same padding as log_mel_spectrogram()
+    const int64_t stage_1_pad = WHISPER_SAMPLE_RATE * 30;
+    const int64_t stage_2_pad = frame_size / 2;
+
+    std::vector<float> samples_padded(n_samples + stage_1_pad + stage_2_pad * 2, 0.0f);
+    std::copy(samples, samples + n_samples, samples_padded.begin() + stage_2_pad);
+    std::reverse_copy(samples + 1, samples + 1 + stage_2_pad, samples_padded.begin());
+
+    auto & mel = wstate.mel;
+
+    mel.n_mel     = wctx.model.filters.n_mel;
+    mel.n_len     = (samples_padded.size() - frame_size) / frame_step;
+    mel.n_len_org = 1 + (n_samples + stage_2_pad - frame_size) / frame_step;
+    mel.data.clear();
+
+    if (!whisper_mel_graph_init(wctx, wstate, samples_padded.size(), mel.n_len)) {
+        return false;
+    }
+
+    auto & mg    = wstate.mel_graph;
+    auto & sched = wstate.sched_mel.sched;
+
+    mg.active = false;
+
+    ggml_backend_tensor_set(mg.samples, samples_padded.data(), 0, samples_padded.size()*sizeof(float));
+
+    // one chunk of frames per graph, to bound the size of the intermediate spectra
+    const int n_chunk = 100*WHISPER_CHUNK_SIZE;
+
+    if (!sched) {
+        if (!whisper_sched_graph_init(wstate.sched_mel, wstate.backends,
+                [&]() {
+                    return whisper_build_graph_mel(wctx, wstate, 0, std::min(n_chunk, mel.n_len));
+                })) {
+            WHISPER_LOG_ERROR("%s: failed to init mel allocator\n", __func__);
+            return false;
+        }
+
+        WHISPER_LOG_INFO("%s: compute buffer (mel)    = %7.2f MB\n", __func__, whisper_sched_size(wstate.sched_mel) / 1e6);
+    }
+
+    for (int i0 = 0; i0 < mel.n_len; i0 += n_chunk) {
+        ggml_cgraph * gf = whisper_build_graph_mel(wctx, wstate, i0, std::min(n_chunk, mel.n_len - i0));
+
+        if (!ggml_backend_sched_alloc_graph(sched, gf) || !ggml_graph_compute_helper(sched, gf, n_threads)) {
+            return false;
+        }
+    }
+
+    {
+        ggml_cgraph * gf = whisper_build_graph_mel_max(wctx, wstate, mel.n_len);
+
+        if (!ggml_backend_sched_alloc_graph(sched, gf) || !ggml_graph_compute_helper(sched, gf, n_threads)) {
+            return false;
+        }
+    }
+
+    mg.active = true;
+
+    wstate.t_mel_us += ggml_time_us() - t_start_us;
+
+    return true;
+}
+
+// character classes of the pre-tokenizer
+enum whisper_pretok_class {
+    WHISPER_PRETOK_SPACE,
+    WHISPER_PRETOK_LETTER,
+    WHISPER_PRETOK_NUMBER,
+    WHISPER_PRETOK_OTHER,
+};
+
+// decode the next UTF-8 code point - invalid sequences are consumed one byte at a time and decoded as U+FFFD
+static uint32_t whisper_utf8_next(const char * text, size_t n, size_t & len) {
+    const uint8_t c = text[0];
+
+    len = 1;
+
+    if (c < 0x80) {
+        return c;
+    }
+
+    size_t   n_cont;
+    uint32_t cp;
+
+    if      ((c & 0xE0) == 0xC0) { n_cont = 1; cp = c & 0x1F; }
+    else if ((c & 0xF0) == 0xE0) { n_cont = 2; cp = c & 0x0F; }
+    else if ((c & 0xF8) == 0xF0) { n_cont = 3; cp = c & 0x07; }
+    else {
+        return 0xFFFD;
+    }
+
+    if (n_cont >= n) {
+        return 0xFFFD;
+    }
+
+    for (size_t k = 1; k <= n_cont; ++k) {
+        const uint8_t cc = text[k];
+        if ((cc & 0xC0) != 0x80) {
+            return 0xFFFD;
+        }
+        cp = (cp << 6) | (cc & 0x3F);
+    }
+
+    len = n_cont + 1;
+
+    return cp;
+}
+
+// the \s, \p{L} and \p{N} classes of the GPT-2 pattern
+// outside of ASCII this is an approximation without the full Unicode tables: the common spaces, digits, punctuation,
+// symbols and combining marks are recognized and all other code points are treated as letters
+static whisper_pretok_class whisper_pretok_classify(uint32_t cp) {
+    if (cp < 0x80) {
+        if (cp == ' ' || (cp >= '\t' && cp <= '\r')) return WHISPER_PRETOK_SPACE;
+        if (cp >= '0' && cp <= '9')                  return WHISPER_PRETOK_NUMBER;
+        if ((cp | 0x20) >= 'a' && (cp | 0x20) <= 'z') return WHISPER_PRETOK_LETTER;
+        return WHISPER_PRETOK_OTHER;
+    }
+
+    if (cp == 0x85 || cp == 0xA0 || cp == 0x1680 || (cp >= 0x2000 && cp <= 0x200A) ||
+        cp == 0x2028 || cp == 0x2029 || cp == 0x202F || cp == 0x205F || cp == 0x3000) {
+        return WHISPER_PRETOK_SPACE;
+    }
+
+    if (cp == 0xB2 || cp == 0xB3 || cp == 0xB9 || (cp >= 0xBC && cp <= 0xBE) ||
+        (cp >= 0x0660 && cp <= 0x0669) || (cp >= 0x06F0 && cp <= 0x06F9) || (cp >= 0x0966 && cp <= 0x096F) ||
+        (cp >= 0x2070 && cp <= 0x2079) || (cp >= 0x2080 && cp <= 0x2089) || (cp >= 0x2150 && cp <= 0x2189) ||
+        (cp >= 0x2460 && cp <= 0x249B) || (cp >= 0xFF10 && cp <= 0xFF19)) {
+        return WHISPER_PRETOK_NUMBER;
+    }
+
+    if ((cp <  0xC0 && cp != 0xAA && cp != 0xB5 && cp != 0xBA) || cp == 0xD7 || cp == 0xF7 ||
+        (cp >= 0x0300 && cp <= 0x036F) ||   // combining marks
+        (cp >= 0x2010 && cp <= 0x2027) || (cp >= 0x2030 && cp <= 0x205E) ||
+        (cp >= 0x20A0 && cp <= 0x20FF) ||   // currency, combining marks for symbols
+        (cp >= 0x2190 && cp <= 0x2BFF) ||   // arrows, math operators, box drawing, shapes, misc symbols
+        (cp >= 0x3001 && cp <= 0x3004) || (cp >= 0x3008 && cp <= 0x3020) ||
+        (cp >= 0xFE30 && cp <= 0xFE4F) ||
+        (cp >= 0xFF01 && cp <= 0xFF0F) || (cp >= 0xFF1A && cp <= 0xFF20) ||
+        (cp >= 0xFF3B && cp <= 0xFF40) || (cp >= 0xFF5B && cp <= 0xFF65) ||
+        (cp >= 0x1F000 && cp <= 0x1FAFF) || // emoji
+        cp == 0xFFFD) {
+        return WHISPER_PRETOK_OTHER;
+    }
+
+    return WHISPER_PRETOK_LETTER;
+}
+
+// split text into words, without a regex and without copying the text
+//
+// ref: https://github.com/openai/gpt-2/blob/a74da5d99abaaba920de8131d64da2862a8f213b/src/encoder.py#L53
+//
+// Regex (Python):
+// r"""'s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+"""
+//
+template <typename F>
+static void whisper_pretokenize(const char * text, size_t n, F && cb) {
+    size_t len;
+
+    size_t i = 0;
+    while (i < n) {
+        size_t j = i;
+
+        // 's|'t|'re|'ve|'m|'ll|'d
+        if (text[i] == '\'' && i + 1 < n) {
+            const char c0 = text[i + 1];
+            const char c1 = i + 2 < n ? text[i + 2] : 0;
+
+            if (c0 == 's' || c0 == 't' || c0 == 'm' || c0 == 'd') {
+                j = i + 2;
+            } else if ((c0 == 'r' && c1 == 'e') || (c0 == 'v' && c1 == 'e') || (c0 == 'l' && c1 == 'l')) {
+                j = i + 3;
+            }
+        }
+
+        if (j == i) {
+            // ' ?' followed by a run of letters, numbers or other characters
+            const size_t k = text[i] == ' ' ? i + 1 : i;
+
+            const whisper_pretok_class cls = k < n ? whisper_pretok_classify(whisper_utf8_next(text + k, n - k, len)) : WHISPER_PRETOK_SPACE;
+
+            if (cls != WHISPER_PRETOK_SPACE) {
+                j = k;
+                while (j < n && whisper_pretok_classify(whisper_utf8_next(text + j, n - j, len)) == cls) {
+                    j += len;
+                }
+            } else {
+                // \s+(?!\S)|\s+ - a run of spaces followed by a word leaves its last space to that word
+                size_t last = i;
+                while (j < n && whisper_pretok_classify(whisper_utf8_next(text + j, n - j, len)) == WHISPER_PRETOK_SPACE) {
+                    last = j;
+                    j += len;
+                }
+                if (j < n && last > i) {
+                    j = last;
+                }
+            }
+        }
+
+        cb(text + i, j - i);
+
+        i = j;
+    }
+}
+
+// byte pair encoding of a single word
+//
+// starting from the individual bytes, the adjacent pair that forms the token with the lowest merge rank is merged until
+// no pair forms a token. the ids of the text tokens are their merge ranks (the vocab is stored in rank order, same as
+// the tiktoken files), so no separate merges table is needed
+//
+// parts is a scratch buffer, reused between the words
+static void whisper_bpe(
+        const whisper_vocab & vocab,
+                 const char * word,
+                       size_t n,
+        std::vector<std::pair<size_t, int32_t>> & parts,
+        std::vector<whisper_vocab::id> & tokens) {
+    const int32_t rank_none = INT32_MAX;
+
+    // special tokens are never the result of a merge
+    const auto rank = [&](size_t i0, size_t i1) {
+        const whisper_vocab::id id = vocab.find(word + i0, i1 - i0);
+        return id >= 0 && id < vocab.token_eot ? id : rank_none;
+    };
+
+    {
+        const int32_t id = rank(0, n);
+        if (id != rank_none) {
+            tokens.push_back(id);
+            return;
+        }
+    }
+
+    // parts[i].first  - start of the i-th part (the last entry marks the end of the word)
+    // parts[i].second - rank of the merge of the i-th and the (i + 1)-th parts
+    parts.clear();
+    for (size_t i = 0; i <= n; ++i) {
+        parts.emplace_back(i, rank_none);
+    }
+
+    const auto pair_rank = [&](size_t i) {
+        return i + 2 < parts.size() ? rank(parts[i].first, parts[i + 2].first) : rank_none;
+    };
+
+    for (size_t i = 0; i + 2 < parts.size(); ++i) {
+        parts[i].second = pair_rank(i);
+    }
+
+    while (parts.size() > 2) {
+        size_t  i_min = 0;
+        int32_t r_min = rank_none;
+
+        for (size_t i = 0; i + 2 < parts.size(); ++i) {
+            if (parts[i].second < r_min) {
+                r_min = parts[i].second;
+                i_min = i;
+            }
+        }
+
+        if (r_min == rank_none) {
+            break;
+        }
+
+        parts.erase(parts.begin() + i_min + 1);
+
+        parts[i_min].second = pair_rank(i_min);
+        if (i_min > 0) {
+            parts[i_min - 1].second = pair_rank(i_min - 1);
+        }
+    }
+
+    for (size_t i = 0; i + 1 < parts.size(); ++i) {
+        const whisper_vocab::id id = vocab.find(word + parts[i].first, parts[i + 1].first - parts[i].first);
+        if (id == -1) {
+            WHISPER_LOG_ERROR("unknown token\n");
+            continue;
+        }
+        tokens.push_back(id);
+    }
+}
+
+// split text into tokens
+static std::vector<whisper_vocab::id> tokenize(const whisper_vocab & vocab, const std::string & text) {
+    std::vector<whisper_vocab::id> tokens;
+    std::vector<std::pair<size_t, int32_t>> parts;
+
+    whisper_pretokenize(text.data(), text.size(), [&](const char * word, size_t n) {
+        whisper_bpe(vocab, word, n, parts, tokens);
+    });
+
+    return tokens;
+}
+
+// returns the tokens of text, tokenizing it only if it is not in the cache
+static const std::vector<whisper_token> & whisper_prompt_cache_get(whisper_prompt_cache & cache, const whisper_vocab & vocab, const char * text) {
+    const auto it = cache.index.find(text);
+    if (it != cache.index.end()) {
+        cache.entries.splice(cache.entries.begin(), cache.entries, it->second);
+        return it->second->second;
+    }
+
+    if (cache.entries.size() >= WHISPER_PROMPT_CACHE_SIZE) {
+        cache.index.erase(cache.entries.back().first);
+        cache.entries.pop_back();
+    }
+
+    cache.entries.emplace_front(text, tokenize(vocab, text));
+    cache.index.emplace(cache.entries.front().first, cache.entries.begin());
+
+    return cache.entries.front().second;
+}
+
+//
+// interface implementation
+//
+
+#ifdef WHISPER_USE_COREML
+// replace .bin with -encoder.mlmodelc
+static std::string whisper_get_coreml_path_encoder(std::string path_bin) {
+    auto pos = path_bin.rfind('.');
+    if (pos != std::string::npos) {
+        path_bin = path_bin.substr(0, pos);
+    }
+
+    // match "-qx_x"
+    pos = path_bin.rfind('-');
+    if (pos != std::string::npos) {
+        auto sub = path_bin.substr(pos);
+        if (sub.size() == 5 && sub[1] == 'q' && sub[3] == '_') {
+            path_bin = path_bin.substr(0, pos);
+        }
+    }
+
+    path_bin += "-encoder.mlmodelc";
+
+    return path_bin;
+}
+#endif
+
+#ifdef WHISPER_USE_OPENVINO
+// replace .bin with-encoder-openvino.xml
+static std::string whisper_openvino_get_path_encoder(std::string path_bin) {
+    auto pos = path_bin.rfind('.');
+    if (pos != std::string::npos) {
+        path_bin = path_bin.substr(0, pos);
+    }
+
+    path_bin += "-encoder-openvino.xml";
+
+    return path_bin;
+}
+
+static std::string whisper_openvino_get_path_cache(std::string path_bin) {
+    auto pos = path_bin.rfind('.');
+    if (pos != std::string::npos) {
+        path_bin = path_bin.substr(0, pos);
+    }
+
+    path_bin += "-encoder-openvino-cache";
+
+    return path_bin;
+}
+#endif
+
+struct whisper_state * whisper_init_state(whisper_context * ctx) {
+    whisper_state * state = new whisper_state;
+
+    state->backends = whisper_backend_init(ctx->params);
+    if (state->backends.empty()) {
+        WHISPER_LOG_ERROR("%s: whisper_backend_init() failed\n", __func__);
+        whisper_free_state(state);
+        return nullptr;
+    }
+
+    // at this point, we don't know yet how many decoders will be used
+    // later during decoding, if more decoders are used, we will recreate the KV cache respectively
+    state->kv_self_n_dec = 1;
+    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
+                ctx->model.hparams.n_text_state,
+                ctx->model.hparams.n_text_layer,
+                GGML_PAD(ctx->model.hparams.n_text_ctx, 256))) {
+        WHISPER_LOG_ERROR("%s: whisper_kv_cache_init() failed for self-attention cache\n", __func__);
+        whisper_free_state(state);
+        return nullptr;
+    }
+
+    {
+        const size_t memory_size = ggml_nbytes(state->kv_self.k) + ggml_nbytes(state->kv_self.v);
+        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB\n", __func__, memory_size / 1e6);
+    }
+
+    if (!whisper_kv_cache_init(state->kv_cross, state->backends[0], ctx->itype,
+                ctx->model.hparams.n_text_state,
+                ctx->model.hparams.n_text_layer,
+                GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
+        WHISPER_LOG_ERROR("%s: whisper_kv_cache_init() failed for cross-attention cache\n", __func__);
+        whisper_free_state(state);
+        return nullptr;
+    }
+
+    {
+        const size_t memory_size = ggml_nbytes(state->kv_cross.k) + ggml_nbytes(state->kv_cross.v);
+        WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB\n", __func__, memory_size / 1e6);
+    }
+
+    if (!whisper_kv_cache_init(state->kv_pad, state->backends[0], ctx->itype,
+                ctx->model.hparams.n_audio_state,
+                1,
+                GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
+        WHISPER_LOG_ERROR("%s: whisper_kv_cache_init() failed for self-attention cache\n", __func__);
+        whisper_free_state(state);
+        return nullptr;
+    }
+
+    {
+        const size_t memory_size = ggml_nbytes(state->kv_pad.k) + ggml_nbytes(state->kv_pad.v);
+        WHISPER_LOG_INFO("%s: kv pad  size  = %7.2f MB\n", __func__, memory_size / 1e6);
+    }
+
+    // [EXPERIMENTAL] Token-level timestamps with DTW
+    if (ctx->params.dtw_token_timestamps) {
+        if (!aheads_masks_init(ctx->params, ctx->model.hparams, state->aheads_masks, state->backends[0])) {
+            WHISPER_LOG_ERROR("%s: aheads_masks_init() failed for alignment heads masks\n", __func__);
+            whisper_free_state(state);
+            return nullptr;
+        }
+        const size_t memory_size = aheads_masks_nbytes(state->aheads_masks);
+        WHISPER_LOG_INFO("%s: alignment heads masks size = %ld B\n", __func__, memory_size);
+    }
+
+#ifdef WHISPER_USE_COREML
+    const auto path_coreml = whisper_get_coreml_path_encoder(ctx->path_model);
+
+    WHISPER_LOG_INFO("%s: loading Core ML model from '%s'\n", __func__, path_coreml.c_str());
+    WHISPER_LOG_INFO("%s: first run on a device may take a while ...\n", __func__);
+
+    state->ctx_coreml = whisper_coreml_init(path_coreml.c_str());
+    if (!state->ctx_coreml) {
+        WHISPER_LOG_ERROR("%s: failed to load Core ML model from '%s'\n", __func__, path_coreml.c_str());
+#ifndef WHISPER_COREML_ALLOW_FALLBACK
+        whisper_free_state(state);
+        return nullptr;
+#endif
+    } else {
+        WHISPER_LOG_INFO("%s: Core ML model loaded\n", __func__);
+    }
+#endif
+
+    state->logits.reserve(ctx->vocab.n_vocab * ctx->model.hparams.n_text_ctx);
+
+    state->batch = whisper_batch_init(ctx->model.hparams.n_text_ctx, WHISPER_MAX_DECODERS);
+
+    // TAGS: WHISPER_DECODER_INIT
+    state->decoders[0].sequence.tokens.reserve(ctx->model.hparams.n_text_ctx);
+
+    state->decoders[0].probs.reserve    (ctx->vocab.n_vocab);
+    state->decoders[0].logits.reserve   (ctx->vocab.n_vocab);
+    state->decoders[0].logprobs.reserve (ctx->vocab.n_vocab);
+    state->decoders[0].logits_id.reserve(ctx->model.hparams.n_vocab);
+
+    state->decoders[0].rng = std::mt19937(0);
+
+    // the compute buffers are prepared with the weights in place - if a part of the model is not loaded yet, its
+    // compute buffers are prepared on first use
+    if (whisper_model_part_is_loaded(ctx, WHISPER_MODEL_PART_ENCODER) && !whisper_sched_init_encode(*ctx, *state)) {
+        whisper_free_state(state);
+        return nullptr;
+    }
+
+    if (whisper_model_part_is_loaded(ctx, WHISPER_MODEL_PART_DECODER) && !whisper_sched_init_decode(*ctx, *state)) {
+        whisper_free_state(state);
+        return nullptr;
+    }
+
+    return state;
+}
+
+int whisper_ctx_init_openvino_encoder_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                    const char * model_path,
+                    const char * device,
+                    const char * cache_dir) {
+#ifndef WHISPER_USE_OPENVINO
+    (void)(ctx);
+    (void)(state);
+    (void)(model_path);
+    (void)(device);
+    (void)(cache_dir);
+
+    return 1;
+#else
+    if (!model_path && ctx->path_model.empty()) {
+        WHISPER_LOG_ERROR("%s: model_path is nullptr, and ctx has no model_path set.\n", __func__);
+        return 1;
+    }
+
+    std::string path_encoder;
+    if (!model_path) {
+        //if model_path is not set, attempt to find it in the same directory as ggml-<model>.bin model
+        path_encoder = whisper_openvino_get_path_encoder(ctx->path_model);
+    } else {
+        path_encoder = model_path;
+    }
+
+    std::string path_cache;
+    if (!cache_dir) {
+        //if cache_dir is not set, set it as a dir residing next to ggml-<model>.bin
+        path_cache = whisper_openvino_get_path_cache(ctx->path_model);
+    } else {
+        path_cache = cache_dir;
+    }
+
+    WHISPER_LOG_INFO("%s: loading OpenVINO model from '%s'\n", __func__, path_encoder.c_str());
+    WHISPER_LOG_INFO("%s: first run on a device may take a while ...\n", __func__);
+
+    state->ctx_openvino = whisper_openvino_init(path_encoder.c_str(), device, path_cache.c_str());
+    if (!state->ctx_openvino) {
+        WHISPER_LOG_ERROR("%s: failed to init OpenVINO encoder from '%s'\n", __func__, path_encoder.c_str());
+        return 1;
+    } else {
+        WHISPER_LOG_INFO("%s: OpenVINO model loaded\n", __func__);
+    }
+
+    return 0;
+#endif
+}
+
+int whisper_ctx_init_openvino_encoder(
+        struct whisper_context * ctx,
+                    const char * model_path,
+                    const char * device,
+                    const char * cache_dir) {
+    return whisper_ctx_init_openvino_encoder_with_state(ctx, ctx->state, model_path, device, cache_dir);
+}
+
+struct whisper_context_params whisper_context_default_params() {
+    struct whisper_context_params result = {
+        /*.use_gpu              =*/ true,
+        /*.flash_attn           =*/ false,
+        /*.gpu_device           =*/ 0,
+
+        /*.dtw_token_timestamps =*/ false,
+        /*.dtw_aheads_preset    =*/ WHISPER_AHEADS_NONE,
+        /*.dtw_n_top            =*/ -1,
+        /*.dtw_aheads           =*/ {
+            /*.n_heads          =*/ 0,
+            /*.heads            =*/ NULL,
+        },
+        /*.dtw_mem_size         =*/ 1024*1024*128,
+
+        /*.use_mmap             =*/ true,
+        /*.n_threads_load       =*/ std::min(4, (int32_t) std::thread::hardware_concurrency()),
+        /*.repack_cache_dir     =*/ nullptr,
+        /*.lazy_load            =*/ false,
+        /*.mel_graph            =*/ false,
 
-            cur = ggml_add(ctx0,
-                    cur,
-                    layer.cross_attn_ln_1_b);
-        }
+        /*.cache_mem_size       =*/ 0,
+        /*.cache_dir            =*/ nullptr,
+        /*.cache_disk_size      =*/ 0,
+    };
+    return result;
+}
 
-        // add the input
-        cur = ggml_add(ctx0, cur, inpCA);
+static void whisper_cache_init(whisper_context & wctx) {
+    const auto & params = wctx.params;
 
-        struct ggml_tensor * inpFF = cur;
+    if (params.cache_mem_size == 0 && params.cache_dir == nullptr) {
+        return;
+    }
 
-        // feed-forward network
-        {
-            // norm
-            {
-                cur = ggml_norm(ctx0, inpFF, hparams.eps);
+    wctx.cache.reset(new whisper_cache);
 
-                // cur = mlp_ln_w*cur + mlp_ln_b
-                cur = ggml_add(ctx0,
-                        ggml_mul(ctx0,
-                            cur,
-                            layer.mlp_ln_w),
-                        layer.mlp_ln_b);
-            }
+    auto & cache = *wctx.cache;
 
-            // fully connected
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_0_w,
-                    cur);
+    cache.mem_size_max  = params.cache_mem_size;
+    cache.disk_size_max = params.cache_disk_size;
 
-            cur = ggml_add(ctx0,
-                    cur,
-                    layer.mlp_0_b);
+    whisper_sha256 key;
 
-            // GELU activation
-            cur = ggml_gelu(ctx0, cur);
+    whisper_cache_key_str(key, WHISPER_VERSION);
+    whisper_cache_key_str(key, whisper_print_system_info());
+    whisper_cache_key_val(key, wctx.model.hparams);
+    whisper_cache_key_val(key, wctx.itype);
+    whisper_cache_key_val(key, params.use_gpu);
+    whisper_cache_key_val(key, params.gpu_device);
+    whisper_cache_key_val(key, params.flash_attn);
+    whisper_cache_key_val(key, params.dtw_token_timestamps);
+    whisper_cache_key_val(key, params.dtw_aheads_preset);
+    whisper_cache_key_val(key, params.dtw_n_top);
+    whisper_cache_key_val(key, params.dtw_aheads.n_heads);
+    if (params.dtw_aheads.heads) {
+        key.update(params.dtw_aheads.heads, params.dtw_aheads.n_heads*sizeof(whisper_ahead));
+    }
 
-            // projection
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_1_w,
-                    cur);
+    // the entries on disk outlive the context, so the model file must be identified
+    struct stat st;
+    if (params.cache_dir != nullptr) {
+        if (!wctx.path_model.empty() && stat(wctx.path_model.c_str(), &st) == 0) {
+            whisper_cache_key_str(key, wctx.path_model.c_str());
+            whisper_cache_key_val(key, (int64_t) st.st_size);
+            whisper_cache_key_val(key, (int64_t) st.st_mtime);
 
-            cur = ggml_add(ctx0,
-                    cur,
-                    layer.mlp_1_b);
+            cache.dir = params.cache_dir;
+        } else {
+            WHISPER_LOG_WARN("%s: the disk cache requires a model loaded from a file - using the memory cache only\n", __func__);
         }
+    }
 
-        inpL = ggml_add(ctx0, cur, inpFF);
+    cache.key_model = key.digest();
+
+    if (!cache.dir.empty()) {
+        cache.disk_scan();
     }
 
-    cur = inpL;
+    WHISPER_LOG_INFO("%s: cache: %.2f MB in memory, dir = '%s' (%.2f MB)\n", __func__,
+            cache.mem_size_max/1e6, cache.dir.c_str(), cache.disk_size_max/1e6);
+}
 
-    // norm
-    {
-        cur = ggml_norm(ctx0, cur, hparams.eps);
+static struct whisper_context * whisper_init_with_params_no_state_impl(
+      struct whisper_context_params   params,
+      std::unique_ptr<whisper_mmap> && mapping,
+                         const char * path_model,
+      const std::function<bool(whisper_context &)> & load) {
+    ggml_time_init();
 
-        cur = ggml_add(ctx0,
-                ggml_mul(ctx0,
-                    cur,
-                    model.d_ln_w),
-                model.d_ln_b);
+    if (params.flash_attn && params.dtw_token_timestamps) {
+        WHISPER_LOG_WARN("%s: dtw_token_timestamps is not supported with flash_attn - disabling\n", __func__);
+        params.dtw_token_timestamps = false;
     }
 
-    // compute logits only for the last token
-    // comment this line to compute logits for all n_tokens
-    // might be useful in the future
-    //cur = ggml_view_2d(ctx0, cur, cur->ne[0], 1, cur->nb[1], (cur->ne[1] - 1)*cur->nb[1]);
+    WHISPER_LOG_INFO("%s: use gpu    = %d\n", __func__, params.use_gpu);
+    WHISPER_LOG_INFO("%s: flash attn = %d\n", __func__, params.flash_attn);
+    WHISPER_LOG_INFO("%s: gpu_device = %d\n", __func__, params.gpu_device);
+    WHISPER_LOG_INFO("%s: mmap       = %d\n", __func__, mapping != nullptr);
+    WHISPER_LOG_INFO("%s: n_thr_load = %d\n", __func__, params.n_threads_load);
+    WHISPER_LOG_INFO("%s: lazy load  = %d\n", __func__, params.lazy_load);
+    WHISPER_LOG_INFO("%s: mel graph  = %d\n", __func__, params.mel_graph);
+    WHISPER_LOG_INFO("%s: dtw        = %d\n", __func__, params.dtw_token_timestamps);
+    WHISPER_LOG_INFO("%s: devices    = %zu\n", __func__, ggml_backend_dev_count());
+    WHISPER_LOG_INFO("%s: backends   = %zu\n", __func__, ggml_backend_reg_count());
 
-    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te, cur);
+    whisper_context * ctx = new whisper_context;
+    ctx->params = params;
+    ctx->model.mapping = std::move(mapping);
 
-    // [EXPERIMENTAL] Token-level timestamps with DTW
-    if (wctx.params.dtw_token_timestamps && aheads_cross_QKs != nullptr) {
-        aheads_cross_QKs = ggml_transpose(ctx0, aheads_cross_QKs);
-        aheads_cross_QKs = ggml_cont(ctx0, aheads_cross_QKs);
-        if (save_alignment_heads_QKs) {
-            ggml_build_forward_expand(gf, aheads_cross_QKs);
-            wstate.aheads_cross_QKs = aheads_cross_QKs;
-        }
+    if (path_model) {
+        ctx->path_model = path_model;
     }
 
-    ggml_build_forward_expand(gf, logits);
+    if (!load(*ctx)) {
+        WHISPER_LOG_ERROR("%s: failed to load model\n", __func__);
+        delete ctx;
+        return nullptr;
+    }
 
-    ggml_free(ctx0);
+    whisper_cache_init(*ctx);
 
-    return gf;
+    return ctx;
 }
 
-// evaluate the decoder
-//
-// given text prompt + audio features -> computes the logits for the next token
-//
-//   - model:      the model
-//   - n_threads:  number of threads to use
-//   - tokens:     text prompt
-//   - n_tokens:   number of tokens in the prompt
-//   - n_past:     number of past tokens to prefix the prompt with
-//
-static bool whisper_decode_internal(
-        whisper_context & wctx,
-          whisper_state & wstate,
-    const whisper_batch & batch,
-              const int   n_threads,
-                   bool   save_alignment_heads_QKs,
-    ggml_abort_callback   abort_callback,
-                   void * abort_callback_data) {
-    const int64_t t_start_us = ggml_time_us();
-
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+static struct whisper_context * whisper_init_with_params_no_state_impl(
+        struct whisper_model_loader * loader,
+      struct whisper_context_params   params,
+      std::unique_ptr<whisper_mmap> && mapping,
+                         const char * path_model) {
+    return whisper_init_with_params_no_state_impl(params, std::move(mapping), path_model, [loader](whisper_context & wctx) {
+        const bool ok = whisper_model_load(loader, wctx);
+        loader->close(loader->context);
+        return ok;
+    });
+}
 
-    const int n_vocab  = hparams.n_vocab;
-    const int n_tokens = batch.n_tokens;
+struct whisper_context * whisper_init_from_file_with_params_no_state(const char * path_model, struct whisper_context_params params) {
+    WHISPER_LOG_INFO("%s: loading model from '%s'\n", __func__, path_model);
+    auto fin = whisper_ifstream_open(path_model);
+    if (!fin) {
+        WHISPER_LOG_ERROR("%s: failed to open '%s'\n", __func__, path_model);
+        return nullptr;
+    }
 
-    auto & logits_out = wstate.logits;
+    uint32_t magic = 0;
+    fin.read((char *) &magic, sizeof(magic));
+    fin.clear();
+    fin.seekg(0);
 
-    struct ggml_tensor * logits;
+    if (magic == WHISPER_GGUF_MAGIC) {
+        std::unique_ptr<whisper_mmap> mapping;
 
-    // find KV slot for the batch
-    {
-        auto & kv_self = wstate.kv_self;
+        if (params.use_mmap && whisper_mmap::SUPPORTED) {
+            mapping.reset(new whisper_mmap);
 
-        if (!whisper_kv_cache_find_slot(kv_self, batch)) {
-            return false;
+            if (!mapping->init(path_model, !params.lazy_load)) {
+                WHISPER_LOG_WARN("%s: failed to mmap '%s' - falling back to reading the file\n", __func__, path_model);
+                mapping.reset();
+            }
         }
 
-        const uint32_t pad = whisper_kv_cache_get_padding(wctx);
-        kv_self.n = std::min(kv_self.size, std::max(pad, GGML_PAD(whisper_kv_cache_cell_max(kv_self), pad)));
+        fin.close();
 
-        //kv_self.n = std::min((int32_t) hparams.n_text_ctx, std::max(32, whisper_kv_cache_cell_max(kv_self)));
-        //printf("n_tokens = %5d, kv_self.head = %5d, kv_self.n = %5d, seq_id = %5d\n", batch.n_tokens, kv_self.head, kv_self.n, batch.seq_id[0][0]);
+        return whisper_init_with_params_no_state_impl(params, std::move(mapping), path_model, [&](whisper_context & wctx) {
+            return whisper_model_load_gguf(path_model, wctx);
+        });
     }
 
-    // decoder
-    {
-        auto & sched = wstate.sched_decode.sched;
+    if (params.use_mmap && whisper_mmap::SUPPORTED) {
+        std::unique_ptr<whisper_mmap> mapping(new whisper_mmap);
 
-        ggml_cgraph * gf = whisper_build_graph_decoder(wctx, wstate, batch, save_alignment_heads_QKs, false);
+        if (mapping->init(path_model, !params.lazy_load)) {
+            fin.close();
 
-        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-            // should never happen as we pre-allocate the memory
-            return false;
-        }
+            whisper_model_loader loader = {};
 
-        // set the inputs
-        {
-            struct ggml_tensor * embd = ggml_graph_get_tensor(gf, "embd");
-            ggml_backend_tensor_set(embd, batch.token, 0, n_tokens*ggml_element_size(embd));
-        }
+            loader.context = mapping.get();
 
-        {
-            struct ggml_tensor * position = ggml_graph_get_tensor(gf, "position");
-            for (int i = 0; i < n_tokens; ++i) {
-                const int32_t val = batch.pos[i];
-                ggml_backend_tensor_set(position, &val, i*sizeof(int32_t), sizeof(int32_t));
-            }
+            loader.read = [](void * ctx, void * output, size_t read_size) {
+                whisper_mmap * mapping = (whisper_mmap *) ctx;
+                return mapping->read(output, read_size);
+            };
+
+            loader.eof = [](void * ctx) {
+                whisper_mmap * mapping = (whisper_mmap *) ctx;
+                return mapping->eof();
+            };
+
+            loader.close = [](void * /*ctx*/) { };
+
+            return whisper_init_with_params_no_state_impl(&loader, params, std::move(mapping), path_model);
         }
 
-        {
-            struct ggml_tensor * KQ_mask = ggml_graph_get_tensor(gf, "KQ_mask");
+        WHISPER_LOG_WARN("%s: failed to mmap '%s' - falling back to reading the file\n", __func__, path_model);
+    }
 
-            auto & kv_self = wstate.kv_self;
+    whisper_model_loader loader = {};
 
-            const int32_t n_kv = kv_self.n;
+    loader.context = &fin;
 
-            wstate.inp_mask.resize(ggml_nelements(KQ_mask));
+    loader.read = [](void * ctx, void * output, size_t read_size) {
+        std::ifstream * fin = (std::ifstream*)ctx;
+        fin->read((char *)output, read_size);
+        return read_size;
+    };
 
-            float * data = wstate.inp_mask.data();
-            memset(data, 0, ggml_nbytes(KQ_mask));
+    loader.eof = [](void * ctx) {
+        std::ifstream * fin = (std::ifstream*)ctx;
+        return fin->eof();
+    };
 
-            for (int h = 0; h < 1; ++h) {
-                for (int j = 0; j < n_tokens; ++j) {
-                    const whisper_pos    pos    = batch.pos[j];
-                    const whisper_seq_id seq_id = batch.seq_id[j][0];
+    loader.close = [](void * ctx) {
+        std::ifstream * fin = (std::ifstream*)ctx;
+        fin->close();
+    };
 
-                    for (int i = 0; i < n_kv; ++i) {
-                        if (!kv_self.cells[i].has_seq_id(seq_id) || kv_self.cells[i].pos > pos) {
-                            data[h*(n_kv*n_tokens) + j*n_kv + i] = -INFINITY;
-                        }
-                    }
-                }
+    return whisper_init_with_params_no_state_impl(&loader, params, nullptr, path_model);
+}
 
-                for (int i = n_tokens; i < GGML_PAD(n_tokens, GGML_KQ_MASK_PAD); ++i) {
-                    for (int j = 0; j < n_kv; ++j) {
-                        data[h*(n_kv*n_tokens) + i*n_kv + j] = -INFINITY;
-                    }
-                }
-            }
+struct whisper_context * whisper_init_from_buffer_with_params_no_state(void * buffer, size_t buffer_size, struct whisper_context_params params) {
+    struct buf_context {
+        uint8_t* buffer;
+        size_t size;
+        size_t current_offset;
+    };
 
-            ggml_backend_tensor_set(KQ_mask, wstate.inp_mask.data(), 0, ggml_nelements(KQ_mask)*sizeof(float));
-        }
+    buf_context ctx = { reinterpret_cast<uint8_t*>(buffer), buffer_size, 0 };
 
-        logits = ggml_graph_node(gf, -1);
+    WHISPER_LOG_INFO("%s: loading model from buffer\n", __func__);
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
-            return false;
-        }
-    }
+    whisper_model_loader loader = {};
 
-    logits_out.resize(n_tokens*n_vocab);
-    for (int i = 0; i < n_tokens; i++) {
-        if (batch.logits[i] == 0) {
-            continue;
-        }
-        ggml_backend_tensor_get(logits, logits_out.data() + (n_vocab*i), sizeof(float)*(n_vocab*i), sizeof(float)*n_vocab);
-    }
+    loader.context = &ctx;
 
-    if (batch.n_tokens > 1) {
-        //printf("%s: used_mem = %f MB, %f MB, %f MB %f MB %f MB\n", __func__,
-        //        ggml_used_mem(ctx0)/1e6,
-        //        wstate.get_buf_max_mem(0)/1e6,
-        //        wstate.get_buf_max_mem(1)/1e6,
-        //        wstate.get_buf_max_mem(2)/1e6,
-        //        wstate.get_buf_max_mem(3)/1e6);
-    }
+    loader.read = [](void * ctx, void * output, size_t read_size) {
+        buf_context * buf = reinterpret_cast<buf_context *>(ctx);
 
-    if (batch.n_tokens == 1) {
-        wstate.t_decode_us += ggml_time_us() - t_start_us;
-        wstate.n_decode++;
-    } else if (batch.n_tokens < 16) {
-        wstate.t_batchd_us += ggml_time_us() - t_start_us;
-        wstate.n_batchd += n_tokens;
-    } else {
-        wstate.t_prompt_us += ggml_time_us() - t_start_us;
-        wstate.n_prompt += n_tokens;
-    }
+        size_t size_to_copy = buf->current_offset + read_size < buf->size ? read_size : buf->size - buf->current_offset;
+
+        memcpy(output, buf->buffer + buf->current_offset, size_to_copy);
+        buf->current_offset += size_to_copy;
+
+        return size_to_copy;
+    };
 
-    return !(abort_callback && abort_callback(abort_callback_data));
-}
+    loader.eof = [](void * ctx) {
+        buf_context * buf = reinterpret_cast<buf_context *>(ctx);
 
-//  500 -> 00:05.000
-// 6000 -> 01:00.000
-static std::string to_timestamp(int64_t t, bool comma = false) {
-    int64_t msec = t * 10;
-    int64_t hr = msec / (1000 * 60 * 60);
-    msec = msec - hr * (1000 * 60 * 60);
-    int64_t min = msec / (1000 * 60);
-    msec = msec - min * (1000 * 60);
-    int64_t sec = msec / 1000;
-    msec = msec - sec * 1000;
+        return buf->current_offset >= buf->size;
+    };
 
-    char buf[32];
-    snprintf(buf, sizeof(buf), "%02d:%02d:%02d%s%03d", (int) hr, (int) min, (int) sec, comma ? "," : ".", (int) msec);
+    loader.close = [](void * /*ctx*/) { };
 
-    return std::string(buf);
+    return whisper_init_with_params_no_state(&loader, params);
 }
 
-#define SIN_COS_N_COUNT WHISPER_N_FFT
-namespace {
-struct whisper_global_cache {
-    // In FFT, we frequently use sine and cosine operations with the same values.
-    // We can use precalculated values to speed up the process.
-    float sin_vals[SIN_COS_N_COUNT];
-    float cos_vals[SIN_COS_N_COUNT];
-
-    // Hann window (Use cosf to eliminate difference)
-    // ref: https://pytorch.org/docs/stable/generated/torch.hann_window.html
-    // ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L147
-    float hann_window[WHISPER_N_FFT];
+struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_loader * loader, struct whisper_context_params params) {
+    return whisper_init_with_params_no_state_impl(loader, params, nullptr, nullptr);
+}
 
-    whisper_global_cache() {
-        fill_sin_cos_table();
-        fill_hann_window(sizeof(hann_window)/sizeof(hann_window[0]), true, hann_window);
+struct whisper_context * whisper_init_from_file_with_params(const char * path_model, struct whisper_context_params params) {
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(path_model, params);
+    if (!ctx) {
+        return nullptr;
     }
 
-    void fill_sin_cos_table() {
-        for (int i = 0; i < SIN_COS_N_COUNT; i++) {
-            double theta = (2 * M_PI * i) / SIN_COS_N_COUNT;
-            sin_vals[i] = sinf(theta);
-            cos_vals[i] = cosf(theta);
-        }
+    ctx->state = whisper_init_state(ctx);
+    if (!ctx->state) {
+        whisper_free(ctx);
+        return nullptr;
     }
 
-    void fill_hann_window(int length, bool periodic, float * output) {
-        int offset = -1;
-        if (periodic) {
-            offset = 0;
-        }
-        for (int i = 0; i < length; i++) {
-            output[i] = 0.5 * (1.0 - cosf((2.0 * M_PI * i) / (length + offset)));
-        }
-    }
-} global_cache;
+    return ctx;
 }
 
-// naive Discrete Fourier Transform
-// input is real-valued
-// output is complex-valued
-static void dft(const float* in, int N, float* out) {
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
-
-    for (int k = 0; k < N; k++) {
-        float re = 0;
-        float im = 0;
-
-        for (int n = 0; n < N; n++) {
-            int idx = (k * n * sin_cos_step) % (SIN_COS_N_COUNT); // t = 2*M_PI*k*n/N
-            re += in[n]*global_cache.cos_vals[idx]; // cos(t)
-            im -= in[n]*global_cache.sin_vals[idx]; // sin(t)
-        }
+struct whisper_context * whisper_init_from_buffer_with_params(void * buffer, size_t buffer_size, struct whisper_context_params params) {
+    whisper_context * ctx = whisper_init_from_buffer_with_params_no_state(buffer, buffer_size, params);
+    if (!ctx) {
+        return nullptr;
+    }
 
-        out[k*2 + 0] = re;
-        out[k*2 + 1] = im;
+    ctx->state = whisper_init_state(ctx);
+    if (!ctx->state) {
+        whisper_free(ctx);
+        return nullptr;
     }
+
+    return ctx;
 }
 
-// Cooley-Tukey FFT
-// poor man's implementation - use something better
-// input is real-valued
-// output is complex-valued
-static void fft(float* in, int N, float* out) {
-    if (N == 1) {
-        out[0] = in[0];
-        out[1] = 0;
-        return;
+struct whisper_context * whisper_init_with_params(struct whisper_model_loader * loader, struct whisper_context_params params) {
+    whisper_context * ctx = whisper_init_with_params_no_state(loader, params);
+    if (!ctx) {
+        return nullptr;
     }
 
-    const int half_N = N / 2;
-    if (N - half_N*2 == 1) {
-        dft(in, N, out);
-        return;
+    ctx->state = whisper_init_state(ctx);
+    if (!ctx->state) {
+        whisper_free(ctx);
+        return nullptr;
     }
 
-    float* even = in + N;
-    for (int i = 0; i < half_N; ++i) {
-        even[i]= in[2*i];
-    }
-    float* even_fft = out + 2 * N;
-    fft(even, half_N, even_fft);
+    return ctx;
+}
 
-    float* odd = even;
-    for (int i = 0; i < half_N; ++i) {
-        odd[i] = in[2*i + 1];
-    }
-    float* odd_fft = even_fft + N;
-    fft(odd, half_N, odd_fft);
+struct whisper_context * whisper_init_from_file(const char * path_model) {
+    return whisper_init_from_file_with_params(path_model, whisper_context_default_params());
+}
+
+struct whisper_context * whisper_init_from_buffer(void * buffer, size_t buffer_size) {
+    return whisper_init_from_buffer_with_params(buffer, buffer_size, whisper_context_default_params());
+}
 
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
-    for (int k = 0; k < half_N; k++) {
-        int idx = k * sin_cos_step; // t = 2*M_PI*k/N
-        float re = global_cache.cos_vals[idx]; // cos(t)
-        float im = -global_cache.sin_vals[idx]; // sin(t)
+struct whisper_context * whisper_init(struct whisper_model_loader * loader) {
+    return whisper_init_with_params(loader, whisper_context_default_params());
+}
+
+struct whisper_context * whisper_init_from_file_no_state(const char * path_model) {
+    return whisper_init_from_file_with_params_no_state(path_model, whisper_context_default_params());
+}
 
-        float re_odd = odd_fft[2*k + 0];
-        float im_odd = odd_fft[2*k + 1];
+struct whisper_context * whisper_init_from_buffer_no_state(void * buffer, size_t buffer_size) {
+    return whisper_init_from_buffer_with_params_no_state(buffer, buffer_size, whisper_context_default_params());
+}
 
-        out[2*k + 0] = even_fft[2*k + 0] + re*re_odd - im*im_odd;
-        out[2*k + 1] = even_fft[2*k + 1] + re*im_odd + im*re_odd;
+struct whisper_context * whisper_init_no_state(struct whisper_model_loader * loader) {
+    return whisper_init_with_params_no_state(loader, whisper_context_default_params());
+}
 
-        out[2*(k + half_N) + 0] = even_fft[2*k + 0] - re*re_odd + im*im_odd;
-        out[2*(k + half_N) + 1] = even_fft[2*k + 1] - re*im_odd - im*re_odd;
+int whisper_model_part_load(struct whisper_context * ctx, enum whisper_model_part part) {
+    if (!whisper_model_require_part(*ctx, part)) {
+        WHISPER_LOG_ERROR("%s: failed to load the %s weights\n", __func__, whisper_model_part_name(part));
+        return -1;
     }
+
+    return 0;
 }
 
-static void log_mel_spectrogram_worker_thread(int ith, const float * hann, const std::vector<float> & samples,
-                                              int n_samples, int frame_size, int frame_step, int n_threads,
-                                              const whisper_filters & filters, whisper_mel & mel) {
-    std::vector<float> fft_in(frame_size * 2, 0.0);
-    std::vector<float> fft_out(frame_size * 2 * 2 * 2);
+int whisper_model_part_evict(struct whisper_context * ctx, enum whisper_model_part part) {
+    auto & model = ctx->model;
 
-    int n_fft = filters.n_fft;
-    int i = ith;
+    std::lock_guard<std::mutex> lock(model.mutex_parts);
 
-    // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
-    assert(n_fft == 1 + (frame_size / 2));
+    if (model.parts[part].records.empty()) {
+        WHISPER_LOG_ERROR("%s: the %s weights cannot be read again from the model file - use a GGUF model or mmap\n", __func__, whisper_model_part_name(part));
+        return -1;
+    }
 
-    // calculate FFT only when fft_in are not all zero
-    for (; i < std::min(n_samples / frame_step + 1, mel.n_len); i += n_threads) {
-        const int offset = i * frame_step;
+    whisper_model_free_part(model, part);
 
-        // apply Hann window (~10% faster)
-        for (int j = 0; j < std::min(frame_size, n_samples - offset); j++) {
-            fft_in[j] = hann[j] * samples[offset + j];
-        }
+    return 0;
+}
 
-        // fill the rest with zeros
-        if (n_samples - offset < frame_size) {
-            std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0);
-        }
+bool whisper_model_part_is_loaded(struct whisper_context * ctx, enum whisper_model_part part) {
+    std::lock_guard<std::mutex> lock(ctx->model.mutex_parts);
 
-        // FFT
-        fft(fft_in.data(), frame_size, fft_out.data());
+    return ctx->model.parts[part].loaded;
+}
 
-        // Calculate modulus^2 of complex numbers
-        // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
-        for (int j = 0; j < n_fft; j++) {
-            fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
-        }
+void whisper_free_state(struct whisper_state * state) {
+    if (state) {
+        whisper_kv_cache_free(state->kv_self);
+        whisper_kv_cache_free(state->kv_cross);
+        whisper_kv_cache_free(state->kv_pad);
 
-        // mel spectrogram
-        for (int j = 0; j < mel.n_mel; j++) {
-            double sum = 0.0;
-            // unroll loop (suggested by GH user @lunixbochs)
-            int k = 0;
-            for (k = 0; k < n_fft - 3; k += 4) {
-                sum +=
-                        fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
-                        fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
-                        fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
-                        fft_out[k + 3] * filters.data[j * n_fft + k + 3];
-            }
-            // handle n_fft remainder
-            for (; k < n_fft; k++) {
-                sum += fft_out[k] * filters.data[j * n_fft + k];
-            }
-            sum = log10(std::max(sum, 1e-10));
-            mel.data[j * mel.n_len + i] = sum;
+#ifdef WHISPER_USE_COREML
+        if (state->ctx_coreml != nullptr) {
+            whisper_coreml_free(state->ctx_coreml);
+            state->ctx_coreml = nullptr;
         }
-    }
+#endif
 
-    // Otherwise fft_out are all zero
-    double sum = log10(1e-10);
-    for (; i < mel.n_len; i += n_threads) {
-        for (int j = 0; j < mel.n_mel; j++) {
-            mel.data[j * mel.n_len + i] = sum;
+#ifdef WHISPER_USE_OPENVINO
+        if (state->ctx_openvino != nullptr) {
+            whisper_openvino_free(state->ctx_openvino);
+            state->ctx_openvino = nullptr;
         }
-    }
-}
-
-// ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L110-L157
-static bool log_mel_spectrogram(
-              whisper_state & wstate,
-              const float * samples,
-              const int   n_samples,
-              const int   /*sample_rate*/,
-              const int   frame_size,
-              const int   frame_step,
-              const int   n_mel,
-              const int   n_threads,
-              const whisper_filters & filters,
-              const bool   debug,
-              whisper_mel & mel) {
-    const int64_t t_start_us = ggml_time_us();
+#endif
 
-    // Hann window
-    WHISPER_ASSERT(frame_size == WHISPER_N_FFT && "Unsupported frame_size");
-    const float * hann = global_cache.hann_window;
+        whisper_batch_free(state->batch);
 
-    // Calculate the length of padding
-    int64_t stage_1_pad = WHISPER_SAMPLE_RATE * 30;
-    int64_t stage_2_pad = frame_size / 2;
+        ggml_backend_buffer_free(state->mel_graph.buffer);
+        ggml_free(state->mel_graph.ctx);
 
-    // Initialize a vector and copy data from C array to it.
-    std::vector<float> samples_padded;
-    samples_padded.resize(n_samples + stage_1_pad + stage_2_pad * 2);
-    std::copy(samples, samples + n_samples, samples_padded.begin() + stage_2_pad);
+        ggml_backend_sched_free(state->sched_mel.sched);
+        ggml_backend_sched_free(state->sched_decode.sched);
 
-    // pad 30 seconds of zeros at the end of audio (480,000 samples) + reflective pad 200 samples at the end of audio
-    std::fill(samples_padded.begin() + n_samples + stage_2_pad, samples_padded.begin() + n_samples + stage_1_pad + 2 * stage_2_pad, 0);
+        for (auto & se : state->sched_enc) {
+            ggml_backend_sched_free(se.conv.sched);
+            ggml_backend_sched_free(se.encode.sched);
+            ggml_backend_sched_free(se.cross.sched);
+        }
 
-    // reflective pad 200 samples at the beginning of audio
-    std::reverse_copy(samples + 1, samples + 1 + stage_2_pad, samples_padded.begin());
+        ggml_backend_sched_free(state->sched_enc_batch.conv.sched);
+        ggml_backend_sched_free(state->sched_enc_batch.encode.sched);
+        ggml_backend_sched_free(state->sched_enc_batch.cross.sched);
 
-    mel.n_mel     = n_mel;
-    // https://github.com/pytorch/pytorch/blob/main/aten/src/ATen/native/SpectralOps.cpp#L936
-    // Calculate number of frames + remove the last frame
-    mel.n_len     = (samples_padded.size() - frame_size) / frame_step;
-    // Calculate semi-padded sample length to ensure compatibility
-    mel.n_len_org = 1 + (n_samples + stage_2_pad - frame_size) / frame_step;
-    mel.data.resize(mel.n_mel * mel.n_len);
+        whisper_enc_stream_free(state->enc_stream);
 
-    {
-        std::vector<std::thread> workers(n_threads - 1);
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw] = std::thread(
-                    log_mel_spectrogram_worker_thread, iw + 1, hann, std::cref(samples_padded),
-                    n_samples + stage_2_pad, frame_size, frame_step, n_threads,
-                    std::cref(filters), std::ref(mel));
+        for (auto & backend : state->backends) {
+            ggml_backend_free(backend);
         }
 
-        // main thread
-        log_mel_spectrogram_worker_thread(0, hann, samples_padded, n_samples + stage_2_pad, frame_size, frame_step, n_threads, filters, mel);
+        // [EXPERIMENTAL] Token-level timestamps with DTW
+        aheads_masks_free(state->aheads_masks);
 
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw].join();
-        }
+        delete state;
     }
+}
 
-    // clamping and normalization
-    double mmax = -1e20;
-    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
-        if (mel.data[i] > mmax) {
-            mmax = mel.data[i];
+void whisper_free(struct whisper_context * ctx) {
+    if (ctx) {
+        // the tensors of the parts live in model.ctx - free their buffers first
+        for (int part = 0; part < WHISPER_MODEL_PART_COUNT; ++part) {
+            whisper_model_free_part(ctx->model, (whisper_model_part) part);
         }
-    }
+        ggml_backend_buffer_free(ctx->model.buffer_mmap);
 
-    mmax -= 8.0;
+        ggml_free(ctx->model.ctx);
 
-    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
-        if (mel.data[i] < mmax) {
-            mel.data[i] = mmax;
-        }
+        whisper_free_state(ctx->state);
 
-        mel.data[i] = (mel.data[i] + 4.0)/4.0;
+        delete ctx;
     }
+}
 
-    wstate.t_mel_us += ggml_time_us() - t_start_us;
-
-    // Dump log_mel_spectrogram
-    if (debug) {
-        std::ofstream outFile("log_mel_spectrogram.json");
-        outFile << "[";
-        for (uint64_t i = 0; i < mel.data.size() - 1; i++) {
-            outFile << mel.data[i] << ", ";
-        }
-        outFile << mel.data[mel.data.size() - 1] << "]";
-        outFile.close();
+void whisper_free_context_params(struct whisper_context_params * params) {
+    if (params) {
+        delete params;
     }
-
-    return true;
 }
 
-// split text into tokens
-//
-// ref: https://github.com/openai/gpt-2/blob/a74da5d99abaaba920de8131d64da2862a8f213b/src/encoder.py#L53
-//
-// Regex (Python):
-// r"""'s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+"""
-//
-// Regex (C++):
-// R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)"
-//
-static std::vector<whisper_vocab::id> tokenize(const whisper_vocab & vocab, const std::string & text) {
-    std::vector<std::string> words;
-
-    // first split the text into words
-    {
-        std::string str = text;
-        std::string pat = R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)";
+void whisper_free_params(struct whisper_full_params * params) {
+    if (params) {
+        delete params;
+    }
+}
 
-        std::regex re(pat);
-        std::smatch m;
+int whisper_pcm_to_mel_with_state(struct whisper_context * ctx, struct whisper_state * state, const float * samples, int n_samples, int n_threads) {
+    state->enc_mel_offset = -1;
 
-        while (std::regex_search(str, m, re)) {
-            for (auto x : m) {
-                words.push_back(x);
-            }
-            str = m.suffix();
+    if (ctx->params.mel_graph && !whisper_encode_external(*state)) {
+        if (!log_mel_spectrogram_graph(*ctx, *state, samples, n_samples, n_threads)) {
+            WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
+            return -1;
         }
+
+        return 0;
     }
 
-    // find the longest tokens that form the words:
-    std::vector<whisper_vocab::id> tokens;
-    for (const auto & word : words) {
-        if (word.empty()) continue;
-
-        int i = 0;
-        int n = word.size();
-        while (i < n) {
-            int j = n;
-            bool found = false;
-            while (j > i) {
-                auto sub = word.substr(i, j-i);
-                auto it = vocab.token_to_id.find(sub);
-                if (it != vocab.token_to_id.end()) {
-                    tokens.push_back(it->second);
-                    i = j;
-                    found = true;
-                    break;
-                }
-                --j;
-            }
-            if (!found) {
-                WHISPER_LOG_ERROR("unknown token\n");
-                ++i;
-            }
-        }
+    state->mel_graph.active = false;
+
+    if (!log_mel_spectrogram(*state, samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, global_cache.hann_window, false, state->mel)) {
+        WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
+        return -1;
     }
 
-    return tokens;
+    return 0;
 }
 
-//
-// interface implementation
-//
+int whisper_pcm_to_mel(struct whisper_context * ctx, const float * samples, int n_samples, int n_threads) {
+    return whisper_pcm_to_mel_with_state(ctx, ctx->state, samples, n_samples, n_threads);
+}
 
-#ifdef WHISPER_USE_COREML
-// replace .bin with -encoder.mlmodelc
-static std::string whisper_get_coreml_path_encoder(std::string path_bin) {
-    auto pos = path_bin.rfind('.');
-    if (pos != std::string::npos) {
-        path_bin = path_bin.substr(0, pos);
-    }
+int whisper_pcm16_to_mel_with_state(struct whisper_context * ctx, struct whisper_state * state, const int16_t * samples, int n_samples, int n_threads) {
+    state->enc_mel_offset = -1;
 
-    // match "-qx_x"
-    pos = path_bin.rfind('-');
-    if (pos != std::string::npos) {
-        auto sub = path_bin.substr(pos);
-        if (sub.size() == 5 && sub[1] == 'q' && sub[3] == '_') {
-            path_bin = path_bin.substr(0, pos);
+    if (ctx->params.mel_graph && !whisper_encode_external(*state)) {
+        // the graph takes F32 samples
+        std::vector<float> samples_f32(n_samples);
+        for (int i = 0; i < n_samples; i++) {
+            samples_f32[i] = samples[i]/32768.0f;
         }
+
+        return whisper_pcm_to_mel_with_state(ctx, state, samples_f32.data(), n_samples, n_threads);
+    }
+
+    state->mel_graph.active = false;
+
+    if (!log_mel_spectrogram(*state, samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, global_cache.hann_window_s16, false, state->mel)) {
+        WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
+        return -1;
     }
 
-    path_bin += "-encoder.mlmodelc";
+    return 0;
+}
 
-    return path_bin;
+int whisper_pcm16_to_mel(struct whisper_context * ctx, const int16_t * samples, int n_samples, int n_threads) {
+    return whisper_pcm16_to_mel_with_state(ctx, ctx->state, samples, n_samples, n_threads);
 }
-#endif
 
-#ifdef WHISPER_USE_OPENVINO
-// replace .bin with-encoder-openvino.xml
-static std::string whisper_openvino_get_path_encoder(std::string path_bin) {
-    auto pos = path_bin.rfind('.');
-    if (pos != std::string::npos) {
-        path_bin = path_bin.substr(0, pos);
-    }
+int whisper_pcm_to_mel_append_with_state(struct whisper_context * ctx, struct whisper_state * state, const float * samples, int n_samples, int n_threads) {
+    state->enc_mel_offset = -1;
 
-    path_bin += "-encoder-openvino.xml";
+    const int64_t t_start_us = ggml_time_us();
 
-    return path_bin;
-}
+    const auto & filters = ctx->model.filters;
 
-static std::string whisper_openvino_get_path_cache(std::string path_bin) {
-    auto pos = path_bin.rfind('.');
-    if (pos != std::string::npos) {
-        path_bin = path_bin.substr(0, pos);
-    }
+    auto & stream = state->mel_stream;
+    auto & mel    = state->mel;
 
-    path_bin += "-encoder-openvino-cache";
+    state->mel_graph.active = false;
 
-    return path_bin;
-}
-#endif
+    const int n_mel      = filters.n_mel;
+    const int frame_size = WHISPER_N_FFT;
+    const int frame_step = WHISPER_HOP_LENGTH;
+    const int stage_2_pad = frame_size / 2;
 
-struct whisper_state * whisper_init_state(whisper_context * ctx) {
-    whisper_state * state = new whisper_state;
+    const float * hann = global_cache.hann_window;
 
-    state->backends = whisper_backend_init(ctx->params);
-    if (state->backends.empty()) {
-        WHISPER_LOG_ERROR("%s: whisper_backend_init() failed\n", __func__);
-        whisper_free_state(state);
-        return nullptr;
+    if (n_samples < 0 || (n_samples > 0 && samples == nullptr)) {
+        WHISPER_LOG_ERROR("%s: invalid samples\n", __func__);
+        return -1;
     }
 
-    // at this point, we don't know yet how many decoders will be used
-    // later during decoding, if more decoders are used, we will recreate the KV cache respectively
-    state->kv_self_n_dec = 1;
-    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
-                ctx->model.hparams.n_text_state,
-                ctx->model.hparams.n_text_layer,
-                GGML_PAD(ctx->model.hparams.n_text_ctx, 256))) {
-        WHISPER_LOG_ERROR("%s: whisper_kv_cache_init() failed for self-attention cache\n", __func__);
-        whisper_free_state(state);
-        return nullptr;
-    }
+    stream.samples.insert(stream.samples.end(), samples, samples + n_samples);
 
-    {
-        const size_t memory_size = ggml_nbytes(state->kv_self.k) + ggml_nbytes(state->kv_self.v);
-        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB\n", __func__, memory_size / 1e6);
-    }
+    // reflective pad at the beginning of the stream, same as in log_mel_spectrogram()
+    if (!stream.padded && (int) stream.samples.size() > stage_2_pad) {
+        std::vector<float> pad(stage_2_pad);
+        std::reverse_copy(stream.samples.begin() + 1, stream.samples.begin() + 1 + stage_2_pad, pad.begin());
 
-    if (!whisper_kv_cache_init(state->kv_cross, state->backends[0], ctx->itype,
-                ctx->model.hparams.n_text_state,
-                ctx->model.hparams.n_text_layer,
-                GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
-        WHISPER_LOG_ERROR("%s: whisper_kv_cache_init() failed for cross-attention cache\n", __func__);
-        whisper_free_state(state);
-        return nullptr;
+        stream.samples.insert(stream.samples.begin(), pad.begin(), pad.end());
+        stream.padded = true;
     }
 
-    {
-        const size_t memory_size = ggml_nbytes(state->kv_cross.k) + ggml_nbytes(state->kv_cross.v);
-        WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB\n", __func__, memory_size / 1e6);
-    }
+    // compute the new complete frames
+    if (stream.padded && (int) stream.samples.size() >= frame_size) {
+        const int n_new = 1 + ((int) stream.samples.size() - frame_size) / frame_step;
+        const int n_old = stream.frames.size() / n_mel;
 
-    if (!whisper_kv_cache_init(state->kv_pad, state->backends[0], ctx->itype,
-                ctx->model.hparams.n_audio_state,
-                1,
-                GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
-        WHISPER_LOG_ERROR("%s: whisper_kv_cache_init() failed for self-attention cache\n", __func__);
-        whisper_free_state(state);
-        return nullptr;
+        stream.frames.resize((size_t) (n_old + n_new) * n_mel);
+
+        const auto worker = [&](int ith, int nth) {
+            log_mel_frame_buffers buf(frame_size);
+
+            for (int i = ith; i < n_new; i += nth) {
+                log_mel_frame(hann, stream.samples.data(), stream.samples.size(), i * frame_step, frame_size, filters, buf,
+                        stream.frames.data() + (size_t) (n_old + i) * n_mel, 1);
+            }
+        };
+
+        const int n_workers = std::max(1, std::min(n_threads, n_new / 16));
+
+        state->thread_pool.run(n_workers, [&](int ith) {
+            worker(ith, n_workers);
+        });
+
+        stream.samples.erase(stream.samples.begin(), stream.samples.begin() + (size_t) n_new * frame_step);
+        stream.n_frames_total += n_new;
+
+        // drop the frames that slid out of the window
+        const int n_frames = n_old + n_new;
+        if (n_frames > stream.n_frames_max) {
+            stream.frames.erase(stream.frames.begin(), stream.frames.begin() + (size_t) (n_frames - stream.n_frames_max) * n_mel);
+        }
     }
 
+    // normalized spectrogram of the window, followed by 30 seconds of silence as in log_mel_spectrogram()
     {
-        const size_t memory_size = ggml_nbytes(state->kv_pad.k) + ggml_nbytes(state->kv_pad.v);
-        WHISPER_LOG_INFO("%s: kv pad  size  = %7.2f MB\n", __func__, memory_size / 1e6);
-    }
+        const int n_frames = stream.frames.size() / n_mel;
 
-    // [EXPERIMENTAL] Token-level timestamps with DTW
-    if (ctx->params.dtw_token_timestamps) {
-        if (!aheads_masks_init(ctx->params, ctx->model.hparams, state->aheads_masks, state->backends[0])) {
-            WHISPER_LOG_ERROR("%s: aheads_masks_init() failed for alignment heads masks\n", __func__);
-            whisper_free_state(state);
-            return nullptr;
+        // the frames that start in the remaining samples are computed with zeros past the end of the audio, same as
+        // the last frames of log_mel_spectrogram() - they are recomputed with the actual samples by the next call
+        const int n_tail = stream.padded ? (stream.samples.size() + frame_step - 1) / frame_step : 0;
+
+        std::vector<float> tail((size_t) n_tail * n_mel);
+        {
+            log_mel_frame_buffers buf(frame_size);
+
+            for (int i = 0; i < n_tail; i++) {
+                log_mel_frame(hann, stream.samples.data(), stream.samples.size(), i * frame_step, frame_size, filters, buf,
+                        tail.data() + (size_t) i * n_mel, 1);
+            }
         }
-        const size_t memory_size = aheads_masks_nbytes(state->aheads_masks);
-        WHISPER_LOG_INFO("%s: alignment heads masks size = %ld B\n", __func__, memory_size);
-    }
 
-#ifdef WHISPER_USE_COREML
-    const auto path_coreml = whisper_get_coreml_path_encoder(ctx->path_model);
+        float mmax = log10f(1e-10f);
+        for (const float val : stream.frames) {
+            mmax = std::max(mmax, val);
+        }
+        for (const float val : tail) {
+            mmax = std::max(mmax, val);
+        }
 
-    WHISPER_LOG_INFO("%s: loading Core ML model from '%s'\n", __func__, path_coreml.c_str());
-    WHISPER_LOG_INFO("%s: first run on a device may take a while ...\n", __func__);
+        const float mmin = mmax - 8.0f;
 
-    state->ctx_coreml = whisper_coreml_init(path_coreml.c_str());
-    if (!state->ctx_coreml) {
-        WHISPER_LOG_ERROR("%s: failed to load Core ML model from '%s'\n", __func__, path_coreml.c_str());
-#ifndef WHISPER_COREML_ALLOW_FALLBACK
-        whisper_free_state(state);
-        return nullptr;
-#endif
-    } else {
-        WHISPER_LOG_INFO("%s: Core ML model loaded\n", __func__);
+        stream.mmax = mmax;
+
+        mel.n_mel     = n_mel;
+        mel.n_len     = n_frames + n_tail + 100*WHISPER_CHUNK_SIZE;
+        mel.n_len_org = n_frames;
+        mel.data.resize((size_t) mel.n_mel * mel.n_len);
+
+        const float silence = (std::max(log10f(1e-10f), mmin) + 4.0f)*0.25f;
+
+        for (int j = 0; j < n_mel; j++) {
+            float * dst = mel.data.data() + (size_t) j * mel.n_len;
+
+            for (int i = 0; i < n_frames; i++) {
+                dst[i] = (std::max(stream.frames[(size_t) i * n_mel + j], mmin) + 4.0f)*0.25f;
+            }
+            for (int i = 0; i < n_tail; i++) {
+                dst[n_frames + i] = (std::max(tail[(size_t) i * n_mel + j], mmin) + 4.0f)*0.25f;
+            }
+
+            std::fill(dst + n_frames + n_tail, dst + mel.n_len, silence);
+        }
     }
-#endif
 
-    state->logits.reserve(ctx->vocab.n_vocab * ctx->model.hparams.n_text_ctx);
+    state->t_mel_us += ggml_time_us() - t_start_us;
 
-    state->batch = whisper_batch_init(ctx->model.hparams.n_text_ctx, WHISPER_MAX_DECODERS);
+    return mel.n_len_org;
+}
 
-    // TAGS: WHISPER_DECODER_INIT
-    state->decoders[0].sequence.tokens.reserve(ctx->model.hparams.n_text_ctx);
+int whisper_pcm_to_mel_append(struct whisper_context * ctx, const float * samples, int n_samples, int n_threads) {
+    return whisper_pcm_to_mel_append_with_state(ctx, ctx->state, samples, n_samples, n_threads);
+}
 
-    state->decoders[0].probs.reserve    (ctx->vocab.n_vocab);
-    state->decoders[0].logits.reserve   (ctx->vocab.n_vocab);
-    state->decoders[0].logprobs.reserve (ctx->vocab.n_vocab);
-    state->decoders[0].logits_id.reserve(ctx->model.hparams.n_vocab);
+void whisper_pcm_to_mel_append_reset_with_state(struct whisper_state * state, int window_ms) {
+    state->enc_mel_offset = -1;
 
-    state->decoders[0].rng = std::mt19937(0);
+    auto & stream = state->mel_stream;
 
-    // conv allocator
-    {
-        bool ok = whisper_sched_graph_init(state->sched_conv, state->backends,
-                [&]() {
-                    return whisper_build_graph_conv(*ctx, *state);
-                });
+    stream.samples.clear();
+    stream.frames.clear();
 
-        if (!ok) {
-            WHISPER_LOG_ERROR("%s: failed to init conv allocator\n", __func__);
-            whisper_free_state(state);
-            return nullptr;
-        }
+    stream.n_frames_max   = window_ms > 0 ? std::max(1, window_ms/10) : 100*WHISPER_CHUNK_SIZE;
+    stream.n_frames_total = 0;
+    stream.mmax           = 0.0f;
 
-        WHISPER_LOG_INFO("%s: compute buffer (conv)   = %7.2f MB\n", __func__, whisper_sched_size(state->sched_conv) / 1e6);
-    }
+    stream.padded = false;
+}
 
-    // encoder allocator
-    if (!whisper_encode_external(*state)) {
-        bool ok = whisper_sched_graph_init(state->sched_encode, state->backends,
-                [&]() {
-                    return whisper_build_graph_encoder(*ctx, *state);
-                });
+void whisper_pcm_to_mel_append_reset(struct whisper_context * ctx, int window_ms) {
+    whisper_pcm_to_mel_append_reset_with_state(ctx->state, window_ms);
+}
 
-        if (!ok) {
-            WHISPER_LOG_ERROR("%s: failed to init encoder allocator\n", __func__);
-            whisper_free_state(state);
-            return nullptr;
-        }
+int64_t whisper_pcm_to_mel_append_offset_from_state(struct whisper_state * state) {
+    const auto & stream = state->mel_stream;
 
-        WHISPER_LOG_INFO("%s: compute buffer (encode) = %7.2f MB\n", __func__, whisper_sched_size(state->sched_encode) / 1e6);
-    }
+    return stream.n_frames_total - (int64_t) (stream.frames.size() / std::max<size_t>(1, state->mel.n_mel));
+}
 
-    // cross allocator
-    {
-        bool ok = whisper_sched_graph_init(state->sched_cross, state->backends,
-                [&]() {
-                    return whisper_build_graph_cross(*ctx, *state);
-                });
+int64_t whisper_pcm_to_mel_append_offset(struct whisper_context * ctx) {
+    return whisper_pcm_to_mel_append_offset_from_state(ctx->state);
+}
 
-        if (!ok) {
-            WHISPER_LOG_ERROR("%s: failed to init cross allocator\n", __func__);
-            whisper_free_state(state);
-            return nullptr;
-        }
+int whisper_set_mel_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                   const float * data,
+                           int   n_len,
+                           int   n_mel) {
+    state->enc_mel_offset = -1;
 
-        WHISPER_LOG_INFO("%s: compute buffer (cross)  = %7.2f MB\n", __func__, whisper_sched_size(state->sched_cross) / 1e6);
+    if (n_mel != ctx->model.filters.n_mel) {
+        WHISPER_LOG_ERROR("%s: invalid number of mel bands: %d (expected %d)\n", __func__, n_mel, ctx->model.filters.n_mel);
+        return -1;
     }
 
-    // decoder allocator
-    {
-        bool ok = whisper_sched_graph_init(state->sched_decode, state->backends,
-                [&]() {
-                    const auto & hparams = ctx->model.hparams;
+    state->mel_graph.active = false;
 
-                    // TODO: make sure this is the worst-case scenario
-                    const int n_tokens = hparams.n_text_ctx;
-                    const int n_past   = 0;
+    state->mel.n_len     = n_len;
+    state->mel.n_len_org = n_len;
+    state->mel.n_mel     = n_mel;
 
-                    whisper_batch_prep_legacy(state->batch, nullptr, n_tokens, n_past, 0);
+    state->mel.data.resize(n_len*n_mel);
+    memcpy(state->mel.data.data(), data, n_len*n_mel*sizeof(float));
 
-                    return whisper_build_graph_decoder(*ctx, *state, state->batch, ctx->params.dtw_token_timestamps, true);
-                });
+    return 0;
+}
 
-        if (!ok) {
-            WHISPER_LOG_ERROR("%s: failed to init decoder allocator\n", __func__);
-            whisper_free_state(state);
-            return nullptr;
-        }
+int whisper_set_mel(
+        struct whisper_context * ctx,
+        const float * data,
+        int n_len,
+        int n_mel) {
+    return whisper_set_mel_with_state(ctx, ctx->state, data, n_len, n_mel);
+}
 
-        WHISPER_LOG_INFO("%s: compute buffer (decode) = %7.2f MB\n", __func__, whisper_sched_size(state->sched_decode) / 1e6);
+int whisper_encode_with_state(struct whisper_context * ctx, struct whisper_state * state, int offset, int n_threads) {
+    if (!whisper_encode_internal(*ctx, *state, offset, n_threads, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return -1;
     }
 
-    return state;
+    return 0;
 }
 
-int whisper_ctx_init_openvino_encoder_with_state(
-        struct whisper_context * ctx,
-          struct whisper_state * state,
-                    const char * model_path,
-                    const char * device,
-                    const char * cache_dir) {
-#ifndef WHISPER_USE_OPENVINO
-    (void)(ctx);
-    (void)(state);
-    (void)(model_path);
-    (void)(device);
-    (void)(cache_dir);
+int whisper_encode_batch(struct whisper_context * ctx, struct whisper_state ** states, const int * offsets, int n_states, int n_threads) {
+    if (n_states < 1) {
+        WHISPER_LOG_ERROR("%s: no states to encode\n", __func__);
+        return -1;
+    }
 
-    return 1;
-#else
-    if (!model_path && ctx->path_model.empty()) {
-        WHISPER_LOG_ERROR("%s: model_path is nullptr, and ctx has no model_path set.\n", __func__);
-        return 1;
+    if (!whisper_encode_batch_internal(*ctx, states, offsets, n_states, n_threads)) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return -1;
     }
 
-    std::string path_encoder;
-    if (!model_path) {
-        //if model_path is not set, attempt to find it in the same directory as ggml-<model>.bin model
-        path_encoder = whisper_openvino_get_path_encoder(ctx->path_model);
-    } else {
-        path_encoder = model_path;
+    return 0;
+}
+
+int whisper_encode(struct whisper_context * ctx, int offset, int n_threads) {
+    if (!whisper_encode_internal(*ctx, *ctx->state, offset, n_threads, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return -1;
     }
 
-    std::string path_cache;
-    if (!cache_dir) {
-        //if cache_dir is not set, set it as a dir residing next to ggml-<model>.bin
-        path_cache = whisper_openvino_get_path_cache(ctx->path_model);
-    } else {
-        path_cache = cache_dir;
+    return 0;
+}
+
+int whisper_encode_stream_reset_with_state(struct whisper_context * ctx, struct whisper_state * state, int block_ms, int left_ms) {
+    const int n_audio_ctx = ctx->model.hparams.n_audio_ctx;
+
+    const int n_block = std::min(n_audio_ctx, block_ms > 0 ? std::max(1, block_ms/20) : 50);
+    const int n_left  = std::min(n_audio_ctx, left_ms  > 0 ? left_ms/20 : 500);
+
+    if (!whisper_model_require_part(*ctx, WHISPER_MODEL_PART_ENCODER)) {
+        return -1;
     }
 
-    WHISPER_LOG_INFO("%s: loading OpenVINO model from '%s'\n", __func__, path_encoder.c_str());
-    WHISPER_LOG_INFO("%s: first run on a device may take a while ...\n", __func__);
+    auto & es = state->enc_stream;
 
-    state->ctx_openvino = whisper_openvino_init(path_encoder.c_str(), device, path_cache.c_str());
-    if (!state->ctx_openvino) {
-        WHISPER_LOG_ERROR("%s: failed to init OpenVINO encoder from '%s'\n", __func__, path_encoder.c_str());
-        return 1;
-    } else {
-        WHISPER_LOG_INFO("%s: OpenVINO model loaded\n", __func__);
+    if (!es.kv.buffer || es.n_block != n_block || es.n_left != n_left) {
+        if (!whisper_enc_stream_init(*ctx, *state, n_block, n_left)) {
+            whisper_enc_stream_free(es);
+            return -2;
+        }
     }
 
+    es.mel_offset = -1;
+
     return 0;
-#endif
 }
 
-int whisper_ctx_init_openvino_encoder(
-        struct whisper_context * ctx,
-                    const char * model_path,
-                    const char * device,
-                    const char * cache_dir) {
-    return whisper_ctx_init_openvino_encoder_with_state(ctx, ctx->state, model_path, device, cache_dir);
+int whisper_encode_stream_reset(struct whisper_context * ctx, int block_ms, int left_ms) {
+    return whisper_encode_stream_reset_with_state(ctx, ctx->state, block_ms, left_ms);
 }
 
-struct whisper_context_params whisper_context_default_params() {
-    struct whisper_context_params result = {
-        /*.use_gpu              =*/ true,
-        /*.flash_attn           =*/ false,
-        /*.gpu_device           =*/ 0,
+int whisper_encode_stream_with_state(struct whisper_context * ctx, struct whisper_state * state, int n_threads) {
+    if (!state->enc_stream.kv.buffer && whisper_encode_stream_reset_with_state(ctx, state, 0, 0) != 0) {
+        return -1;
+    }
 
-        /*.dtw_token_timestamps =*/ false,
-        /*.dtw_aheads_preset    =*/ WHISPER_AHEADS_NONE,
-        /*.dtw_n_top            =*/ -1,
-        /*.dtw_aheads           =*/ {
-            /*.n_heads          =*/ 0,
-            /*.heads            =*/ NULL,
-        },
-        /*.dtw_mem_size         =*/ 1024*1024*128,
-    };
-    return result;
-}
+    if (state->mel_graph.active || whisper_encode_external(*state)) {
+        WHISPER_LOG_ERROR("%s: the streaming encoder needs the spectrogram on the host and the ggml encoder\n", __func__);
+        return -2;
+    }
 
-struct whisper_context * whisper_init_from_file_with_params_no_state(const char * path_model, struct whisper_context_params params) {
-    WHISPER_LOG_INFO("%s: loading model from '%s'\n", __func__, path_model);
-#ifdef _MSC_VER
-    // Convert UTF-8 path to wide string (UTF-16) for Windows, resolving character encoding issues.
-    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
-    std::wstring path_model_wide = converter.from_bytes(path_model);
-    auto fin = std::ifstream(path_model_wide, std::ios::binary);
-#else
-    auto fin = std::ifstream(path_model, std::ios::binary);
-#endif
-    if (!fin) {
-        WHISPER_LOG_ERROR("%s: failed to open '%s'\n", __func__, path_model);
-        return nullptr;
+    const int n_past = whisper_enc_stream_update(*ctx, *state, n_threads);
+    if (n_past < 0) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return -3;
     }
 
-    whisper_model_loader loader = {};
+    return n_past;
+}
 
-    loader.context = &fin;
+int whisper_encode_stream(struct whisper_context * ctx, int n_threads) {
+    return whisper_encode_stream_with_state(ctx, ctx->state, n_threads);
+}
 
-    loader.read = [](void * ctx, void * output, size_t read_size) {
-        std::ifstream * fin = (std::ifstream*)ctx;
-        fin->read((char *)output, read_size);
-        return read_size;
-    };
+int whisper_decode_with_state(struct whisper_context * ctx, struct whisper_state * state, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
+    whisper_batch_prep_legacy(state->batch, tokens, n_tokens, n_past, 0);
 
-    loader.eof = [](void * ctx) {
-        std::ifstream * fin = (std::ifstream*)ctx;
-        return fin->eof();
-    };
+    whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
 
-    loader.close = [](void * ctx) {
-        std::ifstream * fin = (std::ifstream*)ctx;
-        fin->close();
-    };
+    if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads, false, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return 1;
+    }
 
-    auto ctx = whisper_init_with_params_no_state(&loader, params);
+    return 0;
+}
 
-    if (ctx) {
-        ctx->path_model = path_model;
+int whisper_decode(struct whisper_context * ctx, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
+    if (ctx->state == nullptr) {
+        WHISPER_LOG_ERROR("%s: ERROR state was not loaded.\n", __func__);
+        return -1;
     }
 
-    return ctx;
+    return whisper_decode_with_state(ctx, ctx->state, tokens, n_tokens, n_past, n_threads);
 }
 
-struct whisper_context * whisper_init_from_buffer_with_params_no_state(void * buffer, size_t buffer_size, struct whisper_context_params params) {
-    struct buf_context {
-        uint8_t* buffer;
-        size_t size;
-        size_t current_offset;
-    };
+//
+// state serialization
+//
+// layout of the blob (native byte order):
+//
+//   uint32  magic, version
+//   int32   n_audio_ctx, n_text_state, n_text_layer, n_text_ctx, itype, flash_attn - must match the loading context
+//   int32   exp_n_audio_ctx, lang_id
+//   uint32  n_prompt_past, followed by the tokens
+//   uint64  n_bytes of the cross-attention cache, followed by the used part of kv_cross.k and then of kv_cross.v
+//   uint32  has_kv_self
+//   if has_kv_self:
+//     uint32  size, head, n_dec
+//     for each cell: int32 pos, uint32 n_seq_id, followed by the seq ids
+//     uint64  n_bytes, followed by kv_self.k and kv_self.v
+//
 
-    buf_context ctx = { reinterpret_cast<uint8_t*>(buffer), buffer_size, 0 };
+#define WHISPER_STATE_MAGIC   0x77737374 // "wsst"
+#define WHISPER_STATE_VERSION 1
 
-    WHISPER_LOG_INFO("%s: loading model from buffer\n", __func__);
+// with buf == nullptr, only the size is computed
+struct whisper_state_writer {
+    uint8_t * buf  = nullptr;
+    size_t    size = 0;
+    size_t    n    = 0;
 
-    whisper_model_loader loader = {};
+    bool ok = true;
 
-    loader.context = &ctx;
+    void write(const void * src, size_t len) {
+        if (buf) {
+            if (n + len > size) {
+                ok = false;
+                return;
+            }
+            memcpy(buf + n, src, len);
+        }
+        n += len;
+    }
 
-    loader.read = [](void * ctx, void * output, size_t read_size) {
-        buf_context * buf = reinterpret_cast<buf_context *>(ctx);
+    void write_tensor(const ggml_tensor * t, size_t len, size_t offset = 0) {
+        if (buf) {
+            if (n + len > size) {
+                ok = false;
+                return;
+            }
+            ggml_backend_tensor_get(t, buf + n, offset, len);
+        }
+        n += len;
+    }
 
-        size_t size_to_copy = buf->current_offset + read_size < buf->size ? read_size : buf->size - buf->current_offset;
+    template<typename T>
+    void write_val(const T & val) {
+        write(&val, sizeof(T));
+    }
+};
 
-        memcpy(output, buf->buffer + buf->current_offset, size_to_copy);
-        buf->current_offset += size_to_copy;
+struct whisper_state_reader {
+    const uint8_t * buf  = nullptr;
+    size_t          size = 0;
+    size_t          n    = 0;
 
-        return size_to_copy;
-    };
+    // returns a pointer to the next len bytes, or nullptr if the blob is too short
+    const uint8_t * read(size_t len) {
+        if (n + len > size) {
+            return nullptr;
+        }
+        const uint8_t * res = buf + n;
+        n += len;
+        return res;
+    }
 
-    loader.eof = [](void * ctx) {
-        buf_context * buf = reinterpret_cast<buf_context *>(ctx);
+    template<typename T>
+    bool read_val(T & val) {
+        const uint8_t * src = read(sizeof(T));
+        if (src == nullptr) {
+            return false;
+        }
+        memcpy(&val, src, sizeof(T));
+        return true;
+    }
+};
 
-        return buf->current_offset >= buf->size;
-    };
+// the cross-attention cache is only filled up to the current audio context (see whisper_build_graph_cross)
+static size_t whisper_state_kv_cross_nbytes(const whisper_context & ctx, const whisper_state & state) {
+    const auto & hparams = ctx.model.hparams;
 
-    loader.close = [](void * /*ctx*/) { };
+    const int n_ctx = state.exp_n_audio_ctx > 0 ? state.exp_n_audio_ctx : hparams.n_audio_ctx;
 
-    return whisper_init_with_params_no_state(&loader, params);
+    const size_t n_ctx_layer = ctx.params.flash_attn ? GGML_PAD(n_ctx, 256) : n_ctx;
+
+    return ggml_element_size(state.kv_cross.k)*hparams.n_text_state*hparams.n_text_layer*n_ctx_layer;
 }
 
-struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_loader * loader, struct whisper_context_params params) {
-    ggml_time_init();
+// kv_cross filled by the streaming encoder, in the layout of whisper_build_graph_cross for the encoded positions
+static void whisper_state_write_kv_cross_stream(const whisper_context & ctx, const whisper_state & state, whisper_state_writer & writer) {
+    const auto & hparams = ctx.model.hparams;
 
-    if (params.flash_attn && params.dtw_token_timestamps) {
-        WHISPER_LOG_WARN("%s: dtw_token_timestamps is not supported with flash_attn - disabling\n", __func__);
-        params.dtw_token_timestamps = false;
-    }
+    const size_t es = ggml_element_size(state.kv_cross.k);
 
-    WHISPER_LOG_INFO("%s: use gpu    = %d\n", __func__, params.use_gpu);
-    WHISPER_LOG_INFO("%s: flash attn = %d\n", __func__, params.flash_attn);
-    WHISPER_LOG_INFO("%s: gpu_device = %d\n", __func__, params.gpu_device);
-    WHISPER_LOG_INFO("%s: dtw        = %d\n", __func__, params.dtw_token_timestamps);
-    WHISPER_LOG_INFO("%s: devices    = %zu\n", __func__, ggml_backend_dev_count());
-    WHISPER_LOG_INFO("%s: backends   = %zu\n", __func__, ggml_backend_reg_count());
+    const int n_state  = hparams.n_text_state;
+    const int n_ctx    = state.exp_n_audio_ctx;
+    const int n_ctx_kv = state.kv_cross_n_ctx;
 
-    whisper_context * ctx = new whisper_context;
-    ctx->params = params;
+    const int n_ctx_layer = ctx.params.flash_attn ? GGML_PAD(n_ctx, 256) : n_ctx;
 
-    if (!whisper_model_load(loader, *ctx)) {
-        loader->close(loader->context);
-        WHISPER_LOG_ERROR("%s: failed to load model\n", __func__);
-        delete ctx;
-        return nullptr;
+    for (int il = 0; il < hparams.n_text_layer; ++il) {
+        writer.write_tensor(state.kv_cross.k, es*n_state*n_ctx_layer, es*n_state*il*n_ctx_kv);
     }
 
-    loader->close(loader->context);
-
-    return ctx;
+    for (int il = 0; il < hparams.n_text_layer; ++il) {
+        if (ctx.params.flash_attn) {
+            writer.write_tensor(state.kv_cross.v, es*n_state*n_ctx_layer, es*n_state*il*n_ctx_kv);
+        } else {
+            for (int i = 0; i < n_state; ++i) {
+                writer.write_tensor(state.kv_cross.v, es*n_ctx, es*(il*n_ctx_kv*n_state + i*n_ctx_kv));
+            }
+        }
+    }
 }
 
-struct whisper_context * whisper_init_from_file_with_params(const char * path_model, struct whisper_context_params params) {
-    whisper_context * ctx = whisper_init_from_file_with_params_no_state(path_model, params);
-    if (!ctx) {
-        return nullptr;
-    }
+static void whisper_state_write(const whisper_context & ctx, const whisper_state & state, whisper_state_writer & writer, bool with_kv_self) {
+    const auto & hparams = ctx.model.hparams;
 
-    ctx->state = whisper_init_state(ctx);
-    if (!ctx->state) {
-        whisper_free(ctx);
-        return nullptr;
-    }
+    writer.write_val<uint32_t>(WHISPER_STATE_MAGIC);
+    writer.write_val<uint32_t>(WHISPER_STATE_VERSION);
 
-    return ctx;
-}
+    writer.write_val<int32_t>(hparams.n_audio_ctx);
+    writer.write_val<int32_t>(hparams.n_text_state);
+    writer.write_val<int32_t>(hparams.n_text_layer);
+    writer.write_val<int32_t>(hparams.n_text_ctx);
+    writer.write_val<int32_t>(ctx.itype);
+    writer.write_val<int32_t>(ctx.params.flash_attn);
 
-struct whisper_context * whisper_init_from_buffer_with_params(void * buffer, size_t buffer_size, struct whisper_context_params params) {
-    whisper_context * ctx = whisper_init_from_buffer_with_params_no_state(buffer, buffer_size, params);
-    if (!ctx) {
-        return nullptr;
-    }
+    writer.write_val<int32_t>(state.exp_n_audio_ctx);
+    writer.write_val<int32_t>(state.lang_id);
 
-    ctx->state = whisper_init_state(ctx);
-    if (!ctx->state) {
-        whisper_free(ctx);
-        return nullptr;
-    }
+    writer.write_val<uint32_t>(state.prompt_past.size());
+    writer.write(state.prompt_past.data(), state.prompt_past.size()*sizeof(whisper_token));
 
-    return ctx;
-}
+    {
+        const uint64_t n_bytes = whisper_state_kv_cross_nbytes(ctx, state);
 
-struct whisper_context * whisper_init_with_params(struct whisper_model_loader * loader, struct whisper_context_params params) {
-    whisper_context * ctx = whisper_init_with_params_no_state(loader, params);
-    if (!ctx) {
-        return nullptr;
-    }
+        writer.write_val<uint64_t>(n_bytes);
 
-    ctx->state = whisper_init_state(ctx);
-    if (!ctx->state) {
-        whisper_free(ctx);
-        return nullptr;
+        if (state.kv_cross_n_ctx > 0) {
+            whisper_state_write_kv_cross_stream(ctx, state, writer);
+        } else {
+            writer.write_tensor(state.kv_cross.k, n_bytes);
+            writer.write_tensor(state.kv_cross.v, n_bytes);
+        }
     }
 
-    return ctx;
-}
+    writer.write_val<uint32_t>(with_kv_self);
 
-struct whisper_context * whisper_init_from_file(const char * path_model) {
-    return whisper_init_from_file_with_params(path_model, whisper_context_default_params());
-}
+    if (with_kv_self) {
+        const auto & kv_self = state.kv_self;
 
-struct whisper_context * whisper_init_from_buffer(void * buffer, size_t buffer_size) {
-    return whisper_init_from_buffer_with_params(buffer, buffer_size, whisper_context_default_params());
-}
+        writer.write_val<uint32_t>(kv_self.size);
+        writer.write_val<uint32_t>(kv_self.head);
+        writer.write_val<uint32_t>(state.kv_self_n_dec);
 
-struct whisper_context * whisper_init(struct whisper_model_loader * loader) {
-    return whisper_init_with_params(loader, whisper_context_default_params());
-}
+        for (const auto & cell : kv_self.cells) {
+            writer.write_val<int32_t>(cell.pos);
+            writer.write_val<uint32_t>(cell.seq_id.size());
+            for (const auto id : cell.seq_id) {
+                writer.write_val<int32_t>(id);
+            }
+        }
 
-struct whisper_context * whisper_init_from_file_no_state(const char * path_model) {
-    return whisper_init_from_file_with_params_no_state(path_model, whisper_context_default_params());
-}
+        const uint64_t n_bytes = ggml_nbytes(kv_self.k);
 
-struct whisper_context * whisper_init_from_buffer_no_state(void * buffer, size_t buffer_size) {
-    return whisper_init_from_buffer_with_params_no_state(buffer, buffer_size, whisper_context_default_params());
+        writer.write_val<uint64_t>(n_bytes);
+        writer.write_tensor(kv_self.k, n_bytes);
+        writer.write_tensor(kv_self.v, n_bytes);
+    }
 }
 
-struct whisper_context * whisper_init_no_state(struct whisper_model_loader * loader) {
-    return whisper_init_with_params_no_state(loader, whisper_context_default_params());
+size_t whisper_state_save(struct whisper_context * ctx, struct whisper_state * state, uint8_t * dst, size_t dst_size, bool with_kv_self) {
+    whisper_state_writer writer;
+    writer.buf  = dst;
+    writer.size = dst_size;
+
+    whisper_state_write(*ctx, *state, writer, with_kv_self);
+
+    if (!writer.ok) {
+        WHISPER_LOG_ERROR("%s: buffer too small: %zu bytes (need %zu)\n", __func__, dst_size, writer.n);
+        return 0;
+    }
+
+    return writer.n;
 }
 
-void whisper_free_state(struct whisper_state * state) {
-    if (state) {
-        whisper_kv_cache_free(state->kv_self);
-        whisper_kv_cache_free(state->kv_cross);
-        whisper_kv_cache_free(state->kv_pad);
+int whisper_state_load(struct whisper_context * ctx, struct whisper_state * state, const uint8_t * src, size_t src_size) {
+    const auto & hparams = ctx->model.hparams;
 
-#ifdef WHISPER_USE_COREML
-        if (state->ctx_coreml != nullptr) {
-            whisper_coreml_free(state->ctx_coreml);
-            state->ctx_coreml = nullptr;
-        }
-#endif
+    whisper_state_reader reader;
+    reader.buf  = src;
+    reader.size = src_size;
 
-#ifdef WHISPER_USE_OPENVINO
-        if (state->ctx_openvino != nullptr) {
-            whisper_openvino_free(state->ctx_openvino);
-            state->ctx_openvino = nullptr;
+    // verify the header
+    {
+        uint32_t magic   = 0;
+        uint32_t version = 0;
+
+        if (!reader.read_val(magic) || magic != WHISPER_STATE_MAGIC) {
+            WHISPER_LOG_ERROR("%s: invalid state (bad magic)\n", __func__);
+            return -1;
         }
-#endif
 
-        whisper_batch_free(state->batch);
+        if (!reader.read_val(version) || version != WHISPER_STATE_VERSION) {
+            WHISPER_LOG_ERROR("%s: unsupported state version %u (expected %u)\n", __func__, version, WHISPER_STATE_VERSION);
+            return -1;
+        }
 
-        ggml_backend_sched_free(state->sched_conv.sched);
-        ggml_backend_sched_free(state->sched_encode.sched);
-        ggml_backend_sched_free(state->sched_cross.sched);
-        ggml_backend_sched_free(state->sched_decode.sched);
+        const int32_t expected[] = {
+            hparams.n_audio_ctx, hparams.n_text_state, hparams.n_text_layer, hparams.n_text_ctx, ctx->itype, ctx->params.flash_attn,
+        };
 
-        for (auto & backend : state->backends) {
-            ggml_backend_free(backend);
+        for (const int32_t val : expected) {
+            int32_t cur = 0;
+            if (!reader.read_val(cur) || cur != val) {
+                WHISPER_LOG_ERROR("%s: the state was saved with a different model or context params\n", __func__);
+                return -2;
+            }
         }
+    }
 
-        // [EXPERIMENTAL] Token-level timestamps with DTW
-        aheads_masks_free(state->aheads_masks);
+    // parse the whole blob before modifying the state, so that a truncated blob leaves it untouched
+    int32_t exp_n_audio_ctx = 0;
+    int32_t lang_id         = 0;
 
-        delete state;
-    }
-}
+    std::vector<whisper_token> prompt_past;
 
-void whisper_free(struct whisper_context * ctx) {
-    if (ctx) {
-        ggml_free(ctx->model.ctx);
+    const uint8_t * cross_k = nullptr;
+    const uint8_t * cross_v = nullptr;
 
-        ggml_backend_buffer_free(ctx->model.buffer);
+    uint64_t n_bytes_cross = 0;
 
-        whisper_free_state(ctx->state);
+    uint32_t has_kv_self = 0;
 
-        delete ctx;
-    }
-}
+    uint32_t kv_self_size  = 0;
+    uint32_t kv_self_head  = 0;
+    uint32_t kv_self_n_dec = 0;
 
-void whisper_free_context_params(struct whisper_context_params * params) {
-    if (params) {
-        delete params;
-    }
-}
+    std::vector<whisper_kv_cell> cells;
+
+    const uint8_t * self_k = nullptr;
+    const uint8_t * self_v = nullptr;
+
+    uint64_t n_bytes_self = 0;
+
+    bool ok = true;
+
+    {
+        uint32_t n_prompt_past = 0;
+
+        ok = ok && reader.read_val(exp_n_audio_ctx) && reader.read_val(lang_id) && reader.read_val(n_prompt_past);
+        ok = ok && exp_n_audio_ctx >= 0 && exp_n_audio_ctx <= hparams.n_audio_ctx && n_prompt_past <= (uint32_t) hparams.n_text_ctx;
+
+        if (ok) {
+            const uint8_t * data = reader.read(n_prompt_past*sizeof(whisper_token));
+            ok = data != nullptr;
+            if (ok) {
+                prompt_past.resize(n_prompt_past);
+                memcpy(prompt_past.data(), data, n_prompt_past*sizeof(whisper_token));
+            }
+        }
+
+        // the tokens are looked up in the embeddings on the next decode, and the language in the language tokens
+        for (const whisper_token token : prompt_past) {
+            ok = ok && token >= 0 && token < hparams.n_vocab;
+        }
 
-void whisper_free_params(struct whisper_full_params * params) {
-    if (params) {
-        delete params;
+        ok = ok && lang_id >= 0 && lang_id <= whisper_lang_max_id();
     }
-}
 
-int whisper_pcm_to_mel_with_state(struct whisper_context * ctx, struct whisper_state * state, const float * samples, int n_samples, int n_threads) {
-    if (!log_mel_spectrogram(*state, samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, false, state->mel)) {
-        WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
-        return -1;
+    if (ok) {
+        const int32_t exp_n_audio_ctx_cur = state->exp_n_audio_ctx;
+
+        state->exp_n_audio_ctx = exp_n_audio_ctx;
+        const size_t n_bytes_expected = whisper_state_kv_cross_nbytes(*ctx, *state);
+        state->exp_n_audio_ctx = exp_n_audio_ctx_cur;
+
+        ok = reader.read_val(n_bytes_cross) && n_bytes_cross == n_bytes_expected;
+        ok = ok && (cross_k = reader.read(n_bytes_cross)) != nullptr;
+        ok = ok && (cross_v = reader.read(n_bytes_cross)) != nullptr;
     }
 
-    return 0;
-}
+    ok = ok && reader.read_val(has_kv_self);
 
-int whisper_pcm_to_mel(struct whisper_context * ctx, const float * samples, int n_samples, int n_threads) {
-    return whisper_pcm_to_mel_with_state(ctx, ctx->state, samples, n_samples, n_threads);
-}
+    if (ok && has_kv_self) {
+        ok = reader.read_val(kv_self_size) && reader.read_val(kv_self_head) && reader.read_val(kv_self_n_dec);
+        ok = ok && kv_self_head < kv_self_size && kv_self_n_dec >= 1 && kv_self_n_dec <= WHISPER_MAX_DECODERS &&
+            kv_self_size <= (uint32_t) GGML_PAD(hparams.n_text_ctx, 256)*(WHISPER_MAX_DECODERS + 2);
 
-int whisper_set_mel_with_state(
-        struct whisper_context * ctx,
-          struct whisper_state * state,
-                   const float * data,
-                           int   n_len,
-                           int   n_mel) {
-    if (n_mel != ctx->model.filters.n_mel) {
-        WHISPER_LOG_ERROR("%s: invalid number of mel bands: %d (expected %d)\n", __func__, n_mel, ctx->model.filters.n_mel);
-        return -1;
-    }
+        if (ok) {
+            cells.resize(kv_self_size);
+        }
 
-    state->mel.n_len     = n_len;
-    state->mel.n_len_org = n_len;
-    state->mel.n_mel     = n_mel;
+        for (uint32_t i = 0; ok && i < kv_self_size; ++i) {
+            uint32_t n_seq_id = 0;
 
-    state->mel.data.resize(n_len*n_mel);
-    memcpy(state->mel.data.data(), data, n_len*n_mel*sizeof(float));
+            ok = reader.read_val(cells[i].pos) && reader.read_val(n_seq_id) && n_seq_id <= 2*WHISPER_MAX_DECODERS;
 
-    return 0;
-}
+            for (uint32_t j = 0; ok && j < n_seq_id; ++j) {
+                whisper_seq_id id = 0;
+                ok = reader.read_val(id);
+                cells[i].seq_id.insert(id);
+            }
+        }
 
-int whisper_set_mel(
-        struct whisper_context * ctx,
-        const float * data,
-        int n_len,
-        int n_mel) {
-    return whisper_set_mel_with_state(ctx, ctx->state, data, n_len, n_mel);
-}
+        ok = ok && reader.read_val(n_bytes_self) &&
+            n_bytes_self == ggml_row_size(ctx->itype, (int64_t) hparams.n_text_state*hparams.n_text_layer*kv_self_size);
+        ok = ok && (self_k = reader.read(n_bytes_self)) != nullptr;
+        ok = ok && (self_v = reader.read(n_bytes_self)) != nullptr;
+    }
 
-int whisper_encode_with_state(struct whisper_context * ctx, struct whisper_state * state, int offset, int n_threads) {
-    if (!whisper_encode_internal(*ctx, *state, offset, n_threads, nullptr, nullptr)) {
-        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
-        return -1;
+    if (!ok) {
+        WHISPER_LOG_ERROR("%s: invalid or truncated state\n", __func__);
+        return -3;
     }
 
-    return 0;
-}
+    // same as in whisper_full_with_state when the number of decoders changes
+    // the new cache replaces the current one only once everything that can fail has succeeded
+    whisper_kv_cache kv_self_new;
 
-int whisper_encode(struct whisper_context * ctx, int offset, int n_threads) {
-    if (!whisper_encode_internal(*ctx, *ctx->state, offset, n_threads, nullptr, nullptr)) {
-        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
-        return -1;
+    if (has_kv_self && state->kv_self.size != kv_self_size) {
+        if (!whisper_kv_cache_init(kv_self_new, state->backends[0], ctx->itype,
+                    hparams.n_text_state,
+                    hparams.n_text_layer,
+                    kv_self_size)) {
+            WHISPER_LOG_ERROR("%s: whisper_kv_cache_init() failed for self-attention cache\n", __func__);
+            whisper_kv_cache_free(kv_self_new);
+            return -4;
+        }
     }
 
-    return 0;
-}
+    // nothing can fail from here on
 
-int whisper_decode_with_state(struct whisper_context * ctx, struct whisper_state * state, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
-    whisper_batch_prep_legacy(state->batch, tokens, n_tokens, n_past, 0);
+    state->exp_n_audio_ctx = exp_n_audio_ctx;
+    state->lang_id         = lang_id;
+    state->prompt_past     = std::move(prompt_past);
 
-    whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
+    ggml_backend_tensor_set(state->kv_cross.k, cross_k, 0, n_bytes_cross);
+    ggml_backend_tensor_set(state->kv_cross.v, cross_v, 0, n_bytes_cross);
 
-    if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads, false, nullptr, nullptr)) {
-        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
-        return 1;
+    state->enc_mel_offset = -1;
+    state->kv_cross_n_ctx = 0;
+
+    if (kv_self_new.buffer) {
+        whisper_kv_cache_free(state->kv_self);
+        whisper_state_graphs_reset(*state);
+
+        // the tensors of the cache live in ctx_buf, which keeps its storage when moved
+        state->kv_self = std::move(kv_self_new);
     }
 
-    return 0;
-}
+    if (has_kv_self) {
+        state->kv_self_n_dec = kv_self_n_dec;
 
-int whisper_decode(struct whisper_context * ctx, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
-    if (ctx->state == nullptr) {
-        WHISPER_LOG_ERROR("%s: ERROR state was not loaded.\n", __func__);
-        return -1;
+        state->kv_self.head  = kv_self_head;
+        state->kv_self.cells = std::move(cells);
+
+        ggml_backend_tensor_set(state->kv_self.k, self_k, 0, n_bytes_self);
+        ggml_backend_tensor_set(state->kv_self.v, self_v, 0, n_bytes_self);
+    } else {
+        whisper_kv_cache_clear(state->kv_self);
     }
 
-    return whisper_decode_with_state(ctx, ctx->state, tokens, n_tokens, n_past, n_threads);
+    return 0;
 }
 
 int whisper_tokenize(struct whisper_context * ctx, const char * text, whisper_token * tokens, int n_max_tokens) {
@@ -4090,7 +8897,9 @@ float * whisper_get_logits_from_state(struct whisper_state * state) {
 }
 
 const char * whisper_token_to_str(struct whisper_context * ctx, whisper_token token) {
-    return ctx->vocab.id_to_token.at(token).c_str();
+    WHISPER_ASSERT(ctx->vocab.is_valid(token));
+
+    return ctx->vocab.token_c_str(token);
 }
 
 whisper_token whisper_token_eot(struct whisper_context * ctx) {
@@ -4167,6 +8976,10 @@ void whisper_print_timings(struct whisper_context * ctx) {
         WHISPER_LOG_INFO("%s:   batchd time = %8.2f ms / %5d runs (%8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_batchd_us, n_batchd, 1e-3f * ctx->state->t_batchd_us / n_batchd);
         WHISPER_LOG_INFO("%s:   prompt time = %8.2f ms / %5d runs (%8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_prompt_us, n_prompt, 1e-3f * ctx->state->t_prompt_us / n_prompt);
     }
+    if (ctx->cache) {
+        std::lock_guard<std::mutex> lock(ctx->cache->mutex);
+        WHISPER_LOG_INFO("%s:    cache hits = %5lld / %5lld lookups\n", __func__, (long long) ctx->cache->n_hit, (long long) (ctx->cache->n_hit + ctx->cache->n_miss));
+    }
     WHISPER_LOG_INFO("%s:    total time = %8.2f ms\n", __func__, (t_end_us - ctx->t_start_us)/1000.0f);
 }
 
@@ -4595,9 +9408,8 @@ static void whisper_suppress_invalid_grammar(
     std::vector<whisper_grammar_candidate>                              candidates_grammar;
 
     for (whisper_token id = 0; id < eot; ++id) {
-        const std::string & text = ctx.vocab.id_to_token[id];
-        if (!text.empty()) {
-            candidates_decoded.push_back(decode_utf8(text.c_str(), grammar.partial_utf8));
+        if (ctx.vocab.token_len(id) > 0) {
+            candidates_decoded.push_back(decode_utf8(ctx.vocab.token_c_str(id), grammar.partial_utf8));
             candidates_grammar.push_back({ id, candidates_decoded.back().first.data(), candidates_decoded.back().second });
         }
     }
@@ -4620,18 +9432,18 @@ static void whisper_grammar_accept_token(whisper_context & ctx, whisper_grammar
         return;
     }
 
-    //fprintf(stderr, "Accept: '%s'\n", ctx.vocab.id_to_token[token].c_str());
+    //fprintf(stderr, "Accept: '%s'\n", ctx.vocab.token_c_str(token));
 
-    const std::string & text = ctx.vocab.id_to_token[token];
+    const char * text = ctx.vocab.token_c_str(token);
 
-    if (text.rfind("[_", 0) == 0) {
+    if (strncmp(text, "[_", 2) == 0) {
         // fprintf(stderr, " (skipped)\n");
         return;
     }
     // fprintf(stderr, "\n");
 
     // Note terminating 0 in decoded string
-    const auto   decoded     = decode_utf8(text.c_str(), grammar.partial_utf8);
+    const auto   decoded     = decode_utf8(text, grammar.partial_utf8);
     const auto & code_points = decoded.first;
     for (auto it = code_points.begin(), end = code_points.end() - 1; it != end; ++it) {
         grammar.stacks = whisper_grammar_accept(grammar.rules, grammar.stacks, *it);
@@ -4741,6 +9553,18 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.n_grammar_rules =*/ 0,
         /*.i_start_rule    =*/ 0,
         /*.grammar_penalty =*/ 100.0f,
+
+        /*.vad              =*/ {
+            /*.type           =*/ WHISPER_VAD_NONE,
+
+            /*.thold          =*/ 12.0f,
+            /*.min_speech_ms  =*/ 250,
+            /*.min_silence_ms =*/ 2000,
+            /*.pad_ms         =*/ 400,
+        },
+
+        /*.cache_encoder    =*/ true,
+        /*.cache_results    =*/ true,
     };
 
     switch (strategy) {
@@ -4764,7 +9588,8 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
 }
 
 // forward declarations
-static std::vector<float> get_signal_energy(const float * signal, int n_samples, int n_samples_per_half_window);
+template<typename T>
+static std::vector<float> get_signal_energy(const T * signal, int n_samples, int n_samples_per_half_window, float scale);
 static void whisper_exp_compute_token_level_timestamps(
         struct whisper_context & ctx,
           struct whisper_state & state,
@@ -4901,7 +9726,7 @@ static void whisper_process_logits(
     const auto & tokens_cur = decoder.sequence.tokens;
 
     const bool is_initial = tokens_cur.size() == 0;
-    const int  n_logits   = vocab.id_to_token.size();
+    const int  n_logits   = vocab.size();
 
     WHISPER_ASSERT(n_logits == ctx.vocab.n_vocab);
 
@@ -4933,7 +9758,9 @@ static void whisper_process_logits(
         if (params.suppress_blank) {
             if (is_initial) {
                 logits[vocab.token_eot]           = -INFINITY;
-                logits[vocab.token_to_id.at(" ")] = -INFINITY;
+                if (vocab.token_space != -1) {
+                    logits[vocab.token_space] = -INFINITY;
+                }
             }
         }
 
@@ -4976,9 +9803,9 @@ static void whisper_process_logits(
         // ref: https://github.com/openai/whisper/discussions/1041
         if (params.suppress_regex != nullptr) {
             std::regex re(params.suppress_regex);
-            for (std::pair<whisper_vocab::token, whisper_vocab::id> token_id : vocab.token_to_id) {
-                if (std::regex_match(token_id.first, re)) {
-                    logits[token_id.second] = -INFINITY;
+            for (whisper_vocab::id id = 0; id < vocab.size(); ++id) {
+                if (std::regex_match(vocab.token_c_str(id), vocab.token_c_str(id) + vocab.token_len(id), re)) {
+                    logits[id] = -INFINITY;
                 }
             }
         }
@@ -4989,18 +9816,19 @@ static void whisper_process_logits(
             for (const std::string & token : non_speech_tokens) {
                 const std::string suppress_tokens[] = {token, " " + token};
                 for (const std::string & suppress_token : suppress_tokens) {
-                    if (vocab.token_to_id.find(suppress_token) != vocab.token_to_id.end()) {
-                        logits[vocab.token_to_id.at(suppress_token)] = -INFINITY;
+                    const whisper_vocab::id id = vocab.find(suppress_token);
+                    if (id != -1) {
+                        logits[id] = -INFINITY;
                     }
                 }
             }
 
             // allow hyphens "-" and single quotes "'" between words, but not at the beginning of a word
-            if (vocab.token_to_id.find(" -") != vocab.token_to_id.end()) {
-                logits[vocab.token_to_id.at(" -")] = -INFINITY;
-            }
-            if (vocab.token_to_id.find(" '") != vocab.token_to_id.end()) {
-                logits[vocab.token_to_id.at(" '")] = -INFINITY;
+            for (const char * suppress_token : { " -", " '" }) {
+                const whisper_vocab::id id = vocab.find(suppress_token, strlen(suppress_token));
+                if (id != -1) {
+                    logits[id] = -INFINITY;
+                }
             }
         }
 
@@ -5110,7 +9938,7 @@ static void whisper_process_logits(
 #if 0
     // print first 100 logits - token string : logit
     //for (int i = 0; i < 10; i++) {
-    //    const auto token   = vocab.id_to_token.at(i);
+    //    const auto token   = vocab.token_str(i);
     //    const auto prob    = probs[i];
     //    const auto logit   = logits[i];
     //    const auto logprob = logprobs[i];
@@ -5130,7 +9958,7 @@ static void whisper_process_logits(
         });
 
         for (int i = 0; i < 10; i++) {
-            const auto token   = vocab.id_to_token.at(pairs[i].second);
+            const auto token   = vocab.token_str(pairs[i].second);
             const auto prob    = pairs[i].first;
             const auto logit   = logits[pairs[i].second];
             const auto logprob = logprobs[pairs[i].second];
@@ -5141,23 +9969,23 @@ static void whisper_process_logits(
     }
 
     // "And", "and", " And", " and"
-    //printf("logits[\"and\"]  = %f\n", logits[vocab.token_to_id.at("and")]);
-    //printf("logits[\"And\"]  = %f\n", logits[vocab.token_to_id.at("And")]);
-    //printf("logits[\" and\"] = %f\n", logits[vocab.token_to_id.at(" and")]);
-    //printf("logits[\" And\"] = %f\n", logits[vocab.token_to_id.at(" And")]);
-    //printf("logits[\" so\"]  = %f\n", logits[vocab.token_to_id.at(" so")]);
-
-    //printf("logprobs[\"and\"]  = %f\n", logprobs[vocab.token_to_id.at("and")]);
-    //printf("logprobs[\"And\"]  = %f\n", logprobs[vocab.token_to_id.at("And")]);
-    //printf("logprobs[\" and\"] = %f\n", logprobs[vocab.token_to_id.at(" and")]);
-    //printf("logprobs[\" And\"] = %f\n", logprobs[vocab.token_to_id.at(" And")]);
-    //printf("logprobs[\" so\"]  = %f\n", logprobs[vocab.token_to_id.at(" so")]);
-
-    //printf("probs[\"and\"]  = %f\n", probs[vocab.token_to_id.at("and")]);
-    //printf("probs[\"And\"]  = %f\n", probs[vocab.token_to_id.at("And")]);
-    //printf("probs[\" and\"] = %f\n", probs[vocab.token_to_id.at(" and")]);
-    //printf("probs[\" And\"] = %f\n", probs[vocab.token_to_id.at(" And")]);
-    //printf("probs[\" so\"]  = %f\n", probs[vocab.token_to_id.at(" so")]);
+    //printf("logits[\"and\"]  = %f\n", logits[vocab.find("and")]);
+    //printf("logits[\"And\"]  = %f\n", logits[vocab.find("And")]);
+    //printf("logits[\" and\"] = %f\n", logits[vocab.find(" and")]);
+    //printf("logits[\" And\"] = %f\n", logits[vocab.find(" And")]);
+    //printf("logits[\" so\"]  = %f\n", logits[vocab.find(" so")]);
+
+    //printf("logprobs[\"and\"]  = %f\n", logprobs[vocab.find("and")]);
+    //printf("logprobs[\"And\"]  = %f\n", logprobs[vocab.find("And")]);
+    //printf("logprobs[\" and\"] = %f\n", logprobs[vocab.find(" and")]);
+    //printf("logprobs[\" And\"] = %f\n", logprobs[vocab.find(" And")]);
+    //printf("logprobs[\" so\"]  = %f\n", logprobs[vocab.find(" so")]);
+
+    //printf("probs[\"and\"]  = %f\n", probs[vocab.find("and")]);
+    //printf("probs[\"And\"]  = %f\n", probs[vocab.find("And")]);
+    //printf("probs[\" and\"] = %f\n", probs[vocab.find(" and")]);
+    //printf("probs[\" And\"] = %f\n", probs[vocab.find(" And")]);
+    //printf("probs[\" so\"]  = %f\n", probs[vocab.find(" so")]);
 #endif
 }
 
@@ -5287,90 +10115,556 @@ static std::vector<whisper_token_data> whisper_sample_token_topk(
             }
         }
 
-        pt    = max_ts/(sum_ts + 1e-10);
-        ptsum = sum_ts;
+        pt    = max_ts/(sum_ts + 1e-10);
+        ptsum = sum_ts;
+    }
+
+    std::discrete_distribution<> dist(probs.begin(), probs.end());
+
+    for (int i = 0; i < k; ++i) {
+        const auto id = dist(decoder.rng);
+        //printf("XXX %d %d %f %f %f %f\n", id, tid, probs[id], logprobs[id], pt, ptsum);
+
+        result.push_back({ id, tid, probs[id], logprobs[id], pt, ptsum, -1, -1, -1, 0.0f, });
+
+        if (result[i].id >= vocab.token_beg) {
+            result[i].tid = result[i].id;
+            result[i].pt  = result[i].p;
+        }
+    }
+
+    return result;
+}
+
+// ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L178-L192
+static void whisper_sequence_score(
+        const struct whisper_full_params & params,
+                        whisper_sequence & sequence) {
+    if (sequence.result_len == 0) {
+        return;
+    }
+
+    double result = 0.0f;
+
+    for (int i = 0; i < sequence.result_len; ++i) {
+        result += sequence.tokens[i].plog;
+    }
+
+    sequence.sum_logprobs = result;
+    sequence.avg_logprobs = result/sequence.result_len;
+
+    double penalty = sequence.result_len;
+
+    if (params.length_penalty > 0.0f) {
+        penalty = pow((5.0 + penalty)/6.0, params.length_penalty);
+    }
+
+    sequence.score = result/penalty;
+
+    // compute the entropy of the sequence of the last 32 tokens
+    {
+        const int n = 32;
+
+        int cnt = 0;
+        double entropy = 0.0f;
+
+        std::map<whisper_token, int> token_counts;
+        for (int i = std::max(0, sequence.result_len - n); i < sequence.result_len; ++i) {
+            token_counts[sequence.tokens[i].id]++;
+            cnt++;
+        }
+
+        for (const auto & kv : token_counts) {
+            const auto p = kv.second/(double)cnt;
+            entropy -= p*log(p);
+
+            //WHISPER_LOG_DEBUG("entropy: %d %f %f, count %d\n", kv.first, p, log(p), kv.second);
+        }
+
+        sequence.entropy = entropy;
+    }
+}
+
+// spectrogram kept by whisper_full_from_source() and number of samples read from the source at a time
+#define WHISPER_SOURCE_WINDOW_MS  60000
+#define WHISPER_SOURCE_READ_SIZE  (10*WHISPER_SAMPLE_RATE)
+
+// pull-based input of whisper_full_from_source_with_state()
+struct whisper_source_reader {
+    whisper_audio_source source;
+
+    std::vector<float> buf;
+
+    // the last samples read, for the signal energy (token_timestamps only)
+    std::vector<float> samples;
+    int64_t samples_offset = 0; // index in the audio of samples[0]
+
+    bool keep_samples = false;
+    bool eof          = false;
+};
+
+// reads from the source until the spectrogram has the frames before frame_end, or until the end of the audio
+static bool whisper_source_pull(
+        whisper_context & ctx,
+          whisper_state & state,
+  whisper_source_reader & reader,
+                int64_t   frame_end,
+                    int   n_threads) {
+    reader.buf.resize(WHISPER_SOURCE_READ_SIZE);
+
+    while (!reader.eof && state.mel_stream.n_frames_total < frame_end) {
+        const int n = reader.source.read(reader.buf.data(), reader.buf.size(), reader.source.user_data);
+        if (n < 0 || n > (int) reader.buf.size()) {
+            WHISPER_LOG_ERROR("%s: failed to read from the audio source\n", __func__);
+            return false;
+        }
+
+        if (n == 0) {
+            reader.eof = true;
+            break;
+        }
+
+        if (whisper_pcm_to_mel_append_with_state(&ctx, &state, reader.buf.data(), n, n_threads) < 0) {
+            return false;
+        }
+
+        if (reader.keep_samples) {
+            const size_t n_keep = (size_t) WHISPER_SOURCE_WINDOW_MS*(WHISPER_SAMPLE_RATE/1000);
+
+            reader.samples.insert(reader.samples.end(), reader.buf.begin(), reader.buf.begin() + n);
+            if (reader.samples.size() > n_keep) {
+                const size_t n_drop = reader.samples.size() - n_keep;
+
+                reader.samples.erase(reader.samples.begin(), reader.samples.begin() + n_drop);
+                reader.samples_offset += n_drop;
+            }
+        }
+    }
+
+    return true;
+}
+
+// speech band of whisper_vad_band_energy()
+#define WHISPER_VAD_FREQ_MIN 200
+#define WHISPER_VAD_FREQ_MAX 4000
+
+// percentile of the frame energies taken as the noise floor
+#define WHISPER_VAD_FLOOR_PERCENTILE 10
+
+// speech region of the audio, in mel frames [t0, t1)
+struct whisper_vad_region {
+    int64_t t0;
+    int64_t t1;
+};
+
+// mean log10 energy of the mel bands in the speech band, for the frames [f0, f1) of the audio
+// mel_offset is the frame of the audio at the start of state.mel
+static std::vector<float> whisper_vad_band_energy(
+        const whisper_context & ctx,
+                whisper_state & state,
+                      int64_t   f0,
+                      int64_t   f1,
+                      int64_t   mel_offset) {
+    const auto & filters = ctx.model.filters;
+    const auto & mel     = state.mel;
+
+    std::vector<int> bands;
+    for (int j = 0; j < filters.n_mel; ++j) {
+        const int   k    = filters.band_start[j] + filters.band_len[j]/2;
+        const float freq = (float) k*WHISPER_SAMPLE_RATE/WHISPER_N_FFT;
+
+        if (freq >= WHISPER_VAD_FREQ_MIN && freq <= WHISPER_VAD_FREQ_MAX) {
+            bands.push_back(j);
+        }
+    }
+
+    if (bands.empty()) {
+        for (int j = 0; j < filters.n_mel; ++j) {
+            bands.push_back(j);
+        }
+    }
+
+    const int n = (int) (f1 - f0);
+
+    std::vector<float> energy(n, 0.0f);
+    std::vector<float> row(n);
+
+    for (const int j : bands) {
+        if (state.mel_graph.active) {
+            // log10 + 4, before the clamping to 8 below the maximum
+            const auto & mg = state.mel_graph;
+
+            float mmax = 0.0f;
+            ggml_backend_tensor_get(mg.mmax, &mmax, 0, sizeof(float));
+            ggml_backend_tensor_get(mg.mel, row.data(), j*mg.mel->nb[1] + (f0 - mel_offset)*sizeof(float), n*sizeof(float));
+
+            for (int i = 0; i < n; ++i) {
+                energy[i] += std::max(row[i], mmax - 8.0f) - 4.0f;
+            }
+        } else {
+            // (log10 + 4)/4, see log_mel_spectrogram()
+            const float * src = mel.data.data() + (size_t) j*mel.n_len + (f0 - mel_offset);
+
+            for (int i = 0; i < n; ++i) {
+                energy[i] += 4.0f*src[i] - 4.0f;
+            }
+        }
+    }
+
+    for (int i = 0; i < n; ++i) {
+        energy[i] /= bands.size();
+    }
+
+    return energy;
+}
+
+// speech regions of the frames [f0, f1) of the audio
+static std::vector<whisper_vad_region> whisper_vad_detect(
+        const whisper_context & ctx,
+                whisper_state & state,
+    const whisper_full_params & params,
+                      int64_t   f0,
+                      int64_t   f1,
+                      int64_t   mel_offset) {
+    std::vector<whisper_vad_region> regions;
+
+    if (f1 <= f0) {
+        return regions;
+    }
+
+    std::vector<bool> speech(f1 - f0, false);
+
+    switch (params.vad.type) {
+        case WHISPER_VAD_NONE:
+            {
+                std::fill(speech.begin(), speech.end(), true);
+            } break;
+        case WHISPER_VAD_ENERGY:
+            {
+                const auto energy = whisper_vad_band_energy(ctx, state, f0, f1, mel_offset);
+
+                auto sorted = energy;
+                auto nth    = sorted.begin() + (sorted.size() - 1)*WHISPER_VAD_FLOOR_PERCENTILE/100;
+                std::nth_element(sorted.begin(), nth, sorted.end());
+
+                const float thold = *nth + 0.1f*params.vad.thold;
+
+                for (size_t i = 0; i < energy.size(); ++i) {
+                    speech[i] = energy[i] > thold;
+                }
+            } break;
+    };
+
+    for (int64_t i = 0; i < (int64_t) speech.size(); ) {
+        if (!speech[i]) {
+            ++i;
+            continue;
+        }
+
+        int64_t j = i;
+        while (j < (int64_t) speech.size() && speech[j]) {
+            ++j;
+        }
+
+        regions.push_back({ f0 + i, f0 + j });
+        i = j;
+    }
+
+    const int64_t min_speech  = params.vad.min_speech_ms/10;
+    const int64_t min_silence = params.vad.min_silence_ms/10;
+    const int64_t pad         = params.vad.pad_ms/10;
+
+    // close the short gaps, then drop the short regions
+    std::vector<whisper_vad_region> merged;
+    for (const auto & r : regions) {
+        if (!merged.empty() && r.t0 - merged.back().t1 < min_silence) {
+            merged.back().t1 = r.t1;
+        } else {
+            merged.push_back(r);
+        }
+    }
+
+    regions.clear();
+    for (const auto & r : merged) {
+        if (r.t1 - r.t0 < min_speech) {
+            continue;
+        }
+
+        const whisper_vad_region padded = { std::max(f0, r.t0 - pad), std::min(f1, r.t1 + pad) };
+
+        if (!regions.empty() && padded.t0 <= regions.back().t1) {
+            regions.back().t1 = padded.t1;
+        } else {
+            regions.push_back(padded);
+        }
+    }
+
+    return regions;
+}
+
+// the encoder output depends only on its input window of the spectrogram (see whisper_encode_internal)
+static whisper_cache_key whisper_cache_key_encoder(const whisper_context & ctx, const whisper_state & state, int mel_offset) {
+    const auto & mel = state.mel;
+
+    const int n_ctx = state.exp_n_audio_ctx > 0 ? state.exp_n_audio_ctx : ctx.model.hparams.n_audio_ctx;
+
+    const int i0 = std::min(mel_offset,           mel.n_len);
+    const int i1 = std::min(mel_offset + 2*n_ctx, mel.n_len);
+
+    whisper_sha256 key;
+
+    key.update(ctx.cache->key_model.data(), ctx.cache->key_model.size());
+    whisper_cache_key_str(key, "encoder");
+
+    whisper_cache_key_val(key, n_ctx);
+    whisper_cache_key_val(key, i1 - i0);
+    whisper_cache_key_val(key, mel.n_mel);
+
+    for (int j = 0; j < mel.n_mel; ++j) {
+        key.update(mel.data.data() + (size_t) j*mel.n_len + i0, (i1 - i0)*sizeof(float));
+    }
+
+    return key.digest();
+}
+
+// the cross-attention cache computed by the encoder
+static bool whisper_cache_get_encoder(whisper_context & ctx, whisper_state & state, const whisper_cache_key & key) {
+    std::vector<uint8_t> data;
+    if (!ctx.cache->get(key, data)) {
+        return false;
+    }
+
+    const size_t n_bytes = whisper_state_kv_cross_nbytes(ctx, state);
+    if (data.size() != 2*n_bytes) {
+        return false;
     }
 
-    std::discrete_distribution<> dist(probs.begin(), probs.end());
+    ggml_backend_tensor_set(state.kv_cross.k, data.data(),           0, n_bytes);
+    ggml_backend_tensor_set(state.kv_cross.v, data.data() + n_bytes, 0, n_bytes);
 
-    for (int i = 0; i < k; ++i) {
-        const auto id = dist(decoder.rng);
-        //printf("XXX %d %d %f %f %f %f\n", id, tid, probs[id], logprobs[id], pt, ptsum);
+    return true;
+}
 
-        result.push_back({ id, tid, probs[id], logprobs[id], pt, ptsum, -1, -1, -1, 0.0f, });
+static void whisper_cache_put_encoder(whisper_context & ctx, const whisper_state & state, const whisper_cache_key & key) {
+    const size_t n_bytes = whisper_state_kv_cross_nbytes(ctx, state);
 
-        if (result[i].id >= vocab.token_beg) {
-            result[i].tid = result[i].id;
-            result[i].pt  = result[i].p;
+    std::vector<uint8_t> data(2*n_bytes);
+
+    ggml_backend_tensor_get(state.kv_cross.k, data.data(),           0, n_bytes);
+    ggml_backend_tensor_get(state.kv_cross.v, data.data() + n_bytes, 0, n_bytes);
+
+    ctx.cache->put(key, data);
+}
+
+// the results depend on the audio and on the parameters that affect the decoding
+static whisper_cache_key whisper_cache_key_results(
+        const whisper_context & ctx,
+    const whisper_full_params & params,
+                  const float * samples,
+                const int16_t * samples_s16,
+                          int   n_samples) {
+    whisper_sha256 key;
+
+    key.update(ctx.cache->key_model.data(), ctx.cache->key_model.size());
+    whisper_cache_key_str(key, samples_s16 ? "results s16" : "results");
+
+    whisper_cache_key_val(key, n_samples);
+    if (samples_s16) {
+        key.update(samples_s16, (size_t) n_samples*sizeof(int16_t));
+    } else {
+        key.update(samples, (size_t) n_samples*sizeof(float));
+    }
+
+    whisper_cache_key_val(key, params.strategy);
+    whisper_cache_key_val(key, params.n_max_text_ctx);
+    whisper_cache_key_val(key, params.offset_ms);
+    whisper_cache_key_val(key, params.duration_ms);
+    whisper_cache_key_val(key, params.translate);
+    whisper_cache_key_val(key, params.no_timestamps);
+    whisper_cache_key_val(key, params.single_segment);
+    whisper_cache_key_val(key, params.token_timestamps);
+    whisper_cache_key_val(key, params.thold_pt);
+    whisper_cache_key_val(key, params.thold_ptsum);
+    whisper_cache_key_val(key, params.max_len);
+    whisper_cache_key_val(key, params.split_on_word);
+    whisper_cache_key_val(key, params.max_tokens);
+    whisper_cache_key_val(key, params.audio_ctx);
+    whisper_cache_key_val(key, params.tdrz_enable);
+    whisper_cache_key_str(key, params.suppress_regex);
+    whisper_cache_key_str(key, params.initial_prompt);
+    whisper_cache_key_val(key, params.prompt_n_tokens);
+    if (params.prompt_tokens && params.prompt_n_tokens > 0) {
+        key.update(params.prompt_tokens, params.prompt_n_tokens*sizeof(whisper_token));
+    }
+    whisper_cache_key_str(key, params.language);
+    whisper_cache_key_val(key, params.suppress_blank);
+    whisper_cache_key_val(key, params.suppress_nst);
+    whisper_cache_key_val(key, params.temperature);
+    whisper_cache_key_val(key, params.max_initial_ts);
+    whisper_cache_key_val(key, params.length_penalty);
+    whisper_cache_key_val(key, params.temperature_inc);
+    whisper_cache_key_val(key, params.entropy_thold);
+    whisper_cache_key_val(key, params.logprob_thold);
+    whisper_cache_key_val(key, params.no_speech_thold);
+    whisper_cache_key_val(key, params.greedy.best_of);
+    whisper_cache_key_val(key, params.beam_search.beam_size);
+    whisper_cache_key_val(key, params.vad.type);
+    whisper_cache_key_val(key, params.vad.thold);
+    whisper_cache_key_val(key, params.vad.min_speech_ms);
+    whisper_cache_key_val(key, params.vad.min_silence_ms);
+    whisper_cache_key_val(key, params.vad.pad_ms);
+
+    whisper_cache_key_val(key, params.n_grammar_rules);
+    for (size_t i = 0; params.grammar_rules && i < params.n_grammar_rules; ++i) {
+        for (const whisper_grammar_element * e = params.grammar_rules[i]; ; ++e) {
+            whisper_cache_key_val(key, e->type);
+            whisper_cache_key_val(key, e->value);
+            if (e->type == WHISPER_GRETYPE_END) {
+                break;
+            }
         }
     }
+    whisper_cache_key_val(key, params.i_start_rule);
+    whisper_cache_key_val(key, params.grammar_penalty);
 
-    return result;
+    return key.digest();
 }
 
-// ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L178-L192
-static void whisper_sequence_score(
-        const struct whisper_full_params & params,
-                        whisper_sequence & sequence) {
-    if (sequence.result_len == 0) {
-        return;
+// layout of the results: int32 lang_id, uint32 n_segments, then for each segment:
+//   int64 t0, t1, float no_speech_prob, uint32 speaker_turn_next, uint32 n_text followed by the text,
+//   uint32 n_tokens followed by the whisper_token_data
+static bool whisper_cache_get_results(whisper_context & ctx, whisper_state & state, const whisper_cache_key & key) {
+    std::vector<uint8_t> data;
+    if (!ctx.cache->get(key, data)) {
+        return false;
     }
 
-    double result = 0.0f;
+    whisper_state_reader reader;
+    reader.buf  = data.data();
+    reader.size = data.size();
 
-    for (int i = 0; i < sequence.result_len; ++i) {
-        result += sequence.tokens[i].plog;
+    int32_t  lang_id    = 0;
+    uint32_t n_segments = 0;
+
+    if (!reader.read_val(lang_id) || !reader.read_val(n_segments)) {
+        return false;
     }
 
-    sequence.sum_logprobs = result;
-    sequence.avg_logprobs = result/sequence.result_len;
+    std::vector<whisper_segment> result(n_segments);
 
-    double penalty = sequence.result_len;
+    for (auto & segment : result) {
+        uint32_t speaker_turn_next = 0;
+        uint32_t n_text            = 0;
+        uint32_t n_tokens          = 0;
 
-    if (params.length_penalty > 0.0f) {
-        penalty = pow((5.0 + penalty)/6.0, params.length_penalty);
+        if (!reader.read_val(segment.t0) ||
+            !reader.read_val(segment.t1) ||
+            !reader.read_val(segment.no_speech_prob) ||
+            !reader.read_val(speaker_turn_next) ||
+            !reader.read_val(n_text)) {
+            return false;
+        }
+
+        const uint8_t * text = reader.read(n_text);
+        if (text == nullptr || !reader.read_val(n_tokens)) {
+            return false;
+        }
+
+        const uint8_t * tokens = reader.read((size_t) n_tokens*sizeof(whisper_token_data));
+        if (tokens == nullptr) {
+            return false;
+        }
+
+        segment.text.assign((const char *) text, n_text);
+        segment.tokens.resize(n_tokens);
+        memcpy(segment.tokens.data(), tokens, (size_t) n_tokens*sizeof(whisper_token_data));
+        segment.speaker_turn_next = speaker_turn_next;
     }
 
-    sequence.score = result/penalty;
+    state.lang_id    = lang_id;
+    state.result_all = std::move(result);
 
-    // compute the entropy of the sequence of the last 32 tokens
-    {
-        const int n = 32;
+    return true;
+}
 
-        int cnt = 0;
-        double entropy = 0.0f;
+static void whisper_cache_put_results(whisper_context & ctx, const whisper_state & state, const whisper_cache_key & key) {
+    const auto write = [&](whisper_state_writer & writer) {
+        writer.write_val<int32_t>(state.lang_id);
+        writer.write_val<uint32_t>(state.result_all.size());
 
-        std::map<whisper_token, int> token_counts;
-        for (int i = std::max(0, sequence.result_len - n); i < sequence.result_len; ++i) {
-            token_counts[sequence.tokens[i].id]++;
-            cnt++;
+        for (const auto & segment : state.result_all) {
+            writer.write_val(segment.t0);
+            writer.write_val(segment.t1);
+            writer.write_val(segment.no_speech_prob);
+            writer.write_val<uint32_t>(segment.speaker_turn_next);
+            writer.write_val<uint32_t>(segment.text.size());
+            writer.write(segment.text.data(), segment.text.size());
+            writer.write_val<uint32_t>(segment.tokens.size());
+            writer.write(segment.tokens.data(), segment.tokens.size()*sizeof(whisper_token_data));
         }
+    };
 
-        for (const auto & kv : token_counts) {
-            const auto p = kv.second/(double)cnt;
-            entropy -= p*log(p);
+    whisper_state_writer writer;
+    write(writer);
 
-            //WHISPER_LOG_DEBUG("entropy: %d %f %f, count %d\n", kv.first, p, log(p), kv.second);
-        }
+    std::vector<uint8_t> data(writer.n);
 
-        sequence.entropy = entropy;
-    }
+    writer.buf  = data.data();
+    writer.size = data.size();
+    writer.n    = 0;
+    write(writer);
+
+    ctx.cache->put(key, data);
 }
 
-int whisper_full_with_state(
+// the audio is either the F32 samples or the S16 samples_s16 (the other one is nullptr)
+// with a reader, the audio is pulled from it (samples and n_samples are not used) and state->mel is the sliding window
+// of whisper_pcm_to_mel_append(), so the frames of seek are at seek - whisper_pcm_to_mel_append_offset_from_state()
+static int whisper_full_impl(
         struct whisper_context * ctx,
           struct whisper_state * state,
     struct whisper_full_params   params,
                    const float * samples,
-                           int   n_samples) {
+                 const int16_t * samples_s16,
+                           int   n_samples,
+         whisper_source_reader * reader) {
     // clear old results
     auto & result_all = state->result_all;
 
     result_all.clear();
 
-    if (n_samples > 0) {
+    // results of the same audio and parameters - they do not depend on the state with no_context
+    whisper_cache_key key_results;
+
+    if (ctx->cache && params.cache_results && !reader && n_samples > 0 &&
+        params.no_context && !params.detect_language && params.logits_filter_callback == nullptr) {
+        key_results = whisper_cache_key_results(*ctx, params, samples, samples_s16, n_samples);
+
+        if (whisper_cache_get_results(*ctx, *state, key_results)) {
+            WHISPER_LOG_DEBUG("%s: results found in the cache\n", __func__);
+
+            if (params.new_segment_callback && !result_all.empty()) {
+                params.new_segment_callback(ctx, state, result_all.size(), params.new_segment_callback_user_data);
+            }
+
+            return 0;
+        }
+    }
+
+    if (reader) {
+        whisper_pcm_to_mel_append_reset_with_state(state, WHISPER_SOURCE_WINDOW_MS);
+
+        reader->keep_samples = params.token_timestamps;
+
+        // the first window, for the language detection
+        if (!whisper_source_pull(*ctx, *state, *reader, 100*WHISPER_CHUNK_SIZE, params.n_threads)) {
+            return -10;
+        }
+    } else if (n_samples > 0) {
         // compute log mel spectrogram
-        if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, params.n_threads) != 0) {
+        const int ret = samples_s16 ? whisper_pcm16_to_mel_with_state(ctx, state, samples_s16, n_samples, params.n_threads) :
+                                      whisper_pcm_to_mel_with_state  (ctx, state, samples,     n_samples, params.n_threads);
+        if (ret != 0) {
             WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
             return -2;
         }
@@ -5398,13 +10692,24 @@ int whisper_full_with_state(
         state->t_beg    = 0;
         state->t_last   = 0;
         state->tid_last = 0;
-        if (n_samples > 0) {
-            state->energy = get_signal_energy(samples, n_samples, 32);
+        if (!reader && n_samples > 0) {
+            state->energy        = samples_s16 ? get_signal_energy(samples_s16, n_samples, 32, 1.0f/32768.0f) :
+                                                 get_signal_energy(samples,     n_samples, 32, 1.0f);
+            state->energy_offset = 0;
         }
     }
 
     const int seek_start = params.offset_ms/10;
-    const int seek_end = params.duration_ms == 0 ? whisper_n_len_from_state(state) : seek_start + params.duration_ms/10;
+
+    // with a reader, the length of the audio is known only once the end is reached
+    const auto get_seek_end = [&]() {
+        const int n_len = reader == nullptr ? whisper_n_len_from_state(state) :
+                          reader->eof       ? (int) state->mel_stream.n_frames_total : std::numeric_limits<int>::max();
+
+        return params.duration_ms == 0 ? n_len : std::min(n_len, seek_start + params.duration_ms/10);
+    };
+
+    int seek_end = get_seek_end();
 
     // if length of spectrogram is less than 1.0s (100 frames), then return
     // basically don't process anything that is less than 1.0s
@@ -5414,6 +10719,20 @@ int whisper_full_with_state(
         return 0;
     }
 
+    // speech regions - with a reader, they are detected in the spectrogram window before each decoded window instead
+    std::vector<whisper_vad_region> vad_regions;
+    if (params.vad.type != WHISPER_VAD_NONE && !reader) {
+        vad_regions = whisper_vad_detect(*ctx, *state, params, seek_start, seek_end, 0);
+
+        int64_t n_speech = 0;
+        for (const auto & r : vad_regions) {
+            n_speech += r.t1 - r.t0;
+        }
+
+        WHISPER_LOG_INFO("%s: VAD: %d speech regions, %.1f%% of the audio\n", __func__,
+                (int) vad_regions.size(), 100.0f*n_speech/(seek_end - seek_start));
+    }
+
     // a set of temperatures to use
     // [ t0, t0 + delta, t0 + 2*delta, ..., < 1.0f + 1e-6f ]
     std::vector<float> temperatures;
@@ -5472,13 +10791,7 @@ int whisper_full_with_state(
 
         // initial prompt
         if (!params.prompt_tokens && params.initial_prompt) {
-            prompt_tokens.resize(1024);
-            int n_needed = whisper_tokenize(ctx, params.initial_prompt, prompt_tokens.data(), prompt_tokens.size());
-            if (n_needed < 0) {
-                prompt_tokens.resize(-n_needed);
-                n_needed = whisper_tokenize(ctx, params.initial_prompt, prompt_tokens.data(), prompt_tokens.size());
-            }
-            prompt_tokens.resize(n_needed);
+            prompt_tokens = whisper_prompt_cache_get(state->prompt_cache, ctx->vocab, params.initial_prompt);
             params.prompt_tokens   = prompt_tokens.data();
             params.prompt_n_tokens = prompt_tokens.size();
         }
@@ -5498,7 +10811,7 @@ int whisper_full_with_state(
         WHISPER_LOG_ERROR("%s: audio_ctx is larger than the maximum allowed (%d > %d)\n", __func__, params.audio_ctx, whisper_n_audio_ctx(ctx));
         return -5;
     }
-    state->exp_n_audio_ctx = params.audio_ctx;
+    state->exp_n_audio_ctx = std::max(0, params.audio_ctx);
 
     // these tokens determine the task that will be performed
     std::vector<whisper_token> prompt_init = { whisper_token_sot(ctx), };
@@ -5529,6 +10842,8 @@ int whisper_full_with_state(
 
     int seek = seek_start;
 
+    bool aborted = false;
+
     std::vector<whisper_token> prompt;
     prompt.reserve(whisper_n_text_ctx(ctx));
 
@@ -5547,6 +10862,53 @@ int whisper_full_with_state(
 
     // main loop
     while (true) {
+        if (reader) {
+            if (!whisper_source_pull(*ctx, *state, *reader, (int64_t) seek + 100*WHISPER_CHUNK_SIZE, params.n_threads)) {
+                return -10;
+            }
+
+            seek_end = get_seek_end();
+
+            if (params.token_timestamps && !reader->samples.empty()) {
+                state->energy        = get_signal_energy(reader->samples.data(), reader->samples.size(), 32, 1.0f);
+                state->energy_offset = reader->samples_offset;
+            }
+        }
+
+        // skip to the next speech region
+        if (params.vad.type != WHISPER_VAD_NONE) {
+            int64_t frame_end = seek_end;
+
+            if (reader) {
+                const int64_t mel_offset = whisper_pcm_to_mel_append_offset_from_state(state);
+
+                frame_end   = mel_offset + state->mel.n_len_org;
+                vad_regions = whisper_vad_detect(*ctx, *state, params, mel_offset, std::min<int64_t>(frame_end, seek_end), mel_offset);
+            }
+
+            int64_t next = -1;
+            for (const auto & r : vad_regions) {
+                if (r.t1 > seek) {
+                    next = std::max<int64_t>(seek, r.t0);
+                    break;
+                }
+            }
+
+            if (next < 0) {
+                // no speech left - with a reader, keep the end of the window, where a speech region may be cut short
+                next = reader && !reader->eof ? frame_end - (params.vad.min_speech_ms + params.vad.pad_ms)/10 : seek_end;
+            }
+
+            if (next > seek) {
+                next = std::min<int64_t>(next, seek_end);
+
+                WHISPER_LOG_DEBUG("%s: VAD: skipping %.2f s of non-speech at %.2f s\n", __func__, 0.01f*(next - seek), 0.01f*seek);
+
+                seek = next;
+                continue;
+            }
+        }
+
         if (params.progress_callback) {
             const int progress_cur = (100*(seek - seek_start))/(seek_end - seek_start);
 
@@ -5562,14 +10924,56 @@ int whisper_full_with_state(
         if (params.encoder_begin_callback) {
             if (params.encoder_begin_callback(ctx, state, params.encoder_begin_callback_user_data) == false) {
                 WHISPER_LOG_ERROR("%s: encoder_begin_callback returned false - aborting\n", __func__);
+                aborted = true;
                 break;
             }
         }
 
+        // pick the smallest audio context that covers the rest of the audio
+        if (params.audio_ctx < 0) {
+            state->exp_n_audio_ctx = 0;
+
+            // the external encoders are compiled for the full context, and a reader may still have more audio
+            if (!whisper_encode_external(*state) && !(reader && !reader->eof)) {
+                const int64_t n_ctx_min = (seek_end - seek + 1)/2;
+
+                for (int i = 0; i < WHISPER_N_AUDIO_CTX_BUCKETS; ++i) {
+                    if (n_ctx_min <= g_audio_ctx_buckets[i] && g_audio_ctx_buckets[i] < whisper_n_audio_ctx(ctx)) {
+                        state->exp_n_audio_ctx = g_audio_ctx_buckets[i];
+                        break;
+                    }
+                }
+            }
+
+            WHISPER_LOG_DEBUG("%s: audio_ctx = %d for %.2f s of audio\n", __func__, state->exp_n_audio_ctx, 0.01f*(seek_end - seek));
+        }
+
         // encode audio features starting at offset seek
-        if (!whisper_encode_internal(*ctx, *state, seek, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
-            WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
-            return -6;
+        const int mel_offset = reader ? (int) (seek - whisper_pcm_to_mel_append_offset_from_state(state)) : seek;
+
+        // the spectrogram computed with ggml stays on the backend and is not hashed
+        const bool cache_encoder = ctx->cache && params.cache_encoder && !state->mel_graph.active;
+
+        const whisper_cache_key key_encoder = cache_encoder ? whisper_cache_key_encoder(*ctx, *state, mel_offset) : whisper_cache_key();
+
+        if (!reader && state->enc_mel_offset == mel_offset && state->enc_n_ctx == state->exp_n_audio_ctx) {
+            // already encoded, e.g. by the language detection or by whisper_encode_batch()
+            WHISPER_LOG_DEBUG("%s: reusing the encoder output at offset %d\n", __func__, mel_offset);
+        } else if (cache_encoder && whisper_cache_get_encoder(*ctx, *state, key_encoder)) {
+            WHISPER_LOG_DEBUG("%s: encoder output found in the cache\n", __func__);
+
+            state->enc_mel_offset = mel_offset;
+            state->enc_n_ctx      = state->exp_n_audio_ctx;
+            state->kv_cross_n_ctx = 0;
+        } else {
+            if (!whisper_encode_internal(*ctx, *state, mel_offset, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
+                WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+                return -6;
+            }
+
+            if (cache_encoder) {
+                whisper_cache_put_encoder(*ctx, *state, key_encoder);
+            }
         }
 
         // if there is a very short audio segment left to process, we remove any past prompt since it tends
@@ -5650,7 +11054,7 @@ int whisper_full_with_state(
                 // print the prompt
                 WHISPER_LOG_DEBUG("\n\n");
                 for (int i = 0; i < (int) prompt.size(); i++) {
-                    WHISPER_LOG_DEBUG("%s: prompt[%d] = %s\n", __func__, i, ctx->vocab.id_to_token.at(prompt[i]).c_str());
+                    WHISPER_LOG_DEBUG("%s: prompt[%d] = %s\n", __func__, i, ctx->vocab.token_c_str(prompt[i]));
                 }
                 WHISPER_LOG_DEBUG("\n\n");
 
@@ -5659,6 +11063,7 @@ int whisper_full_with_state(
                     WHISPER_LOG_DEBUG("%s: recreating KV cache: n_decoders_cur = %d\n", __func__, n_decoders_cur);
 
                     whisper_kv_cache_free(state->kv_self);
+                    whisper_state_graphs_reset(*state);
 
                     // overallocate to workaround KV cache fragmentation issues
                     const int factor = n_decoders_cur > 1 ? n_decoders_cur + 2 : 1;
@@ -5687,7 +11092,7 @@ int whisper_full_with_state(
                 // Calculate no_speech probability after first decode.
                 // This has to be done before any logit filtering. Hence we cannot use the probs from the whisper_process_logits.
                 {
-                    const int n_logits = ctx->vocab.id_to_token.size();
+                    const int n_logits = ctx->vocab.size();
                     std::vector<float> logprobs(n_logits);
                     std::vector<float> probs(n_logits);
 
@@ -5727,7 +11132,7 @@ int whisper_full_with_state(
                 }
 
                 // sampling
-                // TODO: avoid memory allocations, optimize, avoid threads?
+                // TODO: avoid memory allocations, optimize
                 {
                     std::atomic<int> j_cur(0);
 
@@ -5770,23 +11175,9 @@ int whisper_full_with_state(
                         }
                     };
 
-                    const int n_threads = std::min(params.n_threads, n_decoders_cur);
-
-                    if (n_threads == 1) {
-                        process();
-                    } else {
-                        std::vector<std::thread> threads(n_threads - 1);
-
-                        for (int t = 0; t < n_threads - 1; ++t) {
-                            threads[t] = std::thread(process);
-                        }
-
+                    state->thread_pool.run(std::min(params.n_threads, n_decoders_cur), [&](int) {
                         process();
-
-                        for (int t = 0; t < n_threads - 1; ++t) {
-                            threads[t].join();
-                        }
-                    }
+                    });
                 }
 
                 beam_candidates.clear();
@@ -5837,7 +11228,7 @@ int whisper_full_with_state(
                         whisper_kv_cache_seq_cp(state->kv_self, cur.decoder_idx, WHISPER_MAX_DECODERS + j, -1, -1);
 
                         WHISPER_LOG_DEBUG("%s: beam search: decoder %d: from decoder %d: token = %10s, plog = %8.5f, sum_logprobs = %8.5f\n",
-                                __func__, j, cur.decoder_idx, ctx->vocab.id_to_token.at(decoder.sequence.tokens.back().id).c_str(), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
+                                __func__, j, cur.decoder_idx, ctx->vocab.token_c_str(decoder.sequence.tokens.back().id), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
                     }
 
                     for (int j = 0; j < n_decoders_cur; ++j) {
@@ -5893,9 +11284,9 @@ int whisper_full_with_state(
 
 #ifdef WHISPER_DEBUG
                         {
-                            const auto tt = token.pt > 0.10 ? ctx->vocab.id_to_token.at(token.tid) : "[?]";
+                            const auto tt = token.pt > 0.10 ? ctx->vocab.token_str(token.tid) : "[?]";
                             WHISPER_LOG_DEBUG("%s: id = %3d, decoder = %d, token = %6d, p = %6.3f, ts = %10s, %6.3f, result_len = %4d '%s'\n",
-                                    __func__, i, j, token.id, token.p, tt.c_str(), token.pt, result_len, ctx->vocab.id_to_token.at(token.id).c_str());
+                                    __func__, i, j, token.id, token.p, tt.c_str(), token.pt, result_len, ctx->vocab.token_c_str(token.id));
                         }
 #endif
 
@@ -5998,7 +11389,7 @@ int whisper_full_with_state(
 
                     const int64_t t_start_sample_us = ggml_time_us();
 
-                    // TODO: avoid memory allocations, optimize, avoid threads?
+                    // TODO: avoid memory allocations, optimize
                     {
                         std::atomic<int> j_cur(0);
 
@@ -6020,23 +11411,9 @@ int whisper_full_with_state(
                             }
                         };
 
-                        const int n_threads = std::min(params.n_threads, n_decoders_cur);
-
-                        if (n_threads == 1) {
-                            process();
-                        } else {
-                            std::vector<std::thread> threads(n_threads - 1);
-
-                            for (int t = 0; t < n_threads - 1; ++t) {
-                                threads[t] = std::thread(process);
-                            }
-
+                        state->thread_pool.run(std::min(params.n_threads, n_decoders_cur), [&](int) {
                             process();
-
-                            for (int t = 0; t < n_threads - 1; ++t) {
-                                threads[t].join();
-                            }
-                        }
+                        });
                     }
 
                     state->t_sample_us += ggml_time_us() - t_start_sample_us;
@@ -6097,7 +11474,7 @@ int whisper_full_with_state(
 
             if (success) {
                 //for (auto & token : ctx->decoders[best_decoder_id].sequence.tokens) {
-                //    WHISPER_LOG_DEBUG("%s: token = %d, p = %6.3f, pt = %6.3f, ts = %s, str = %s\n", __func__, token.id, token.p, token.pt, ctx->vocab.id_to_token.at(token.tid).c_str(), ctx->vocab.id_to_token.at(token.id).c_str());
+                //    WHISPER_LOG_DEBUG("%s: token = %d, p = %6.3f, pt = %6.3f, ts = %s, str = %s\n", __func__, token.id, token.p, token.pt, ctx->vocab.token_c_str(token.tid), ctx->vocab.token_c_str(token.id));
                 //}
 
                 break;
@@ -6142,8 +11519,8 @@ int whisper_full_with_state(
 
                 for (int i = 0; i < (int) tokens_cur.size(); i++) {
                     //printf("%s: %18s %6.3f %18s %6.3f\n", __func__,
-                    //        ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].p,
-                    //        ctx->vocab.id_to_token[tokens_cur[i].tid].c_str(), tokens_cur[i].pt);
+                    //        ctx->vocab.token_c_str(tokens_cur[i].id), tokens_cur[i].p,
+                    //        ctx->vocab.token_c_str(tokens_cur[i].tid), tokens_cur[i].pt);
 
                     if (params.print_special || tokens_cur[i].id < whisper_token_eot(ctx)) {
                         text += whisper_token_to_str(ctx, tokens_cur[i].id);
@@ -6170,7 +11547,7 @@ int whisper_full_with_state(
                                 }
                             }
 
-                            //printf("tt0 = %d, tt1 = %d, text = %s, token = %s, token_id = %d, tid = %d\n", tt0, tt1, text.c_str(), ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].id, tokens_cur[i].tid);
+                            //printf("tt0 = %d, tt1 = %d, text = %s, token = %s, token_id = %d, tid = %d\n", tt0, tt1, text.c_str(), ctx->vocab.token_c_str(tokens_cur[i].id), tokens_cur[i].id, tokens_cur[i].tid);
 
                             result_all.push_back({ tt0, tt1, text, state->no_speech_prob, {}, speaker_turn_next });
                             for (int j = i0; j <= i; j++) {
@@ -6270,9 +11647,22 @@ int whisper_full_with_state(
         }
     }
 
+    if (!key_results.empty() && !aborted) {
+        whisper_cache_put_results(*ctx, *state, key_results);
+    }
+
     return 0;
 }
 
+int whisper_full_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+    struct whisper_full_params   params,
+                   const float * samples,
+                           int   n_samples) {
+    return whisper_full_impl(ctx, state, params, samples, nullptr, n_samples, nullptr);
+}
+
 int whisper_full(
         struct whisper_context * ctx,
     struct whisper_full_params   params,
@@ -6281,6 +11671,46 @@ int whisper_full(
     return whisper_full_with_state(ctx, ctx->state, params, samples, n_samples);
 }
 
+int whisper_full_pcm16_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+    struct whisper_full_params   params,
+                 const int16_t * samples,
+                           int   n_samples) {
+    return whisper_full_impl(ctx, state, params, nullptr, samples, n_samples, nullptr);
+}
+
+int whisper_full_pcm16(
+        struct whisper_context * ctx,
+    struct whisper_full_params   params,
+                 const int16_t * samples,
+                           int   n_samples) {
+    return whisper_full_pcm16_with_state(ctx, ctx->state, params, samples, n_samples);
+}
+
+int whisper_full_from_source_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+    struct whisper_full_params   params,
+   struct whisper_audio_source   source) {
+    if (source.read == nullptr) {
+        WHISPER_LOG_ERROR("%s: invalid audio source\n", __func__);
+        return -10;
+    }
+
+    whisper_source_reader reader;
+    reader.source = source;
+
+    return whisper_full_impl(ctx, state, params, nullptr, nullptr, 0, &reader);
+}
+
+int whisper_full_from_source(
+        struct whisper_context * ctx,
+    struct whisper_full_params   params,
+   struct whisper_audio_source   source) {
+    return whisper_full_from_source_with_state(ctx, ctx->state, params, source);
+}
+
 int whisper_full_parallel(
         struct whisper_context * ctx,
         struct whisper_full_params params,
@@ -6453,11 +11883,11 @@ int whisper_full_n_tokens(struct whisper_context * ctx, int i_segment) {
 }
 
 const char * whisper_full_get_token_text_from_state(struct whisper_context * ctx, struct whisper_state * state, int i_segment, int i_token) {
-    return ctx->vocab.id_to_token[state->result_all[i_segment].tokens[i_token].id].c_str();
+    return ctx->vocab.token_c_str(state->result_all[i_segment].tokens[i_token].id);
 }
 
 const char* whisper_full_get_token_text(struct whisper_context * ctx, int i_segment, int i_token) {
-    return ctx->vocab.id_to_token[ctx->state->result_all[i_segment].tokens[i_token].id].c_str();
+    return ctx->vocab.token_c_str(ctx->state->result_all[i_segment].tokens[i_token].id);
 }
 
 whisper_token whisper_full_get_token_id_from_state(struct whisper_state * state, int i_segment, int i_token) {
@@ -6770,6 +12200,122 @@ WHISPER_API const char * whisper_bench_ggml_mul_mat_str(int n_threads) {
     return s.c_str();
 }
 
+WHISPER_API int whisper_bench_ggml_flash_attn(int n_threads) {
+    fputs(whisper_bench_ggml_flash_attn_str(n_threads), stderr);
+    return 0;
+}
+
+WHISPER_API const char * whisper_bench_ggml_flash_attn_str(int n_threads) {
+    static std::string s;
+    s = "";
+    char strbuf[256];
+
+    ggml_time_init();
+
+    const int n_max = 128;
+
+    // encoder self-attention of the base model: 8 heads of size 64
+    const int n_head       = 8;
+    const int n_state_head = 64;
+
+    const std::vector<int> sizes = {
+        250, 500, 1000, 1500,
+    };
+
+    std::vector<uint8_t> work;
+
+    for (int j = 0; j < (int) sizes.size(); j++) {
+        const int N     = sizes[j];
+        const int N_pad = GGML_PAD(N, 256);
+
+        int    n[2] = { 0, 0 };
+        double t[2] = { 0.0, 0.0 };
+
+        // k == 0: ggml_flash_attn_ext over the padded K/V, as with whisper_context_params.flash_attn
+        // k == 1: ggml_mul_mat + ggml_soft_max_ext + ggml_mul_mat
+        for (int k = 0; k < 2; ++k) {
+            // q, k, v, KQ, KQ_soft_max, KQV + permuted copy
+            const size_t mem_size =
+                3llu*n_state_head*N_pad*n_head*sizeof(float) +
+                2llu*N*N*n_head*sizeof(float) +
+                2llu*n_state_head*N*n_head*sizeof(float) +
+                8*ggml_tensor_overhead() + ggml_graph_overhead();
+
+            struct ggml_init_params gparams = {
+                /*.mem_size   =*/ mem_size,
+                /*.mem_buffer =*/ nullptr,
+                /*.no_alloc   =*/ false,
+            };
+
+            struct ggml_context * ctx0 = ggml_init(gparams);
+
+            const int n_kv = k == 0 ? N_pad : N;
+
+            struct ggml_tensor * q = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_state_head, N,    n_head);
+            struct ggml_tensor * K = ggml_new_tensor_3d(ctx0, GGML_TYPE_F16, n_state_head, n_kv, n_head);
+            struct ggml_tensor * V = k == 0 ?
+                ggml_new_tensor_3d(ctx0, GGML_TYPE_F16, n_state_head, n_kv, n_head) :
+                ggml_new_tensor_3d(ctx0, GGML_TYPE_F16, n_kv, n_state_head, n_head);
+
+            for (int64_t i = 0; i < ggml_nelements(q); ++i) {
+                ((float *) q->data)[i] = sinf(0.37f*i);
+            }
+            for (int64_t i = 0; i < ggml_nelements(K); ++i) {
+                ((ggml_fp16_t *) K->data)[i] = ggml_fp32_to_fp16(cosf(0.11f*i));
+                ((ggml_fp16_t *) V->data)[i] = ggml_fp32_to_fp16(sinf(0.23f*i));
+            }
+
+            const float KQscale = 1.0f/sqrtf(float(n_state_head));
+
+            struct ggml_tensor * c = nullptr;
+
+            if (k == 0) {
+                c = ggml_flash_attn_ext(ctx0, q, K, V, nullptr, KQscale, 0.0f, 0.0f);
+                ggml_flash_attn_ext_set_prec(c, GGML_PREC_F32);
+            } else {
+                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, q);
+
+                struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, nullptr, KQscale, 0.0f);
+
+                c = ggml_cont(ctx0, ggml_permute(ctx0, ggml_mul_mat(ctx0, V, KQ_soft_max), 0, 2, 1, 3));
+            }
+
+            struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+            ggml_build_forward_expand(gf, c);
+
+            // heat-up
+            ggml_graph_compute_helper(gf, work, n_threads, nullptr, nullptr);
+
+            for (int i = 0; i < n_max; ++i) {
+                const int64_t t0 = ggml_time_us();
+
+                ggml_graph_compute_helper(gf, work, n_threads, nullptr, nullptr);
+
+                const int64_t t1 = ggml_time_us();
+
+                t[k] += (t1 - t0)*1e-3;
+                n[k]++;
+
+                if (t[k] > 1000.0 && n[k] >= 3) {
+                    break;
+                }
+            }
+
+            ggml_free(ctx0);
+        }
+
+        const double t_fa = t[0]/n[0];
+        const double t_mm = t[1]/n[1];
+
+        snprintf(strbuf, sizeof(strbuf), "%4d x %4d x %d heads: flash %8.2f ms (%3d runs) | mul_mat + soft_max %8.2f ms (%3d runs) | %5.2fx\n",
+                N, N, n_head, t_fa, n[0], t_mm, n[1], t_mm/t_fa);
+        s += strbuf;
+    }
+
+    return s.c_str();
+}
+
 // =================================================================================================
 
 // =================================================================================================
@@ -6787,12 +12333,13 @@ WHISPER_API const char * whisper_bench_ggml_mul_mat_str(int n_threads) {
 // token-level timestamps
 //
 
-static int timestamp_to_sample(int64_t t, int n_samples) {
-    return std::max(0, std::min((int) n_samples - 1, (int) ((t*WHISPER_SAMPLE_RATE)/100)));
+// offset - index in the audio of the first sample of the signal
+static int timestamp_to_sample(int64_t t, int n_samples, int64_t offset) {
+    return std::max(0, std::min((int) n_samples - 1, (int) ((t*WHISPER_SAMPLE_RATE)/100 - offset)));
 }
 
-static int64_t sample_to_timestamp(int i_sample) {
-    return (100ll*i_sample)/WHISPER_SAMPLE_RATE;
+static int64_t sample_to_timestamp(int i_sample, int64_t offset) {
+    return (100ll*(i_sample + offset))/WHISPER_SAMPLE_RATE;
 }
 
 // a cost-function / heuristic that is high for text that takes longer to pronounce
@@ -6821,8 +12368,9 @@ static float voice_length(const std::string & text) {
     return res;
 }
 
-// average the fabs of the signal
-static std::vector<float> get_signal_energy(const float * signal, int n_samples, int n_samples_per_half_window) {
+// average the fabs of the signal, multiplied by scale
+template<typename T>
+static std::vector<float> get_signal_energy(const T * signal, int n_samples, int n_samples_per_half_window, float scale) {
     const int hw = n_samples_per_half_window;
 
     std::vector<float> result(n_samples);
@@ -6831,7 +12379,7 @@ static std::vector<float> get_signal_energy(const float * signal, int n_samples,
         float sum = 0;
         for (int j = -hw; j <= hw; j++) {
             if (i + j >= 0 && i + j < n_samples) {
-                sum += fabs(signal[i + j]);
+                sum += fabs(scale*signal[i + j]);
             }
         }
         result[i] = sum/(2*hw + 1);
@@ -6986,8 +12534,8 @@ static void whisper_exp_compute_token_level_timestamps(
                 continue;
             }
 
-            int s0 = timestamp_to_sample(tokens[j].t0, n_samples);
-            int s1 = timestamp_to_sample(tokens[j].t1, n_samples);
+            int s0 = timestamp_to_sample(tokens[j].t0, n_samples, state.energy_offset);
+            int s1 = timestamp_to_sample(tokens[j].t1, n_samples, state.energy_offset);
 
             const int ss0 = std::max(s0 - hw, 0);
             const int ss1 = std::min(s1 + hw, n_samples);
@@ -7008,7 +12556,7 @@ static void whisper_exp_compute_token_level_timestamps(
                     while (k > 0 && state.energy[k] > thold) {
                         k--;
                     }
-                    tokens[j].t0 = sample_to_timestamp(k);
+                    tokens[j].t0 = sample_to_timestamp(k, state.energy_offset);
                     if (tokens[j].t0 < tokens[j - 1].t1) {
                         tokens[j].t0 = tokens[j - 1].t1;
                     } else {
@@ -7019,7 +12567,7 @@ static void whisper_exp_compute_token_level_timestamps(
                         k++;
                     }
                     s0 = k;
-                    tokens[j].t0 = sample_to_timestamp(k);
+                    tokens[j].t0 = sample_to_timestamp(k, state.energy_offset);
                 }
             }
 
@@ -7029,7 +12577,7 @@ static void whisper_exp_compute_token_level_timestamps(
                     while (k < n_samples - 1 && state.energy[k] > thold) {
                         k++;
                     }
-                    tokens[j].t1 = sample_to_timestamp(k);
+                    tokens[j].t1 = sample_to_timestamp(k, state.energy_offset);
                     if (j < n - 1 && tokens[j].t1 > tokens[j + 1].t0) {
                         tokens[j].t1 = tokens[j + 1].t0;
                     } else {
@@ -7040,7 +12588,7 @@ static void whisper_exp_compute_token_level_timestamps(
                         k--;
                     }
                     s1 = k;
-                    tokens[j].t1 = sample_to_timestamp(k);
+                    tokens[j].t1 = sample_to_timestamp(k, state.energy_offset);
                 }
             }
         }
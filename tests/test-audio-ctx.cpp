@@ -0,0 +1,78 @@
+// the automatic audio context of whisper_full() (whisper_full_params.audio_ctx < 0)
+//
+// for clips of different lengths, also on either side of a bucket boundary, the result is the one of the smallest
+// bucket of 256, 512, 1024 frames that covers the clip, passed explicitly - and of the full context for the longer
+// clips. switching between the buckets reuses their compute buffers, so a clip gives the same result again after the
+// others
+
+#include "test-common.h"
+
+static std::vector<whisper_token> transcribe(struct whisper_context * ctx, struct whisper_state * state, const std::vector<float> & pcm, int audio_ctx) {
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.n_threads       = 2;
+    wparams.language        = "en";
+    wparams.print_progress  = false;
+    wparams.temperature_inc = 0.0f;
+    wparams.audio_ctx       = audio_ctx;
+
+    TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, pcm.data(), (int) pcm.size()) == 0);
+
+    return test_tokens(state);
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx = test_init(argc, argv, "test-audio-ctx", pcm);
+
+    struct whisper_state * state = whisper_init_state(ctx);
+    TEST_ASSERT(state != nullptr);
+
+    std::vector<float> pcm_long;
+    while (pcm_long.size() < 25*WHISPER_SAMPLE_RATE) {
+        pcm_long.insert(pcm_long.end(), pcm.begin(), pcm.end());
+    }
+
+    // the clip covers (n_frames + 1)/2 positions, with n_frames = 1 + (n_samples - 200)/160
+    struct test_clip {
+        int n_samples;
+        int audio_ctx;
+    };
+
+    const test_clip clips[] = {
+        { 3*WHISPER_SAMPLE_RATE,  256  },
+        { 82080,                  256  }, // 512 frames - 256 positions
+        { 82240,                  512  }, // 513 frames
+        { 11*WHISPER_SAMPLE_RATE, 1024 },
+        { 25*WHISPER_SAMPLE_RATE, 0    }, // more than 1024 positions - the full context
+    };
+
+    std::vector<std::vector<whisper_token>> ref;
+
+    for (const auto & clip : clips) {
+        const std::vector<float> audio(pcm_long.begin(), pcm_long.begin() + clip.n_samples);
+
+        ref.push_back(transcribe(ctx, state, audio, clip.audio_ctx));
+        TEST_ASSERT(!ref.back().empty());
+
+        TEST_ASSERT(transcribe(ctx, state, audio, -1) == ref.back());
+
+        // the next bucket gives another result, so the one above is not a coincidence
+        if (clip.audio_ctx > 0) {
+            TEST_ASSERT(transcribe(ctx, state, audio, clip.audio_ctx < 1024 ? 2*clip.audio_ctx : 0) != ref.back());
+        }
+    }
+
+    // again, after the other buckets
+    for (size_t i = 0; i < sizeof(clips)/sizeof(clips[0]); ++i) {
+        const std::vector<float> audio(pcm_long.begin(), pcm_long.begin() + clips[i].n_samples);
+
+        TEST_ASSERT(transcribe(ctx, state, audio, -1) == ref[i]);
+    }
+
+    whisper_free_state(state);
+    whisper_free(ctx);
+
+    return 0;
+}
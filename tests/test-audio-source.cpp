@@ -0,0 +1,116 @@
+// whisper_full_from_source(): the audio is pulled from a callback while it is processed
+//
+// the source returns the samples in pieces of varying size - for audio shorter than the sliding window of the
+// spectrogram, the result is the same as whisper_full() on the whole audio. longer audio slides the window, and a
+// failing source stops the processing
+
+#include "test-common.h"
+
+struct test_source {
+    const std::vector<float> * pcm;
+
+    size_t pos     = 0;
+    size_t fail_at = SIZE_MAX; // the read that reaches this position fails
+    int    n_reads = 0;
+};
+
+static int test_source_read(float * dst, int n_samples, void * user_data) {
+    auto & src = *(test_source *) user_data;
+
+    if (src.pos >= src.fail_at) {
+        return -1;
+    }
+
+    // 1, 160, 1000, 4097, ... samples - never the number asked for, unless it is smaller
+    static const int sizes[] = { 1, 160, 1000, 4097, 333, 16000 };
+
+    const size_t n = std::min({ (size_t) n_samples, (size_t) sizes[src.n_reads++ % 6], src.pcm->size() - src.pos });
+
+    memcpy(dst, src.pcm->data() + src.pos, n*sizeof(float));
+    src.pos += n;
+
+    return (int) n;
+}
+
+static struct whisper_full_params test_params() {
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.n_threads       = 2;
+    wparams.language        = "en";
+    wparams.print_progress  = false;
+    wparams.temperature_inc = 0.0f;
+
+    return wparams;
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx = test_init(argc, argv, "test-audio-source", pcm);
+
+    struct whisper_state * state = whisper_init_state(ctx);
+    TEST_ASSERT(state != nullptr);
+
+    const struct whisper_full_params wparams = test_params();
+
+    // shorter than the window: same as the whole audio
+    {
+        TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, pcm.data(), (int) pcm.size()) == 0);
+
+        const std::vector<whisper_token> ref = test_tokens(state);
+        TEST_ASSERT(!ref.empty());
+
+        test_source src;
+        src.pcm = &pcm;
+
+        TEST_ASSERT(whisper_full_from_source_with_state(ctx, state, wparams, { test_source_read, &src }) == 0);
+
+        TEST_ASSERT(src.pos == pcm.size());
+        TEST_ASSERT(test_tokens(state) == ref);
+    }
+
+    // longer than the window: the segments cover the whole audio, in order
+    {
+        std::vector<float> pcm_long;
+        while (pcm_long.size() < 70*WHISPER_SAMPLE_RATE) {
+            pcm_long.insert(pcm_long.end(), pcm.begin(), pcm.end());
+        }
+
+        test_source src;
+        src.pcm = &pcm_long;
+
+        TEST_ASSERT(whisper_full_from_source_with_state(ctx, state, wparams, { test_source_read, &src }) == 0);
+
+        TEST_ASSERT(src.pos == pcm_long.size());
+
+        const int n_segments = whisper_full_n_segments_from_state(state);
+        TEST_ASSERT(n_segments > 0);
+
+        int64_t t_prev = 0;
+        for (int i = 0; i < n_segments; ++i) {
+            const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+            const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
+
+            TEST_ASSERT(t0 >= t_prev && t1 >= t0);
+
+            t_prev = t0;
+        }
+
+        // past the first window of 30 s
+        TEST_ASSERT(whisper_full_get_segment_t1_from_state(state, n_segments - 1) > 3000);
+    }
+
+    // a failing source
+    {
+        test_source src;
+        src.pcm     = &pcm;
+        src.fail_at = pcm.size()/2;
+
+        TEST_ASSERT(whisper_full_from_source_with_state(ctx, state, wparams, { test_source_read, &src }) == -10);
+    }
+
+    whisper_free_state(state);
+    whisper_free(ctx);
+
+    return 0;
+}
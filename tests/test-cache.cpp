@@ -0,0 +1,221 @@
+// the cache of whisper_full() (whisper_context_params.cache_mem_size / cache_dir)
+//
+// hits must return the results computed without the cache, and the entries must never be used for another input,
+// even if a file of the disk tier has the name of its key. a file whose header claims more data than it holds is
+// rejected
+
+#include "test-common.h"
+
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <dirent.h>
+#endif
+
+static const char * k_dir = "test-cache-dir";
+
+static std::vector<std::string> list_dir() {
+    std::vector<std::string> result;
+
+#if !defined(_WIN32)
+    DIR * d = opendir(k_dir);
+    if (d) {
+        while (const struct dirent * e = readdir(d)) {
+            if (strncmp(e->d_name, "whisper-cache-", 14) == 0) {
+                result.push_back(e->d_name);
+            }
+        }
+        closedir(d);
+    }
+#endif
+
+    return result;
+}
+
+static float encode_ms(struct whisper_context * ctx) {
+    struct whisper_timings * timings = whisper_get_timings(ctx);
+    TEST_ASSERT(timings != nullptr);
+
+    const float result = timings->encode_ms;
+
+    delete timings;
+
+    return result;
+}
+
+static bool on_encoder_begin(struct whisper_context *, struct whisper_state *, void * user_data) {
+    (*(int *) user_data)++;
+    return true;
+}
+
+struct run_result {
+    std::vector<whisper_token> tokens;
+    int n_encoder_begin;
+};
+
+static run_result run(struct whisper_context * ctx, const std::vector<float> & pcm, bool cache_results, bool cache_encoder) {
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.n_threads       = 2;
+    wparams.language        = "en";
+    wparams.print_progress  = false;
+    wparams.temperature_inc = 0.0f;
+    wparams.cache_results   = cache_results;
+    wparams.cache_encoder   = cache_encoder;
+
+    run_result result = {};
+
+    wparams.encoder_begin_callback           = on_encoder_begin;
+    wparams.encoder_begin_callback_user_data = &result.n_encoder_begin;
+
+    TEST_ASSERT(whisper_full(ctx, wparams, pcm.data(), (int) pcm.size()) == 0);
+
+    result.tokens = test_tokens(ctx);
+
+    return result;
+}
+
+static struct whisper_context * init_cached(int argc, char ** argv, std::vector<float> & pcm, size_t mem_size) {
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.cache_mem_size = mem_size;
+    cparams.cache_dir      = k_dir;
+
+    return test_init(argc, argv, "test-cache", pcm, cparams);
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    // results without the cache, for the sample and for the same sample at half the volume
+    struct whisper_context * ctx_ref = test_init(argc, argv, "test-cache", pcm);
+
+    std::vector<float> pcm_half = pcm;
+    for (auto & v : pcm_half) {
+        v *= 0.5f;
+    }
+
+    const std::vector<whisper_token> ref      = run(ctx_ref, pcm,      false, false).tokens;
+    const std::vector<whisper_token> ref_half = run(ctx_ref, pcm_half, false, false).tokens;
+
+    whisper_free(ctx_ref);
+
+    // start with an empty disk tier
+#if defined(_WIN32)
+    _mkdir(k_dir);
+#else
+    mkdir(k_dir, 0755);
+#endif
+    for (const auto & name : list_dir()) {
+        std::remove((std::string(k_dir) + "/" + name).c_str());
+    }
+
+    {
+        struct whisper_context * ctx = init_cached(argc, argv, pcm, 64*1024*1024);
+
+        // results: miss, then hit
+        run_result res = run(ctx, pcm, true, false);
+        TEST_ASSERT(res.n_encoder_begin > 0);
+        TEST_ASSERT(res.tokens == ref);
+
+        res = run(ctx, pcm, true, false);
+        TEST_ASSERT(res.n_encoder_begin == 0);
+        TEST_ASSERT(res.tokens == ref);
+
+        // other audio: miss
+        res = run(ctx, pcm_half, true, false);
+        TEST_ASSERT(res.n_encoder_begin > 0);
+        TEST_ASSERT(res.tokens == ref_half);
+
+        // encoder output: miss, then hit
+        whisper_reset_timings(ctx);
+        res = run(ctx, pcm, false, true);
+        TEST_ASSERT(encode_ms(ctx) > 0.0f);
+        TEST_ASSERT(res.tokens == ref);
+
+        whisper_reset_timings(ctx);
+        res = run(ctx, pcm, false, true);
+        TEST_ASSERT(encode_ms(ctx) == 0.0f);
+        TEST_ASSERT(res.tokens == ref);
+
+        whisper_free(ctx);
+    }
+
+    // disk tier only, from a new context
+    {
+        struct whisper_context * ctx = init_cached(argc, argv, pcm, 0);
+
+        run_result res = run(ctx, pcm, true, false);
+        TEST_ASSERT(res.n_encoder_begin == 0);
+        TEST_ASSERT(res.tokens == ref);
+
+        res = run(ctx, pcm_half, true, false);
+        TEST_ASSERT(res.n_encoder_begin == 0);
+        TEST_ASSERT(res.tokens == ref_half);
+
+        whisper_free(ctx);
+    }
+
+#if !defined(_WIN32)
+    // give each file the name of another entry - the key stored in the file must be checked on each hit
+    {
+        const std::vector<std::string> names = list_dir();
+        TEST_ASSERT(names.size() >= 2);
+
+        const std::string dir = std::string(k_dir) + "/";
+
+        TEST_ASSERT(std::rename((dir + names[0]).c_str(), (dir + "tmp").c_str()) == 0);
+        for (size_t i = 1; i < names.size(); ++i) {
+            TEST_ASSERT(std::rename((dir + names[i]).c_str(), (dir + names[i - 1]).c_str()) == 0);
+        }
+        TEST_ASSERT(std::rename((dir + "tmp").c_str(), (dir + names.back()).c_str()) == 0);
+
+        struct whisper_context * ctx = init_cached(argc, argv, pcm, 0);
+
+        run_result res = run(ctx, pcm, true, false);
+        TEST_ASSERT(res.n_encoder_begin > 0);
+        TEST_ASSERT(res.tokens == ref);
+
+        res = run(ctx, pcm_half, true, false);
+        TEST_ASSERT(res.n_encoder_begin > 0);
+        TEST_ASSERT(res.tokens == ref_half);
+
+        whisper_free(ctx);
+    }
+
+    // a size in the header far beyond the end of the file - a miss, and the entry is written again
+    {
+        for (const auto & name : list_dir()) {
+            FILE * f = fopen((std::string(k_dir) + "/" + name).c_str(), "r+b");
+            TEST_ASSERT(f != nullptr);
+
+            // after the magic, the version and the key of 32 bytes
+            const uint64_t size = 1ull << 60;
+            TEST_ASSERT(fseek(f, 40, SEEK_SET) == 0);
+            TEST_ASSERT(fwrite(&size, sizeof(size), 1, f) == 1);
+
+            fclose(f);
+        }
+
+        struct whisper_context * ctx = init_cached(argc, argv, pcm, 0);
+
+        run_result res = run(ctx, pcm, true, false);
+        TEST_ASSERT(res.n_encoder_begin > 0);
+        TEST_ASSERT(res.tokens == ref);
+
+        res = run(ctx, pcm, true, false);
+        TEST_ASSERT(res.n_encoder_begin == 0);
+        TEST_ASSERT(res.tokens == ref);
+
+        whisper_free(ctx);
+    }
+#endif
+
+    for (const auto & name : list_dir()) {
+        std::remove((std::string(k_dir) + "/" + name).c_str());
+    }
+
+    return 0;
+}
@@ -0,0 +1,372 @@
+// helpers shared by the unit tests
+//
+// the unit tests run on a small model with random weights (4 layers of 64 states), built from the hparams, the mel
+// filters and the vocab of one of the models/for-tests-ggml-*.bin files - the outputs are meaningless, but they are
+// deterministic, so the tests compare two ways of computing the same thing
+
+#pragma once
+
+#include "whisper.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#define TEST_ASSERT(x)                                                               \
+    do {                                                                             \
+        if (!(x)) {                                                                  \
+            fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #x); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while (0)
+
+// gaussian numbers from a fixed seed, identical on all platforms
+struct test_rng {
+    uint64_t s;
+
+    explicit test_rng(uint64_t seed) : s(seed) {}
+
+    uint32_t next() {
+        s = s*6364136223846793005ULL + 1442695040888963407ULL;
+        return (uint32_t) (s >> 33);
+    }
+
+    float uniform() {
+        return (next() + 0.5f)/2147483648.0f;
+    }
+
+    float gauss() {
+        const float u0 = uniform();
+        const float u1 = uniform();
+
+        return sqrtf(-2.0f*logf(u0))*cosf(6.2831853f*u1);
+    }
+};
+
+// write a model with random weights to dst, with the header of the stub model src
+// ftype: 0 - F32, 1 - F16 (for the matrices)
+static bool test_make_model(const char * src, const char * dst, int ftype = 1) {
+    FILE * fin = fopen(src, "rb");
+    if (!fin) {
+        fprintf(stderr, "%s: failed to open '%s'\n", __func__, src);
+        return false;
+    }
+
+    std::vector<uint8_t> data;
+    {
+        uint8_t buf[1 << 16];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fin)) > 0) {
+            data.insert(data.end(), buf, buf + n);
+        }
+        fclose(fin);
+    }
+
+    size_t off = 0;
+
+    auto rd_i32 = [&]() {
+        int32_t v = 0;
+        if (off + sizeof(v) <= data.size()) {
+            memcpy(&v, data.data() + off, sizeof(v));
+        }
+        off += sizeof(v);
+        return v;
+    };
+
+    const uint32_t magic = (uint32_t) rd_i32();
+
+    int32_t hp[11];
+    for (auto & v : hp) {
+        v = rd_i32();
+    }
+
+    // the mel filters are copied as is
+    const size_t off_filters = off;
+
+    const int32_t n_mel = rd_i32();
+    const int32_t n_fft = rd_i32();
+    off += (size_t) n_mel*n_fft*sizeof(float);
+
+    const size_t off_vocab = off;
+
+    const int32_t n_vocab = rd_i32();
+
+    std::vector<std::string> vocab;
+    for (int i = 0; i < n_vocab && off <= data.size(); ++i) {
+        const uint32_t len = (uint32_t) rd_i32();
+        if (off + len <= data.size()) {
+            vocab.emplace_back((const char *) data.data() + off, len);
+        }
+        off += len;
+    }
+
+    if (off > data.size()) {
+        fprintf(stderr, "%s: invalid model '%s'\n", __func__, src);
+        return false;
+    }
+
+    // the stub models have U+FFFD in place of the tokens that are not valid UTF-8 - restore at least the first 256
+    // tokens, the single bytes, in the order of the GPT-2 byte encoder: the printable bytes, then all the others
+    {
+        std::vector<int> bytes;
+        for (int b = 0; b < 256; ++b) {
+            if ((b >= '!' && b <= '~') || (b >= 0xA1 && b <= 0xAC) || (b >= 0xAE && b <= 0xFF)) {
+                bytes.push_back(b);
+            }
+        }
+        for (int b = 0; b < 256; ++b) {
+            if (!((b >= '!' && b <= '~') || (b >= 0xA1 && b <= 0xAC) || (b >= 0xAE && b <= 0xFF))) {
+                bytes.push_back(b);
+            }
+        }
+
+        for (size_t i = 0; i < bytes.size() && i < vocab.size(); ++i) {
+            vocab[i] = std::string(1, (char) bytes[i]);
+        }
+    }
+
+    const int32_t S = 64;
+    const int32_t H = 2;
+    const int32_t L = 4;
+
+    const int32_t n_vocab_h   = hp[0];
+    const int32_t n_audio_ctx = hp[1];
+    const int32_t n_text_ctx  = hp[5];
+    const int32_t n_mels      = hp[9];
+
+    const int32_t hp_out[11] = { n_vocab_h, n_audio_ctx, S, H, L, n_text_ctx, S, H, L, n_mels, ftype };
+
+    FILE * fout = fopen(dst, "wb");
+    if (!fout) {
+        fprintf(stderr, "%s: failed to create '%s'\n", __func__, dst);
+        return false;
+    }
+
+    fwrite(&magic, sizeof(magic), 1, fout);
+    fwrite(hp_out, sizeof(hp_out), 1, fout);
+    fwrite(data.data() + off_filters, 1, off_vocab - off_filters, fout);
+
+    fwrite(&n_vocab, sizeof(n_vocab), 1, fout);
+    for (const auto & token : vocab) {
+        const uint32_t len = (uint32_t) token.size();
+        fwrite(&len, sizeof(len), 1, fout);
+        fwrite(token.data(), 1, token.size(), fout);
+    }
+
+    test_rng rng(1234);
+
+    auto tensor = [&](const std::string & name, std::vector<int32_t> ne, bool big) {
+        const int32_t type = big && ftype == 1 ? 1 : 0;
+
+        const int32_t n_dims   = (int32_t) ne.size();
+        const int32_t name_len = (int32_t) name.size();
+
+        fwrite(&n_dims,   sizeof(n_dims),   1, fout);
+        fwrite(&name_len, sizeof(name_len), 1, fout);
+        fwrite(&type,     sizeof(type),     1, fout);
+        fwrite(ne.data(), sizeof(int32_t), ne.size(), fout);
+        fwrite(name.data(), 1, name.size(), fout);
+
+        int64_t n = 1;
+        for (auto v : ne) {
+            n *= v;
+        }
+
+        const bool  is_ln = name.find("ln") != std::string::npos && name.find(".weight") != std::string::npos;
+        const float scale = 0.5f/sqrtf((float) ne[0]);
+
+        for (int64_t i = 0; i < n; ++i) {
+            const float v = (is_ln ? 1.0f : 0.0f) + scale*rng.gauss();
+            if (type == 1) {
+                const ggml_fp16_t h = ggml_fp32_to_fp16(v);
+                fwrite(&h, sizeof(h), 1, fout);
+            } else {
+                fwrite(&v, sizeof(v), 1, fout);
+            }
+        }
+    };
+
+    const std::vector<std::tuple<std::string, std::vector<int32_t>, bool>> attn = {
+        { "ln.weight",    { S },    false },
+        { "ln.bias",      { S },    false },
+        { ".query.weight", { S, S }, true  },
+        { ".query.bias",   { S },    false },
+        { ".key.weight",   { S, S }, true  },
+        { ".value.weight", { S, S }, true  },
+        { ".value.bias",   { S },    false },
+        { ".out.weight",   { S, S }, true  },
+        { ".out.bias",     { S },    false },
+    };
+
+    auto attn_block = [&](const std::string & prefix) {
+        for (const auto & t : attn) {
+            // attn_ln.weight, attn.query.weight, ...
+            const std::string & suffix = std::get<0>(t);
+            tensor(prefix + (suffix[0] == '.' ? "" : "_") + suffix, std::get<1>(t), std::get<2>(t));
+        }
+    };
+
+    auto mlp_block = [&](const std::string & prefix) {
+        tensor(prefix + "mlp_ln.weight", { S },        false);
+        tensor(prefix + "mlp_ln.bias",   { S },        false);
+        tensor(prefix + "mlp.0.weight",  { S, 4*S },   true);
+        tensor(prefix + "mlp.0.bias",    { 4*S },      false);
+        tensor(prefix + "mlp.2.weight",  { 4*S, S },   true);
+        tensor(prefix + "mlp.2.bias",    { S },        false);
+    };
+
+    tensor("encoder.positional_embedding", { S, n_audio_ctx }, false);
+    tensor("encoder.conv1.weight",         { 3, n_mels, S },   true);
+    tensor("encoder.conv1.bias",           { 1, S },           false);
+    tensor("encoder.conv2.weight",         { 3, S, S },        true);
+    tensor("encoder.conv2.bias",           { 1, S },           false);
+    tensor("encoder.ln_post.weight",       { S },              false);
+    tensor("encoder.ln_post.bias",         { S },              false);
+
+    for (int i = 0; i < L; ++i) {
+        const std::string prefix = "encoder.blocks." + std::to_string(i) + ".";
+
+        mlp_block (prefix);
+        attn_block(prefix + "attn");
+    }
+
+    tensor("decoder.positional_embedding",   { S, n_text_ctx }, false);
+    tensor("decoder.token_embedding.weight", { S, n_vocab_h },  true);
+    tensor("decoder.ln.weight",              { S },             false);
+    tensor("decoder.ln.bias",                { S },             false);
+
+    for (int i = 0; i < L; ++i) {
+        const std::string prefix = "decoder.blocks." + std::to_string(i) + ".";
+
+        attn_block(prefix + "attn");
+        attn_block(prefix + "cross_attn");
+        mlp_block (prefix);
+    }
+
+    const bool ok = ferror(fout) == 0;
+
+    fclose(fout);
+
+    return ok;
+}
+
+// 16-bit mono WAV at 16 kHz (e.g. samples/jfk.wav)
+static bool test_read_wav(const char * fname, std::vector<float> & pcm) {
+    FILE * f = fopen(fname, "rb");
+    if (!f) {
+        fprintf(stderr, "%s: failed to open '%s'\n", __func__, fname);
+        return false;
+    }
+
+    std::vector<uint8_t> data;
+    {
+        uint8_t buf[1 << 16];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            data.insert(data.end(), buf, buf + n);
+        }
+        fclose(f);
+    }
+
+    // find the "data" chunk
+    size_t off = 12;
+    while (off + 8 <= data.size()) {
+        uint32_t size = 0;
+        memcpy(&size, data.data() + off + 4, sizeof(size));
+
+        if (memcmp(data.data() + off, "data", 4) == 0) {
+            const size_t n = std::min<size_t>(size, data.size() - off - 8)/sizeof(int16_t);
+
+            pcm.resize(n);
+            for (size_t i = 0; i < n; ++i) {
+                int16_t v;
+                memcpy(&v, data.data() + off + 8 + i*sizeof(int16_t), sizeof(v));
+                pcm[i] = v/32768.0f;
+            }
+
+            return true;
+        }
+
+        off += 8 + size;
+    }
+
+    fprintf(stderr, "%s: no data in '%s'\n", __func__, fname);
+    return false;
+}
+
+static void test_log_silent(enum ggml_log_level, const char *, void *) {
+}
+
+// usage: <test> <stub model> <wav> - writes the random model to the working directory and loads it
+// ftype: see test_make_model()
+static struct whisper_context * test_init(int argc, char ** argv, const char * name, std::vector<float> & pcm,
+        struct whisper_context_params cparams = whisper_context_default_params(), int ftype = 1) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <models/for-tests-ggml-*.bin> <samples/jfk.wav>\n", argv[0]);
+        exit(1);
+    }
+
+    if (getenv("WHISPER_TEST_VERBOSE") == nullptr) {
+        whisper_log_set(test_log_silent, nullptr);
+    }
+
+    const std::string fname = std::string(name) + "-model.bin";
+
+    // once per process - the file identifies the model for the disk caches
+    static std::set<std::string> written;
+    if (written.insert(fname).second) {
+        TEST_ASSERT(test_make_model(argv[1], fname.c_str(), ftype));
+    }
+
+    TEST_ASSERT(test_read_wav(argv[2], pcm));
+
+    cparams.use_gpu = false;
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params(fname.c_str(), cparams);
+    TEST_ASSERT(ctx != nullptr);
+
+    return ctx;
+}
+
+// the tokens of all segments of the last whisper_full() call
+static std::vector<whisper_token> test_tokens(struct whisper_state * state) {
+    std::vector<whisper_token> result;
+
+    for (int i = 0; i < whisper_full_n_segments_from_state(state); ++i) {
+        for (int j = 0; j < whisper_full_n_tokens_from_state(state, i); ++j) {
+            result.push_back(whisper_full_get_token_id_from_state(state, i, j));
+        }
+    }
+
+    return result;
+}
+
+// same, with the default state of the context
+static std::vector<whisper_token> test_tokens(struct whisper_context * ctx) {
+    std::vector<whisper_token> result;
+
+    for (int i = 0; i < whisper_full_n_segments(ctx); ++i) {
+        for (int j = 0; j < whisper_full_n_tokens(ctx, i); ++j) {
+            result.push_back(whisper_full_get_token_id(ctx, i, j));
+        }
+    }
+
+    return result;
+}
+
+static std::string test_text(struct whisper_state * state) {
+    std::string result;
+
+    for (int i = 0; i < whisper_full_n_segments_from_state(state); ++i) {
+        result += whisper_full_get_segment_text_from_state(state, i);
+    }
+
+    return result;
+}
@@ -0,0 +1,163 @@
+// ggml_conv_1d_direct on the CPU against ggml_im2col + ggml_mul_mat, the path of the other backends
+//
+// the encoder front convolves with stride 1 and 2 and kernels in F16 or F32 - both are compared with and without the
+// fused bias and GELU, for output lengths that are not multiples of the tiles and a batch of two inputs. with an F16
+// kernel, ggml_mul_mat rounds the input to F16 while the direct kernel keeps it in F32, hence the looser tolerance
+// (relative to the largest output)
+
+#include "test-common.h"
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+struct test_conv_case {
+    int64_t K;
+    int64_t IC;
+    int64_t OC;
+    int64_t IL;
+    int64_t N;
+
+    int s0;
+    int d0;
+
+    ggml_type type_w;
+
+    bool gelu;
+};
+
+static std::vector<float> test_conv_run(const test_conv_case & tc, const std::vector<float> & w, const std::vector<float> & x,
+        const std::vector<float> & b, bool direct, int n_threads) {
+    const int p0 = (int) tc.K/2;
+
+    const size_t mem_size = 64*1024*1024;
+
+    struct ggml_init_params gparams = {
+        /*.mem_size   =*/ mem_size,
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ false,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(gparams);
+
+    struct ggml_tensor * a    = ggml_new_tensor_3d(ctx0, tc.type_w,     tc.K, tc.IC, tc.OC);
+    struct ggml_tensor * data = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, tc.IL, tc.IC, tc.N);
+    struct ggml_tensor * bias = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 1, tc.OC);
+
+    if (tc.type_w == GGML_TYPE_F16) {
+        ggml_fp32_to_fp16_row(w.data(), (ggml_fp16_t *) a->data, (int64_t) w.size());
+    } else {
+        memcpy(a->data, w.data(), w.size()*sizeof(float));
+    }
+
+    memcpy(data->data, x.data(), x.size()*sizeof(float));
+    memcpy(bias->data, b.data(), b.size()*sizeof(float));
+
+    struct ggml_tensor * cur = nullptr;
+
+    if (direct) {
+        cur = ggml_conv_1d_direct(ctx0, a, data, bias, tc.s0, p0, tc.d0, tc.gelu);
+    } else {
+        struct ggml_tensor * im2col = ggml_im2col(ctx0, a, data, tc.s0, 0, p0, 0, tc.d0, 0, false, GGML_TYPE_F32); // [N, OL, IC*K]
+
+        cur = ggml_mul_mat(ctx0, ggml_reshape_2d(ctx0, a, tc.K*tc.IC, tc.OC), im2col); // [N, OL, OC]
+        cur = ggml_cont(ctx0, ggml_permute(ctx0, cur, 1, 0, 2, 3));
+        cur = ggml_add(ctx0, cur, bias);
+
+        if (tc.gelu) {
+            cur = ggml_gelu(ctx0, cur);
+        }
+    }
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+    ggml_build_forward_expand(gf, cur);
+
+    TEST_ASSERT(ggml_graph_compute_with_ctx(ctx0, gf, n_threads) == GGML_STATUS_SUCCESS);
+
+    // [N, OC, OL]
+    TEST_ASSERT(cur->ne[1] == tc.OC && cur->ne[2] == tc.N);
+
+    std::vector<float> result((const float *) cur->data, (const float *) cur->data + ggml_nelements(cur));
+
+    ggml_free(ctx0);
+
+    return result;
+}
+
+int main(int argc, char ** argv) {
+    (void) argc;
+    (void) argv;
+
+    test_rng rng(7);
+
+    int n_cases = 0;
+
+    for (ggml_type type_w : { GGML_TYPE_F16, GGML_TYPE_F32 }) {
+        for (int s0 : { 1, 2 }) {
+            for (int d0 : { 1, 2 }) {
+                for (int64_t IL : { 37, 100, 3000 }) {
+                    test_conv_case tc;
+
+                    tc.K      = 3;
+                    tc.IC     = 80;
+                    tc.OC     = 66; // not a multiple of the channel blocks
+                    tc.IL     = IL;
+                    tc.N      = IL < 1000 ? 2 : 1;
+                    tc.s0     = s0;
+                    tc.d0     = d0;
+                    tc.type_w = type_w;
+                    tc.gelu   = IL != 100;
+
+                    std::vector<float> w(tc.K*tc.IC*tc.OC);
+                    std::vector<float> x(tc.IL*tc.IC*tc.N);
+                    std::vector<float> b(tc.OC);
+
+                    for (auto & v : w) {
+                        v = 0.1f*rng.gauss();
+                    }
+                    for (auto & v : x) {
+                        v = rng.gauss();
+                    }
+                    for (auto & v : b) {
+                        v = 0.1f*rng.gauss();
+                    }
+
+                    const std::vector<float> ref = test_conv_run(tc, w, x, b, false, 1);
+
+                    double amax = 0.0;
+                    for (float v : ref) {
+                        amax = std::max(amax, (double) fabsf(v));
+                    }
+
+                    for (int n_threads : { 1, 3 }) {
+                        const std::vector<float> res = test_conv_run(tc, w, x, b, true, n_threads);
+
+                        TEST_ASSERT(res.size() == ref.size());
+
+                        double err = 0.0;
+                        for (size_t i = 0; i < ref.size(); ++i) {
+                            TEST_ASSERT(std::isfinite(res[i]));
+                            err = std::max(err, (double) fabsf(res[i] - ref[i]));
+                        }
+
+                        // GELU is looked up in an F16 table, so a difference in its input can change the output by
+                        // one F16 step
+                        const double tol = tc.gelu ? 2e-3 : type_w == GGML_TYPE_F16 ? 1e-3 : 1e-5;
+
+                        if (err > tol*amax) {
+                            fprintf(stderr, "%s: type = %s, s0 = %d, d0 = %d, IL = %d, n_threads = %d: error = %g, max = %g\n",
+                                    __func__, ggml_type_name(type_w), s0, d0, (int) IL, n_threads, err, amax);
+                        }
+
+                        TEST_ASSERT(err <= tol*amax);
+
+                        n_cases++;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("%s: %d cases passed\n", __func__, n_cases);
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+// whisper_full() with beam search on a state that was used with whisper_decode() before
+//
+// whisper_full() recreates the self-attention KV cache of the state for the decoders, so the decoder graph that was
+// built for whisper_decode() must not be reused - the result must be the same as with a fresh state
+
+#include "test-common.h"
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx = test_init(argc, argv, "test-decode-full", pcm);
+
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH);
+
+    wparams.n_threads        = 2;
+    wparams.language         = "en";
+    wparams.print_progress   = false;
+    wparams.print_realtime   = false;
+    wparams.print_timestamps = false;
+    wparams.print_special    = false;
+
+    wparams.beam_search.beam_size = 3;
+
+    // no sampling with temperature fallback, the results must be exact
+    wparams.temperature_inc = 0.0f;
+
+    // reference: fresh state
+    std::vector<whisper_token> ref;
+    std::string ref_text;
+    {
+        struct whisper_state * state = whisper_init_state(ctx);
+        TEST_ASSERT(state != nullptr);
+
+        TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, pcm.data(), (int) pcm.size()) == 0);
+
+        ref      = test_tokens(state);
+        ref_text = test_text(state);
+
+        whisper_free_state(state);
+    }
+
+    TEST_ASSERT(!ref.empty());
+
+    // decode a few tokens first, then transcribe on the same state
+    {
+        struct whisper_state * state = whisper_init_state(ctx);
+        TEST_ASSERT(state != nullptr);
+
+        TEST_ASSERT(whisper_pcm_to_mel_with_state(ctx, state, pcm.data(), (int) pcm.size(), 2) == 0);
+        TEST_ASSERT(whisper_encode_with_state(ctx, state, 0, 2) == 0);
+
+        const whisper_token prompt[3] = {
+            whisper_token_sot(ctx),
+            whisper_token_lang(ctx, whisper_lang_id("en")),
+            whisper_token_transcribe(ctx),
+        };
+
+        TEST_ASSERT(whisper_decode_with_state(ctx, state, prompt, 3, 0, 2) == 0);
+
+        TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, pcm.data(), (int) pcm.size()) == 0);
+
+        const std::vector<whisper_token> res = test_tokens(state);
+
+        if (res != ref) {
+            fprintf(stderr, "%s: reference: '%s' (%d tokens)\n", __func__, ref_text.c_str(), (int) ref.size());
+            fprintf(stderr, "%s: result:    '%s' (%d tokens)\n", __func__, test_text(state).c_str(), (int) res.size());
+        }
+
+        TEST_ASSERT(res == ref);
+
+        // and once more, the caches are warm now
+        TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, pcm.data(), (int) pcm.size()) == 0);
+        TEST_ASSERT(test_tokens(state) == ref);
+
+        whisper_free_state(state);
+    }
+
+    whisper_free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+// whisper_encode_batch() against one whisper_encode_with_state() per window
+//
+// the encoder output is not exposed, so the logits after a prompt are compared - for windows of one audio at different
+// offsets, each in its own state, and for a batch smaller than the one the compute buffers were reserved for
+
+#include "test-common.h"
+
+static std::vector<float> logits_after_prompt(struct whisper_context * ctx, struct whisper_state * state, int n_threads) {
+    const whisper_token prompt[3] = {
+        whisper_token_sot(ctx),
+        whisper_token_lang(ctx, whisper_lang_id("en")),
+        whisper_token_transcribe(ctx),
+    };
+
+    TEST_ASSERT(whisper_decode_with_state(ctx, state, prompt, 3, 0, n_threads) == 0);
+
+    const int n_vocab = whisper_n_vocab(ctx);
+    const float * logits = whisper_get_logits_from_state(state) + 2*n_vocab;
+
+    return std::vector<float>(logits, logits + n_vocab);
+}
+
+static double rel_error(const std::vector<float> & res, const std::vector<float> & ref) {
+    TEST_ASSERT(res.size() == ref.size());
+
+    double err  = 0.0;
+    double norm = 0.0;
+
+    for (size_t i = 0; i < ref.size(); ++i) {
+        TEST_ASSERT(std::isfinite(res[i]));
+
+        err  += (res[i] - ref[i])*(res[i] - ref[i]);
+        norm += ref[i]*ref[i];
+    }
+
+    return sqrt(err/norm);
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx = test_init(argc, argv, "test-encode-batch", pcm);
+
+    // 50 s of audio - windows of 30 s at different offsets
+    std::vector<float> pcm_long;
+    while (pcm_long.size() < 50*WHISPER_SAMPLE_RATE) {
+        pcm_long.insert(pcm_long.end(), pcm.begin(), pcm.end());
+    }
+
+    const int n_threads = 2;
+
+    const int offsets[3] = { 0, 1000, 2000 };
+
+    std::vector<struct whisper_state *> states;
+    for (int i = 0; i < 3; ++i) {
+        states.push_back(whisper_init_state(ctx));
+        TEST_ASSERT(states.back() != nullptr);
+
+        TEST_ASSERT(whisper_pcm_to_mel_with_state(ctx, states.back(), pcm_long.data(), (int) pcm_long.size(), n_threads) == 0);
+    }
+
+    // one window at a time
+    std::vector<std::vector<float>> ref;
+    for (int i = 0; i < 3; ++i) {
+        TEST_ASSERT(whisper_encode_with_state(ctx, states[i], offsets[i], n_threads) == 0);
+
+        ref.push_back(logits_after_prompt(ctx, states[i], n_threads));
+    }
+
+    // the windows differ
+    TEST_ASSERT(ref[0] != ref[1] && ref[1] != ref[2]);
+
+    // the 3 windows in one graph, then the last 2 in the buffers reserved for 3
+    for (int n_batch : { 3, 2 }) {
+        const int i0 = 3 - n_batch;
+
+        // another window in the states first, so that a batch that does not write the result is noticed
+        for (int i = i0; i < 3; ++i) {
+            TEST_ASSERT(whisper_encode_with_state(ctx, states[i], 500, n_threads) == 0);
+        }
+
+        TEST_ASSERT(whisper_encode_batch(ctx, states.data() + i0, offsets + i0, n_batch, n_threads) == 0);
+
+        for (int i = i0; i < 3; ++i) {
+            const double rel = rel_error(logits_after_prompt(ctx, states[i], n_threads), ref[i]);
+
+            printf("%s: n_batch = %d, window %d: relative error of the logits = %g\n", __func__, n_batch, i, rel);
+
+            TEST_ASSERT(rel < 1e-4);
+        }
+    }
+
+    // a batch with the same state twice is rejected
+    {
+        whisper_state * dup[2]     = { states[0], states[0] };
+        const int       dup_off[2] = { 0, 1000 };
+
+        TEST_ASSERT(whisper_encode_batch(ctx, dup, dup_off, 2, n_threads) != 0);
+    }
+
+    for (auto * state : states) {
+        whisper_free_state(state);
+    }
+
+    whisper_free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+// the block-causal streaming encoder (whisper_encode_stream)
+//
+// - audio appended in pieces and encoded after each piece gives the same result as the whole audio encoded at once,
+//   also when a louder piece moves the floor of the normalization of the spectrogram
+// - with one block covering the whole audio, the result is close to the full encoder on the same frames (the block
+//   also sees the frame after its end, where the full encoder pads with zeros)
+// - when the window of the spectrogram slides by whole positions, the encoded positions are kept and only the new
+//   blocks are encoded, while a slide by an odd number of frames starts the stream over - the return values of
+//   whisper_encode_stream() tell them apart, since the slides are not multiples of the blocks
+//
+// the encoder output is not exposed, so the logits after a prompt are compared
+
+#include "test-common.h"
+
+static std::vector<float> logits_after_prompt(struct whisper_context * ctx, struct whisper_state * state) {
+    const whisper_token prompt[3] = {
+        whisper_token_sot(ctx),
+        whisper_token_lang(ctx, whisper_lang_id("en")),
+        whisper_token_transcribe(ctx),
+    };
+
+    TEST_ASSERT(whisper_decode_with_state(ctx, state, prompt, 3, 0, 2) == 0);
+
+    const int n_vocab = whisper_n_vocab(ctx);
+    const float * logits = whisper_get_logits_from_state(state) + 2*n_vocab;
+
+    for (int i = 0; i < n_vocab; ++i) {
+        TEST_ASSERT(std::isfinite(logits[i]));
+    }
+
+    return std::vector<float>(logits, logits + n_vocab);
+}
+
+static double rel_error(const std::vector<float> & res, const std::vector<float> & ref) {
+    TEST_ASSERT(res.size() == ref.size());
+
+    double err  = 0.0;
+    double norm = 0.0;
+
+    for (size_t i = 0; i < ref.size(); ++i) {
+        err  += (res[i] - ref[i])*(res[i] - ref[i]);
+        norm += ref[i]*ref[i];
+    }
+
+    return sqrt(err/norm);
+}
+
+// append pcm[i0, i1) and encode the completed blocks
+static int append_and_encode(struct whisper_context * ctx, struct whisper_state * state, const std::vector<float> & pcm, size_t i0, size_t i1) {
+    TEST_ASSERT(whisper_pcm_to_mel_append_with_state(ctx, state, pcm.data() + i0, (int) (i1 - i0), 2) >= 0);
+
+    const int n_ctx = whisper_encode_stream_with_state(ctx, state, 2);
+    TEST_ASSERT(n_ctx >= 0);
+
+    return n_ctx;
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx = test_init(argc, argv, "test-encode-stream", pcm);
+
+    struct whisper_state * state = whisper_init_state(ctx);
+    TEST_ASSERT(state != nullptr);
+
+    struct whisper_state * state_ref = whisper_init_state(ctx);
+    TEST_ASSERT(state_ref != nullptr);
+
+    // in pieces - quiet at first, so that the floor of the normalization moves with the louder pieces
+    {
+        std::vector<float> audio(pcm.begin(), pcm.begin() + 8*WHISPER_SAMPLE_RATE);
+        for (size_t i = 0; i < 2*WHISPER_SAMPLE_RATE; ++i) {
+            audio[i] *= 0.01f;
+        }
+
+        whisper_pcm_to_mel_append_reset_with_state(state, 0);
+        TEST_ASSERT(whisper_encode_stream_reset_with_state(ctx, state, 500, 2000) == 0);
+
+        int n_ctx = 0;
+        for (size_t i0 = 0; i0 < audio.size(); i0 += 7000) {
+            n_ctx = append_and_encode(ctx, state, audio, i0, std::min(audio.size(), i0 + 7000));
+        }
+
+        whisper_pcm_to_mel_append_reset_with_state(state_ref, 0);
+        TEST_ASSERT(whisper_encode_stream_reset_with_state(ctx, state_ref, 500, 2000) == 0);
+
+        TEST_ASSERT(append_and_encode(ctx, state_ref, audio, 0, audio.size()) == n_ctx);
+        TEST_ASSERT(n_ctx == 375);
+
+        TEST_ASSERT(logits_after_prompt(ctx, state) == logits_after_prompt(ctx, state_ref));
+    }
+
+    // one block of 4 s against the full encoder with an audio context of 4 s
+    {
+        whisper_pcm_to_mel_append_reset_with_state(state, 0);
+        TEST_ASSERT(whisper_encode_stream_reset_with_state(ctx, state, 4000, 0) == 0);
+
+        TEST_ASSERT(append_and_encode(ctx, state, pcm, 0, 5*WHISPER_SAMPLE_RATE) == 200);
+
+        const std::vector<float> res = logits_after_prompt(ctx, state);
+
+        // the same spectrogram, with the audio context of the stream
+        TEST_ASSERT(whisper_encode_with_state(ctx, state, 0, 2) == 0);
+
+        const double rel = rel_error(res, logits_after_prompt(ctx, state));
+
+        printf("%s: one block against the full encoder: relative error of the logits = %g\n", __func__, rel);
+
+        TEST_ASSERT(rel < 1e-2);
+    }
+
+    // a window of 10 s that slides
+    {
+        whisper_pcm_to_mel_append_reset_with_state(state, 10000);
+        TEST_ASSERT(whisper_encode_stream_reset_with_state(ctx, state, 1000, 4000) == 0);
+
+        // a tone of 1 kHz, whose period divides the hop of the frames: the frames are all the same, so the floor of
+        // the normalization stays the same as the window slides
+        std::vector<float> audio(20*WHISPER_SAMPLE_RATE);
+        for (size_t i = 0; i < audio.size(); ++i) {
+            audio[i] = i < 16 ? 0.5f*sinf(2.0f*(float) M_PI*i/16.0f) : audio[i - 16];
+        }
+
+        // the last frame of the 10 s window completes the block 9 s .. 10 s
+        size_t n = 0;
+        for (; n < 12*WHISPER_SAMPLE_RATE; n += WHISPER_SAMPLE_RATE) {
+            TEST_ASSERT(append_and_encode(ctx, state, audio, n, n + WHISPER_SAMPLE_RATE) == std::min<int>(450, (n/WHISPER_SAMPLE_RATE)*50));
+        }
+
+        // 0.5 s: the window slides by 25 positions - the 425 positions left are kept, one more block is encoded
+        TEST_ASSERT(append_and_encode(ctx, state, audio, n, n + WHISPER_SAMPLE_RATE/2) == 475);
+        n += WHISPER_SAMPLE_RATE/2;
+
+        // the moved K/V and the new block decode to finite logits
+        logits_after_prompt(ctx, state);
+
+        // 0.5 s + 10 ms: the window slides by 51 frames - the stream starts over from the new start of the window
+        TEST_ASSERT(append_and_encode(ctx, state, audio, n, n + WHISPER_SAMPLE_RATE/2 + 160) == 450);
+        n += WHISPER_SAMPLE_RATE/2 + 160;
+
+        // the stream keeps up with whisper_full() on the same window
+        struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+        wparams.n_threads       = 2;
+        wparams.language        = "en";
+        wparams.print_progress  = false;
+        wparams.temperature_inc = 0.0f;
+        wparams.audio_ctx       = append_and_encode(ctx, state, audio, n, n + WHISPER_SAMPLE_RATE);
+
+        TEST_ASSERT(wparams.audio_ctx == 450);
+        TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, nullptr, 0) == 0);
+    }
+
+    whisper_free_state(state_ref);
+    whisper_free_state(state);
+    whisper_free(ctx);
+
+    return 0;
+}
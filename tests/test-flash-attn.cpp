@@ -0,0 +1,289 @@
+// the CPU flash-attention kernels against a reference in double precision
+//
+// with GGML_PREC_F32 and 32 or more queries per head, ggml_flash_attn_ext uses the tiled kernel - it is compared for
+// query counts and K/V lengths that are not multiples of the tiles, masks with fully -INF rows and rows that are masked
+// up to the last K/V tile, logit softcap and ALiBi slopes. the generic kernel (GGML_PREC_DEFAULT) is compared on the
+// same inputs with a looser tolerance, since it accumulates V in F16 - except on the fully masked rows, for which it
+// has no defined result
+
+#include "test-common.h"
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+struct test_fa_case {
+    int64_t D;
+    int64_t N;      // queries per head
+    int64_t n_kv;
+    int64_t n_head;
+    int64_t n_batch;
+
+    bool  mask;
+    float max_bias;
+    float softcap;
+};
+
+struct test_fa_data {
+    std::vector<float> q;    // [n_batch][n_head][N][D]
+    std::vector<float> k;    // [n_batch][n_head][n_kv][D], rounded to F16
+    std::vector<float> v;    // [n_batch][n_head][n_kv][D], rounded to F16
+    std::vector<float> mask; // [N_pad][n_kv], rounded to F16
+
+    std::vector<bool> masked_row; // all the K/V of the query are masked
+};
+
+static float test_fa_round(float x) {
+    return ggml_fp16_to_fp32(ggml_fp32_to_fp16(x));
+}
+
+static test_fa_data test_fa_make_data(const test_fa_case & tc, test_rng & rng) {
+    const int64_t N_pad = GGML_PAD(tc.N, GGML_KQ_MASK_PAD);
+
+    test_fa_data data;
+
+    data.q.resize(tc.n_batch*tc.n_head*tc.N*tc.D);
+    data.k.resize(tc.n_batch*tc.n_head*tc.n_kv*tc.D);
+    data.v.resize(tc.n_batch*tc.n_head*tc.n_kv*tc.D);
+
+    for (auto & x : data.q) {
+        x = rng.gauss();
+    }
+    for (auto & x : data.k) {
+        x = test_fa_round(rng.gauss());
+    }
+    for (auto & x : data.v) {
+        x = test_fa_round(rng.gauss());
+    }
+
+    data.masked_row.assign(tc.N, false);
+
+    if (!tc.mask) {
+        return data;
+    }
+
+    data.mask.resize(N_pad*tc.n_kv);
+
+    for (int64_t i = 0; i < N_pad; ++i) {
+        for (int64_t j = 0; j < tc.n_kv; ++j) {
+            float m = test_fa_round(0.5f*rng.gauss());
+
+            if (i % 7 == 3) {
+                // fully masked
+                m = -INFINITY;
+            } else if (i % 7 == 5) {
+                // only the last 3 K/V, in the last tile
+                m = j < tc.n_kv - 3 ? -INFINITY : m;
+            } else if ((i + j) % 5 == 0) {
+                m = -INFINITY;
+            }
+
+            data.mask[i*tc.n_kv + j] = m;
+        }
+    }
+
+    for (int64_t i = 0; i < tc.N; ++i) {
+        data.masked_row[i] = i % 7 == 3;
+    }
+
+    return data;
+}
+
+// dst: [n_batch][N][n_head][D], as the output of ggml_flash_attn_ext
+static std::vector<double> test_fa_ref(const test_fa_case & tc, const test_fa_data & data, float scale) {
+    const int64_t D = tc.D;
+
+    const uint32_t n_head_log2 = 1u << (uint32_t) floor(log2((double) tc.n_head));
+
+    const double m0 = pow(2.0, -(tc.max_bias       )/n_head_log2);
+    const double m1 = pow(2.0, -(tc.max_bias / 2.0f)/n_head_log2);
+
+    std::vector<double> dst(tc.n_batch*tc.N*tc.n_head*D, 0.0);
+    std::vector<double> s(tc.n_kv);
+
+    for (int64_t ib = 0; ib < tc.n_batch; ++ib) {
+        for (int64_t h = 0; h < tc.n_head; ++h) {
+            const double slope = tc.max_bias > 0.0f ? h < n_head_log2 ? pow(m0, h + 1) : pow(m1, 2*(h - n_head_log2) + 1) : 1.0;
+
+            const float * k = data.k.data() + (ib*tc.n_head + h)*tc.n_kv*D;
+            const float * v = data.v.data() + (ib*tc.n_head + h)*tc.n_kv*D;
+
+            for (int64_t i = 0; i < tc.N; ++i) {
+                if (data.masked_row[i]) {
+                    continue;
+                }
+
+                const float * q = data.q.data() + ((ib*tc.n_head + h)*tc.N + i)*D;
+
+                double smax = -INFINITY;
+
+                for (int64_t j = 0; j < tc.n_kv; ++j) {
+                    double qk = 0.0;
+                    for (int64_t d = 0; d < D; ++d) {
+                        qk += (double) q[d]*k[j*D + d];
+                    }
+
+                    qk *= scale;
+
+                    if (tc.softcap != 0.0f) {
+                        qk = tc.softcap*tanh(qk/tc.softcap);
+                    }
+
+                    if (tc.mask) {
+                        qk += slope*data.mask[i*tc.n_kv + j];
+                    }
+
+                    s[j] = qk;
+                    smax = std::max(smax, qk);
+                }
+
+                double sum = 0.0;
+                for (int64_t j = 0; j < tc.n_kv; ++j) {
+                    s[j] = s[j] == -INFINITY ? 0.0 : exp(s[j] - smax);
+                    sum += s[j];
+                }
+
+                double * out = dst.data() + ((ib*tc.N + i)*tc.n_head + h)*D;
+
+                for (int64_t j = 0; j < tc.n_kv; ++j) {
+                    for (int64_t d = 0; d < D; ++d) {
+                        out[d] += s[j]*v[j*D + d];
+                    }
+                }
+
+                for (int64_t d = 0; d < D; ++d) {
+                    out[d] /= sum;
+                }
+            }
+        }
+    }
+
+    return dst;
+}
+
+static std::vector<float> test_fa_run(const test_fa_case & tc, const test_fa_data & data, float scale, ggml_prec prec, int n_threads) {
+    const int64_t N_pad = GGML_PAD(tc.N, GGML_KQ_MASK_PAD);
+
+    // q, k, v, mask, dst + the work buffer of the kernels
+    const size_t mem_size =
+        data.q.size()*sizeof(float) + (data.k.size() + data.v.size())*sizeof(ggml_fp16_t) +
+        N_pad*tc.n_kv*sizeof(ggml_fp16_t) + data.q.size()*sizeof(float) +
+        8*ggml_tensor_overhead() + ggml_graph_overhead() + 4*1024*1024;
+
+    struct ggml_init_params gparams = {
+        /*.mem_size   =*/ mem_size,
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ false,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(gparams);
+
+    struct ggml_tensor * q = ggml_new_tensor_4d(ctx0, GGML_TYPE_F32, tc.D, tc.N,    tc.n_head, tc.n_batch);
+    struct ggml_tensor * k = ggml_new_tensor_4d(ctx0, GGML_TYPE_F16, tc.D, tc.n_kv, tc.n_head, tc.n_batch);
+    struct ggml_tensor * v = ggml_new_tensor_4d(ctx0, GGML_TYPE_F16, tc.D, tc.n_kv, tc.n_head, tc.n_batch);
+
+    memcpy(q->data, data.q.data(), data.q.size()*sizeof(float));
+
+    ggml_fp32_to_fp16_row(data.k.data(), (ggml_fp16_t *) k->data, (int64_t) data.k.size());
+    ggml_fp32_to_fp16_row(data.v.data(), (ggml_fp16_t *) v->data, (int64_t) data.v.size());
+
+    struct ggml_tensor * mask = nullptr;
+
+    if (tc.mask) {
+        mask = ggml_new_tensor_2d(ctx0, GGML_TYPE_F16, tc.n_kv, N_pad);
+        ggml_fp32_to_fp16_row(data.mask.data(), (ggml_fp16_t *) mask->data, (int64_t) data.mask.size());
+    }
+
+    struct ggml_tensor * cur = ggml_flash_attn_ext(ctx0, q, k, v, mask, scale, tc.max_bias, tc.softcap);
+    ggml_flash_attn_ext_set_prec(cur, prec);
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+    ggml_build_forward_expand(gf, cur);
+
+    TEST_ASSERT(ggml_graph_compute_with_ctx(ctx0, gf, n_threads) == GGML_STATUS_SUCCESS);
+
+    std::vector<float> result((const float *) cur->data, (const float *) cur->data + ggml_nelements(cur));
+
+    ggml_free(ctx0);
+
+    return result;
+}
+
+// largest difference over the rows that are not fully masked - the fully masked rows are 0 when zero is true
+static double test_fa_compare(const test_fa_case & tc, const test_fa_data & data, const std::vector<double> & ref, const std::vector<float> & out, bool zero) {
+    TEST_ASSERT(out.size() == ref.size());
+
+    double err = 0.0;
+
+    for (int64_t ib = 0; ib < tc.n_batch; ++ib) {
+        for (int64_t i = 0; i < tc.N; ++i) {
+            for (int64_t h = 0; h < tc.n_head; ++h) {
+                const size_t off = ((ib*tc.N + i)*tc.n_head + h)*tc.D;
+
+                for (int64_t d = 0; d < tc.D; ++d) {
+                    if (data.masked_row[i]) {
+                        TEST_ASSERT(!zero || out[off + d] == 0.0f);
+                        continue;
+                    }
+
+                    TEST_ASSERT(std::isfinite(out[off + d]));
+
+                    err = std::max(err, fabs(out[off + d] - ref[off + d]));
+                }
+            }
+        }
+    }
+
+    return err;
+}
+
+int main(int argc, char ** argv) {
+    (void) argc;
+    (void) argv;
+
+    test_rng rng(42);
+
+    int n_cases = 0;
+
+    for (int64_t N : { 32, 33, 100, 130 }) {
+        for (int64_t n_kv : { 65, 100, 257 }) {
+            // no mask, mask, mask + softcap, mask + ALiBi
+            for (int variant = 0; variant < 4; ++variant) {
+                test_fa_case tc;
+
+                tc.D        = 64;
+                tc.N        = N;
+                tc.n_kv     = n_kv;
+                tc.n_head   = 3;
+                tc.n_batch  = variant == 0 ? 2 : 1;
+                tc.mask     = variant > 0;
+                tc.softcap  = variant == 2 ? 2.0f : 0.0f;
+                tc.max_bias = variant == 3 ? 8.0f : 0.0f;
+
+                const float scale = 1.0f/sqrtf((float) tc.D);
+
+                const test_fa_data data = test_fa_make_data(tc, rng);
+
+                const std::vector<double> ref = test_fa_ref(tc, data, scale);
+
+                for (int n_threads : { 1, 3 }) {
+                    const double err_tiled   = test_fa_compare(tc, data, ref, test_fa_run(tc, data, scale, GGML_PREC_F32,     n_threads), true);
+                    const double err_generic = test_fa_compare(tc, data, ref, test_fa_run(tc, data, scale, GGML_PREC_DEFAULT, n_threads), false);
+
+                    if (err_tiled > 1e-5 || err_generic > 1e-2) {
+                        fprintf(stderr, "%s: N = %d, n_kv = %d, variant = %d, n_threads = %d: err tiled = %g, generic = %g\n",
+                                __func__, (int) N, (int) n_kv, variant, n_threads, err_tiled, err_generic);
+                    }
+
+                    TEST_ASSERT(err_tiled   <= 1e-5);
+                    TEST_ASSERT(err_generic <= 1e-2);
+
+                    n_cases++;
+                }
+            }
+        }
+    }
+
+    printf("%s: %d cases passed\n", __func__, n_cases);
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+// a model converted to GGUF with whisper-convert-gguf gives the same results as the ggml .bin model
+//
+// usage: test-gguf <stub model> <wav> <whisper-convert-gguf>
+
+#include "test-common.h"
+
+// the logits after the prompt, and the transcript
+struct run_result {
+    std::vector<float> logits;
+    std::vector<whisper_token> tokens;
+};
+
+static run_result run(struct whisper_context * ctx, const std::vector<float> & pcm) {
+    run_result result;
+
+    struct whisper_state * state = whisper_init_state(ctx);
+    TEST_ASSERT(state != nullptr);
+
+    TEST_ASSERT(whisper_pcm_to_mel_with_state(ctx, state, pcm.data(), (int) pcm.size(), 2) == 0);
+    TEST_ASSERT(whisper_encode_with_state(ctx, state, 0, 2) == 0);
+
+    const whisper_token prompt[3] = {
+        whisper_token_sot(ctx),
+        whisper_token_lang(ctx, whisper_lang_id("en")),
+        whisper_token_transcribe(ctx),
+    };
+
+    TEST_ASSERT(whisper_decode_with_state(ctx, state, prompt, 3, 0, 2) == 0);
+
+    const int n_vocab = whisper_n_vocab(ctx);
+    const float * logits = whisper_get_logits_from_state(state) + 2*n_vocab;
+
+    result.logits.assign(logits, logits + n_vocab);
+
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+    wparams.n_threads       = 2;
+    wparams.language        = "en";
+    wparams.print_progress  = false;
+    wparams.temperature_inc = 0.0f;
+
+    TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, pcm.data(), (int) pcm.size()) == 0);
+
+    result.tokens = test_tokens(state);
+
+    whisper_free_state(state);
+
+    return result;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <models/for-tests-ggml-*.bin> <samples/jfk.wav> <whisper-convert-gguf>\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx_bin = test_init(argc, argv, "test-gguf", pcm);
+
+    const run_result ref = run(ctx_bin, pcm);
+
+    const std::string cmd = std::string("\"") + argv[3] + "\" test-gguf-model.bin test-gguf-model.gguf";
+    TEST_ASSERT(system(cmd.c_str()) == 0);
+
+    // the converted file must be picked up by the GGUF loader
+    {
+        FILE * f = fopen("test-gguf-model.gguf", "rb");
+        TEST_ASSERT(f != nullptr);
+
+        char magic[4] = {};
+        TEST_ASSERT(fread(magic, 1, sizeof(magic), f) == sizeof(magic));
+        TEST_ASSERT(memcmp(magic, "GGUF", 4) == 0);
+
+        fclose(f);
+    }
+
+    for (bool use_mmap : { true, false }) {
+        struct whisper_context_params cparams = whisper_context_default_params();
+        cparams.use_gpu  = false;
+        cparams.use_mmap = use_mmap;
+
+        struct whisper_context * ctx = whisper_init_from_file_with_params("test-gguf-model.gguf", cparams);
+        TEST_ASSERT(ctx != nullptr);
+
+        TEST_ASSERT(whisper_n_vocab(ctx) == whisper_n_vocab(ctx_bin));
+        for (whisper_token i = 0; i < whisper_n_vocab(ctx); ++i) {
+            TEST_ASSERT(strcmp(whisper_token_to_str(ctx, i), whisper_token_to_str(ctx_bin, i)) == 0);
+        }
+
+        const run_result res = run(ctx, pcm);
+
+        TEST_ASSERT(res.logits == ref.logits);
+        TEST_ASSERT(res.tokens == ref.tokens);
+
+        whisper_free(ctx);
+    }
+
+    whisper_free(ctx_bin);
+
+    return 0;
+}
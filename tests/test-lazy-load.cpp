@@ -0,0 +1,71 @@
+// lazy loading and eviction of the model parts
+//
+// the parts are loaded on first use, evicted and loaded again, and the results do not change - the contexts are freed
+// in every state of the parts (build with WHISPER_SANITIZE_ADDRESS to check that no freed memory is touched)
+
+#include "test-common.h"
+
+static std::vector<whisper_token> transcribe(struct whisper_context * ctx, const std::vector<float> & pcm) {
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.n_threads       = 2;
+    wparams.language        = "en";
+    wparams.print_progress  = false;
+    wparams.temperature_inc = 0.0f;
+
+    TEST_ASSERT(whisper_full(ctx, wparams, pcm.data(), (int) pcm.size()) == 0);
+
+    return test_tokens(ctx);
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx = test_init(argc, argv, "test-lazy-load", pcm);
+
+    TEST_ASSERT(whisper_model_part_is_loaded(ctx, WHISPER_MODEL_PART_ENCODER));
+    TEST_ASSERT(whisper_model_part_is_loaded(ctx, WHISPER_MODEL_PART_DECODER));
+
+    const std::vector<whisper_token> ref = transcribe(ctx, pcm);
+
+    whisper_free(ctx);
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+    cparams.lazy_load = true;
+
+    // freed before anything is loaded
+    ctx = test_init(argc, argv, "test-lazy-load", pcm, cparams);
+
+    TEST_ASSERT(!whisper_model_part_is_loaded(ctx, WHISPER_MODEL_PART_ENCODER));
+    TEST_ASSERT(!whisper_model_part_is_loaded(ctx, WHISPER_MODEL_PART_DECODER));
+
+    whisper_free(ctx);
+
+    // loaded on first use
+    ctx = test_init(argc, argv, "test-lazy-load", pcm, cparams);
+
+    TEST_ASSERT(transcribe(ctx, pcm) == ref);
+
+    TEST_ASSERT(whisper_model_part_is_loaded(ctx, WHISPER_MODEL_PART_ENCODER));
+    TEST_ASSERT(whisper_model_part_is_loaded(ctx, WHISPER_MODEL_PART_DECODER));
+
+    // evicted and loaded again
+    for (int part : { WHISPER_MODEL_PART_ENCODER, WHISPER_MODEL_PART_DECODER }) {
+        TEST_ASSERT(whisper_model_part_evict(ctx, (enum whisper_model_part) part) == 0);
+        TEST_ASSERT(!whisper_model_part_is_loaded(ctx, (enum whisper_model_part) part));
+
+        TEST_ASSERT(transcribe(ctx, pcm) == ref);
+
+        TEST_ASSERT(whisper_model_part_is_loaded(ctx, (enum whisper_model_part) part));
+    }
+
+    TEST_ASSERT(whisper_model_part_load(ctx, WHISPER_MODEL_PART_ENCODER) == 0);
+    TEST_ASSERT(whisper_model_part_load(ctx, WHISPER_MODEL_PART_ENCODER) == 0);
+
+    // freed with one part evicted
+    TEST_ASSERT(whisper_model_part_evict(ctx, WHISPER_MODEL_PART_DECODER) == 0);
+
+    whisper_free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+// whisper_pcm_to_mel_append(): the spectrogram of a stream, computed from the appended samples only
+//
+// - the audio appended in pieces of any size, also smaller than a frame, gives the same spectrogram as
+//   whisper_pcm_to_mel() on the whole audio, and whisper_full() with n_samples == 0 the same transcript
+// - once the window slides, the spectrogram of the window is the one of the whole audio from the start of the window,
+//   when the loudest frame is in the window (the normalization only sees the window)
+//
+// the spectrogram is not exposed, so the logits after a prompt are compared
+
+#include "test-common.h"
+
+static std::vector<float> logits_after_prompt(struct whisper_context * ctx, struct whisper_state * state, int offset) {
+    TEST_ASSERT(whisper_encode_with_state(ctx, state, offset, 2) == 0);
+
+    const whisper_token prompt[3] = {
+        whisper_token_sot(ctx),
+        whisper_token_lang(ctx, whisper_lang_id("en")),
+        whisper_token_transcribe(ctx),
+    };
+
+    TEST_ASSERT(whisper_decode_with_state(ctx, state, prompt, 3, 0, 2) == 0);
+
+    const int n_vocab = whisper_n_vocab(ctx);
+    const float * logits = whisper_get_logits_from_state(state) + 2*n_vocab;
+
+    return std::vector<float>(logits, logits + n_vocab);
+}
+
+// appends the audio in pieces of 1, 159, 160, 161, 4000, 7919 samples, returns the last result
+static int append_in_pieces(struct whisper_context * ctx, struct whisper_state * state, const std::vector<float> & pcm, int n_threads) {
+    static const int sizes[] = { 1, 159, 160, 161, 4000, 7919 };
+
+    int n_frames = 0;
+
+    for (size_t i0 = 0, k = 0; i0 < pcm.size(); ++k) {
+        const size_t n = std::min(pcm.size() - i0, (size_t) sizes[k % 6]);
+
+        n_frames = whisper_pcm_to_mel_append_with_state(ctx, state, pcm.data() + i0, (int) n, n_threads);
+        TEST_ASSERT(n_frames >= 0);
+
+        i0 += n;
+    }
+
+    return n_frames;
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx = test_init(argc, argv, "test-mel-append", pcm);
+
+    struct whisper_state * state = whisper_init_state(ctx);
+    TEST_ASSERT(state != nullptr);
+
+    struct whisper_state * state_ref = whisper_init_state(ctx);
+    TEST_ASSERT(state_ref != nullptr);
+
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.n_threads       = 2;
+    wparams.language        = "en";
+    wparams.print_progress  = false;
+    wparams.temperature_inc = 0.0f;
+
+    // shorter than the window
+    {
+        TEST_ASSERT(whisper_pcm_to_mel_with_state(ctx, state_ref, pcm.data(), (int) pcm.size(), 2) == 0);
+
+        const std::vector<float> ref = logits_after_prompt(ctx, state_ref, 0);
+
+        for (int n_threads : { 1, 3 }) {
+            whisper_pcm_to_mel_append_reset_with_state(state, 0);
+
+            const int n_frames = append_in_pieces(ctx, state, pcm, n_threads);
+
+            TEST_ASSERT(n_frames == whisper_n_len_from_state(state_ref));
+            TEST_ASSERT(whisper_pcm_to_mel_append_offset_from_state(state) == 0);
+
+            TEST_ASSERT(logits_after_prompt(ctx, state, 0) == ref);
+        }
+
+        TEST_ASSERT(whisper_full_with_state(ctx, state_ref, wparams, pcm.data(), (int) pcm.size()) == 0);
+
+        const std::vector<whisper_token> tokens = test_tokens(state_ref);
+        TEST_ASSERT(!tokens.empty());
+
+        TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, nullptr, 0) == 0);
+        TEST_ASSERT(test_tokens(state) == tokens);
+    }
+
+    // a window of 5 s over 16 s of audio - quiet speech, then 5 s of loud speech
+    {
+        std::vector<float> audio;
+        for (const float v : pcm) {
+            audio.push_back(0.25f*v);
+        }
+        audio.insert(audio.end(), pcm.begin(), pcm.begin() + 5*WHISPER_SAMPLE_RATE);
+
+        whisper_pcm_to_mel_append_reset_with_state(state, 5000);
+
+        const int n_frames = append_in_pieces(ctx, state, audio, 2);
+        TEST_ASSERT(n_frames == 500);
+
+        const int64_t offset = whisper_pcm_to_mel_append_offset_from_state(state);
+
+        TEST_ASSERT(whisper_pcm_to_mel_with_state(ctx, state_ref, audio.data(), (int) audio.size(), 2) == 0);
+        TEST_ASSERT(whisper_n_len_from_state(state_ref) == offset + n_frames);
+
+        TEST_ASSERT(logits_after_prompt(ctx, state, 0) == logits_after_prompt(ctx, state_ref, (int) offset));
+    }
+
+    whisper_free_state(state_ref);
+    whisper_free_state(state);
+    whisper_free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+// the log mel spectrogram computed with ggml (mel_graph) against the one computed on the host, and the one computed on
+// the host with one thread against more threads
+//
+// the spectrogram is not exposed, so the logits after a prompt are compared, and the transcripts
+
+#include "test-common.h"
+
+static std::vector<float> logits_after_prompt(struct whisper_context * ctx, const std::vector<float> & pcm, int n_threads) {
+    struct whisper_state * state = whisper_init_state(ctx);
+    TEST_ASSERT(state != nullptr);
+
+    TEST_ASSERT(whisper_pcm_to_mel_with_state(ctx, state, pcm.data(), (int) pcm.size(), n_threads) == 0);
+    TEST_ASSERT(whisper_encode_with_state(ctx, state, 0, n_threads) == 0);
+
+    const whisper_token prompt[3] = {
+        whisper_token_sot(ctx),
+        whisper_token_lang(ctx, whisper_lang_id("en")),
+        whisper_token_transcribe(ctx),
+    };
+
+    TEST_ASSERT(whisper_decode_with_state(ctx, state, prompt, 3, 0, n_threads) == 0);
+
+    const int n_vocab = whisper_n_vocab(ctx);
+    const float * logits = whisper_get_logits_from_state(state) + 2*n_vocab;
+
+    std::vector<float> result(logits, logits + n_vocab);
+
+    whisper_free_state(state);
+
+    return result;
+}
+
+static std::string transcribe(struct whisper_context * ctx, const std::vector<float> & pcm, int n_threads) {
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.n_threads       = n_threads;
+    wparams.language        = "en";
+    wparams.print_progress  = false;
+    wparams.temperature_inc = 0.0f;
+
+    struct whisper_state * state = whisper_init_state(ctx);
+    TEST_ASSERT(state != nullptr);
+
+    TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, pcm.data(), (int) pcm.size()) == 0);
+
+    const std::string result = test_text(state);
+
+    whisper_free_state(state);
+
+    return result;
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx_cpu = test_init(argc, argv, "test-mel-graph", pcm);
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+    cparams.mel_graph = true;
+
+    struct whisper_context * ctx_mel = test_init(argc, argv, "test-mel-graph", pcm, cparams);
+
+    const std::vector<float> ref = logits_after_prompt(ctx_cpu, pcm, 1);
+
+    // the frames of the spectrogram on the host are split between the threads of the pool - the result is exact
+    TEST_ASSERT(logits_after_prompt(ctx_cpu, pcm, 4) == ref);
+
+    for (int n_threads : { 1, 4 }) {
+        const std::vector<float> res = logits_after_prompt(ctx_mel, pcm, n_threads);
+
+        TEST_ASSERT(res.size() == ref.size());
+
+        double err  = 0.0;
+        double norm = 0.0;
+
+        for (size_t i = 0; i < ref.size(); ++i) {
+            TEST_ASSERT(std::isfinite(res[i]));
+
+            err  += (res[i] - ref[i])*(res[i] - ref[i]);
+            norm += ref[i]*ref[i];
+        }
+
+        const double rel = sqrt(err/norm);
+
+        printf("%s: n_threads = %d, relative error of the logits = %g\n", __func__, n_threads, rel);
+
+        TEST_ASSERT(rel < 1e-2);
+
+        const std::string text_cpu = transcribe(ctx_cpu, pcm, n_threads);
+        const std::string text_mel = transcribe(ctx_mel, pcm, n_threads);
+
+        printf("%s: n_threads = %d, cpu: '%s', mel_graph: '%s'\n", __func__, n_threads, text_cpu.c_str(), text_mel.c_str());
+
+        TEST_ASSERT(text_cpu == text_mel);
+    }
+
+    whisper_free(ctx_mel);
+    whisper_free(ctx_cpu);
+
+    return 0;
+}
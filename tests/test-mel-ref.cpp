@@ -0,0 +1,240 @@
+// the log mel spectrogram of whisper_pcm_to_mel() against a reference in double precision, computed with a plain DFT
+// and the dense mel filters
+//
+// the signals exercise all the bins of the real FFT of 400 samples: noise, tones on and between the bins (also the DC
+// and the Nyquist bins), a chirp and speech. loud bursts between digital silence and faint noise, and silence alone,
+// put most of the spectrogram below the floor of the clamp (80 dB under the loudest frame). the spectrogram is not
+// exposed, so the reference is passed to whisper_set_mel() and the logits after a prompt are compared
+
+#include "test-common.h"
+
+struct test_mel_filters {
+    int32_t n_mel = 0;
+    int32_t n_fft = 0;
+
+    std::vector<float> data; // [n_mel][n_fft]
+};
+
+// the mel filters of the stub model, which test_make_model() copies as is
+static test_mel_filters test_read_filters(const char * fname) {
+    test_mel_filters filters;
+
+    FILE * f = fopen(fname, "rb");
+    TEST_ASSERT(f != nullptr);
+
+    // magic and the 11 hparams
+    TEST_ASSERT(fseek(f, 12*sizeof(int32_t), SEEK_SET) == 0);
+
+    TEST_ASSERT(fread(&filters.n_mel, sizeof(int32_t), 1, f) == 1);
+    TEST_ASSERT(fread(&filters.n_fft, sizeof(int32_t), 1, f) == 1);
+
+    filters.data.resize((size_t) filters.n_mel*filters.n_fft);
+    TEST_ASSERT(fread(filters.data.data(), sizeof(float), filters.data.size(), f) == filters.data.size());
+
+    fclose(f);
+
+    return filters;
+}
+
+// [n_mel][n_len], padded as in whisper_pcm_to_mel(): reflected by 200 samples at the beginning, 30 s of zeros at the end
+static std::vector<float> test_mel_ref(const test_mel_filters & filters, const std::vector<float> & pcm, int & n_len) {
+    const int frame_size = 400;
+    const int frame_step = 160;
+    const int n_fft      = filters.n_fft;
+    const int n_samples  = (int) pcm.size();
+
+    TEST_ASSERT(n_fft == frame_size/2 + 1);
+
+    n_len = (n_samples + 30*WHISPER_SAMPLE_RATE)/frame_step;
+
+    std::vector<double> hann(frame_size);
+    std::vector<double> cos_tab(frame_size);
+    std::vector<double> sin_tab(frame_size);
+
+    for (int i = 0; i < frame_size; ++i) {
+        hann[i]    = 0.5*(1.0 - cos(2.0*M_PI*i/frame_size));
+        cos_tab[i] = cos(2.0*M_PI*i/frame_size);
+        sin_tab[i] = sin(2.0*M_PI*i/frame_size);
+    }
+
+    std::vector<double> log_mel((size_t) filters.n_mel*n_len);
+    std::vector<double> frame(frame_size);
+    std::vector<double> power(n_fft);
+
+    double mmax = -1e20;
+
+    for (int i = 0; i < n_len; ++i) {
+        for (int j = 0; j < frame_size; ++j) {
+            int k = i*frame_step - frame_size/2 + j;
+            k = k < 0 ? -k : k;
+
+            frame[j] = k < n_samples ? hann[j]*pcm[k] : 0.0;
+        }
+
+        // the frames of the padding at the end are all zero
+        std::fill(power.begin(), power.end(), 0.0);
+
+        for (int b = 0; b < n_fft && i*frame_step - frame_size/2 < n_samples; ++b) {
+            double re = 0.0;
+            double im = 0.0;
+            for (int j = 0; j < frame_size; ++j) {
+                re += frame[j]*cos_tab[(b*j) % frame_size];
+                im -= frame[j]*sin_tab[(b*j) % frame_size];
+            }
+            power[b] = re*re + im*im;
+        }
+
+        for (int m = 0; m < filters.n_mel; ++m) {
+            double sum = 0.0;
+            for (int b = 0; b < n_fft; ++b) {
+                sum += filters.data[(size_t) m*n_fft + b]*power[b];
+            }
+
+            const double val = log10(std::max(sum, 1e-10));
+
+            log_mel[(size_t) m*n_len + i] = val;
+            mmax = std::max(mmax, val);
+        }
+    }
+
+    std::vector<float> result(log_mel.size());
+    for (size_t i = 0; i < log_mel.size(); ++i) {
+        result[i] = (float) ((std::max(log_mel[i], mmax - 8.0) + 4.0)/4.0);
+    }
+
+    return result;
+}
+
+static std::vector<float> logits_after_prompt(struct whisper_context * ctx, struct whisper_state * state) {
+    TEST_ASSERT(whisper_encode_with_state(ctx, state, 0, 2) == 0);
+
+    const whisper_token prompt[3] = {
+        whisper_token_sot(ctx),
+        whisper_token_lang(ctx, whisper_lang_id("en")),
+        whisper_token_transcribe(ctx),
+    };
+
+    TEST_ASSERT(whisper_decode_with_state(ctx, state, prompt, 3, 0, 2) == 0);
+
+    const int n_vocab = whisper_n_vocab(ctx);
+    const float * logits = whisper_get_logits_from_state(state) + 2*n_vocab;
+
+    for (int i = 0; i < n_vocab; ++i) {
+        TEST_ASSERT(std::isfinite(logits[i]));
+    }
+
+    return std::vector<float>(logits, logits + n_vocab);
+}
+
+static double rel_error(const std::vector<float> & res, const std::vector<float> & ref) {
+    TEST_ASSERT(res.size() == ref.size());
+
+    double err  = 0.0;
+    double norm = 0.0;
+
+    for (size_t i = 0; i < ref.size(); ++i) {
+        err  += (res[i] - ref[i])*(res[i] - ref[i]);
+        norm += ref[i]*ref[i];
+    }
+
+    return sqrt(err/norm);
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    // F32 weights - the F16 weights of the first convolution would round the differences in the spectrogram to F16 steps
+    struct whisper_context * ctx = test_init(argc, argv, "test-mel-ref", pcm, whisper_context_default_params(), 0);
+
+    struct whisper_state * state = whisper_init_state(ctx);
+    TEST_ASSERT(state != nullptr);
+
+    const test_mel_filters filters = test_read_filters(argv[1]);
+    TEST_ASSERT(filters.n_mel == whisper_model_n_mels(ctx));
+
+    const int n = 4*WHISPER_SAMPLE_RATE;
+
+    std::vector<std::pair<std::string, std::vector<float>>> signals;
+
+    {
+        test_rng rng(3);
+
+        std::vector<float> x(n);
+        for (auto & v : x) {
+            v = 0.1f*rng.gauss();
+        }
+
+        signals.emplace_back("noise", x);
+    }
+
+    // the DC and the Nyquist bins, bins 1, 7 and 150 (40 Hz each) and halfway between bins 63 and 64
+    {
+        std::vector<float> x(n);
+        for (int i = 0; i < n; ++i) {
+            const double t = (double) i/WHISPER_SAMPLE_RATE;
+
+            x[i] = (float) (0.05 + 0.05*(i % 2 == 0 ? 1.0 : -1.0) +
+                0.1*sin(2.0*M_PI*40.0*t) + 0.1*sin(2.0*M_PI*280.0*t) + 0.1*cos(2.0*M_PI*6000.0*t) +
+                0.1*sin(2.0*M_PI*2540.0*t));
+        }
+
+        signals.emplace_back("tones", x);
+    }
+
+    // 20 Hz to 8 kHz
+    {
+        std::vector<float> x(n);
+        for (int i = 0; i < n; ++i) {
+            const double t = (double) i/WHISPER_SAMPLE_RATE;
+            const double T = (double) n/WHISPER_SAMPLE_RATE;
+
+            x[i] = (float) (0.3*sin(2.0*M_PI*(20.0*t + (8000.0 - 20.0)*t*t/(2.0*T))));
+        }
+
+        signals.emplace_back("chirp", x);
+    }
+
+    // 0.5 s bursts of a tone, then digital silence, then noise 120 dB below the tone
+    {
+        test_rng rng(5);
+
+        std::vector<float> x(n);
+        for (int i = 0; i < n; ++i) {
+            const int phase = (i/(WHISPER_SAMPLE_RATE/2)) % 3;
+
+            x[i] = phase == 0 ? (float) (0.9*sin(2.0*M_PI*1000.0*i/WHISPER_SAMPLE_RATE)) :
+                   phase == 1 ? 0.0f : 1e-6f*rng.gauss();
+        }
+
+        signals.emplace_back("bursts", x);
+    }
+
+    signals.emplace_back("silence", std::vector<float>(n, 0.0f));
+
+    signals.emplace_back("speech", pcm);
+
+    for (const auto & signal : signals) {
+        int n_len = 0;
+        const std::vector<float> mel = test_mel_ref(filters, signal.second, n_len);
+
+        TEST_ASSERT(whisper_set_mel_with_state(ctx, state, mel.data(), n_len, filters.n_mel) == 0);
+
+        const std::vector<float> ref = logits_after_prompt(ctx, state);
+
+        for (int n_threads : { 1, 3 }) {
+            TEST_ASSERT(whisper_pcm_to_mel_with_state(ctx, state, signal.second.data(), (int) signal.second.size(), n_threads) == 0);
+
+            const double rel = rel_error(logits_after_prompt(ctx, state), ref);
+
+            printf("%s: %-7s, n_threads = %d: relative error of the logits = %g\n", __func__, signal.first.c_str(), n_threads, rel);
+
+            // a Hann window of 399 samples instead of 400 already gives more than 4e-4
+            TEST_ASSERT(rel < 2e-4);
+        }
+    }
+
+    whisper_free_state(state);
+    whisper_free(ctx);
+
+    return 0;
+}
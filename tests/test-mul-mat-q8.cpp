@@ -0,0 +1,109 @@
+// ggml_mul_mat with quantized weights on the CPU, the input cast to the vec_dot type of the weights in the graph
+// (see whisper_mul_mat_input()) against the F32 input, which the CPU backend converts for each multiplication
+//
+// the cast uses the same quantization as the conversion, so the results must be bit-identical - for the types of the
+// quantized models (vec_dot types Q8_0, Q8_1 and Q8_K), for one and more columns, with two weights sharing the input
+
+#include "test-common.h"
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+// the products of w0 and w1 with x - the input of both is cast to the vec_dot type once when shared is true
+static std::vector<float> test_mul_mat(ggml_type type, const std::vector<float> & w, const std::vector<float> & x,
+        int64_t K, int64_t M, int64_t N, bool shared, int n_threads) {
+    const size_t mem_size = 2*ggml_row_size(type, K)*M + 4*K*N*sizeof(float) + 4*M*N*sizeof(float) +
+        16*ggml_tensor_overhead() + ggml_graph_overhead() + 4*1024*1024;
+
+    struct ggml_init_params gparams = {
+        /*.mem_size   =*/ mem_size,
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ false,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(gparams);
+
+    struct ggml_tensor * w0  = ggml_new_tensor_2d(ctx0, type,          K, M);
+    struct ggml_tensor * w1  = ggml_new_tensor_2d(ctx0, type,          K, M);
+    struct ggml_tensor * inp = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, K, N);
+
+    ggml_quantize_chunk(type, w.data(),       w0->data, 0, M, K, nullptr);
+    ggml_quantize_chunk(type, w.data() + M*K, w1->data, 0, M, K, nullptr);
+
+    memcpy(inp->data, x.data(), x.size()*sizeof(float));
+
+    struct ggml_tensor * cur = inp;
+
+    if (shared) {
+        cur = ggml_cast(ctx0, cur, ggml_get_type_traits_cpu(type)->vec_dot_type);
+    }
+
+    struct ggml_tensor * out0 = ggml_mul_mat(ctx0, w0, cur);
+    struct ggml_tensor * out1 = ggml_mul_mat(ctx0, w1, cur);
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+    ggml_build_forward_expand(gf, out0);
+    ggml_build_forward_expand(gf, out1);
+
+    TEST_ASSERT(ggml_graph_compute_with_ctx(ctx0, gf, n_threads) == GGML_STATUS_SUCCESS);
+
+    std::vector<float> result((const float *) out0->data, (const float *) out0->data + M*N);
+    result.insert(result.end(), (const float *) out1->data, (const float *) out1->data + M*N);
+
+    ggml_free(ctx0);
+
+    return result;
+}
+
+int main(int argc, char ** argv) {
+    (void) argc;
+    (void) argv;
+
+    test_rng rng(25);
+
+    const ggml_type types[] = {
+        GGML_TYPE_Q4_0, GGML_TYPE_Q4_1, GGML_TYPE_Q5_0, GGML_TYPE_Q5_1, GGML_TYPE_Q8_0,
+        GGML_TYPE_Q2_K, GGML_TYPE_Q3_K, GGML_TYPE_Q4_K, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K,
+    };
+
+    const int64_t K = 768; // a multiple of the blocks of all the types
+    const int64_t M = 67;
+
+    int n_cases = 0;
+
+    for (const ggml_type type : types) {
+        std::vector<float> w(2*M*K);
+        for (auto & v : w) {
+            v = 0.1f*rng.gauss();
+        }
+
+        for (int64_t N : { 1, 5, 33 }) {
+            std::vector<float> x(K*N);
+            for (auto & v : x) {
+                v = rng.gauss();
+            }
+
+            for (int n_threads : { 1, 3 }) {
+                const std::vector<float> ref = test_mul_mat(type, w, x, K, M, N, false, n_threads);
+                const std::vector<float> res = test_mul_mat(type, w, x, K, M, N, true,  n_threads);
+
+                for (float v : ref) {
+                    TEST_ASSERT(std::isfinite(v));
+                }
+
+                if (res != ref) {
+                    fprintf(stderr, "%s: type = %s, N = %d, n_threads = %d: the results differ\n",
+                            __func__, ggml_type_name(type), (int) N, n_threads);
+                }
+
+                TEST_ASSERT(res == ref);
+
+                n_cases++;
+            }
+        }
+    }
+
+    printf("%s: %d cases passed\n", __func__, n_cases);
+
+    return 0;
+}
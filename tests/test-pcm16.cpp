@@ -0,0 +1,105 @@
+// the 16-bit PCM entry points against the float ones on the same samples (s/32768)
+//
+// the scaling is folded into the Hann window with a power of 2, so the spectrogram must be bit-identical - compared
+// through the logits after a prompt, with 1 and 3 threads and with the full scale samples, and through the transcript
+// and the token timestamps of whisper_full()
+
+#include "test-common.h"
+
+static std::vector<float> logits_after_prompt(struct whisper_context * ctx, struct whisper_state * state) {
+    TEST_ASSERT(whisper_encode_with_state(ctx, state, 0, 2) == 0);
+
+    const whisper_token prompt[3] = {
+        whisper_token_sot(ctx),
+        whisper_token_lang(ctx, whisper_lang_id("en")),
+        whisper_token_transcribe(ctx),
+    };
+
+    TEST_ASSERT(whisper_decode_with_state(ctx, state, prompt, 3, 0, 2) == 0);
+
+    const int n_vocab = whisper_n_vocab(ctx);
+    const float * logits = whisper_get_logits_from_state(state) + 2*n_vocab;
+
+    return std::vector<float>(logits, logits + n_vocab);
+}
+
+struct test_token {
+    whisper_token id;
+
+    int64_t t0;
+    int64_t t1;
+
+    bool operator==(const test_token & other) const {
+        return id == other.id && t0 == other.t0 && t1 == other.t1;
+    }
+};
+
+static std::vector<test_token> test_tokens_ts(struct whisper_state * state) {
+    std::vector<test_token> result;
+
+    for (int i = 0; i < whisper_full_n_segments_from_state(state); ++i) {
+        for (int j = 0; j < whisper_full_n_tokens_from_state(state, i); ++j) {
+            const whisper_token_data data = whisper_full_get_token_data_from_state(state, i, j);
+
+            result.push_back({ data.id, data.t0, data.t1 });
+        }
+    }
+
+    return result;
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx = test_init(argc, argv, "test-pcm16", pcm);
+
+    struct whisper_state * state = whisper_init_state(ctx);
+    TEST_ASSERT(state != nullptr);
+
+    // the speech, then 1 s alternating between the extremes of int16
+    std::vector<int16_t> pcm16;
+    for (const float v : pcm) {
+        pcm16.push_back((int16_t) lrintf(v*32768.0f));
+    }
+    for (int i = 0; i < WHISPER_SAMPLE_RATE; ++i) {
+        pcm16.push_back(i % 50 < 25 ? INT16_MAX : INT16_MIN);
+    }
+
+    std::vector<float> pcmf32;
+    for (const int16_t v : pcm16) {
+        pcmf32.push_back(v/32768.0f);
+    }
+
+    // spectrogram
+    for (int n_threads : { 1, 3 }) {
+        TEST_ASSERT(whisper_pcm_to_mel_with_state(ctx, state, pcmf32.data(), (int) pcmf32.size(), n_threads) == 0);
+        const std::vector<float> ref = logits_after_prompt(ctx, state);
+
+        TEST_ASSERT(whisper_pcm16_to_mel_with_state(ctx, state, pcm16.data(), (int) pcm16.size(), n_threads) == 0);
+        TEST_ASSERT(logits_after_prompt(ctx, state) == ref);
+    }
+
+    // whisper_full() with token timestamps, which are computed from the signal energy
+    {
+        struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+        wparams.n_threads        = 2;
+        wparams.language         = "en";
+        wparams.print_progress   = false;
+        wparams.temperature_inc  = 0.0f;
+        wparams.token_timestamps = true;
+
+        TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, pcmf32.data(), (int) pcmf32.size()) == 0);
+
+        const std::vector<test_token> ref = test_tokens_ts(state);
+        TEST_ASSERT(!ref.empty());
+
+        TEST_ASSERT(whisper_full_pcm16_with_state(ctx, state, wparams, pcm16.data(), (int) pcm16.size()) == 0);
+        TEST_ASSERT(test_tokens_ts(state) == ref);
+    }
+
+    whisper_free_state(state);
+    whisper_free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+// the resampler of read_wav() (examples/common.h)
+//
+// - tones below the cutoff come out at the output rate with the same phase, tones above it are removed
+// - the signal passed in pieces of any size gives the same samples as resample() on the whole signal
+// - a 24-bit stereo WAV at 44.1 kHz is read as mono at 16 kHz, and as the two channels for diarization
+
+#include "test-common.h"
+
+#include "common.h"
+
+static std::vector<float> tone(double freq, double amp, int sample_rate, double seconds) {
+    std::vector<float> result((size_t) (seconds*sample_rate));
+    for (size_t i = 0; i < result.size(); ++i) {
+        result[i] = (float) (amp*sin(2.0*M_PI*freq*i/sample_rate));
+    }
+
+    return result;
+}
+
+// largest difference to the tone, away from the edges, where the filter sees the zeros around the signal
+static double tone_error(const std::vector<float> & x, double freq, double amp, int sample_rate) {
+    const size_t n_edge = sample_rate/50;
+
+    TEST_ASSERT(x.size() > 2*n_edge);
+
+    double err = 0.0;
+    for (size_t i = n_edge; i < x.size() - n_edge; ++i) {
+        err = std::max(err, fabs(x[i] - amp*sin(2.0*M_PI*freq*i/sample_rate)));
+    }
+
+    return err;
+}
+
+static double rms(const std::vector<float> & x) {
+    const size_t n_edge = x.size()/10;
+
+    double sum = 0.0;
+    for (size_t i = n_edge; i < x.size() - n_edge; ++i) {
+        sum += (double) x[i]*x[i];
+    }
+
+    return sqrt(sum/(x.size() - 2*n_edge));
+}
+
+static void wav_put(std::string & buf, uint32_t v, int n_bytes) {
+    for (int i = 0; i < n_bytes; ++i) {
+        buf += (char) ((v >> (8*i)) & 0xFF);
+    }
+}
+
+// 24-bit PCM WAV in memory
+static std::string wav_24(const std::vector<std::vector<float>> & channels, int sample_rate) {
+    const uint32_t n_channels = (uint32_t) channels.size();
+    const uint32_t n_frames   = (uint32_t) channels[0].size();
+    const uint32_t n_data     = n_frames*n_channels*3;
+
+    std::string buf = "RIFF";
+    wav_put(buf, 36 + n_data, 4);
+    buf += "WAVEfmt ";
+    wav_put(buf, 16, 4);
+    wav_put(buf, 1, 2); // PCM
+    wav_put(buf, n_channels, 2);
+    wav_put(buf, sample_rate, 4);
+    wav_put(buf, sample_rate*n_channels*3, 4);
+    wav_put(buf, n_channels*3, 2);
+    wav_put(buf, 24, 2);
+    buf += "data";
+    wav_put(buf, n_data, 4);
+
+    for (uint32_t i = 0; i < n_frames; ++i) {
+        for (uint32_t c = 0; c < n_channels; ++c) {
+            wav_put(buf, (uint32_t) (int32_t) lrint(channels[c][i]*8388607.0), 3);
+        }
+    }
+
+    return buf;
+}
+
+int main(int argc, char ** argv) {
+    (void) argc;
+    (void) argv;
+
+    // down and up to 16 kHz, a tone in the pass band and one above the output Nyquist frequency
+    for (int sample_rate : { 44100, 48000, 22050, 8000 }) {
+        const double freq = 1000.0;
+
+        std::vector<float> out;
+        resample(tone(freq, 0.5, sample_rate, 1.0), sample_rate, COMMON_SAMPLE_RATE, out);
+
+        TEST_ASSERT(out.size() == (size_t) COMMON_SAMPLE_RATE);
+
+        const double err = tone_error(out, freq, 0.5, COMMON_SAMPLE_RATE);
+
+        printf("%s: %5d Hz: error of a tone of %.0f Hz = %g\n", __func__, sample_rate, freq, err);
+
+        TEST_ASSERT(err < 1e-4);
+
+        if (sample_rate > COMMON_SAMPLE_RATE) {
+            resample(tone(10000.0, 0.5, sample_rate, 1.0), sample_rate, COMMON_SAMPLE_RATE, out);
+
+            const double level = rms(out);
+
+            printf("%s: %5d Hz: level of a tone of 10 kHz = %g\n", __func__, sample_rate, level);
+
+            TEST_ASSERT(level < 1e-4);
+        }
+    }
+
+    // in pieces
+    {
+        test_rng rng(11);
+
+        std::vector<float> in(44100);
+        for (auto & v : in) {
+            v = 0.3f*rng.gauss();
+        }
+
+        std::vector<float> ref;
+        resample(in, 44100, COMMON_SAMPLE_RATE, ref);
+
+        static const size_t sizes[] = { 1, 2, 441, 1000, 3, 4097 };
+
+        resampler r(44100, COMMON_SAMPLE_RATE);
+
+        std::vector<float> out;
+        for (size_t i0 = 0, k = 0; i0 < in.size(); ++k) {
+            const size_t n = std::min(in.size() - i0, sizes[k % 6]);
+            r.process(in.data() + i0, n, out);
+            i0 += n;
+        }
+        r.flush(out);
+
+        TEST_ASSERT(out == ref);
+    }
+
+    // 24-bit stereo at 44.1 kHz
+    {
+        const std::vector<float> left  = tone(440.0, 0.5, 44100, 1.0);
+        const std::vector<float> right = tone(440.0, 0.2, 44100, 1.0);
+
+        const std::string wav = wav_24({ left, right }, 44100);
+
+        std::vector<float> pcmf32;
+        std::vector<std::vector<float>> pcmf32s;
+
+        TEST_ASSERT(read_wav(wav, pcmf32, pcmf32s, false));
+        TEST_ASSERT(pcmf32.size() == (size_t) COMMON_SAMPLE_RATE);
+        TEST_ASSERT(tone_error(pcmf32, 440.0, 0.35, COMMON_SAMPLE_RATE) < 1e-3);
+
+        TEST_ASSERT(read_wav(wav, pcmf32, pcmf32s, true));
+        TEST_ASSERT(pcmf32s.size() == 2);
+        TEST_ASSERT(tone_error(pcmf32s[0], 440.0, 0.5, COMMON_SAMPLE_RATE) < 1e-3);
+        TEST_ASSERT(tone_error(pcmf32s[1], 440.0, 0.2, COMMON_SAMPLE_RATE) < 1e-3);
+    }
+
+    return 0;
+}
@@ -0,0 +1,156 @@
+// whisper_state_save() / whisper_state_load()
+//
+// decoding continues the same way after the state is restored into another state, also one with a KV cache of a
+// different size, and a blob that cannot be loaded (e.g. with token ids out of range) leaves the state untouched
+
+#include "test-common.h"
+
+static std::vector<uint8_t> save(struct whisper_context * ctx, struct whisper_state * state, bool with_kv_self) {
+    const size_t n = whisper_state_save(ctx, state, nullptr, 0, with_kv_self);
+    TEST_ASSERT(n > 0);
+
+    std::vector<uint8_t> result(n);
+    TEST_ASSERT(whisper_state_save(ctx, state, result.data(), result.size(), with_kv_self) == n);
+
+    return result;
+}
+
+// the logits of the next token, decoded after the prompt
+static std::vector<float> decode_next(struct whisper_context * ctx, struct whisper_state * state) {
+    const whisper_token token = whisper_token_not(ctx);
+
+    TEST_ASSERT(whisper_decode_with_state(ctx, state, &token, 1, 3, 2) == 0);
+
+    const float * logits = whisper_get_logits_from_state(state);
+
+    return std::vector<float>(logits, logits + whisper_n_vocab(ctx));
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx = test_init(argc, argv, "test-state", pcm);
+
+    const whisper_token prompt[3] = {
+        whisper_token_sot(ctx),
+        whisper_token_lang(ctx, whisper_lang_id("en")),
+        whisper_token_transcribe(ctx),
+    };
+
+    struct whisper_state * state_a = whisper_init_state(ctx);
+    TEST_ASSERT(state_a != nullptr);
+
+    TEST_ASSERT(whisper_pcm_to_mel_with_state(ctx, state_a, pcm.data(), (int) pcm.size(), 2) == 0);
+    TEST_ASSERT(whisper_encode_with_state(ctx, state_a, 0, 2) == 0);
+    TEST_ASSERT(whisper_decode_with_state(ctx, state_a, prompt, 3, 0, 2) == 0);
+
+    const std::vector<uint8_t> blob = save(ctx, state_a, true);
+
+    const std::vector<float> ref = decode_next(ctx, state_a);
+
+    // a fresh state
+    {
+        struct whisper_state * state = whisper_init_state(ctx);
+        TEST_ASSERT(state != nullptr);
+
+        TEST_ASSERT(whisper_state_load(ctx, state, blob.data(), blob.size()) == 0);
+        TEST_ASSERT(decode_next(ctx, state) == ref);
+
+        whisper_free_state(state);
+    }
+
+    // a state used for beam search before - its KV cache is larger and is replaced
+    {
+        struct whisper_state * state = whisper_init_state(ctx);
+        TEST_ASSERT(state != nullptr);
+
+        struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH);
+        wparams.n_threads       = 2;
+        wparams.language        = "en";
+        wparams.print_progress  = false;
+        wparams.temperature_inc = 0.0f;
+
+        TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, pcm.data(), (int) pcm.size()) == 0);
+
+        TEST_ASSERT(whisper_state_load(ctx, state, blob.data(), blob.size()) == 0);
+        TEST_ASSERT(decode_next(ctx, state) == ref);
+
+        // invalid blobs do not modify the state
+        const std::vector<uint8_t> before = save(ctx, state, true);
+
+        std::vector<uint8_t> bad = blob;
+        bad[0] ^= 0xff;
+        TEST_ASSERT(whisper_state_load(ctx, state, bad.data(), bad.size()) == -1);
+
+        for (size_t n : { blob.size() - 1, blob.size()/2, (size_t) 64 }) {
+            TEST_ASSERT(whisper_state_load(ctx, state, blob.data(), n) == -3);
+        }
+
+        TEST_ASSERT(save(ctx, state, true) == before);
+
+        whisper_free_state(state);
+    }
+
+    // out of range token ids and language
+    {
+        struct whisper_state * state = whisper_init_state(ctx);
+        TEST_ASSERT(state != nullptr);
+
+        struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+        wparams.n_threads       = 2;
+        wparams.language        = "en";
+        wparams.print_progress  = false;
+        wparams.temperature_inc = 0.0f;
+
+        TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, pcm.data(), (int) pcm.size()) == 0);
+
+        const std::vector<uint8_t> blob_full = save(ctx, state, false);
+        const std::vector<uint8_t> before    = save(ctx, state, true);
+
+        // magic, version and 6 hparams, then exp_n_audio_ctx, lang_id, n_prompt_past and the prompt tokens
+        const size_t offs_lang   = 9*sizeof(int32_t);
+        const size_t offs_prompt = 11*sizeof(int32_t);
+
+        uint32_t n_prompt_past = 0;
+        memcpy(&n_prompt_past, blob_full.data() + 10*sizeof(int32_t), sizeof(n_prompt_past));
+        TEST_ASSERT(n_prompt_past > 0);
+
+        auto load_patched = [&](size_t offs, int32_t val) {
+            std::vector<uint8_t> bad = blob_full;
+            memcpy(bad.data() + offs, &val, sizeof(val));
+
+            return whisper_state_load(ctx, state, bad.data(), bad.size());
+        };
+
+        TEST_ASSERT(load_patched(offs_prompt, whisper_n_vocab(ctx)) == -3);
+        TEST_ASSERT(load_patched(offs_prompt + (n_prompt_past - 1)*sizeof(int32_t), -1) == -3);
+        TEST_ASSERT(load_patched(offs_lang, whisper_lang_max_id() + 1) == -3);
+        TEST_ASSERT(load_patched(offs_lang, -1) == -3);
+
+        TEST_ASSERT(save(ctx, state, true) == before);
+
+        TEST_ASSERT(load_patched(offs_lang, whisper_lang_id("de")) == 0);
+
+        whisper_free_state(state);
+    }
+
+    // without the self-attention cache, the prompt must be decoded again
+    {
+        const std::vector<uint8_t> blob_cross = save(ctx, state_a, false);
+        TEST_ASSERT(blob_cross.size() < blob.size());
+
+        struct whisper_state * state = whisper_init_state(ctx);
+        TEST_ASSERT(state != nullptr);
+
+        TEST_ASSERT(whisper_state_load(ctx, state, blob_cross.data(), blob_cross.size()) == 0);
+        TEST_ASSERT(whisper_decode_with_state(ctx, state, prompt, 3, 0, 2) == 0);
+        TEST_ASSERT(decode_next(ctx, state) == ref);
+
+        whisper_free_state(state);
+    }
+
+    whisper_free_state(state_a);
+    whisper_free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+// whisper_tokenize(): the tokens of a text must decode back to the same text, also outside of ASCII, and the common
+// words must not be split
+
+#include "test-common.h"
+
+static std::vector<whisper_token> tokenize(struct whisper_context * ctx, const std::string & text) {
+    std::vector<whisper_token> tokens(text.size() + 1);
+
+    const int n = whisper_tokenize(ctx, text.c_str(), tokens.data(), (int) tokens.size());
+    TEST_ASSERT(n >= 0);
+
+    tokens.resize(n);
+
+    return tokens;
+}
+
+static std::string detokenize(struct whisper_context * ctx, const std::vector<whisper_token> & tokens) {
+    std::string result;
+
+    for (const auto token : tokens) {
+        result += whisper_token_to_str(ctx, token);
+    }
+
+    return result;
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx = test_init(argc, argv, "test-tokenizer", pcm);
+
+    const std::vector<std::string> texts = {
+        "",
+        " ",
+        "Hello world",
+        " And so my fellow Americans, ask not what your country can do for you.",
+        "It's 3:45pm - don't you've we'll they're I'm",
+        "  multiple   spaces\tand\ttabs\nand new lines\n\n",
+        "1234567890 3.14159 1,000,000",
+        "!@#$%^&*()_+-=[]{};':\",./<>?`~|\\",
+        "Grüße aus Köln, ça va? Ñandú, straße",
+        "Привет, как дела?",
+        "日本語のテキストです。中文文本。",
+        "한국어 텍스트",
+        "مرحبا بالعالم",
+        "emoji 🙂👍🏽 and symbols ©®™ €£¥",
+        "mixed: hello世界123мир!",
+        "\xe2\x80\x94 dash \xe2\x80\x9cquotes\xe2\x80\x9d",
+    };
+
+    const whisper_token token_eot = whisper_token_eot(ctx);
+
+    for (const auto & text : texts) {
+        const std::vector<whisper_token> tokens = tokenize(ctx, text);
+
+        const std::string res = detokenize(ctx, tokens);
+
+        if (res != text) {
+            fprintf(stderr, "%s: '%s' -> '%s' (%d tokens)\n", __func__, text.c_str(), res.c_str(), (int) tokens.size());
+        }
+
+        TEST_ASSERT(res == text);
+        TEST_ASSERT(tokens.size() <= text.size());
+
+        // only text tokens
+        for (const auto token : tokens) {
+            TEST_ASSERT(token >= 0 && token < token_eot);
+        }
+
+        // deterministic
+        TEST_ASSERT(tokenize(ctx, text) == tokens);
+    }
+
+    // common words are single tokens
+    TEST_ASSERT(tokenize(ctx, " Hello world").size() == 2);
+    TEST_ASSERT(tokenize(ctx, " the").size() == 1);
+
+    // byte pair merges: the characters outside of ASCII are not split into single bytes
+    TEST_ASSERT(tokenize(ctx, "ö").size() == 1);
+    TEST_ASSERT(tokenize(ctx, " Grüße").size() < strlen(" Grüße")/2);
+    TEST_ASSERT(tokenize(ctx, " Привет").size() < strlen(" Привет")/2);
+
+    // not enough room: the negated number of tokens
+    {
+        const std::string text = " And so my fellow Americans";
+        const int n = (int) tokenize(ctx, text).size();
+
+        whisper_token tokens[2];
+        TEST_ASSERT(whisper_tokenize(ctx, text.c_str(), tokens, 2) == -n);
+        TEST_ASSERT(whisper_token_count(ctx, text.c_str()) == n);
+    }
+
+    whisper_free(ctx);
+
+    return 0;
+}
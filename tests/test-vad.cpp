@@ -0,0 +1,99 @@
+// the voice activity detection of whisper_full() (whisper_full_params.vad)
+//
+// the audio is the same speech twice, each after 35 s of silence - the windows of silence are skipped, and the
+// segments of the second speech are the ones of the first, with the timestamps moved by the distance between them.
+// the windows that start at the two speech regions see the same spectrogram, and without the text of the previous
+// windows as prompt, this holds for the meaningless transcript of the random model too
+
+#include "test-common.h"
+
+struct test_segment {
+    std::string text;
+
+    int64_t t0;
+    int64_t t1;
+};
+
+static bool on_encoder_begin(struct whisper_context *, struct whisper_state *, void * user_data) {
+    (*(int *) user_data)++;
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    std::vector<float> pcm;
+
+    struct whisper_context * ctx = test_init(argc, argv, "test-vad", pcm);
+
+    struct whisper_state * state = whisper_init_state(ctx);
+    TEST_ASSERT(state != nullptr);
+
+    // 35 s of silence, the speech, 35 s of silence, the speech, 35 s of silence
+    const int64_t n_silence = 35*WHISPER_SAMPLE_RATE;
+
+    std::vector<float> audio;
+    for (int i = 0; i < 2; ++i) {
+        audio.insert(audio.end(), n_silence, 0.0f);
+        audio.insert(audio.end(), pcm.begin(), pcm.end());
+    }
+    audio.insert(audio.end(), n_silence, 0.0f);
+
+    // in frames of 10 ms - the sample lengths are multiples of the hop, so the two copies have the same frames
+    TEST_ASSERT(pcm.size() % 160 == 0);
+
+    const int64_t t_speech0 = n_silence/160;
+    const int64_t t_speech1 = (2*n_silence + (int64_t) pcm.size())/160;
+
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.n_threads       = 2;
+    wparams.language        = "en";
+    wparams.print_progress  = false;
+    wparams.temperature_inc = 0.0f;
+    wparams.n_max_text_ctx  = 0;
+    wparams.vad.type        = WHISPER_VAD_ENERGY;
+
+    int n_encode = 0;
+
+    wparams.encoder_begin_callback           = on_encoder_begin;
+    wparams.encoder_begin_callback_user_data = &n_encode;
+
+    TEST_ASSERT(whisper_full_with_state(ctx, state, wparams, audio.data(), (int) audio.size()) == 0);
+
+    // the segments of each speech, the second one moved back by the distance between them
+    std::vector<test_segment> seg[2];
+
+    for (int i = 0; i < whisper_full_n_segments_from_state(state); ++i) {
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+        const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
+
+        const int k = t0 >= t_speech1 - wparams.vad.pad_ms/10 ? 1 : 0;
+
+        seg[k].push_back({
+            whisper_full_get_segment_text_from_state(state, i),
+            t0 - k*(t_speech1 - t_speech0),
+            t1 - k*(t_speech1 - t_speech0),
+        });
+    }
+
+    printf("%s: %d windows encoded, %d + %d segments\n", __func__, n_encode, (int) seg[0].size(), (int) seg[1].size());
+
+    TEST_ASSERT(!seg[0].empty());
+    TEST_ASSERT(seg[0].size() == seg[1].size());
+
+    // nothing in the silence before the first speech, apart from the padding of the region
+    TEST_ASSERT(seg[0][0].t0 >= t_speech0 - wparams.vad.pad_ms/10);
+
+    for (size_t i = 0; i < seg[0].size(); ++i) {
+        TEST_ASSERT(seg[0][i].text == seg[1][i].text);
+        TEST_ASSERT(seg[0][i].t0   == seg[1][i].t0);
+        TEST_ASSERT(seg[0][i].t1   == seg[1][i].t1);
+    }
+
+    // the audio is 127 s - 5 windows of 30 s at least without the detection
+    TEST_ASSERT(n_encode < 5);
+
+    whisper_free_state(state);
+    whisper_free(ctx);
+
+    return 0;
+}